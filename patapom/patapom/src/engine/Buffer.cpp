@@ -50,6 +50,12 @@ void Buffer::SetElementSizeAndCount(int sizeInByte, int count)
 	mElementCount = count;
 }
 
+void Buffer::GrowElementCount(u32 count)
+{
+	fatalAssertf(!mInitialized, "buffer %s can't grow after it is initialized", mDebugName.c_str());
+	mElementCount = MAX(mElementCount, count);
+}
+
 void Buffer::Release(bool checkOnly)
 {
 	SAFE_RELEASE(mBuffer, checkOnly);
@@ -16,6 +16,7 @@ public:
 
 	void InitBuffer(Renderer* renderer);
 	void SetElementSizeAndCount(int sizeInByte, int count);
+	void GrowElementCount(u32 count); // only before InitBuffer, views are created from the element count
 
 	virtual void SetBufferData(void* data, int sizeInByte);
 	virtual void Release(bool checkOnly = false);
@@ -0,0 +1,106 @@
+#include "Denoiser.h"
+#include "PathTracer.h"
+#include "Store.h"
+#include "Scene.h"
+
+XMFLOAT4X4				Denoiser::sHistoryViewProj;
+XMFLOAT3				Denoiser::sHistoryEyePos(0.0f, 0.0f, 0.0f);
+bool					Denoiser::sHistoryValid = false;
+bool					Denoiser::sResetPrior = true;
+RenderTexture			Denoiser::sDenoisePingPT(TextureType::TEX_2D, "denoise ping", PathTracer::sBackbufferWidth, PathTracer::sBackbufferHeight, 1, 1, ReadFrom::COLOR, Format::R32G32B32A32_FLOAT, XMFLOAT4(0.0f, 0.0f, 0.0f, 0.0f));
+RenderTexture			Denoiser::sDenoisePongPT(TextureType::TEX_2D, "denoise pong", PathTracer::sBackbufferWidth, PathTracer::sBackbufferHeight, 1, 1, ReadFrom::COLOR, Format::R32G32B32A32_FLOAT, XMFLOAT4(0.0f, 0.0f, 0.0f, 0.0f));
+RenderTexture			Denoiser::sDenoisePriorPT(TextureType::TEX_2D, "denoise prior", PathTracer::sBackbufferWidth, PathTracer::sBackbufferHeight, 1, 1, ReadFrom::COLOR, Format::R32G32B32A32_FLOAT, XMFLOAT4(0.0f, 0.0f, 0.0f, 0.0f));
+RenderTexture			Denoiser::sDenoiseHistoryPT(TextureType::TEX_2D, "denoise history", PathTracer::sBackbufferWidth, PathTracer::sBackbufferHeight, 1, 1, ReadFrom::COLOR, Format::R32G32B32A32_FLOAT, XMFLOAT4(0.0f, 0.0f, 0.0f, 0.0f));
+RenderTexture			Denoiser::sDenoiseHistoryFeaturesPT(TextureType::TEX_2D, "denoise history features", PathTracer::sBackbufferWidth, PathTracer::sBackbufferHeight, 1, 1, ReadFrom::COLOR, Format::R32G32B32A32_FLOAT, XMFLOAT4(0.0f, 0.0f, 0.0f, 0.0f));
+RenderTexture			Denoiser::sDenoisedPT(TextureType::TEX_2D, "denoised backbuffer", PathTracer::sBackbufferWidth, PathTracer::sBackbufferHeight, 1, 1, ReadFrom::COLOR, Format::R16G16B16A16_FLOAT, XMFLOAT4(0.0f, 0.0f, 0.0f, 0.0f));
+PassDenoiser			Denoiser::sDenoiseTemporalPass("denoise temporal pass", false, false);
+PassDenoiser			Denoiser::sDenoiseAtrousPass[PT_DENOISE_ATROUS_ITERATION_COUNT];
+Shader					Denoiser::sDenoiseTemporalCS(Shader::ShaderType::COMPUTE_SHADER, "cs_pathtracer_denoise_temporal");
+Shader					Denoiser::sDenoiseAtrousCS(Shader::ShaderType::COMPUTE_SHADER, "cs_pathtracer_denoise_atrous");
+
+void Denoiser::InitDenoiser(Store& store, Scene& scene)
+{
+	XMStoreFloat4x4(&sHistoryViewProj, XMMatrixIdentity());
+
+	// every pass binds the same textures, see the register list of cs_pathtracer_denoise_temporal
+	vector<PassDenoiser*> passes = { &sDenoiseTemporalPass };
+	sDenoiseTemporalPass.AddShader(&sDenoiseTemporalCS);
+	for (u32 i = 0; i < PT_DENOISE_ATROUS_ITERATION_COUNT; i++)
+	{
+		sDenoiseAtrousPass[i].CreatePass("denoise a-trous pass " + to_string(i), false, false);
+		sDenoiseAtrousPass[i].AddShader(&sDenoiseAtrousCS);
+		sDenoiseAtrousPass[i].mPassUniform.mDenoiseIterationIndex = i;
+		passes.push_back(&sDenoiseAtrousPass[i]);
+	}
+	for (PassDenoiser* pass : passes)
+	{
+		pass->AddWriteTexture(&PathTracer::sBackbufferPT, 0);
+		pass->AddWriteTexture(&PathTracer::sConvergencePT, 0);
+		pass->AddWriteTexture(&PathTracer::sNormalDepthPT, 0);
+		pass->AddWriteTexture(&PathTracer::sAlbedoPT, 0);
+		pass->AddWriteTexture(&sDenoisePingPT, 0);
+		pass->AddWriteTexture(&sDenoisePongPT, 0);
+		pass->AddWriteTexture(&sDenoisePriorPT, 0);
+		pass->AddWriteTexture(&sDenoiseHistoryPT, 0);
+		pass->AddWriteTexture(&sDenoiseHistoryFeaturesPT, 0);
+		pass->AddWriteTexture(&sDenoisedPT, 0);
+		pass->SetCamera(&gCameraMain);
+		scene.AddPass(pass);
+		store.AddPass(pass);
+	}
+
+	store.AddShader(&sDenoiseTemporalCS);
+	store.AddShader(&sDenoiseAtrousCS);
+	store.AddTexture(&sDenoisePingPT);
+	store.AddTexture(&sDenoisePongPT);
+	store.AddTexture(&sDenoisePriorPT);
+	store.AddTexture(&sDenoiseHistoryPT);
+	store.AddTexture(&sDenoiseHistoryFeaturesPT);
+	store.AddTexture(&sDenoisedPT);
+}
+
+// runs after the path tracer incremented the sample index, so a non zero index means every pixel has at least one sample
+void Denoiser::RunDenoiser(CommandList commandList, Scene& scene)
+{
+	GPU_LABEL_BEGIN(commandList, "Denoiser");
+
+	bool everyPixelSampled = scene.mSceneUniform.mPathTracerCurrentSampleIndex > 0;
+	SET_UNIFORM_VAR(sDenoiseTemporalPass, mPassUniform, mHistoryViewProj, sHistoryViewProj);
+	SET_UNIFORM_VAR(sDenoiseTemporalPass, mPassUniform, mHistoryEyePos, sHistoryEyePos);
+	SET_UNIFORM_VAR(sDenoiseTemporalPass, mPassUniform, mDenoiseResetPrior, sResetPrior);
+	SET_UNIFORM_VAR(sDenoiseTemporalPass, mPassUniform, mDenoiseHistoryValid, sHistoryValid);
+	SET_UNIFORM_VAR(sDenoiseTemporalPass, mPassUniform, mDenoiseEveryPixelSampled, everyPixelSampled);
+	SET_UNIFORM_VAR(sDenoiseAtrousPass[PT_DENOISE_ATROUS_ITERATION_COUNT - 1], mPassUniform, mDenoiseEveryPixelSampled, everyPixelSampled);
+
+	RenderTexture* textures[] = { &PathTracer::sBackbufferPT, &PathTracer::sConvergencePT, &PathTracer::sNormalDepthPT, &PathTracer::sAlbedoPT, &sDenoisePingPT, &sDenoisePongPT, &sDenoisePriorPT, &sDenoiseHistoryPT, &sDenoiseHistoryFeaturesPT, &sDenoisedPT };
+	for (RenderTexture* texture : textures)
+		texture->MakeReadyToWrite(commandList);
+	gRenderer.RecordComputePass(sDenoiseTemporalPass, commandList, PathTracer::sThreadGroupCountX, PathTracer::sThreadGroupCountY, 1);
+	for (u32 i = 0; i < PT_DENOISE_ATROUS_ITERATION_COUNT; i++)
+	{
+		for (RenderTexture* texture : textures)
+			texture->MakeReadyToWriteAgain(commandList);
+		gRenderer.RecordComputePass(sDenoiseAtrousPass[i], commandList, PathTracer::sThreadGroupCountX, PathTracer::sThreadGroupCountY, 1);
+	}
+
+	sResetPrior = false;
+	if (everyPixelSampled)
+	{
+		// the last a-trous pass wrote the history with this camera
+		sHistoryViewProj = gCameraMain.GetViewProjMatrix();
+		sHistoryEyePos = gCameraMain.GetPosition();
+		sHistoryValid = true;
+	}
+
+	GPU_LABEL_END(commandList);
+}
+
+void Denoiser::Restart()
+{
+	sResetPrior = true;
+}
+
+void Denoiser::Shutdown()
+{
+
+}
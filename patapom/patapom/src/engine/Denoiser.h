@@ -0,0 +1,29 @@
+#pragma once
+
+#include "Texture.h"
+#include "Pass.h"
+
+typedef PassCommon<PassUniformDenoiser> PassDenoiser;
+
+class Denoiser
+{
+public:
+	static XMFLOAT4X4 sHistoryViewProj;
+	static XMFLOAT3 sHistoryEyePos;
+	static bool sHistoryValid; // the history textures hold a denoised image of the camera above
+	static bool sResetPrior; // the path tracer restarted since the last run
+	static RenderTexture sDenoisePingPT; // demodulated illumination and its variance, the a-trous iterations ping pong between these two
+	static RenderTexture sDenoisePongPT;
+	static RenderTexture sDenoisePriorPT; // history reprojected to the camera of the current restart
+	static RenderTexture sDenoiseHistoryPT;
+	static RenderTexture sDenoiseHistoryFeaturesPT;
+	static RenderTexture sDenoisedPT;
+	static PassDenoiser sDenoiseTemporalPass;
+	static PassDenoiser sDenoiseAtrousPass[PT_DENOISE_ATROUS_ITERATION_COUNT];
+	static Shader sDenoiseTemporalCS;
+	static Shader sDenoiseAtrousCS;
+	static void InitDenoiser(Store& store, Scene& scene);
+	static void RunDenoiser(CommandList commandList, Scene& scene);
+	static void Restart();
+	static void Shutdown();
+};
@@ -11,6 +11,7 @@
 #include <sstream>
 #include <unordered_map>
 #include <stack>
+#include <chrono>
 #include "../dependency/d3dx12.h"
 
 using namespace DirectX;
@@ -111,6 +112,7 @@ extern int gCurrentFramebufferIndex;
 extern const string ShaderSrcPath;
 extern const string ShaderBuildPath;
 extern const string AssetPath;
+extern const string CachePath;
 
 // return true if it is error
 static bool CheckError(HRESULT hr, ID3D12Device* device = nullptr, ID3D10Blob* error_message = nullptr)
@@ -168,11 +170,77 @@ static size_t ReadFile(string filePathName, Functor functor, bool binary = true,
 	return length; // return size in byte
 }
 
+// read only view of a whole file, the OS pages it in on demand
+class MappedFile
+{
+public:
+	MappedFile() : mFile(INVALID_HANDLE_VALUE), mMapping(nullptr), mData(nullptr), mSize(0) {}
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+	~MappedFile() { Close(); }
+
+	bool Open(const string& filePathName)
+	{
+		Close();
+		mFile = CreateFileA(filePathName.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+		if (mFile == INVALID_HANDLE_VALUE)
+			return false;
+		LARGE_INTEGER size;
+		if (GetFileSizeEx(mFile, &size) && size.QuadPart > 0)
+			mMapping = CreateFileMappingA(mFile, nullptr, PAGE_READONLY, 0, 0, nullptr);
+		if (mMapping)
+			mData = (const char*)MapViewOfFile(mMapping, FILE_MAP_READ, 0, 0, 0);
+		if (!mData)
+		{
+			Close();
+			return false;
+		}
+		mSize = size.QuadPart;
+		return true;
+	}
+
+	void Close()
+	{
+		if (mData)
+			UnmapViewOfFile(mData);
+		if (mMapping)
+			CloseHandle(mMapping);
+		if (mFile != INVALID_HANDLE_VALUE)
+			CloseHandle(mFile);
+		mFile = INVALID_HANDLE_VALUE;
+		mMapping = nullptr;
+		mData = nullptr;
+		mSize = 0;
+	}
+
+	const char* GetData() const { return mData; }
+	size_t GetSize() const { return mSize; }
+
+private:
+	HANDLE mFile;
+	HANDLE mMapping;
+	const char* mData;
+	size_t mSize;
+};
+
+// wall clock timer for CPU side profiling
+class CpuTimer
+{
+public:
+	CpuTimer() : mStart(chrono::high_resolution_clock::now()) {}
+	void Reset() { mStart = chrono::high_resolution_clock::now(); }
+	float GetMilliseconds() const { return chrono::duration<float, milli>(chrono::high_resolution_clock::now() - mStart).count(); }
+
+private:
+	chrono::high_resolution_clock::time_point mStart;
+};
+
 // type defines
 typedef uint8_t		u8;
 typedef uint16_t	u16;
 typedef uint32_t	u32;
 typedef uint64_t	u64;
+typedef int16_t		i16;
 typedef int32_t		i32;
 typedef int64_t		i64;
 
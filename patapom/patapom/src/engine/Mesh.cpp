@@ -1,8 +1,14 @@
 #include "Mesh.h"
 #include "Texture.h"
+#include "ThreadPool.h"
+#include "Camera.h"
 #include <fstream>
 #include <sstream>
 #include <limits>
+#include <cfloat>
+#include <algorithm>
+#include <intrin.h>
+#include <DirectXPackedVector.h>
 
 Mesh::Mesh(const string& debugName,
 	const MeshType& type,
@@ -12,10 +18,21 @@ Mesh::Mesh(const string& debugName,
 	const string& fileName) :
 	mDebugName(debugName),
 	mType(type),
+	mVertexFormat(VertexFormat::FULL),
 	mPosition(position),
 	mScale(scale),
 	mRotation(rotation),
-	mFileName(fileName)
+	mEmissive(0.0f, 0.0f, 0.0f),
+	mMaterialType(MATERIAL_TYPE_INVALID),
+	mAlbedo(1.0f, 1.0f, 1.0f),
+	mFileName(fileName),
+	mRenderer(nullptr),
+	mVertices(nullptr),
+	mIndices(nullptr),
+	mVertexCount(0),
+	mIndexCount(0),
+	mVertexBuffer(nullptr),
+	mIndexBuffer(nullptr)
 {
 	if (mType == MeshType::PLANE)
 	{
@@ -47,6 +64,11 @@ Mesh::Mesh(const string& debugName,
 	}
 	else
 		fatalf("unsupported mesh type!");
+	UpdateGeometryView();
+	mObjectUniform.mRoughness = 0.5f;
+	mObjectUniform.mFresnel = 0.04f;
+	mObjectUniform.mMetallic = 0.0f;
+	mObjectUniform.mVertexPacked = 0;
 	UpdateMatrix();
 }
 
@@ -64,6 +86,8 @@ void Mesh::ResetMesh(MeshType type,
 	mPosition = position;
 	mScale = scale;
 	mRotation = rotation;
+	mCacheFile.Close();
+	mLods.clear();
 	if (mType == MeshType::PLANE)
 	{
 		SetPlane();
@@ -88,6 +112,7 @@ void Mesh::ResetMesh(MeshType type,
 	{
 		SetMesh();
 	}
+	UpdateGeometryView();
 	UpdateMatrix();
 }
 
@@ -98,6 +123,11 @@ void Mesh::InitMesh(
 {
 	mRenderer = renderer;
 
+	// packed positions are relative to the bounds
+	mObjectUniform.mVertexPacked = mVertexFormat == VertexFormat::PACKED;
+	mObjectUniform.mPackedPositionOffset = mBoundsMin;
+	mObjectUniform.mPackedPositionScale = XMFLOAT3(mBoundsMax.x - mBoundsMin.x, mBoundsMax.y - mBoundsMin.y, mBoundsMax.z - mBoundsMin.z);
+
 	// create uniform buffers
 	CreateUniformBuffer(frameCount);
 	for(int i = 0;i<frameCount;i++)
@@ -151,7 +181,8 @@ void Mesh::UpdateUniformBuffer(int frameIndex)
 
 void Mesh::CreateVertexBuffer()
 {
-	mVertexBufferSizeInBytes = sizeof(Vertex) * mVertexVec.size();
+	const UINT vertexStride = mVertexFormat == VertexFormat::PACKED ? sizeof(PackedVertex) : sizeof(Vertex);
+	mVertexBufferSizeInBytes = vertexStride * mVertexCount;
 
 	HRESULT hr = mRenderer->mDevice->CreateCommittedResource(
 		&CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_DEFAULT), // a default heap
@@ -164,13 +195,14 @@ void Mesh::CreateVertexBuffer()
 	fatalAssertf(SUCCEEDED(hr), "create vertex buffer failed");
 	mVertexBuffer->SetName(L"mesh vertex buffer");
 	mVertexBufferView.BufferLocation = mVertexBuffer->GetGPUVirtualAddress();
-	mVertexBufferView.StrideInBytes = sizeof(Vertex);
+	mVertexBufferView.StrideInBytes = vertexStride;
 	mVertexBufferView.SizeInBytes = mVertexBufferSizeInBytes;
 }
 
 void Mesh::CreateIndexBuffer()
 {
-	mIndexBufferSizeInBytes = sizeof(uint32_t) * mIndexVec.size();
+	// every level of detail goes into the one index buffer
+	mIndexBufferSizeInBytes = sizeof(uint32_t) * (mLods.back().mIndexOffset + mLods.back().mIndexCount);
 
 	HRESULT hr = mRenderer->mDevice->CreateCommittedResource(
 		&CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_DEFAULT), // a default heap
@@ -189,12 +221,20 @@ void Mesh::CreateIndexBuffer()
 
 void Mesh::UpdateVertexBuffer()
 {
-	mRenderer->WriteDataToBufferSync(mVertexBuffer, mVertexVec.data(), mVertexBufferSizeInBytes);
+	if (mVertexFormat == VertexFormat::PACKED)
+	{
+		vector<PackedVertex> packedVertices(mVertexCount);
+		for (u32 i = 0; i < mVertexCount; i++)
+			packedVertices[i] = EncodePackedVertex(mVertices[i], mBoundsMin, mBoundsMax);
+		mRenderer->WriteDataToBufferSync(mVertexBuffer, packedVertices.data(), mVertexBufferSizeInBytes);
+	}
+	else
+		mRenderer->WriteDataToBufferSync(mVertexBuffer, (void*)mVertices, mVertexBufferSizeInBytes);
 }
 
 void Mesh::UpdateIndexBuffer()
 {
-	mRenderer->WriteDataToBufferSync(mIndexBuffer, mIndexVec.data(), mIndexBufferSizeInBytes);
+	mRenderer->WriteDataToBufferSync(mIndexBuffer, (void*)mIndices, mIndexBufferSizeInBytes);
 }
 
 void Mesh::Release(bool checkOnly)
@@ -245,6 +285,37 @@ void Mesh::SetRotation(const XMFLOAT3& rotation)
 	mRotation = rotation;
 }
 
+void Mesh::SetEmissive(const XMFLOAT3& emissive)
+{
+	mEmissive = emissive;
+}
+
+void Mesh::SetMaterial(u32 materialType, const XMFLOAT3& albedo, float roughness, float fresnel, float metallic)
+{
+	mMaterialType = materialType;
+	mAlbedo = albedo;
+	mObjectUniform.mRoughness = roughness;
+	mObjectUniform.mFresnel = fresnel;
+	mObjectUniform.mMetallic = metallic;
+}
+
+void Mesh::SetGeometry(const vector<Vertex>& vertices, const vector<uint32_t>& indices)
+{
+	fatalAssertf(mVertexBuffer == nullptr && mCacheFile.GetData() == nullptr, "geometry of mesh %s changed after its vertex buffer was created or it was loaded from a file", mDebugName.c_str());
+	fatalAssertf(indices.size() > 0 && indices.size() % 3 == 0, "number of indices is not a multiple of 3");
+	mPrimitiveType = PrimitiveType::TRIANGLE;
+	mVertexVec = vertices;
+	mIndexVec = indices;
+	mLods.clear();
+	UpdateGeometryView();
+}
+
+void Mesh::SetVertexFormat(VertexFormat vertexFormat)
+{
+	fatalAssertf(mVertexBuffer == nullptr, "vertex format of mesh %s changed after its vertex buffer was created", mDebugName.c_str());
+	mVertexFormat = vertexFormat;
+}
+
 XMFLOAT3 Mesh::GetPosition()
 {
 	return mPosition;
@@ -255,9 +326,49 @@ XMFLOAT3 Mesh::GetRotation()
 	return mRotation;
 }
 
+XMFLOAT3 Mesh::GetEmissive() const
+{
+	return mEmissive;
+}
+
+u32 Mesh::GetMaterialType() const
+{
+	return mMaterialType;
+}
+
+XMFLOAT3 Mesh::GetAlbedo() const
+{
+	return mAlbedo;
+}
+
 int Mesh::GetIndexCount() const
 {
-	return mIndexVec.size();
+	return mIndexCount;
+}
+
+u32 Mesh::GetLodCount() const
+{
+	return (u32)mLods.size();
+}
+
+const Mesh::Lod& Mesh::GetLod(u32 lodIndex) const
+{
+	return mLods[lodIndex];
+}
+
+XMFLOAT3 Mesh::GetBoundsMin() const
+{
+	return mBoundsMin;
+}
+
+XMFLOAT3 Mesh::GetBoundsMax() const
+{
+	return mBoundsMax;
+}
+
+Mesh::VertexFormat Mesh::GetVertexFormat() const
+{
+	return mVertexFormat;
 }
 
 int Mesh::GetTextureCount() const
@@ -270,6 +381,33 @@ vector<Texture*>& Mesh::GetTextures()
 	return mTextures;
 }
 
+const string& Mesh::GetDebugName() const
+{
+	return mDebugName;
+}
+
+u64 Mesh::GetGeometryHash() const
+{
+	// FNV-1a over 32 bit words of the vertices and indices, the transform is not part of the geometry
+	u64 hash = 14695981039346656037ull;
+	auto hashWords = [&hash](const void* data, size_t sizeInBytes) {
+		const u32* words = (const u32*)data;
+		for (size_t i = 0; i < sizeInBytes / sizeof(u32); i++)
+			hash = (hash ^ words[i]) * 1099511628211ull;
+	};
+	hashWords(mVertices, mVertexCount * sizeof(Vertex));
+	hashWords(mIndices, mIndexCount * sizeof(uint32_t));
+	return hash;
+}
+
+bool Mesh::HasSameGeometry(const Mesh& other) const
+{
+	return mVertexCount == other.mVertexCount &&
+		mIndexCount == other.mIndexCount &&
+		memcmp(mVertices, other.mVertices, mVertexCount * sizeof(Vertex)) == 0 &&
+		memcmp(mIndices, other.mIndices, mIndexCount * sizeof(uint32_t)) == 0;
+}
+
 inline u32 LeftShift3(float fx)
 {
 	u32 x = *((u32*)&fx);
@@ -288,18 +426,16 @@ u32 Mesh::GenerateMortonCode(XMFLOAT3 position)
 
 void Mesh::ConvertMeshToTrianglesPT(vector<TrianglePT>& outTriangles, u32 meshIndex)
 {
-	fatalAssertf(mIndexVec.size() > 0 && mIndexVec.size() % 3 == 0, "number of indices is not a multiple of 3");
-	outTriangles.resize(mIndexVec.size() / 3);
-	fatalAssertf(outTriangles.size() < PT_TRIANGLE_PER_MESH_MAX, "this affects the size of prefix sum buffer and we don't want it to be too large");
+	fatalAssertf(mIndexCount > 0 && mIndexCount % 3 == 0, "number of indices is not a multiple of 3");
+	outTriangles.resize(mIndexCount / 3);
 	fatalAssertf(outTriangles.size() < (size_t)std::numeric_limits<int>::max, "entry index is int32 in shaders (for prefix sum and tree building) so exceeding that will cause issues!");
-	fatalAssertf(outTriangles.size() < pow(2, PT_TRIANGLE_BVH_TREE_HEIGHT_MAX - 1), "a bvh tree of %d triangles might exceed the max height %d", outTriangles.size(), PT_TRIANGLE_BVH_TREE_HEIGHT_MAX);
-	XMVECTOR minPos = XMLoadFloat3(&mVertexVec[mIndexVec[0]].pos);
-	XMVECTOR maxPos = XMLoadFloat3(&mVertexVec[mIndexVec[0]].pos);
+	XMVECTOR minPos = XMLoadFloat3(&mVertices[mIndices[0]].pos);
+	XMVECTOR maxPos = XMLoadFloat3(&mVertices[mIndices[0]].pos);
 	for (int i = 0; i < outTriangles.size(); i++)
 	{
-		const Vertex& v0 = mVertexVec[mIndexVec[i * 3]];
-		const Vertex& v1 = mVertexVec[mIndexVec[i * 3 + 1]];
-		const Vertex& v2 = mVertexVec[mIndexVec[i * 3 + 2]];
+		const Vertex& v0 = mVertices[mIndices[i * 3]];
+		const Vertex& v1 = mVertices[mIndices[i * 3 + 1]];
+		const Vertex& v2 = mVertices[mIndices[i * 3 + 2]];
 		outTriangles[i].mVertices[0] = v0;
 		outTriangles[i].mVertices[1] = v1;
 		outTriangles[i].mVertices[2] = v2;
@@ -567,8 +703,33 @@ void Mesh::SetSkyFullscreenTriangle()
 void Mesh::SetMesh()
 {
 	mPrimitiveType = PrimitiveType::TRIANGLE;
+	if (LoadMeshCache())
+		return;
 
-	string filePathName = AssetPath + mFileName;
+	// meshes constructed during static initialization parse on the calling thread
+	ObjData obj;
+	const bool parsed = ParseObjFile(AssetPath + mFileName, ThreadPool::IsInitialized(), obj) && !obj.mPoints.empty();
+	if (!verifyf(parsed, "can't load mesh %s, drawing a cube instead", mFileName.c_str()))
+	{
+		// the renderer and the path tracer can't handle a mesh without triangles
+		SetCube();
+		return;
+	}
+	AssembleObjMesh(obj.mPositions, obj.mUVs, obj.mNormals, obj.mPoints, mVertexVec, mIndexVec);
+	const bool assembled = !mIndexVec.empty();
+	if (!verifyf(assembled, "mesh %s has no valid triangles, drawing a cube instead", mFileName.c_str()))
+	{
+		mVertexVec.clear();
+		SetCube();
+		return;
+	}
+	OptimizeVertexCache(mVertexVec, mIndexVec);
+	GenerateLods(mVertexVec, mIndexVec, mLods);
+	SaveMeshCache(mFileName, mVertexVec, mIndexVec, mLods);
+}
+
+void Mesh::ParseObjStringStream(const string& filePathName, ObjData& obj)
+{
 	stringstream ss;
 	auto lambda = [&](const char* buf) {
 		string str(buf);
@@ -576,10 +737,10 @@ void Mesh::SetMesh()
 	};
 	ReadFile(filePathName, lambda, false);
 
-	vector<XMFLOAT3> vecPos;
-	vector<XMFLOAT3> vecNor;
-	vector<XMFLOAT2> vecUV;
-	vector<Point> vecPoint;
+	vector<XMFLOAT3>& vecPos = obj.mPositions;
+	vector<XMFLOAT3>& vecNor = obj.mNormals;
+	vector<XMFLOAT2>& vecUV = obj.mUVs;
+	vector<Point>& vecPoint = obj.mPoints;
 
 	string str;
 	while (getline(ss, str))
@@ -643,8 +804,6 @@ void Mesh::SetMesh()
 			//others
 		}
 	}
-
-	AssembleObjMesh(vecPos, vecUV, vecNor, vecPoint);
 }
 
 void Mesh::ParseObjFace(stringstream &ss, vector<Point>& tempVecPoint)
@@ -756,72 +915,1850 @@ void Mesh::ParseObjFace(stringstream &ss, vector<Point>& tempVecPoint)
 	} while (!ss.eof());
 }
 
+// SSE2 search for the next line break, returns end if there is none
+inline const char* FindObjLineEnd(const char* p, const char* end)
+{
+	const __m128i newline = _mm_set1_epi8('\n');
+	for (; end - p >= 16; p += 16)
+	{
+		const int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)p), newline));
+		if (mask)
+		{
+			unsigned long index;
+			_BitScanForward(&index, mask);
+			return p + index;
+		}
+	}
+	while (p < end && *p != '\n')
+		p++;
+	return p;
+}
+
+inline const char* SkipObjSpaces(const char* p, const char* end)
+{
+	while (p < end && (*p == ' ' || *p == '\t'))
+		p++;
+	return p;
+}
+
+inline bool IsObjDigit(char c)
+{
+	return c >= '0' && c <= '9';
+}
+
+static const double ObjPowersOfTen[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+
+// locale free replacement of stringstream >> float, a missing number reads as 0 like a failed stream
+// a mantissa below 2^53 times an exact power of ten is rounded once to double, the only case where rounding that to float
+// differs from rounding the decimal straight to float is a double that lands exactly between two floats, that and everything else goes to strtof
+inline const char* ParseObjFloat(const char* p, const char* end, float& value)
+{
+	p = SkipObjSpaces(p, end);
+	const char* start = p;
+	bool negative = false;
+	if (p < end && (*p == '-' || *p == '+'))
+		negative = *p++ == '-';
+	u64 mantissa = 0;
+	int exponent = 0;
+	bool exact = true;
+	bool anyDigit = false;
+	for (; p < end && IsObjDigit(*p); p++)
+	{
+		anyDigit = true;
+		if (mantissa < 100000000000000000ull)
+			mantissa = mantissa * 10 + (*p - '0');
+		else
+		{
+			exponent++;
+			exact = exact && *p == '0';
+		}
+	}
+	if (p < end && *p == '.')
+	{
+		for (p++; p < end && IsObjDigit(*p); p++)
+		{
+			anyDigit = true;
+			if (mantissa < 100000000000000000ull)
+			{
+				mantissa = mantissa * 10 + (*p - '0');
+				exponent--;
+			}
+			else
+				exact = exact && *p == '0';
+		}
+	}
+	if (!anyDigit)
+	{
+		value = 0.0f;
+		return start;
+	}
+	if (p < end && (*p == 'e' || *p == 'E'))
+	{
+		const char* exponentStart = p++;
+		bool exponentNegative = false;
+		if (p < end && (*p == '-' || *p == '+'))
+			exponentNegative = *p++ == '-';
+		if (p < end && IsObjDigit(*p))
+		{
+			int exponentValue = 0;
+			for (; p < end && IsObjDigit(*p); p++)
+				exponentValue = MIN(exponentValue * 10 + (*p - '0'), 100000);
+			exponent += exponentNegative ? -exponentValue : exponentValue;
+		}
+		else
+			p = exponentStart;
+	}
+
+	if (exact && mantissa < (1ull << 53) && exponent >= -22 && exponent <= 22)
+	{
+		double d = (double)mantissa;
+		d = exponent < 0 ? d / ObjPowersOfTen[-exponent] : d * ObjPowersOfTen[exponent];
+		u64 bits;
+		memcpy(&bits, &d, sizeof(bits));
+		const bool floatMidpoint = (bits & ((1ull << 29) - 1)) == (1ull << 28);
+		if (mantissa == 0 || (d >= FLT_MIN && d <= FLT_MAX && !floatMidpoint))
+		{
+			value = negative ? -(float)d : (float)d;
+			return p;
+		}
+	}
+	char buf[128];
+	const size_t length = MIN((size_t)(p - start), sizeof(buf) - 1);
+	memcpy(buf, start, length);
+	buf[length] = '\0';
+	value = strtof(buf, nullptr);
+	return p;
+}
+
+// 1 based index, 0 when it is missing like in ParseObjFace
+// a negative index counts back from the last of the count elements read so far, indices that don't exist become MAX_UINT32 so AssembleObjMesh rejects them
+inline const char* ParseObjIndex(const char* p, const char* end, size_t count, uint32_t& index, bool& relative)
+{
+	const bool negative = p < end && *p == '-';
+	if (negative)
+		p++;
+	u64 value = 0;
+	for (; p < end && IsObjDigit(*p); p++)
+	{
+		const u64 next = value * 10 + (*p - '0');
+		value = MIN(next, (u64)MAX_UINT32);
+	}
+	if (negative)
+	{
+		index = value > 0 && value <= count ? (uint32_t)(count + 1 - value) : MAX_UINT32;
+		relative = true;
+	}
+	else
+		index = (uint32_t)value;
+	return p;
+}
+
+bool Mesh::ParseObjFile(const string& filePathName, bool parallel, ObjData& obj)
+{
+	MappedFile file;
+	const bool opened = file.Open(filePathName);
+	if (!verifyf(opened, "can't open file %s", filePathName.c_str()))
+		return false;
+	ParseObj(file.GetData(), file.GetSize(), parallel, obj);
+	return true;
+}
+
+// chunks end on a line break so every line belongs to exactly one chunk, and appending them in order gives the serial result
+void Mesh::ParseObj(const char* data, size_t size, bool parallel, ObjData& obj)
+{
+	const size_t chunkSizeMin = 256 * 1024;
+	const size_t chunkCountMax = parallel ? ThreadPool::GetThreadCount() * 4 : 1;
+	const size_t chunkCountBySize = size / chunkSizeMin;
+	const u32 chunkCount = (u32)CLAMP(chunkCountBySize, 1, chunkCountMax);
+	if (chunkCount == 1)
+	{
+		ParseObjChunk(data, data + size, obj);
+		return;
+	}
+
+	const char* dataEnd = data + size;
+	vector<const char*> chunkBegins(chunkCount + 1, dataEnd);
+	chunkBegins[0] = data;
+	for (u32 i = 1; i < chunkCount; i++)
+	{
+		const char* p = MAX(data + size * i / chunkCount, chunkBegins[i - 1]);
+		p = FindObjLineEnd(p, dataEnd);
+		chunkBegins[i] = p < dataEnd ? p + 1 : dataEnd;
+	}
+	vector<ObjData> chunks(chunkCount);
+	ThreadPool::ParallelFor(chunkCount, 1, [&](i64 begin, i64 end, u32) {
+		for (i64 i = begin; i < end; i++)
+			ParseObjChunk(chunkBegins[i], chunkBegins[i + 1], chunks[i]);
+	});
+
+	// relative indices depend on every element before them, a chunk only counts its own so the file is parsed again in one piece
+	for (const ObjData& chunk : chunks)
+	{
+		if (chunk.mHasRelativeIndices)
+		{
+			ParseObjChunk(data, dataEnd, obj);
+			return;
+		}
+	}
+
+	// face indices are absolute, so the chunks are copied as they are
+	vector<size_t> positionOffsets(chunkCount + 1, 0);
+	vector<size_t> uvOffsets(chunkCount + 1, 0);
+	vector<size_t> normalOffsets(chunkCount + 1, 0);
+	vector<size_t> pointOffsets(chunkCount + 1, 0);
+	for (u32 i = 0; i < chunkCount; i++)
+	{
+		positionOffsets[i + 1] = positionOffsets[i] + chunks[i].mPositions.size();
+		uvOffsets[i + 1] = uvOffsets[i] + chunks[i].mUVs.size();
+		normalOffsets[i + 1] = normalOffsets[i] + chunks[i].mNormals.size();
+		pointOffsets[i + 1] = pointOffsets[i] + chunks[i].mPoints.size();
+	}
+	obj.mPositions.resize(positionOffsets[chunkCount]);
+	obj.mUVs.resize(uvOffsets[chunkCount]);
+	obj.mNormals.resize(normalOffsets[chunkCount]);
+	obj.mPoints.resize(pointOffsets[chunkCount]);
+	ThreadPool::ParallelFor(chunkCount, 1, [&](i64 begin, i64 end, u32) {
+		for (i64 i = begin; i < end; i++)
+		{
+			copy(chunks[i].mPositions.begin(), chunks[i].mPositions.end(), obj.mPositions.begin() + positionOffsets[i]);
+			copy(chunks[i].mUVs.begin(), chunks[i].mUVs.end(), obj.mUVs.begin() + uvOffsets[i]);
+			copy(chunks[i].mNormals.begin(), chunks[i].mNormals.end(), obj.mNormals.begin() + normalOffsets[i]);
+			copy(chunks[i].mPoints.begin(), chunks[i].mPoints.end(), obj.mPoints.begin() + pointOffsets[i]);
+		}
+	});
+}
+
+// same lines as the stringstream parser, "v ", "vt ", "vn " and "f " at the start of a line and everything else ignored
+void Mesh::ParseObjChunk(const char* begin, const char* end, ObjData& obj)
+{
+	vector<Point> facePoints;
+	for (const char* line = begin; line < end;)
+	{
+		const char* lineEnd = FindObjLineEnd(line, end);
+		const char* nextLine = lineEnd < end ? lineEnd + 1 : end;
+		if (lineEnd > line && lineEnd[-1] == '\r')
+			lineEnd--;
+		const size_t length = lineEnd - line;
+		if (length >= 2 && line[0] == 'v' && line[1] == ' ')
+		{
+			XMFLOAT3 v;
+			const char* p = ParseObjFloat(line + 2, lineEnd, v.x);
+			p = ParseObjFloat(p, lineEnd, v.y);
+			ParseObjFloat(p, lineEnd, v.z);
+			obj.mPositions.push_back(v);
+		}
+		else if (length >= 3 && line[0] == 'v' && line[1] == 't' && line[2] == ' ')
+		{
+			XMFLOAT2 v;
+			const char* p = ParseObjFloat(line + 3, lineEnd, v.x);
+			ParseObjFloat(p, lineEnd, v.y);
+			obj.mUVs.push_back(v);
+		}
+		else if (length >= 3 && line[0] == 'v' && line[1] == 'n' && line[2] == ' ')
+		{
+			XMFLOAT3 v;
+			const char* p = ParseObjFloat(line + 3, lineEnd, v.x);
+			p = ParseObjFloat(p, lineEnd, v.y);
+			ParseObjFloat(p, lineEnd, v.z);
+			obj.mNormals.push_back(v);
+		}
+		else if (length >= 2 && line[0] == 'f' && line[1] == ' ')
+		{
+			// v, v/t, v//n or v/t/n per corner
+			facePoints.clear();
+			for (const char* p = SkipObjSpaces(line + 2, lineEnd); p < lineEnd; p = SkipObjSpaces(p, lineEnd))
+			{
+				Point point = { 0, 0, 0 };
+				p = ParseObjIndex(p, lineEnd, obj.mPositions.size(), point.VI, obj.mHasRelativeIndices);
+				if (p < lineEnd && *p == '/')
+				{
+					p = ParseObjIndex(p + 1, lineEnd, obj.mUVs.size(), point.TI, obj.mHasRelativeIndices);
+					if (p < lineEnd && *p == '/')
+						p = ParseObjIndex(p + 1, lineEnd, obj.mNormals.size(), point.NI, obj.mHasRelativeIndices);
+				}
+				while (p < lineEnd && *p != ' ' && *p != '\t')
+					p++;
+				facePoints.push_back(point);
+			}
+			for (size_t i = 0; i < facePoints.size(); i++)
+			{
+				if (i >= 3)
+				{
+					obj.mPoints.push_back(facePoints[0]);
+					obj.mPoints.push_back(facePoints[i - 1]);
+				}
+				obj.mPoints.push_back(facePoints[i]);
+			}
+		}
+		line = nextLine;
+	}
+}
+
+template<class T>
+inline bool IsSameObjArray(const vector<T>& a, const vector<T>& b)
+{
+	return a.size() == b.size() && (a.empty() || memcmp(a.data(), b.data(), a.size() * sizeof(T)) == 0);
+}
+
+// the headless mesh reports take comma separated obj files in the asset folder, report returns false for a file it fails on
+inline bool ReportObjFiles(const char* title, const string& fileNames, const function<bool(const string& fileName)>& report)
+{
+	printf(">>> %s <<<\n", title);
+	ThreadPool::Init();
+	int failureCount = 0;
+	stringstream ss(fileNames);
+	string fileName;
+	while (getline(ss, fileName, ','))
+		failureCount += report(fileName) ? 0 : 1;
+	const bool passed = failureCount == 0;
+	if (!passed)
+		fprintf(stderr, "%s failed on %d files\n", title, failureCount);
+	printf("==============================\n");
+	return passed;
+}
+
+bool Mesh::LoadObjFile(const string& fileName, vector<Vertex>& vertices, vector<uint32_t>& indices)
+{
+	ObjData obj;
+	if (!ParseObjFile(AssetPath + fileName, true, obj))
+	{
+		fprintf(stderr, "can't open file %s\n", (AssetPath + fileName).c_str());
+		return false;
+	}
+	AssembleObjMesh(obj.mPositions, obj.mUVs, obj.mNormals, obj.mPoints, vertices, indices);
+	const bool assembled = !indices.empty();
+	if (!assembled)
+		fprintf(stderr, "%s has no valid triangles\n", fileName.c_str());
+	return assembled;
+}
+
+// best of a few runs of each parser, the chunked parser has to produce the same bits as the stringstream parser
+bool Mesh::BenchmarkObjParser(const string& fileNames)
+{
+	return ReportObjFiles("obj parser benchmark", fileNames, [](const string& fileName) {
+		const int runCount = 3;
+		const string filePathName = AssetPath + fileName;
+		MappedFile file;
+		const bool opened = file.Open(filePathName);
+		if (!opened)
+		{
+			fprintf(stderr, "can't open file %s\n", filePathName.c_str());
+			return false;
+		}
+		const float megabytes = file.GetSize() / 1048576.0f;
+		file.Close();
+
+		ObjData reference;
+		ObjData serial;
+		ObjData parallel;
+		float stringStreamTime = FLT_MAX;
+		float serialTime = FLT_MAX;
+		float parallelTime = FLT_MAX;
+		for (int i = 0; i < runCount; i++)
+		{
+			reference = ObjData();
+			serial = ObjData();
+			parallel = ObjData();
+			CpuTimer timer;
+			ParseObjStringStream(filePathName, reference);
+			stringStreamTime = MIN(stringStreamTime, timer.GetMilliseconds());
+			timer.Reset();
+			ParseObjFile(filePathName, false, serial);
+			serialTime = MIN(serialTime, timer.GetMilliseconds());
+			timer.Reset();
+			ParseObjFile(filePathName, true, parallel);
+			parallelTime = MIN(parallelTime, timer.GetMilliseconds());
+		}
+
+		bool same = true;
+		for (const ObjData* obj : { &serial, &parallel })
+		{
+			same = same && IsSameObjArray(obj->mPositions, reference.mPositions);
+			same = same && IsSameObjArray(obj->mUVs, reference.mUVs);
+			same = same && IsSameObjArray(obj->mNormals, reference.mNormals);
+			same = same && IsSameObjArray(obj->mPoints, reference.mPoints);
+		}
+		printf("%s: %f MB, %u triangles, stringstream %f MB/s, chunked %f MB/s on 1 thread and %f MB/s on %u threads, %s\n",
+			fileName.c_str(), megabytes, (u32)reference.mPoints.size() / 3,
+			megabytes * 1000.0f / stringStreamTime, megabytes * 1000.0f / serialTime, megabytes * 1000.0f / parallelTime, ThreadPool::GetThreadCount(),
+			same ? "identical" : "MISMATCH");
+		if (!same)
+			fprintf(stderr, "%s: the chunked parser doesn't match the stringstream parser\n", fileName.c_str());
+		return same;
+	});
+}
+
+// corners with the same position, uv and normal index triple share a vertex, the triples are hashed by their position index
+// and the few vertices that share a position (uv seams, hard edges) are chained
 void Mesh::AssembleObjMesh(
 	const vector<XMFLOAT3> &vecPos,
 	const vector<XMFLOAT2> &vecUV,
 	const vector<XMFLOAT3> &vecNor,
-	const vector<Point> &vecPoint)
+	const vector<Point> &vecPoint,
+	vector<Vertex>& vertices,
+	vector<uint32_t>& indices)
 {
 	uint32_t n = static_cast<uint32_t>(vecPoint.size());
-
-	mVertexVec.resize(n);
-	mIndexVec.resize(n);
-
-	for (uint32_t i = 0; i < n; i += 3)
+	if (n % 3 != 0)
 	{
-		XMFLOAT3 p0 = vecPos[vecPoint[i].VI - 1];
-		XMFLOAT3 p1 = vecPos[vecPoint[i + 1].VI - 1];
-		XMFLOAT3 p2 = vecPos[vecPoint[i + 2].VI - 1];
+		fprintf(stderr, "obj faces have to be split into triangles, ignoring the last %u corners\n", n % 3);
+		n -= n % 3;
+	}
 
-		XMFLOAT2 w0 = vecUV[vecPoint[i].TI - 1];
-		XMFLOAT2 w1 = vecUV[vecPoint[i + 1].TI - 1];
-		XMFLOAT2 w2 = vecUV[vecPoint[i + 2].TI - 1];
+	vector<uint32_t> firstVertexOfPosition(vecPos.size(), INVALID_UINT32);
+	vector<uint32_t> nextVertexOfPosition;
+	vector<Point> vertexPoints;
+	vertices.clear();
+	indices.clear();
+	indices.reserve(n);
+	u32 skippedTriangleCount = 0;
+	for (uint32_t i = 0; i < n; i++)
+	{
+		if (i % 3 == 0)
+		{
+			// a triangle with any corner out of range is skipped as a whole
+			bool inRange = true;
+			for (uint32_t j = i; j < i + 3; j++)
+				inRange = inRange && vecPoint[j].VI > 0 && vecPoint[j].VI <= vecPos.size() && vecPoint[j].TI <= vecUV.size() && vecPoint[j].NI <= vecNor.size();
+			if (!inRange)
+			{
+				skippedTriangleCount++;
+				i += 2;
+				continue;
+			}
+		}
+		const Point& point = vecPoint[i];
+		uint32_t vertexIndex = firstVertexOfPosition[point.VI - 1];
+		while (vertexIndex != INVALID_UINT32 && (vertexPoints[vertexIndex].TI != point.TI || vertexPoints[vertexIndex].NI != point.NI))
+			vertexIndex = nextVertexOfPosition[vertexIndex];
+		if (vertexIndex == INVALID_UINT32)
+		{
+			vertexIndex = static_cast<uint32_t>(vertices.size());
+			nextVertexOfPosition.push_back(firstVertexOfPosition[point.VI - 1]);
+			firstVertexOfPosition[point.VI - 1] = vertexIndex;
+			vertexPoints.push_back(point);
 
-		float x1 = p1.x - p0.x;
-		float x2 = p2.x - p0.x;
-		float y1 = p1.y - p0.y;
-		float y2 = p2.y - p0.y;
-		float z1 = p1.z - p0.z;
-		float z2 = p2.z - p0.z;
+			XMFLOAT3 pos = vecPos[point.VI - 1];//index start at 1 in an .obj file but at 0 in an array
+			XMFLOAT3 nor(0, 0, 0);
+			XMFLOAT2 uv(0, 0);
+			if (point.NI > 0) nor = vecNor[point.NI - 1];//0 was used to mark not-have-nor
+			if (point.TI > 0) uv = vecUV[point.TI - 1];//0 was used to mark not-have-uv
+			vertices.push_back({ pos, uv, nor, XMFLOAT4(0, 0, 0, 0) });
+		}
+		indices.push_back(vertexIndex);
+	}
+	if (skippedTriangleCount > 0)
+		fprintf(stderr, "skipped %u obj triangles with a position, uv or normal index out of range\n", skippedTriangleCount);
+	n = static_cast<uint32_t>(indices.size());
 
-		float s1 = w1.x - w0.x;
-		float s2 = w2.x - w0.x;
-		float t1 = w1.y - w0.y;
-		float t2 = w2.y - w0.y;
+	// tangents of the triangles around a vertex are summed unnormalized so larger triangles weigh more, triangles without a uv mapping are skipped
+	vector<XMFLOAT3> sdirSum(vertices.size(), XMFLOAT3(0, 0, 0));
+	vector<XMFLOAT3> tdirSum(vertices.size(), XMFLOAT3(0, 0, 0));
+	for (uint32_t i = 0; i < n; i += 3)
+	{
+		const Vertex& v0 = vertices[indices[i]];
+		const Vertex& v1 = vertices[indices[i + 1]];
+		const Vertex& v2 = vertices[indices[i + 2]];
+
+		float x1 = v1.pos.x - v0.pos.x;
+		float x2 = v2.pos.x - v0.pos.x;
+		float y1 = v1.pos.y - v0.pos.y;
+		float y2 = v2.pos.y - v0.pos.y;
+		float z1 = v1.pos.z - v0.pos.z;
+		float z2 = v2.pos.z - v0.pos.z;
+
+		float s1 = v1.uv.x - v0.uv.x;
+		float s2 = v2.uv.x - v0.uv.x;
+		float t1 = v1.uv.y - v0.uv.y;
+		float t2 = v2.uv.y - v0.uv.y;
 
 		float r = 1.0f / (s1 * t2 - s2 * t1);
-		XMFLOAT3 sdir(
+		if (!isfinite(r))
+			continue;
+		XMVECTOR sdir = XMVectorSet(
 			(t2 * x1 - t1 * x2) * r,
 			(t2 * y1 - t1 * y2) * r,
-			(t2 * z1 - t1 * z2) * r);
-		XMFLOAT3 tdir(
+			(t2 * z1 - t1 * z2) * r,
+			0.0f);
+		XMVECTOR tdir = XMVectorSet(
 			(s1 * x2 - s2 * x1) * r,
 			(s1 * y2 - s2 * y1) * r,
-			(s1 * z2 - s2 * z1) * r);
+			(s1 * z2 - s2 * z1) * r,
+			0.0f);
+		for (uint32_t j = i; j < i + 3; j++)
+		{
+			XMStoreFloat3(&sdirSum[indices[j]], XMLoadFloat3(&sdirSum[indices[j]]) + sdir);
+			XMStoreFloat3(&tdirSum[indices[j]], XMLoadFloat3(&tdirSum[indices[j]]) + tdir);
+		}
+	}
 
-		XMStoreFloat3(&sdir, XMVector3Normalize(XMLoadFloat3(&sdir)));
-		XMStoreFloat3(&tdir, XMVector3Normalize(XMLoadFloat3(&tdir)));
+	// Gram-Schmidt against the normal, vertices without a usable tangent get any direction perpendicular to the normal
+	for (uint32_t i = 0; i < vertices.size(); i++)
+	{
+		Vertex& vertex = vertices[i];
+		XMVECTOR nor = XMLoadFloat3(&vertex.nor);
+		XMVECTOR sdir = XMLoadFloat3(&sdirSum[i]);
+		XMVECTOR tan = XMVector3Normalize(sdir - nor * XMVector3Dot(nor, sdir));
+		if (!(XMVectorGetX(XMVector3LengthSq(tan)) > 0.5f))
+		{
+			XMVECTOR axis = fabsf(vertex.nor.x) < 0.9f ? XMVectorSet(1.0f, 0.0f, 0.0f, 0.0f) : XMVectorSet(0.0f, 1.0f, 0.0f, 0.0f);
+			tan = XMVector3Normalize(axis - nor * XMVector3Dot(nor, axis));
+		}
 
-		for (uint32_t j = i; j < i + 3; j++)
+		//The order is fixed, it is the same in the shaders. The only way to tell the direction when reconstructing tangent is the sign component.
+		float dotProduct = 0;
+		XMStoreFloat(&dotProduct, XMVector3Dot(XMVector3Cross(nor, tan), XMLoadFloat3(&tdirSum[i])));
+		float sign = dotProduct > 0.0f ? 1.0f : -1.0f;
+		XMStoreFloat4(&vertex.tan, XMVectorSetW(tan, sign));
+	}
+}
+
+static const u32 VertexCacheSize = 32; // LRU cache the triangle order is optimized for
+static const u32 VertexCacheValenceMax = 32; // valence scores beyond this are all the same
+
+inline float GetVertexCacheScore(int cachePosition, u32 valence)
+{
+	// Tom Forsyth, Linear-Speed Vertex Cache Optimisation
+	if (valence == 0)
+		return -1.0f;
+	float score = 0.0f;
+	if (cachePosition >= 0)
+	{
+		// the 3 vertices of the last triangle get a fixed score so the next triangle doesn't just reuse all of them
+		if (cachePosition < 3)
+			score = 0.75f;
+		else
+			score = powf(1.0f - (float)(cachePosition - 3) / (VertexCacheSize - 3), 1.5f);
+	}
+	// vertices with few triangles left are finished off first so they leave the cache for good
+	return score + 2.0f * powf((float)MIN(valence, VertexCacheValenceMax), -0.5f);
+}
+
+// Forsyth triangle order for the post transform cache, then the vertices in the order the triangles first use them for the pre transform cache
+void Mesh::OptimizeVertexCache(vector<Vertex>& vertices, vector<uint32_t>& indices)
+{
+	const u32 vertexCount = static_cast<u32>(vertices.size());
+	const u32 triangleCount = static_cast<u32>(indices.size() / 3);
+	if (triangleCount == 0)
+		return;
+
+	float cacheScores[VertexCacheSize + 1][VertexCacheValenceMax + 1];
+	for (u32 i = 0; i <= VertexCacheSize; i++)
+		for (u32 j = 0; j <= VertexCacheValenceMax; j++)
+			cacheScores[i][j] = GetVertexCacheScore(i < VertexCacheSize ? (int)i : -1, j);
+	auto getScore = [&](int cachePosition, u32 valence) {
+		return cacheScores[cachePosition < 0 ? VertexCacheSize : cachePosition][MIN(valence, VertexCacheValenceMax)];
+	};
+
+	// triangles of every vertex, the ones not emitted yet are kept at the front of each list
+	vector<u32> valences(vertexCount, 0);
+	for (uint32_t index : indices)
+		valences[index]++;
+	vector<u32> triangleOffsets(vertexCount + 1, 0);
+	for (u32 i = 0; i < vertexCount; i++)
+		triangleOffsets[i + 1] = triangleOffsets[i] + valences[i];
+	vector<u32> vertexTriangles(indices.size());
+	vector<u32> fillCounts(vertexCount, 0);
+	for (u32 i = 0; i < indices.size(); i++)
+		vertexTriangles[triangleOffsets[indices[i]] + fillCounts[indices[i]]++] = i / 3;
+
+	vector<int> cachePositions(vertexCount, -1);
+	vector<float> vertexScores(vertexCount);
+	for (u32 i = 0; i < vertexCount; i++)
+		vertexScores[i] = getScore(-1, valences[i]);
+	vector<float> triangleScores(triangleCount);
+	for (u32 i = 0; i < triangleCount; i++)
+		triangleScores[i] = vertexScores[indices[i * 3]] + vertexScores[indices[i * 3 + 1]] + vertexScores[indices[i * 3 + 2]];
+	vector<bool> emitted(triangleCount, false);
+
+	vector<uint32_t> optimized(indices.size());
+	u32 cache[VertexCacheSize + 3];
+	u32 cacheCount = 0;
+	u32 nextTriangle = 0; // linear scan for a start when no triangle touches the cache
+	int bestTriangle = -1;
+	for (u32 emittedCount = 0; emittedCount < triangleCount; emittedCount++)
+	{
+		if (bestTriangle < 0)
 		{
-			XMFLOAT3 pos(0, 0, 0);
-			XMFLOAT3 nor(0, 0, 0);
-			XMFLOAT2 uv(0, 0);
+			while (emitted[nextTriangle])
+				nextTriangle++;
+			bestTriangle = nextTriangle;
+		}
+		const u32 triangle = bestTriangle;
+		emitted[triangle] = true;
+		u32 newCache[VertexCacheSize + 3];
+		u32 newCacheCount = 0;
+		for (u32 k = 0; k < 3; k++)
+		{
+			const u32 vertex = indices[triangle * 3 + k];
+			optimized[emittedCount * 3 + k] = vertex;
+			newCache[newCacheCount++] = vertex;
+			u32* triangles = &vertexTriangles[triangleOffsets[vertex]];
+			for (u32 t = 0; t < valences[vertex]; t++)
+			{
+				if (triangles[t] == triangle)
+				{
+					swap(triangles[t], triangles[valences[vertex] - 1]);
+					break;
+				}
+			}
+			valences[vertex]--;
+		}
+		for (u32 i = 0; i < cacheCount; i++)
+		{
+			const u32 vertex = cache[i];
+			if (vertex != newCache[0] && vertex != newCache[1] && vertex != newCache[2])
+				newCache[newCacheCount++] = vertex;
+		}
+
+		// rescore the vertices that moved in the cache or fell out of it, and the triangles around them
+		bestTriangle = -1;
+		float bestScore = -1.0f;
+		for (u32 i = 0; i < newCacheCount; i++)
+		{
+			const u32 vertex = newCache[i];
+			const int cachePosition = i < VertexCacheSize ? (int)i : -1;
+			cachePositions[vertex] = cachePosition;
+			const float scoreDelta = getScore(cachePosition, valences[vertex]) - vertexScores[vertex];
+			vertexScores[vertex] += scoreDelta;
+			const u32* triangles = &vertexTriangles[triangleOffsets[vertex]];
+			for (u32 t = 0; t < valences[vertex]; t++)
+			{
+				triangleScores[triangles[t]] += scoreDelta;
+				if (cachePosition >= 0 && triangleScores[triangles[t]] > bestScore)
+				{
+					bestScore = triangleScores[triangles[t]];
+					bestTriangle = triangles[t];
+				}
+			}
+		}
+		cacheCount = MIN(newCacheCount, VertexCacheSize);
+		memcpy(cache, newCache, cacheCount * sizeof(u32));
+	}
+
+	vector<uint32_t> remap(vertexCount, INVALID_UINT32);
+	vector<Vertex> reordered;
+	reordered.reserve(vertexCount);
+	for (uint32_t& index : optimized)
+	{
+		if (remap[index] == INVALID_UINT32)
+		{
+			remap[index] = static_cast<uint32_t>(reordered.size());
+			reordered.push_back(vertices[index]);
+		}
+		index = remap[index];
+	}
+	vertices.swap(reordered);
+	indices.swap(optimized);
+}
+
+// average cache miss ratio, transformed vertices per triangle with a FIFO post transform cache
+float Mesh::GetAcmr(const vector<uint32_t>& indices, u32 cacheSize)
+{
+	if (indices.empty())
+		return 0.0f;
+	uint32_t vertexCount = 0;
+	for (uint32_t index : indices)
+		vertexCount = MAX(vertexCount, index + 1);
+	vector<u64> insertTimes(vertexCount, 0); // 0 means never cached
+	u64 time = 0;
+	u64 missCount = 0;
+	for (uint32_t index : indices)
+	{
+		if (insertTimes[index] == 0 || time - insertTimes[index] >= cacheSize)
+		{
+			missCount++;
+			time++;
+			insertTimes[index] = time;
+		}
+	}
+	return (float)missCount / (indices.size() / 3);
+}
+
+bool Mesh::ReportVertexCacheStats(const string& fileNames)
+{
+	return ReportObjFiles("vertex cache stats", fileNames, [](const string& fileName) {
+		vector<Vertex> vertices;
+		vector<uint32_t> indices;
+		if (!LoadObjFile(fileName, vertices, indices))
+			return false;
+		const float acmrFileOrder = GetAcmr(indices, VertexCacheSize);
+		CpuTimer timer;
+		OptimizeVertexCache(vertices, indices);
+		const float optimizeTime = timer.GetMilliseconds();
+		const u32 triangleCount = (u32)indices.size() / 3;
+		// without an index buffer every corner is its own vertex, which is what meshes used to be loaded as
+		printf("%s: %u triangles, %u vertices instead of %u, reuse ratio %f, ACMR (FIFO %u) 3.0 unindexed, %f in file order, %f optimized in %f ms, ATVR %f\n",
+			fileName.c_str(), triangleCount, (u32)vertices.size(), (u32)indices.size(), (float)indices.size() / vertices.size(), VertexCacheSize,
+			acmrFileOrder, GetAcmr(indices, VertexCacheSize), optimizeTime, GetAcmr(indices, VertexCacheSize) * triangleCount / vertices.size());
+		return true;
+	});
+}
+
+static const u32 MeshCacheMagic = 0x4853454d; // "MESH"
+static const u32 MeshCacheVersion = 3; // bump whenever the obj loader changes its output
+
+struct MeshCacheHeader
+{
+	u32 mMagic;
+	u32 mVersion;
+	u32 mVertexSize;
+	u32 mVertexCount;
+	u32 mIndexCount; // of every level of detail
+	u32 mLodCount;
+	u64 mSourceSize; // the obj the cache was built from
+	u64 mSourceWriteTime;
+	u64 mSourceHash;
+	XMFLOAT3 mBoundsMin;
+	XMFLOAT3 mBoundsMax;
+};
+
+// the header, the vertices, the indices and the table of the levels of detail
+inline size_t GetMeshCacheFileSize(u64 vertexCount, u64 indexCount, u64 lodCount)
+{
+	return sizeof(MeshCacheHeader) + sizeof(Vertex) * vertexCount + sizeof(uint32_t) * indexCount + sizeof(Mesh::Lod) * lodCount;
+}
+
+inline string GetMeshCacheFilePathName(const string& fileName)
+{
+	return CachePath + fileName + ".mesh";
+}
+
+inline bool GetMeshCacheSourceStamp(const string& filePathName, u64& size, u64& writeTime)
+{
+	WIN32_FILE_ATTRIBUTE_DATA attributes;
+	if (!GetFileAttributesExA(filePathName.c_str(), GetFileExInfoStandard, &attributes))
+		return false;
+	size = (u64)attributes.nFileSizeHigh << 32 | attributes.nFileSizeLow;
+	writeTime = (u64)attributes.ftLastWriteTime.dwHighDateTime << 32 | attributes.ftLastWriteTime.dwLowDateTime;
+	return true;
+}
+
+// FNV-1a over 32 bit words of the obj text, then over its last few bytes
+inline u64 HashMeshCacheSource(const string& filePathName)
+{
+	MappedFile file;
+	if (!file.Open(filePathName))
+		return 0;
+	u64 hash = 14695981039346656037ull;
+	const u32* words = (const u32*)file.GetData();
+	const size_t wordCount = file.GetSize() / sizeof(u32);
+	for (size_t i = 0; i < wordCount; i++)
+		hash = (hash ^ words[i]) * 1099511628211ull;
+	for (size_t i = wordCount * sizeof(u32); i < file.GetSize(); i++)
+		hash = (hash ^ (u8)file.GetData()[i]) * 1099511628211ull;
+	return hash;
+}
+
+inline void GetVertexBounds(const Vertex* vertices, u32 vertexCount, XMFLOAT3& boundsMin, XMFLOAT3& boundsMax)
+{
+	if (vertexCount == 0)
+	{
+		boundsMin = boundsMax = XMFLOAT3(0.0f, 0.0f, 0.0f);
+		return;
+	}
+	XMVECTOR minPos = XMLoadFloat3(&vertices[0].pos);
+	XMVECTOR maxPos = minPos;
+	for (u32 i = 1; i < vertexCount; i++)
+	{
+		minPos = XMVectorMin(minPos, XMLoadFloat3(&vertices[i].pos));
+		maxPos = XMVectorMax(maxPos, XMLoadFloat3(&vertices[i].pos));
+	}
+	XMStoreFloat3(&boundsMin, minPos);
+	XMStoreFloat3(&boundsMax, maxPos);
+}
+
+// the cache is stale once the obj changed, a new timestamp alone (e.g. after a checkout) costs a hash of the obj
+inline bool IsMeshCacheValid(const string& fileName, const char* data, size_t size)
+{
+	const MeshCacheHeader* header = (const MeshCacheHeader*)data;
+	if (size < sizeof(MeshCacheHeader) ||
+		header->mMagic != MeshCacheMagic ||
+		header->mVersion != MeshCacheVersion ||
+		header->mVertexSize != sizeof(Vertex) ||
+		size != GetMeshCacheFileSize(header->mVertexCount, header->mIndexCount, header->mLodCount) ||
+		header->mVertexCount == 0 ||
+		header->mIndexCount == 0 ||
+		header->mIndexCount % 3 != 0 ||
+		header->mLodCount == 0)
+		return false;
+	const string sourceFilePathName = AssetPath + fileName;
+	u64 sourceSize;
+	u64 sourceWriteTime;
+	if (!GetMeshCacheSourceStamp(sourceFilePathName, sourceSize, sourceWriteTime) || sourceSize != header->mSourceSize)
+		return false;
+	if (sourceWriteTime != header->mSourceWriteTime && HashMeshCacheSource(sourceFilePathName) != header->mSourceHash)
+		return false;
+	const uint32_t* indices = (const uint32_t*)(data + sizeof(MeshCacheHeader) + sizeof(Vertex) * header->mVertexCount);
+	bool indicesValid = true;
+	for (u32 i = 0; i < header->mIndexCount; i++)
+		indicesValid = indicesValid && indices[i] < header->mVertexCount;
+	const Mesh::Lod* lods = (const Mesh::Lod*)(indices + header->mIndexCount);
+	bool lodsValid = lods[0].mIndexOffset == 0 && lods[0].mIndexCount > 0;
+	for (u32 i = 0; i < header->mLodCount; i++)
+		lodsValid = lodsValid && lods[i].mIndexCount % 3 == 0 && (u64)lods[i].mIndexOffset + lods[i].mIndexCount <= header->mIndexCount;
+	return indicesValid && lodsValid;
+}
+
+// points the vertices and indices at the mapped mesh cache if SetMesh found one, at the vectors otherwise
+void Mesh::UpdateGeometryView()
+{
+	if (mCacheFile.GetData())
+	{
+		const MeshCacheHeader* header = (const MeshCacheHeader*)mCacheFile.GetData();
+		mVertices = (const Vertex*)(mCacheFile.GetData() + sizeof(MeshCacheHeader));
+		mIndices = (const uint32_t*)(mVertices + header->mVertexCount);
+		const Lod* lods = (const Lod*)(mIndices + header->mIndexCount);
+		mLods.assign(lods, lods + header->mLodCount);
+		mVertexCount = header->mVertexCount;
+		mIndexCount = mLods[0].mIndexCount;
+		mBoundsMin = header->mBoundsMin;
+		mBoundsMax = header->mBoundsMax;
+	}
+	else
+	{
+		mVertices = mVertexVec.data();
+		mIndices = mIndexVec.data();
+		mVertexCount = (u32)mVertexVec.size();
+		if (mLods.empty())
+			mLods.push_back(Lod{ 0, (u32)mIndexVec.size(), 0.0f });
+		mIndexCount = mLods[0].mIndexCount;
+		GetVertexBounds(mVertices, mVertexCount, mBoundsMin, mBoundsMax);
+	}
+}
+
+// the cache stays mapped for the lifetime of the mesh, the buffers are uploaded and the path tracer triangles are built straight from it
+bool Mesh::LoadMeshCache()
+{
+	const string filePathName = GetMeshCacheFilePathName(mFileName);
+	if (!mCacheFile.Open(filePathName))
+		return false;
+	if (!IsMeshCacheValid(mFileName, mCacheFile.GetData(), mCacheFile.GetSize()))
+	{
+		displayfln("mesh cache %s is stale, parsing %s again", filePathName.c_str(), mFileName.c_str());
+		mCacheFile.Close();
+		return false;
+	}
+	vector<Vertex>().swap(mVertexVec);
+	vector<uint32_t>().swap(mIndexVec);
+	return true;
+}
+
+void Mesh::SaveMeshCache(const string& fileName, const vector<Vertex>& vertices, const vector<uint32_t>& indices, const vector<Lod>& lods)
+{
+	const string sourceFilePathName = AssetPath + fileName;
+	MeshCacheHeader header = {};
+	header.mMagic = MeshCacheMagic;
+	header.mVersion = MeshCacheVersion;
+	header.mVertexSize = sizeof(Vertex);
+	header.mVertexCount = (u32)vertices.size();
+	header.mIndexCount = (u32)indices.size();
+	header.mLodCount = (u32)lods.size();
+	if (!GetMeshCacheSourceStamp(sourceFilePathName, header.mSourceSize, header.mSourceWriteTime))
+		return;
+	header.mSourceHash = HashMeshCacheSource(sourceFilePathName);
+	GetVertexBounds(vertices.data(), header.mVertexCount, header.mBoundsMin, header.mBoundsMax);
+
+	// other instances of the app may load the same obj, write to a file of our own first so a reader never sees a partial file
+	CreateDirectoryA(CachePath.c_str(), nullptr);
+	const string filePathName = GetMeshCacheFilePathName(fileName);
+	const string tempFilePathName = filePathName + "." + to_string(GetCurrentProcessId()) + ".tmp";
+	{
+		fstream file;
+		file.open(tempFilePathName, ios::out | ios::binary | ios::trunc);
+		if (!verifyf(file.is_open(), "can't write mesh cache %s", tempFilePathName.c_str()))
+			return;
+		file.write((const char*)&header, sizeof(header));
+		file.write((const char*)vertices.data(), sizeof(Vertex) * vertices.size());
+		file.write((const char*)indices.data(), sizeof(uint32_t) * indices.size());
+		file.write((const char*)lods.data(), sizeof(Lod) * lods.size());
+	}
+	if (!verifyf(MoveFileExA(tempFilePathName.c_str(), filePathName.c_str(), MOVEFILE_REPLACE_EXISTING), "can't write mesh cache %s", filePathName.c_str()))
+		DeleteFileA(tempFilePathName.c_str());
+}
+
+// best of a few runs of each load path, both cache paths have to give back the parsed mesh and its levels of detail bit for bit
+// the cache is mapped with the same calls as SetMesh, its pages are only read in by the first copy out of it (the upload)
+bool Mesh::BenchmarkMeshCache(const string& fileNames)
+{
+	return ReportObjFiles("mesh cache benchmark", fileNames, [](const string& fileName) {
+		const int runCount = 3;
+		const string filePathName = GetMeshCacheFilePathName(fileName);
+		vector<Vertex> parsedVertices;
+		vector<uint32_t> parsedIndices;
+		vector<Lod> parsedLods;
+		vector<Vertex> readVertices;
+		vector<uint32_t> readIndices;
+		vector<Lod> readLods;
+		vector<char> upload;
+		float parseTime = FLT_MAX;
+		float readTime = FLT_MAX;
+		float mapTime = FLT_MAX;
+		float mapCopyTime = FLT_MAX;
+		bool same = true;
+		bool loaded = true;
+		for (int i = 0; i < runCount; i++)
+		{
+			CpuTimer timer;
+			loaded = LoadObjFile(fileName, parsedVertices, parsedIndices);
+			if (!loaded)
+				break;
+			OptimizeVertexCache(parsedVertices, parsedIndices);
+			GenerateLods(parsedVertices, parsedIndices, parsedLods);
+			parseTime = MIN(parseTime, timer.GetMilliseconds());
+			if (i == 0)
+			{
+				// meshes of the scene may have the cache mapped already, which can't be replaced
+				MappedFile file;
+				if (!file.Open(filePathName) || !IsMeshCacheValid(fileName, file.GetData(), file.GetSize()))
+				{
+					file.Close();
+					SaveMeshCache(fileName, parsedVertices, parsedIndices, parsedLods);
+				}
+			}
+
+			// a regular binary loader, the whole file is read and copied into the vectors
+			timer.Reset();
+			vector<char> data;
+			{
+				fstream file;
+				file.open(filePathName, ios::in | ios::binary | ios::ate);
+				loaded = file.is_open();
+				if (!loaded)
+				{
+					fprintf(stderr, "can't read mesh cache %s\n", filePathName.c_str());
+					break;
+				}
+				data.resize((size_t)file.tellg());
+				file.seekg(0);
+				file.read(data.data(), data.size());
+			}
+			loaded = IsMeshCacheValid(fileName, data.data(), data.size());
+			if (!loaded)
+			{
+				fprintf(stderr, "mesh cache %s is stale\n", filePathName.c_str());
+				break;
+			}
+			const MeshCacheHeader* header = (const MeshCacheHeader*)data.data();
+			const Vertex* vertices = (const Vertex*)(data.data() + sizeof(MeshCacheHeader));
+			const uint32_t* indices = (const uint32_t*)(vertices + header->mVertexCount);
+			readVertices.assign(vertices, vertices + header->mVertexCount);
+			readIndices.assign(indices, indices + header->mIndexCount);
+			const Lod* lods = (const Lod*)(indices + header->mIndexCount);
+			readLods.assign(lods, lods + header->mLodCount);
+			readTime = MIN(readTime, timer.GetMilliseconds());
+
+			upload.resize(data.size() - sizeof(MeshCacheHeader));
+			timer.Reset();
+			MappedFile file;
+			loaded = file.Open(filePathName) && IsMeshCacheValid(fileName, file.GetData(), file.GetSize());
+			if (!loaded)
+			{
+				fprintf(stderr, "can't map mesh cache %s\n", filePathName.c_str());
+				break;
+			}
+			mapTime = MIN(mapTime, timer.GetMilliseconds());
+			memcpy(upload.data(), file.GetData() + sizeof(MeshCacheHeader), upload.size());
+			mapCopyTime = MIN(mapCopyTime, timer.GetMilliseconds());
+
+			same = same && IsSameObjArray(readVertices, parsedVertices) && IsSameObjArray(readIndices, parsedIndices) && IsSameObjArray(readLods, parsedLods);
+			same = same && memcmp(upload.data(), parsedVertices.data(), sizeof(Vertex) * parsedVertices.size()) == 0;
+			same = same && memcmp(upload.data() + sizeof(Vertex) * parsedVertices.size(), parsedIndices.data(), sizeof(uint32_t) * parsedIndices.size()) == 0;
+			same = same && memcmp(upload.data() + sizeof(Vertex) * parsedVertices.size() + sizeof(uint32_t) * parsedIndices.size(), parsedLods.data(), sizeof(Lod) * parsedLods.size()) == 0;
+		}
+		if (!loaded)
+		{
+			fprintf(stderr, "%s: can't load\n", fileName.c_str());
+			return false;
+		}
+		printf("%s: %u vertices, %u triangles, %u levels of detail, %f MB cache, parse %f ms, read cache %f ms (%fx), map cache %f ms and %f ms with the upload copy (%fx), %s\n",
+			fileName.c_str(), (u32)parsedVertices.size(), parsedLods[0].mIndexCount / 3, (u32)parsedLods.size(), (upload.size() + sizeof(MeshCacheHeader)) / 1048576.0f,
+			parseTime, readTime, parseTime / readTime, mapTime, mapCopyTime, parseTime / mapCopyTime,
+			same ? "identical" : "MISMATCH");
+		if (!same)
+			fprintf(stderr, "%s: the mesh cache doesn't match the parsed mesh\n", fileName.c_str());
+		return same;
+	});
+}
+
+inline u16 QuantizeUnorm16(float value, float minValue, float maxValue)
+{
+	if (maxValue <= minValue)
+		return 0;
+	float t = (value - minValue) / (maxValue - minValue);
+	t = CLAMP(t, 0.0f, 1.0f);
+	return (u16)(t * 65535.0f + 0.5f);
+}
+
+inline float DequantizeUnorm16(u16 value, float minValue, float maxValue)
+{
+	return minValue + value / 65535.0f * (maxValue - minValue);
+}
+
+// projects a vector onto the octahedron and unfolds the lower half, the result is in [-1, 1]^2
+inline XMFLOAT2 ProjectOctahedral(const XMFLOAT3& v)
+{
+	const float l1 = fabsf(v.x) + fabsf(v.y) + fabsf(v.z);
+	if (l1 == 0.0f)
+		return XMFLOAT2(0.0f, 0.0f);
+	float x = v.x / l1;
+	float y = v.y / l1;
+	if (v.z < 0.0f)
+	{
+		const float foldedX = (1.0f - fabsf(y)) * (x >= 0.0f ? 1.0f : -1.0f);
+		y = (1.0f - fabsf(x)) * (y >= 0.0f ? 1.0f : -1.0f);
+		x = foldedX;
+	}
+	return XMFLOAT2(x, y);
+}
+
+// same as DecodeOctahedral in ShaderInclude.hlsli
+inline XMFLOAT3 DecodeOctahedral(float x, float y)
+{
+	XMFLOAT3 v(x, y, 1.0f - fabsf(x) - fabsf(y));
+	const float t = CLAMP(-v.z, 0.0f, 1.0f);
+	v.x += v.x >= 0.0f ? -t : t;
+	v.y += v.y >= 0.0f ? -t : t;
+	XMStoreFloat3(&v, XMVector3Normalize(XMLoadFloat3(&v)));
+	return v;
+}
+
+// picks the snorm neighbor of the projection that decodes closest to the vector, y is a multiple of yStep
+inline void EncodeOctahedralSnorm16(const XMFLOAT3& v, int yStep, i16& x, i16& y)
+{
+	const XMFLOAT2 projected = ProjectOctahedral(v);
+	const float xBase = floorf(projected.x * 32767.0f);
+	const float yBase = floorf(projected.y * 32767.0f / yStep) * yStep;
+	const float yMax = (float)(32767 / yStep * yStep);
+	float bestDot = -FLT_MAX;
+	for (int i = 0; i < 4; i++)
+	{
+		float xCandidate = xBase + (i & 1);
+		float yCandidate = yBase + (i >> 1) * yStep;
+		xCandidate = CLAMP(xCandidate, -32767.0f, 32767.0f);
+		yCandidate = CLAMP(yCandidate, -yMax, yMax);
+		const XMFLOAT3 decoded = DecodeOctahedral(xCandidate / 32767.0f, yCandidate / 32767.0f);
+		const float dot = decoded.x * v.x + decoded.y * v.y + decoded.z * v.z;
+		if (dot > bestDot)
+		{
+			bestDot = dot;
+			x = (i16)xCandidate;
+			y = (i16)yCandidate;
+		}
+	}
+}
+
+PackedVertex Mesh::EncodePackedVertex(const Vertex& vertex, const XMFLOAT3& boundsMin, const XMFLOAT3& boundsMax)
+{
+	PackedVertex packedVertex;
+	packedVertex.pos[0] = QuantizeUnorm16(vertex.pos.x, boundsMin.x, boundsMax.x);
+	packedVertex.pos[1] = QuantizeUnorm16(vertex.pos.y, boundsMin.y, boundsMax.y);
+	packedVertex.pos[2] = QuantizeUnorm16(vertex.pos.z, boundsMin.z, boundsMax.z);
+	packedVertex.pos[3] = 0;
+	packedVertex.uv[0] = PackedVector::XMConvertFloatToHalf(vertex.uv.x);
+	packedVertex.uv[1] = PackedVector::XMConvertFloatToHalf(vertex.uv.y);
+	EncodeOctahedralSnorm16(vertex.nor, 1, packedVertex.nor[0], packedVertex.nor[1]);
+	// an even y leaves the lowest bit to the bitangent sign
+	EncodeOctahedralSnorm16(XMFLOAT3(vertex.tan.x, vertex.tan.y, vertex.tan.z), 2, packedVertex.tan[0], packedVertex.tan[1]);
+	if (vertex.tan.w < 0.0f)
+		packedVertex.tan[1] |= 1;
+	return packedVertex;
+}
+
+Vertex Mesh::DecodePackedVertex(const PackedVertex& packedVertex, const XMFLOAT3& boundsMin, const XMFLOAT3& boundsMax)
+{
+	Vertex vertex;
+	vertex.pos.x = DequantizeUnorm16(packedVertex.pos[0], boundsMin.x, boundsMax.x);
+	vertex.pos.y = DequantizeUnorm16(packedVertex.pos[1], boundsMin.y, boundsMax.y);
+	vertex.pos.z = DequantizeUnorm16(packedVertex.pos[2], boundsMin.z, boundsMax.z);
+	vertex.uv.x = PackedVector::XMConvertHalfToFloat(packedVertex.uv[0]);
+	vertex.uv.y = PackedVector::XMConvertHalfToFloat(packedVertex.uv[1]);
+	vertex.nor = DecodeOctahedral(packedVertex.nor[0] / 32767.0f, packedVertex.nor[1] / 32767.0f);
+	const XMFLOAT3 tangent = DecodeOctahedral(packedVertex.tan[0] / 32767.0f, (packedVertex.tan[1] & ~1) / 32767.0f);
+	vertex.tan = XMFLOAT4(tangent.x, tangent.y, tangent.z, packedVertex.tan[1] & 1 ? -1.0f : 1.0f);
+	return vertex;
+}
+
+// atan2 stays precise for small angles where acos of the dot product doesn't
+inline float GetAngleInDegrees(const XMFLOAT3& a, const XMFLOAT3& b)
+{
+	const XMVECTOR va = XMLoadFloat3(&a);
+	const XMVECTOR vb = XMLoadFloat3(&b);
+	return XMConvertToDegrees(atan2f(XMVectorGetX(XMVector3Length(XMVector3Cross(va, vb))), XMVectorGetX(XMVector3Dot(va, vb))));
+}
+
+// round trip of every vertex through the packed layout, the position error is also given relative to the bounds diagonal
+// zero normals and tangents (some obj files have them) have no direction to keep and are left out of the angle errors
+bool Mesh::ReportPackedVertexError(const string& fileNames)
+{
+	return ReportObjFiles("packed vertex error", fileNames, [](const string& fileName) {
+		// the same vertices SetMesh ends up with, a Mesh would quietly turn a file it can't load into a cube
+		vector<Vertex> vertices;
+		vector<uint32_t> indices;
+		if (!LoadObjFile(fileName, vertices, indices))
+			return false;
+		OptimizeVertexCache(vertices, indices);
+		XMFLOAT3 boundsMin;
+		XMFLOAT3 boundsMax;
+		GetVertexBounds(vertices.data(), (u32)vertices.size(), boundsMin, boundsMax);
+		float positionError = 0.0f;
+		float uvError = 0.0f;
+		float normalError = 0.0f;
+		float tangentError = 0.0f;
+		int signMismatches = 0;
+		int zeroVectorCount = 0;
+		for (const Vertex& vertex : vertices)
+		{
+			const Vertex decoded = DecodePackedVertex(EncodePackedVertex(vertex, boundsMin, boundsMax), boundsMin, boundsMax);
+			const float vertexPositionError = XMVectorGetX(XMVector3Length(XMLoadFloat3(&decoded.pos) - XMLoadFloat3(&vertex.pos)));
+			const float vertexUvError = XMVectorGetX(XMVector2Length(XMLoadFloat2(&decoded.uv) - XMLoadFloat2(&vertex.uv)));
+			positionError = MAX(positionError, vertexPositionError);
+			uvError = MAX(uvError, vertexUvError);
+			const XMFLOAT3 tangent(vertex.tan.x, vertex.tan.y, vertex.tan.z);
+			if (XMVectorGetX(XMVector3LengthSq(XMLoadFloat3(&vertex.nor))) == 0.0f || XMVectorGetX(XMVector3LengthSq(XMLoadFloat3(&tangent))) == 0.0f)
+			{
+				zeroVectorCount++;
+				continue;
+			}
+			const float vertexNormalError = GetAngleInDegrees(decoded.nor, vertex.nor);
+			const float vertexTangentError = GetAngleInDegrees(XMFLOAT3(decoded.tan.x, decoded.tan.y, decoded.tan.z), tangent);
+			normalError = MAX(normalError, vertexNormalError);
+			tangentError = MAX(tangentError, vertexTangentError);
+			if ((decoded.tan.w < 0.0f) != (vertex.tan.w < 0.0f))
+				signMismatches++;
+		}
+		const float diagonal = XMVectorGetX(XMVector3Length(XMLoadFloat3(&boundsMax) - XMLoadFloat3(&boundsMin)));
+		const u32 vertexCount = (u32)vertices.size();
+		printf("%s: %u vertices, %u bytes instead of %u, max error position %f (%f of the bounds diagonal), uv %f, normal %f degrees, tangent %f degrees (%d vertices without a normal or tangent), %d bitangent signs flipped\n",
+			fileName.c_str(), vertexCount, vertexCount * (u32)sizeof(PackedVertex), vertexCount * (u32)sizeof(Vertex),
+			positionError, positionError / diagonal, uvError, normalError, tangentError, zeroVectorCount, signMismatches);
+		if (signMismatches > 0)
+			fprintf(stderr, "%s: packing flipped %d bitangent signs\n", fileName.c_str(), signMismatches);
+		return signMismatches == 0;
+	});
+}
+
+float Mesh::sLodErrorPixels = 1.0f;
+
+// quadric error metric simplification by half edge collapses, every level keeps the vertices of the full mesh so they all share its vertex buffer
+// vertices at the same position are wedges of one corner, where their uvs or normals differ (a seam) both sides collapse together along the seam
+enum class SimplifyVertexKind : u8
+{
+	MANIFOLD, // one wedge inside the surface
+	BORDER, // one wedge on an open edge of the surface
+	SEAM, // two wedges, each on an open edge in vertex space
+	LOCKED, // corners of borders and seams and everything else that can't move
+	COUNT
+};
+
+// [from][to], borders and seams only collapse along themselves so their outline stays in place
+static const bool SimplifyCanCollapse[(int)SimplifyVertexKind::COUNT][(int)SimplifyVertexKind::COUNT] =
+{
+	{ true, true, true, true },
+	{ false, true, false, false },
+	{ false, false, true, false },
+	{ false, false, false, false },
+};
+
+// whether an edge between the two kinds shows up in both of its triangles, those are only looked at once
+static const bool SimplifyEdgeHasOpposite[(int)SimplifyVertexKind::COUNT][(int)SimplifyVertexKind::COUNT] =
+{
+	{ true, true, true, true },
+	{ true, false, true, false },
+	{ true, true, true, true },
+	{ true, false, true, false },
+};
+
+static const float SimplifyBorderWeight = 10.0f; // open edges are held much harder than the surface
+static const float SimplifySeamWeight = 1.0f;
+static const float SimplifyFaceRotationCosMin = 0.5f; // a collapse may not turn a remaining triangle by more than 60 degrees, which keeps the vertex normals in line with the faces
+static const float SimplifyErrorMax = 0.05f; // relative to the largest extent of the mesh, the simplification stops short of the target beyond it
+static const u32 LodCountMax = 8; // including the full mesh
+static const u32 LodTriangleCountMin = 64; // no level gets simplified below this
+static const float LodTriangleRatio = 0.5f; // target of each level relative to the level before
+static const float LodReductionMin = 0.85f; // a level that keeps more of the triangles of the level before than this ends the chain
+
+// sum of squared distances to planes, A is symmetric so only 6 of its 9 entries are kept
+struct SimplifyQuadric
+{
+	float mA[6]; // xx, yy, zz, xy, xz, yz
+	float mB[3];
+	float mC;
+	float mWeight;
+};
+
+inline void AddPlaneQuadric(SimplifyQuadric& quadric, XMVECTOR normal, float distance, float weight)
+{
+	XMFLOAT3 n;
+	XMStoreFloat3(&n, normal);
+	quadric.mA[0] += weight * n.x * n.x;
+	quadric.mA[1] += weight * n.y * n.y;
+	quadric.mA[2] += weight * n.z * n.z;
+	quadric.mA[3] += weight * n.x * n.y;
+	quadric.mA[4] += weight * n.x * n.z;
+	quadric.mA[5] += weight * n.y * n.z;
+	quadric.mB[0] += weight * n.x * distance;
+	quadric.mB[1] += weight * n.y * distance;
+	quadric.mB[2] += weight * n.z * distance;
+	quadric.mC += weight * distance * distance;
+	quadric.mWeight += weight;
+}
+
+inline void AddQuadric(SimplifyQuadric& quadric, const SimplifyQuadric& other)
+{
+	for (int i = 0; i < 6; i++)
+		quadric.mA[i] += other.mA[i];
+	for (int i = 0; i < 3; i++)
+		quadric.mB[i] += other.mB[i];
+	quadric.mC += other.mC;
+	quadric.mWeight += other.mWeight;
+}
+
+// weighted mean of the squared distances of p to the planes
+inline float GetQuadricError(const SimplifyQuadric& quadric, const XMFLOAT3& p)
+{
+	const float ax = quadric.mA[0] * p.x + quadric.mA[3] * p.y + quadric.mA[4] * p.z;
+	const float ay = quadric.mA[3] * p.x + quadric.mA[1] * p.y + quadric.mA[5] * p.z;
+	const float az = quadric.mA[4] * p.x + quadric.mA[5] * p.y + quadric.mA[2] * p.z;
+	const float error = p.x * ax + p.y * ay + p.z * az + 2.0f * (quadric.mB[0] * p.x + quadric.mB[1] * p.y + quadric.mB[2] * p.z) + quadric.mC;
+	return quadric.mWeight > 0.0f ? fabsf(error) / quadric.mWeight : 0.0f;
+}
+
+// the triangles around each vertex as their other two corners in winding order
+struct SimplifyAdjacency
+{
+	vector<u32> mOffsets;
+	vector<u32> mNext;
+	vector<u32> mPrev;
+};
+
+inline void BuildSimplifyAdjacency(const vector<uint32_t>& indices, u32 vertexCount, SimplifyAdjacency& adjacency)
+{
+	adjacency.mOffsets.assign(vertexCount + 1, 0);
+	for (uint32_t index : indices)
+		adjacency.mOffsets[index + 1]++;
+	for (u32 i = 0; i < vertexCount; i++)
+		adjacency.mOffsets[i + 1] += adjacency.mOffsets[i];
+	adjacency.mNext.resize(indices.size());
+	adjacency.mPrev.resize(indices.size());
+	vector<u32> fill(adjacency.mOffsets.begin(), adjacency.mOffsets.end() - 1);
+	for (size_t i = 0; i < indices.size(); i += 3)
+	{
+		for (u32 corner = 0; corner < 3; corner++)
+		{
+			const u32 slot = fill[indices[i + corner]]++;
+			adjacency.mNext[slot] = indices[i + (corner + 1) % 3];
+			adjacency.mPrev[slot] = indices[i + (corner + 2) % 3];
+		}
+	}
+}
 
-			if (vecPoint[j].VI > 0) pos = vecPos[vecPoint[j].VI - 1];//index start at 1 in an .obj file but at 0 in an array, 0 was used to mark not-have-pos
-			if (vecPoint[j].NI > 0) nor = vecNor[vecPoint[j].NI - 1];//index start at 1 in an .obj file but at 0 in an array, 0 was used to mark not-have-nor
-			if (vecPoint[j].TI > 0) uv = vecUV[vecPoint[j].TI - 1];//index start at 1 in an .obj file but at 0 in an array, 0 was used to mark not-have-uv
+inline bool HasSimplifyEdge(const SimplifyAdjacency& adjacency, u32 from, u32 to)
+{
+	for (u32 i = adjacency.mOffsets[from]; i < adjacency.mOffsets[from + 1]; i++)
+	{
+		if (adjacency.mNext[i] == to)
+			return true;
+	}
+	return false;
+}
+
+// whether moving vertex0 onto vertex1 turns one of the triangles around vertex0 that stay by too much, earlier collapses of the pass included
+inline bool HasSimplifyFaceRotation(const SimplifyAdjacency& adjacency, const vector<XMFLOAT3>& positions, const vector<u32>& remap, const vector<u32>& collapseRemap, u32 vertex0, u32 vertex1)
+{
+	const XMVECTOR p0 = XMLoadFloat3(&positions[vertex0]);
+	const XMVECTOR p1 = XMLoadFloat3(&positions[vertex1]);
+	for (u32 i = adjacency.mOffsets[vertex0]; i < adjacency.mOffsets[vertex0 + 1]; i++)
+	{
+		const u32 a = collapseRemap[adjacency.mNext[i]];
+		const u32 b = collapseRemap[adjacency.mPrev[i]];
+		// the triangles on the collapsed edge go away
+		if (remap[a] == remap[vertex1] || remap[b] == remap[vertex1] || remap[a] == remap[b])
+			continue;
+		const XMVECTOR pa = XMLoadFloat3(&positions[a]);
+		const XMVECTOR edge = XMLoadFloat3(&positions[b]) - pa;
+		const XMVECTOR normal0 = XMVector3Cross(edge, p0 - pa);
+		const XMVECTOR normal1 = XMVector3Cross(edge, p1 - pa);
+		const float length1 = XMVectorGetX(XMVector3Length(normal1));
+		if (length1 == 0.0f || XMVectorGetX(XMVector3Dot(normal0, normal1)) < SimplifyFaceRotationCosMin * XMVectorGetX(XMVector3Length(normal0)) * length1)
+			return true;
+	}
+	return false;
+}
+
+// an open edge loop that ran into a collapsed vertex now runs into its target
+inline void RemapSimplifyLoop(vector<u32>& loop, const vector<u32>& collapseRemap)
+{
+	for (u32 i = 0; i < (u32)loop.size(); i++)
+	{
+		if (loop[i] == INVALID_UINT32)
+			continue;
+		const u32 next = loop[i];
+		const u32 target = collapseRemap[next];
+		// a seam collapsed against the direction of the loop
+		loop[i] = i == target ? loop[next] : target;
+	}
+}
+
+struct SimplifyCollapse
+{
+	u32 mVertex0; // moves onto mVertex1
+	u32 mVertex1;
+	float mError;
+};
+
+// collapses the cheapest edges first in passes over the whole mesh, a vertex takes part in one collapse per pass so the errors of a pass stay valid
+// the error is the largest quadric error of the collapses in object space, which is rather an estimate than a bound of the distance to the input
+void Mesh::SimplifyMesh(const vector<Vertex>& vertices, const uint32_t* indices, u32 indexCount, u32 targetIndexCount, vector<uint32_t>& simplifiedIndices, float& error)
+{
+	const u32 vertexCount = (u32)vertices.size();
+	simplifiedIndices.assign(indices, indices + indexCount);
+	error = 0.0f;
+
+	// positions in the unit cube, so the weights and limits don't depend on the size of the mesh
+	XMFLOAT3 boundsMin;
+	XMFLOAT3 boundsMax;
+	GetVertexBounds(vertices.data(), vertexCount, boundsMin, boundsMax);
+	const float extentX = boundsMax.x - boundsMin.x;
+	const float extentY = boundsMax.y - boundsMin.y;
+	const float extentZ = boundsMax.z - boundsMin.z;
+	const float extent = MAX(extentX, MAX(extentY, extentZ));
+	const float positionScale = extent > 0.0f ? 1.0f / extent : 1.0f;
+	vector<XMFLOAT3> positions(vertexCount);
+	for (u32 i = 0; i < vertexCount; i++)
+		positions[i] = XMFLOAT3((vertices[i].pos.x - boundsMin.x) * positionScale, (vertices[i].pos.y - boundsMin.y) * positionScale, (vertices[i].pos.z - boundsMin.z) * positionScale);
+
+	// remap points at the first wedge of each position, wedge links the wedges of a position in a cycle
+	// vertices the previous level doesn't use any more stay on their own
+	vector<u32> remap(vertexCount);
+	vector<u32> wedge(vertexCount);
+	vector<u32> order;
+	vector<u8> used(vertexCount, 0);
+	for (u32 i = 0; i < indexCount; i++)
+		used[indices[i]] = 1;
+	for (u32 i = 0; i < vertexCount; i++)
+	{
+		remap[i] = wedge[i] = i;
+		if (used[i])
+			order.push_back(i);
+	}
+	sort(order.begin(), order.end(), [&vertices](u32 a, u32 b) {
+		const int compare = memcmp(&vertices[a].pos, &vertices[b].pos, sizeof(XMFLOAT3));
+		return compare < 0 || (compare == 0 && a < b);
+	});
+	for (size_t begin = 0; begin < order.size();)
+	{
+		size_t end = begin + 1;
+		while (end < order.size() && memcmp(&vertices[order[begin]].pos, &vertices[order[end]].pos, sizeof(XMFLOAT3)) == 0)
+			end++;
+		for (size_t i = begin; i < end; i++)
+		{
+			remap[order[i]] = order[begin];
+			wedge[order[i]] = order[i + 1 < end ? i + 1 : begin];
+		}
+		begin = end;
+	}
+
+	// open half edges in vertex space, a vertex with more than one in the same direction points at itself
+	SimplifyAdjacency adjacency;
+	BuildSimplifyAdjacency(simplifiedIndices, vertexCount, adjacency);
+	vector<u32> loop(vertexCount, INVALID_UINT32);
+	vector<u32> loopback(vertexCount, INVALID_UINT32);
+	for (u32 i = 0; i < vertexCount; i++)
+	{
+		for (u32 j = adjacency.mOffsets[i]; j < adjacency.mOffsets[i + 1]; j++)
+		{
+			const u32 next = adjacency.mNext[j];
+			if (HasSimplifyEdge(adjacency, next, i))
+				continue;
+			loop[i] = loop[i] == INVALID_UINT32 ? next : i;
+			loopback[next] = loopback[next] == INVALID_UINT32 ? i : next;
+		}
+	}
+	auto isLoopOpen = [](const vector<u32>& openLoop, u32 i) { return openLoop[i] != INVALID_UINT32 && openLoop[i] != i; };
+
+	vector<SimplifyVertexKind> kinds(vertexCount, SimplifyVertexKind::MANIFOLD);
+	for (u32 i = 0; i < vertexCount; i++)
+	{
+		if (remap[i] != i)
+			continue;
+		const u32 other = wedge[i];
+		if (other == i)
+		{
+			if (loop[i] == INVALID_UINT32 && loopback[i] == INVALID_UINT32)
+				kinds[i] = SimplifyVertexKind::MANIFOLD;
+			else if (isLoopOpen(loop, i) && isLoopOpen(loopback, i))
+				kinds[i] = SimplifyVertexKind::BORDER;
+			else
+				kinds[i] = SimplifyVertexKind::LOCKED;
+		}
+		else if (wedge[other] == i &&
+			isLoopOpen(loop, i) && isLoopOpen(loopback, i) && isLoopOpen(loop, other) && isLoopOpen(loopback, other) &&
+			remap[loopback[i]] == remap[loop[other]] && remap[loop[i]] == remap[loopback[other]] && remap[loop[i]] != remap[loopback[i]])
+			kinds[i] = SimplifyVertexKind::SEAM; // both sides of the seam run between the same two positions
+		else
+			kinds[i] = SimplifyVertexKind::LOCKED;
+	}
+	for (u32 i = 0; i < vertexCount; i++)
+	{
+		kinds[i] = kinds[remap[i]];
+		if (!isLoopOpen(loop, i))
+			loop[i] = INVALID_UINT32;
+		if (!isLoopOpen(loopback, i))
+			loopback[i] = INVALID_UINT32;
+	}
+
+	// the planes of the triangles around each position weighted by their area, plus planes through the open edges perpendicular to their triangle
+	vector<SimplifyQuadric> quadrics(vertexCount, SimplifyQuadric());
+	for (size_t i = 0; i < simplifiedIndices.size(); i += 3)
+	{
+		const uint32_t* triangle = &simplifiedIndices[i];
+		const XMVECTOR p0 = XMLoadFloat3(&positions[triangle[0]]);
+		XMVECTOR normal = XMVector3Cross(XMLoadFloat3(&positions[triangle[1]]) - p0, XMLoadFloat3(&positions[triangle[2]]) - p0);
+		const float length = XMVectorGetX(XMVector3Length(normal));
+		if (length > 0.0f)
+		{
+			normal = normal / length;
+			SimplifyQuadric quadric = {};
+			AddPlaneQuadric(quadric, normal, -XMVectorGetX(XMVector3Dot(normal, p0)), length * 0.5f);
+			for (u32 corner = 0; corner < 3; corner++)
+				AddQuadric(quadrics[remap[triangle[corner]]], quadric);
+		}
+		for (u32 corner = 0; corner < 3; corner++)
+		{
+			const u32 i0 = triangle[corner];
+			const u32 i1 = triangle[(corner + 1) % 3];
+			const u32 i2 = triangle[(corner + 2) % 3];
+			const SimplifyVertexKind kind0 = kinds[i0];
+			const SimplifyVertexKind kind1 = kinds[i1];
+			const bool open0 = kind0 == SimplifyVertexKind::BORDER || kind0 == SimplifyVertexKind::SEAM;
+			const bool open1 = kind1 == SimplifyVertexKind::BORDER || kind1 == SimplifyVertexKind::SEAM;
+			if ((!open0 && !open1) || (open0 && loop[i0] != i1) || (open1 && loopback[i1] != i0))
+				continue;
+			if (SimplifyEdgeHasOpposite[(int)kind0][(int)kind1] && remap[i1] > remap[i0])
+				continue;
+			const XMVECTOR pa = XMLoadFloat3(&positions[i0]);
+			XMVECTOR edge = XMLoadFloat3(&positions[i1]) - pa;
+			const float edgeLength = XMVectorGetX(XMVector3Length(edge));
+			if (edgeLength == 0.0f)
+				continue;
+			edge = edge / edgeLength;
+			const XMVECTOR toOther = XMLoadFloat3(&positions[i2]) - pa;
+			XMVECTOR edgeNormal = toOther - edge * XMVectorGetX(XMVector3Dot(toOther, edge));
+			const float edgeNormalLength = XMVectorGetX(XMVector3Length(edgeNormal));
+			if (edgeNormalLength == 0.0f)
+				continue;
+			edgeNormal = edgeNormal / edgeNormalLength;
+			const bool border = kind0 == SimplifyVertexKind::BORDER || kind1 == SimplifyVertexKind::BORDER;
+			SimplifyQuadric quadric = {};
+			AddPlaneQuadric(quadric, edgeNormal, -XMVectorGetX(XMVector3Dot(edgeNormal, pa)), edgeLength * edgeLength * (border ? SimplifyBorderWeight : SimplifySeamWeight));
+			AddQuadric(quadrics[remap[i0]], quadric);
+			AddQuadric(quadrics[remap[i1]], quadric);
+		}
+	}
+
+	vector<SimplifyCollapse> collapses;
+	vector<u32> collapseRemap(vertexCount);
+	vector<u8> collapseLocked(vertexCount);
+	const float errorLimit = SimplifyErrorMax * SimplifyErrorMax;
+	float errorMax = 0.0f;
+	while (simplifiedIndices.size() > targetIndexCount)
+	{
+		if (collapses.size())
+			BuildSimplifyAdjacency(simplifiedIndices, vertexCount, adjacency);
+
+		// every edge once, in the cheaper of the directions its kinds allow
+		collapses.clear();
+		for (size_t i = 0; i < simplifiedIndices.size(); i++)
+		{
+			const u32 i0 = simplifiedIndices[i];
+			const u32 i1 = simplifiedIndices[i % 3 == 2 ? i - 2 : i + 1];
+			const SimplifyVertexKind kind0 = kinds[i0];
+			const SimplifyVertexKind kind1 = kinds[i1];
+			const bool collapse01 = SimplifyCanCollapse[(int)kind0][(int)kind1];
+			const bool collapse10 = SimplifyCanCollapse[(int)kind1][(int)kind0];
+			if ((!collapse01 && !collapse10) || remap[i0] == remap[i1])
+				continue;
+			if (kind0 == kind1 && (kind0 == SimplifyVertexKind::BORDER || kind0 == SimplifyVertexKind::SEAM) && loop[i0] != i1)
+				continue;
+			if (SimplifyEdgeHasOpposite[(int)kind0][(int)kind1] && remap[i1] > remap[i0])
+				continue;
+			const float error01 = collapse01 ? GetQuadricError(quadrics[remap[i0]], positions[i1]) : FLT_MAX;
+			const float error10 = collapse10 ? GetQuadricError(quadrics[remap[i1]], positions[i0]) : FLT_MAX;
+			collapses.push_back(error01 <= error10 ? SimplifyCollapse{ i0, i1, error01 } : SimplifyCollapse{ i1, i0, error10 });
+		}
+		if (collapses.empty())
+			break;
+		sort(collapses.begin(), collapses.end(), [](const SimplifyCollapse& a, const SimplifyCollapse& b) { return a.mError < b.mError; });
+
+		for (u32 i = 0; i < vertexCount; i++)
+		{
+			collapseRemap[i] = i;
+			collapseLocked[i] = 0;
+		}
+		const u32 triangleCollapseGoal = ((u32)simplifiedIndices.size() - targetIndexCount) / 3;
+		u32 triangleCollapseCount = 0;
+		for (const SimplifyCollapse& collapse : collapses)
+		{
+			if (triangleCollapseCount >= triangleCollapseGoal || collapse.mError > errorLimit)
+				break;
+			const u32 i0 = collapse.mVertex0;
+			const u32 i1 = collapse.mVertex1;
+			const u32 r0 = remap[i0];
+			const u32 r1 = remap[i1];
+			if (collapseLocked[r0] || collapseLocked[r1])
+				continue;
+			if (kinds[i0] == SimplifyVertexKind::SEAM)
+			{
+				// the other wedge moves along the other side of the seam
+				const u32 s0 = wedge[i0];
+				const u32 s1 = loop[i0] == i1 ? loopback[s0] : loop[s0];
+				if (s1 == INVALID_UINT32 || remap[s1] != r1)
+					continue;
+				if (HasSimplifyFaceRotation(adjacency, positions, remap, collapseRemap, i0, i1) || HasSimplifyFaceRotation(adjacency, positions, remap, collapseRemap, s0, s1))
+					continue;
+				collapseRemap[s0] = s1;
+			}
+			else if (HasSimplifyFaceRotation(adjacency, positions, remap, collapseRemap, i0, i1))
+				continue;
+			collapseRemap[i0] = i1;
+			collapseLocked[r0] = 1;
+			collapseLocked[r1] = 1;
+			AddQuadric(quadrics[r1], quadrics[r0]);
+			// a border edge has one triangle
+			triangleCollapseCount += kinds[i0] == SimplifyVertexKind::BORDER ? 1 : 2;
+			errorMax = MAX(errorMax, collapse.mError);
+		}
+		if (triangleCollapseCount == 0)
+			break;
+
+		RemapSimplifyLoop(loop, collapseRemap);
+		RemapSimplifyLoop(loopback, collapseRemap);
+		size_t writeIndex = 0;
+		for (size_t i = 0; i < simplifiedIndices.size(); i += 3)
+		{
+			const u32 a = collapseRemap[simplifiedIndices[i]];
+			const u32 b = collapseRemap[simplifiedIndices[i + 1]];
+			const u32 c = collapseRemap[simplifiedIndices[i + 2]];
+			if (remap[a] == remap[b] || remap[b] == remap[c] || remap[c] == remap[a])
+				continue;
+			simplifiedIndices[writeIndex++] = a;
+			simplifiedIndices[writeIndex++] = b;
+			simplifiedIndices[writeIndex++] = c;
+		}
+		simplifiedIndices.resize(writeIndex);
+	}
+	error = sqrtf(errorMax) * extent;
+}
+
+// each level targets half the triangles of the one before, the chain ends once the simplification can't keep up
+void Mesh::GenerateLods(const vector<Vertex>& vertices, vector<uint32_t>& indices, vector<Lod>& lods)
+{
+	lods.assign(1, Lod{ 0, (u32)indices.size(), 0.0f });
+	vector<uint32_t> simplifiedIndices;
+	while (lods.size() < LodCountMax)
+	{
+		const Lod previous = lods.back();
+		const u32 targetIndexCount = (u32)(previous.mIndexCount / 3 * LodTriangleRatio) * 3;
+		if (targetIndexCount < LodTriangleCountMin * 3)
+			break;
+		float error;
+		SimplifyMesh(vertices, indices.data() + previous.mIndexOffset, previous.mIndexCount, targetIndexCount, simplifiedIndices, error);
+		if (simplifiedIndices.size() > previous.mIndexCount * LodReductionMin)
+			break;
+		// every level is simplified from the one before, in the worst case their errors add up
+		lods.push_back(Lod{ (u32)indices.size(), (u32)simplifiedIndices.size(), previous.mError + error });
+		indices.insert(indices.end(), simplifiedIndices.begin(), simplifiedIndices.end());
+	}
+}
+
+// the error of a level is measured where the bounding sphere comes closest to the camera
+u32 Mesh::SelectLod(Camera& camera) const
+{
+	if (mLods.size() <= 1 || sLodErrorPixels <= 0.0f)
+		return 0;
+	const XMVECTOR boundsMin = XMLoadFloat3(&mBoundsMin);
+	const XMVECTOR boundsMax = XMLoadFloat3(&mBoundsMax);
+	const XMVECTOR center = XMVector3Transform((boundsMin + boundsMax) * 0.5f, XMLoadFloat4x4(&mObjectUniform.mModel));
+	const float scaleX = fabsf(mScale.x);
+	const float scaleY = fabsf(mScale.y);
+	const float scaleZ = fabsf(mScale.z);
+	const float scale = MAX(scaleX, MAX(scaleY, scaleZ));
+	const float radius = XMVectorGetX(XMVector3Length(boundsMax - boundsMin)) * 0.5f * scale;
+	const XMFLOAT3 cameraPosition = camera.GetPosition();
+	const float centerDistance = XMVectorGetX(XMVector3Length(center - XMLoadFloat3(&cameraPosition)));
+	// the clip planes are swapped with reversed z
+	const float nearClipPlane = camera.GetNearClipPlane();
+	const float farClipPlane = camera.GetFarClipPlane();
+	const float nearestDistance = MIN(nearClipPlane, farClipPlane);
+	const float sphereDistance = centerDistance - radius;
+	const float distance = MAX(sphereDistance, nearestDistance);
+	const float pixelsPerUnit = camera.GetHeight() / (2.0f * tanf(XMConvertToRadians(camera.GetFov()) * 0.5f) * distance);
+	for (u32 i = (u32)mLods.size() - 1; i > 0; i--)
+	{
+		if (mLods[i].mError * scale * pixelsPerUnit <= sLodErrorPixels)
+			return i;
+	}
+	return 0;
+}
+
+// uniform grid over the triangles of one level for the distance queries of ReportLods
+struct LodDistanceGrid
+{
+	XMFLOAT3 mOrigin;
+	float mCellSize;
+	int mSize[3];
+	vector<u32> mCellOffsets;
+	vector<u32> mTriangles;
+};
+
+inline int GetLodDistanceCell(const LodDistanceGrid& grid, float position, float origin, int axis)
+{
+	const int cell = (int)floorf((position - origin) / grid.mCellSize);
+	const int cellMax = grid.mSize[axis] - 1;
+	return CLAMP(cell, 0, cellMax);
+}
+
+// the grid spans the bounds of the full mesh, every level lies within them since they keep its vertices
+inline void BuildLodDistanceGrid(const Vertex* vertices, const uint32_t* indices, u32 indexCount, const XMFLOAT3& boundsMin, const XMFLOAT3& boundsMax, LodDistanceGrid& grid)
+{
+	const u32 triangleCount = indexCount / 3;
+	const float extent[3] = { boundsMax.x - boundsMin.x, boundsMax.y - boundsMin.y, boundsMax.z - boundsMin.z };
+	const float extentMax = MAX(extent[0], MAX(extent[1], extent[2]));
+	// a surface fills about the square of the cells along an axis, that many cells per axis keep a few triangles in each
+	const float triangleCountRoot = sqrtf((float)triangleCount);
+	const float cellsPerAxis = CLAMP(triangleCountRoot, 1.0f, 128.0f);
+	grid.mOrigin = boundsMin;
+	grid.mCellSize = extentMax > 0.0f ? extentMax / cellsPerAxis : 1.0f;
+	for (int axis = 0; axis < 3; axis++)
+		grid.mSize[axis] = (int)(extent[axis] / grid.mCellSize) + 1;
+	grid.mCellOffsets.assign(grid.mSize[0] * grid.mSize[1] * grid.mSize[2] + 1, 0);
+
+	// the cells the bounds of each triangle overlap, counted first and filled in the second round
+	for (int round = 0; round < 2; round++)
+	{
+		if (round == 1)
+		{
+			for (size_t i = 1; i < grid.mCellOffsets.size(); i++)
+				grid.mCellOffsets[i] += grid.mCellOffsets[i - 1];
+			grid.mTriangles.resize(grid.mCellOffsets.back());
+		}
+		vector<u32> fill(grid.mCellOffsets.begin(), grid.mCellOffsets.end() - 1);
+		for (u32 t = 0; t < triangleCount; t++)
+		{
+			XMFLOAT3 triangleMin;
+			XMFLOAT3 triangleMax;
+			const XMVECTOR p0 = XMLoadFloat3(&vertices[indices[t * 3]].pos);
+			const XMVECTOR p1 = XMLoadFloat3(&vertices[indices[t * 3 + 1]].pos);
+			const XMVECTOR p2 = XMLoadFloat3(&vertices[indices[t * 3 + 2]].pos);
+			XMStoreFloat3(&triangleMin, XMVectorMin(p0, XMVectorMin(p1, p2)));
+			XMStoreFloat3(&triangleMax, XMVectorMax(p0, XMVectorMax(p1, p2)));
+			const int xMin = GetLodDistanceCell(grid, triangleMin.x, grid.mOrigin.x, 0);
+			const int yMin = GetLodDistanceCell(grid, triangleMin.y, grid.mOrigin.y, 1);
+			const int zMin = GetLodDistanceCell(grid, triangleMin.z, grid.mOrigin.z, 2);
+			const int xMax = GetLodDistanceCell(grid, triangleMax.x, grid.mOrigin.x, 0);
+			const int yMax = GetLodDistanceCell(grid, triangleMax.y, grid.mOrigin.y, 1);
+			const int zMax = GetLodDistanceCell(grid, triangleMax.z, grid.mOrigin.z, 2);
+			// large triangles only go into the cells their plane passes through, not every cell of their bounds
+			XMVECTOR normal = XMVector3Cross(p1 - p0, p2 - p0);
+			const float normalLength = XMVectorGetX(XMVector3Length(normal));
+			normal = normalLength > 0.0f ? normal / normalLength : XMVectorZero();
+			const float cellRadius = grid.mCellSize * 0.5f * sqrtf(3.0f);
+			for (int z = zMin; z <= zMax; z++)
+			{
+				for (int y = yMin; y <= yMax; y++)
+				{
+					for (int x = xMin; x <= xMax; x++)
+					{
+						const XMVECTOR cellCenter = XMLoadFloat3(&grid.mOrigin) + XMVectorSet(x + 0.5f, y + 0.5f, z + 0.5f, 0.0f) * grid.mCellSize;
+						if (fabsf(XMVectorGetX(XMVector3Dot(normal, cellCenter - p0))) > cellRadius)
+							continue;
+						const int cell = (z * grid.mSize[1] + y) * grid.mSize[0] + x;
+						if (round == 0)
+							grid.mCellOffsets[cell + 1]++;
+						else
+							grid.mTriangles[fill[cell]++] = t;
+					}
+				}
+			}
+		}
+	}
+}
+
+inline float GetLengthSquared(XMVECTOR v)
+{
+	return XMVectorGetX(XMVector3LengthSq(v));
+}
 
-			//The order is fixed, it is the same in the shaders. The only way to tell the direction when reconstructing tangent is the sign component.
-			float dotProduct = 0;
-			XMStoreFloat(&dotProduct, XMVector3Dot(XMVector3Cross(XMLoadFloat3(&nor), XMLoadFloat3(&sdir)), XMLoadFloat3(&tdir)));
-			float sign = dotProduct > 0.0f ? 1.0f : -1.0f;
-			XMFLOAT4 tan(sdir.x, sdir.y, sdir.z, sign);
+// closest point on a triangle by the region of p, Real-Time Collision Detection 5.1.5, degenerate edges fall back to their first corner
+inline float GetPointTriangleDistanceSquared(XMVECTOR p, XMVECTOR a, XMVECTOR b, XMVECTOR c)
+{
+	const XMVECTOR ab = b - a;
+	const XMVECTOR ac = c - a;
+	const XMVECTOR ap = p - a;
+	const float d1 = XMVectorGetX(XMVector3Dot(ab, ap));
+	const float d2 = XMVectorGetX(XMVector3Dot(ac, ap));
+	if (d1 <= 0.0f && d2 <= 0.0f)
+		return GetLengthSquared(ap);
+	const XMVECTOR bp = p - b;
+	const float d3 = XMVectorGetX(XMVector3Dot(ab, bp));
+	const float d4 = XMVectorGetX(XMVector3Dot(ac, bp));
+	if (d3 >= 0.0f && d4 <= d3)
+		return GetLengthSquared(bp);
+	const float vc = d1 * d4 - d3 * d2;
+	if (vc <= 0.0f && d1 >= 0.0f && d3 <= 0.0f)
+		return GetLengthSquared(d1 > d3 ? ap - ab * (d1 / (d1 - d3)) : ap);
+	const XMVECTOR cp = p - c;
+	const float d5 = XMVectorGetX(XMVector3Dot(ab, cp));
+	const float d6 = XMVectorGetX(XMVector3Dot(ac, cp));
+	if (d6 >= 0.0f && d5 <= d6)
+		return GetLengthSquared(cp);
+	const float vb = d5 * d2 - d1 * d6;
+	if (vb <= 0.0f && d2 >= 0.0f && d6 <= 0.0f)
+		return GetLengthSquared(d2 > d6 ? ap - ac * (d2 / (d2 - d6)) : ap);
+	const float va = d3 * d6 - d5 * d4;
+	if (va <= 0.0f && d4 - d3 >= 0.0f && d5 - d6 >= 0.0f)
+		return GetLengthSquared(d4 - d3 + d5 - d6 > 0.0f ? bp - (c - b) * ((d4 - d3) / ((d4 - d3) + (d5 - d6))) : bp);
+	const float sum = va + vb + vc;
+	if (sum <= 0.0f)
+		return GetLengthSquared(ap);
+	return GetLengthSquared(ap - ab * (vb / sum) - ac * (vc / sum));
+}
 
-			mVertexVec[j] = { pos, uv, nor, tan };
-			mIndexVec[j] = j;//this way, all 3 vertices on every triangle are unique, even though they belong to the same polygon, which increase storing space but allow for finer control
+// searches shells of cells around p until no unvisited cell can be closer than the closest triangle found
+inline float GetLodSurfaceDistance(const LodDistanceGrid& grid, const Vertex* vertices, const uint32_t* indices, const XMFLOAT3& p)
+{
+	const int cx = GetLodDistanceCell(grid, p.x, grid.mOrigin.x, 0);
+	const int cy = GetLodDistanceCell(grid, p.y, grid.mOrigin.y, 1);
+	const int cz = GetLodDistanceCell(grid, p.z, grid.mOrigin.z, 2);
+	const float position[3] = { p.x, p.y, p.z };
+	const float origin[3] = { grid.mOrigin.x, grid.mOrigin.y, grid.mOrigin.z };
+	const int center[3] = { cx, cy, cz };
+	const int sizeXY = MAX(grid.mSize[0], grid.mSize[1]);
+	const int sizeMax = MAX(sizeXY, grid.mSize[2]);
+	float distanceSquared = FLT_MAX;
+	for (int shell = 0; shell < sizeMax; shell++)
+	{
+		// the cells of this shell lie outside the box of the shells before
+		float boxDistance = FLT_MAX;
+		for (int axis = 0; axis < 3; axis++)
+		{
+			const float lowDistance = position[axis] - (origin[axis] + (center[axis] - shell + 1) * grid.mCellSize);
+			const float highDistance = origin[axis] + (center[axis] + shell) * grid.mCellSize - position[axis];
+			boxDistance = MIN(boxDistance, lowDistance);
+			boxDistance = MIN(boxDistance, highDistance);
+		}
+		if (shell > 0 && boxDistance > 0.0f && distanceSquared <= boxDistance * boxDistance)
+			break;
+		for (int z = MAX(cz - shell, 0); z <= MIN(cz + shell, grid.mSize[2] - 1); z++)
+		{
+			for (int y = MAX(cy - shell, 0); y <= MIN(cy + shell, grid.mSize[1] - 1); y++)
+			{
+				for (int x = MAX(cx - shell, 0); x <= MIN(cx + shell, grid.mSize[0] - 1); x++)
+				{
+					if (abs(x - cx) != shell && abs(y - cy) != shell && abs(z - cz) != shell)
+						continue;
+					const int cell = (z * grid.mSize[1] + y) * grid.mSize[0] + x;
+					for (u32 i = grid.mCellOffsets[cell]; i < grid.mCellOffsets[cell + 1]; i++)
+					{
+						const u32 t = grid.mTriangles[i];
+						const float triangleDistanceSquared = GetPointTriangleDistanceSquared(XMLoadFloat3(&p),
+							XMLoadFloat3(&vertices[indices[t * 3]].pos), XMLoadFloat3(&vertices[indices[t * 3 + 1]].pos), XMLoadFloat3(&vertices[indices[t * 3 + 2]].pos));
+						distanceSquared = MIN(distanceSquared, triangleDistanceSquared);
+					}
+				}
+			}
 		}
 	}
+	return sqrtf(distanceSquared);
+}
+
+// largest distance from the corners, edge midpoints and centroids of one level to the surface of the other
+inline float GetOneSidedHausdorffDistance(const Vertex* vertices, const uint32_t* fromIndices, u32 fromIndexCount, const uint32_t* toIndices, const LodDistanceGrid& toGrid)
+{
+	vector<float> threadDistances(ThreadPool::GetThreadCount(), 0.0f);
+	ThreadPool::ParallelFor(fromIndexCount / 3, 256, [&](i64 begin, i64 end, u32 threadIndex) {
+		float distanceMax = threadDistances[threadIndex];
+		for (i64 t = begin; t < end; t++)
+		{
+			const XMVECTOR p0 = XMLoadFloat3(&vertices[fromIndices[t * 3]].pos);
+			const XMVECTOR p1 = XMLoadFloat3(&vertices[fromIndices[t * 3 + 1]].pos);
+			const XMVECTOR p2 = XMLoadFloat3(&vertices[fromIndices[t * 3 + 2]].pos);
+			const XMVECTOR samples[] = { p0, p1, p2, (p0 + p1) * 0.5f, (p1 + p2) * 0.5f, (p2 + p0) * 0.5f, (p0 + p1 + p2) / 3.0f };
+			for (const XMVECTOR& sample : samples)
+			{
+				XMFLOAT3 p;
+				XMStoreFloat3(&p, sample);
+				const float distance = GetLodSurfaceDistance(toGrid, vertices, toIndices, p);
+				distanceMax = MAX(distanceMax, distance);
+			}
+		}
+		threadDistances[threadIndex] = distanceMax;
+	});
+	float distanceMax = 0.0f;
+	for (float distance : threadDistances)
+		distanceMax = MAX(distanceMax, distance);
+	return distanceMax;
+}
+
+// triangle counts of the chain SetMesh builds, the error the simplifier estimated and the symmetric Hausdorff distance to the full mesh
+bool Mesh::ReportLods(const string& fileNames)
+{
+	return ReportObjFiles("mesh lods", fileNames, [](const string& fileName) {
+		vector<Vertex> vertices;
+		vector<uint32_t> indices;
+		vector<Lod> lods;
+		if (!LoadObjFile(fileName, vertices, indices))
+			return false;
+		OptimizeVertexCache(vertices, indices);
+		CpuTimer timer;
+		GenerateLods(vertices, indices, lods);
+		const float generateTime = timer.GetMilliseconds();
+		XMFLOAT3 boundsMin;
+		XMFLOAT3 boundsMax;
+		GetVertexBounds(vertices.data(), (u32)vertices.size(), boundsMin, boundsMax);
+		const float diagonal = XMVectorGetX(XMVector3Length(XMLoadFloat3(&boundsMax) - XMLoadFloat3(&boundsMin)));
+		printf("%s: %u vertices, %u levels of detail generated in %f ms, bounds diagonal %f\n",
+			fileName.c_str(), (u32)vertices.size(), (u32)lods.size(), generateTime, diagonal);
+		LodDistanceGrid fullGrid;
+		BuildLodDistanceGrid(vertices.data(), indices.data(), lods[0].mIndexCount, boundsMin, boundsMax, fullGrid);
+		// a level has to drop triangles, stay inside the shared vertex buffer and stay closer to the full mesh than its whole extent
+		int failureCount = 0;
+		for (u32 i = 0; i < lods.size(); i++)
+		{
+			const Lod& lod = lods[i];
+			const uint32_t* lodIndices = indices.data() + lod.mIndexOffset;
+			const bool reduced = i == 0 || lod.mIndexCount < lods[i - 1].mIndexCount;
+			bool inRange = lod.mIndexOffset + lod.mIndexCount <= indices.size();
+			for (u32 j = 0; inRange && j < lod.mIndexCount; j++)
+				inRange = lodIndices[j] < vertices.size();
+			if (!inRange)
+			{
+				fprintf(stderr, "%s lod %u: indices out of range\n", fileName.c_str(), i);
+				failureCount++;
+				continue;
+			}
+			float distance = 0.0f;
+			if (i > 0)
+			{
+				LodDistanceGrid lodGrid;
+				BuildLodDistanceGrid(vertices.data(), lodIndices, lod.mIndexCount, boundsMin, boundsMax, lodGrid);
+				const float fullToLodDistance = GetOneSidedHausdorffDistance(vertices.data(), indices.data(), lods[0].mIndexCount, lodIndices, lodGrid);
+				const float lodToFullDistance = GetOneSidedHausdorffDistance(vertices.data(), lodIndices, lod.mIndexCount, indices.data(), fullGrid);
+				distance = MAX(fullToLodDistance, lodToFullDistance);
+			}
+			printf("%s lod %u: %u triangles (%f of the full mesh), error %f, Hausdorff distance %f (%f of the bounds diagonal)\n",
+				fileName.c_str(), i, lod.mIndexCount / 3, (float)lod.mIndexCount / lods[0].mIndexCount, lod.mError, distance, diagonal > 0.0f ? distance / diagonal : 0.0f);
+			const bool close = distance <= diagonal;
+			if (!reduced || !close)
+			{
+				fprintf(stderr, "%s lod %u: %u triangles against %u in the level before, Hausdorff distance %f for a bounds diagonal of %f\n",
+					fileName.c_str(), i, lod.mIndexCount / 3, lods[i - 1].mIndexCount / 3, distance, diagonal);
+				failureCount++;
+			}
+		}
+		return failureCount == 0;
+	});
 }
 
 void Mesh::SetLine()
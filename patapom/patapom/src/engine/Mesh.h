@@ -3,6 +3,17 @@
 #include "GlobalInclude.h"
 #include "Renderer.h"
 
+class Camera;
+
+// 20 bytes instead of the 48 of Vertex, this has to match PackedVertexInputLayout
+struct PackedVertex
+{
+	u16 pos[4]; // unorm within the bounds of the mesh, w is unused
+	u16 uv[2]; // half
+	i16 nor[2]; // octahedral snorm
+	i16 tan[2]; // octahedral snorm, the lowest bit of y is set when the bitangent is flipped
+};
+
 class Mesh
 {
 public:
@@ -18,6 +29,20 @@ public:
 		COUNT 
 	};
 
+	enum class VertexFormat
+	{
+		FULL, // Vertex
+		PACKED, // PackedVertex, only the CPU copy of the vertices stays in full precision
+	};
+
+	// every level of detail indexes the same vertices, the index buffer holds them one after the other
+	struct Lod
+	{
+		u32 mIndexOffset;
+		u32 mIndexCount;
+		float mError; // object space distance the simplified surface may be off the full mesh by, 0 for the full mesh
+	};
+
 	Mesh(const string& debugName,
 		const MeshType& type,
 		const XMFLOAT3& position,
@@ -55,18 +80,44 @@ public:
 	void AddTexture(Texture* texture);
 	void SetPosition(const XMFLOAT3&position);
 	void SetRotation(const XMFLOAT3&rotation);
+	void SetEmissive(const XMFLOAT3& emissive); // radiance, the path tracer turns every mesh that emits into a light
+	void SetMaterial(u32 materialType, const XMFLOAT3& albedo, float roughness, float fresnel, float metallic); // path tracer material, meshes without one use the scene material of the UI
+	void SetGeometry(const vector<Vertex>& vertices, const vector<uint32_t>& indices); // procedural triangles instead of the ones of the mesh type, before InitMesh
+	void SetVertexFormat(VertexFormat vertexFormat); // before InitMesh, the meshes of a pass have to share a vertex format and their vertex shader has to call UnpackVertex
 	XMFLOAT3 GetPosition();
 	XMFLOAT3 GetRotation();
-	int GetIndexCount() const;
+	XMFLOAT3 GetEmissive() const;
+	u32 GetMaterialType() const; // MATERIAL_TYPE_INVALID until SetMaterial
+	XMFLOAT3 GetAlbedo() const; // only used without an albedo texture
+	int GetIndexCount() const; // of the full mesh
+	u32 GetLodCount() const;
+	const Lod& GetLod(u32 lodIndex) const;
+	u32 SelectLod(Camera& camera) const; // the coarsest level whose error stays under sLodErrorPixels on the screen of the camera
+	XMFLOAT3 GetBoundsMin() const; // object space bounds of the vertices
+	XMFLOAT3 GetBoundsMax() const;
+	VertexFormat GetVertexFormat() const;
 	int GetTextureCount() const;
 	vector<Texture*>& GetTextures();
+	const string& GetDebugName() const;
+	u64 GetGeometryHash() const;
+	bool HasSameGeometry(const Mesh& other) const; // same vertices and indices, meshes that share geometry share their triangle BVH in the path tracer
 
 	void ConvertMeshToTrianglesPT(vector<TrianglePT>& outTriangles, u32 meshIndex);
 	Vertex TransformVertexToWorldSpace(const Vertex& vertex, const XMFLOAT4X4& m, const XMFLOAT4X4& mInv);
 
 	ObjectUniform mObjectUniform;
 
+	static float sLodErrorPixels; // 0 always draws the full mesh
+
 	inline static u32 GenerateMortonCode(XMFLOAT3 position);
+	// headless reports on comma separated obj files in the asset folder, false if a file can't be loaded or fails its check
+	static bool BenchmarkObjParser(const string& fileNames);
+	static bool ReportVertexCacheStats(const string& fileNames);
+	static bool BenchmarkMeshCache(const string& fileNames);
+	static bool ReportPackedVertexError(const string& fileNames);
+	static bool ReportLods(const string& fileNames);
+	static PackedVertex EncodePackedVertex(const Vertex& vertex, const XMFLOAT3& boundsMin, const XMFLOAT3& boundsMax);
+	static Vertex DecodePackedVertex(const PackedVertex& packedVertex, const XMFLOAT3& boundsMin, const XMFLOAT3& boundsMax); // what UnpackVertex gives the vertex shader
 
 private:
 	struct Point
@@ -76,17 +127,40 @@ private:
 		uint32_t NI;
 	};
 
+	struct ObjData
+	{
+		vector<XMFLOAT3> mPositions;
+		vector<XMFLOAT2> mUVs;
+		vector<XMFLOAT3> mNormals;
+		vector<Point> mPoints; // 3 per triangle, polygons are split into fans
+		bool mHasRelativeIndices = false; // some face counted back from the elements before it
+	};
+
 	string mFileName;
 	string mDebugName;
 	MeshType mType;
+	VertexFormat mVertexFormat;
 	XMFLOAT3 mPosition;
 	XMFLOAT3 mScale;
 	XMFLOAT3 mRotation;
+	XMFLOAT3 mEmissive;
+	u32 mMaterialType;
+	XMFLOAT3 mAlbedo;
 
 	vector<Vertex> mVertexVec;
 	vector<uint32_t> mIndexVec;
 	vector<Texture*> mTextures;
 
+	// the vertices and indices are either the vectors above or read in place from the mapped mesh cache
+	MappedFile mCacheFile;
+	const Vertex* mVertices;
+	const uint32_t* mIndices;
+	u32 mVertexCount;
+	u32 mIndexCount;
+	vector<Lod> mLods; // only the full mesh unless SetMesh generated or loaded a chain
+	XMFLOAT3 mBoundsMin;
+	XMFLOAT3 mBoundsMax;
+
 	Renderer* mRenderer;
 
 	UINT mVertexBufferSizeInBytes;
@@ -110,14 +184,31 @@ private:
 	void SetSkyFullscreenTriangle();
 	void SetMesh();
 	void SetLine();
+	void UpdateGeometryView();
+	bool LoadMeshCache();
 
-	void AssembleObjMesh(
+	static void SaveMeshCache(const string& fileName, const vector<Vertex>& vertices, const vector<uint32_t>& indices, const vector<Lod>& lods);
+
+	static void AssembleObjMesh(
 		const vector<XMFLOAT3> &vecPos,
 		const vector<XMFLOAT2> &vecUV,
 		const vector<XMFLOAT3> &vecNor,
-		const vector<Point> &vecPoint);
+		const vector<Point> &vecPoint,
+		vector<Vertex>& vertices,
+		vector<uint32_t>& indices);
+
+	static void OptimizeVertexCache(vector<Vertex>& vertices, vector<uint32_t>& indices);
+	static float GetAcmr(const vector<uint32_t>& indices, u32 cacheSize);
+	static void SimplifyMesh(const vector<Vertex>& vertices, const uint32_t* indices, u32 indexCount, u32 targetIndexCount, vector<uint32_t>& simplifiedIndices, float& error);
+	static void GenerateLods(const vector<Vertex>& vertices, vector<uint32_t>& indices, vector<Lod>& lods); // appends the levels to the indices of the full mesh
 	
-	void ParseObjFace(
+	static void ParseObjFace(
 		stringstream &ss, 
 		vector<Point>& tempVecPoint);
+
+	static void ParseObjStringStream(const string& filePathName, ObjData& obj); // the original parser, only kept to benchmark against
+	static bool ParseObjFile(const string& filePathName, bool parallel, ObjData& obj); // false if the file can't be opened
+	static bool LoadObjFile(const string& fileName, vector<Vertex>& vertices, vector<uint32_t>& indices); // parsed and assembled, false if there is no triangle
+	static void ParseObj(const char* data, size_t size, bool parallel, ObjData& obj);
+	static void ParseObjChunk(const char* begin, const char* end, ObjData& obj);
 };
@@ -3,23 +3,62 @@
 #include "Store.h"
 #include "Light.h"
 #include "DeferredLighting.h"
+#include "ThreadPool.h"
+#include "PathTracerCpu.h"
+#include "Denoiser.h"
 #include <algorithm>
+#include <random>
 
 CommandLineArg PARAM_printBvh("-printBvh");
 CommandLineArg PARAM_buildBvhGpu("-buildBvhGpu");
+CommandLineArg PARAM_bvhBuilder("-bvhBuilder"); // lbvh (default) or sah, only affects the CPU build
+CommandLineArg PARAM_compareBvhBuilders("-compareBvhBuilders"); // report SAH cost and build time of every CPU builder for each mesh
+CommandLineArg PARAM_validateBvhMultithreaded("-validateBvhMultithreaded"); // check that the multithreaded CPU build matches the single threaded one and quit
+CommandLineArg PARAM_validateBvhRefit("-validateBvhRefit"); // move meshes around, refit the mesh BVH, check the bounds of every node and quit
+CommandLineArg PARAM_benchmarkWideBvh("-benchmarkWideBvh"); // compare CPU traversal of the binary BVH against the collapsed wide BVH and quit
+CommandLineArg PARAM_validateWatertightTriangles("-validateWatertightTriangles"); // fire rays at shared edges and vertices of a tessellated grid and time each ray/triangle test and quit
+CommandLineArg PARAM_benchmarkRayPackets("-benchmarkRayPackets"); // compare single ray and SIMD packet traversal on these comma separated obj files and quit, rex.obj,gameboy.obj by default
+CommandLineArg PARAM_noBvhCache("-noBvhCache"); // always rebuild triangle BVHs, neither read nor write the on-disk cache
+CommandLineArg PARAM_validateBvhCache("-validateBvhCache"); // rebuild every cached triangle BVH, diff it against the cached copy and quit
+CommandLineArg PARAM_validateLargeMesh("-validateLargeMesh"); // build and trace a procedural mesh of this many triangles (1M by default) through the CPU build path and quit
+CommandLineArg PARAM_validateRadixSort("-validateRadixSort"); // run the GPU radix sort on the CPU against std::sort, report its passes and traffic and quit
+CommandLineArg PARAM_stressInstances("-stressInstances"); // scatter this many instances of ball.obj (10k by default) and report how memory and build time grow with the instance count and quit
 
-const int							PathTracer::sLightDataCountMax = PT_LIGHT_PER_SCENE_MAX;
 const int							PathTracer::sThreadGroupCountX = ceil(PT_BACKBUFFER_WIDTH / PT_THREAD_PER_THREADGROUP_X);
 const int							PathTracer::sThreadGroupCountY = ceil(PT_BACKBUFFER_HEIGHT / PT_THREAD_PER_THREADGROUP_Y);
 const int							PathTracer::sBackbufferWidth = PT_BACKBUFFER_WIDTH;
 const int							PathTracer::sBackbufferHeight = PT_BACKBUFFER_HEIGHT;
 u32									PathTracer::sMeshTextureCount = 0;
 u32									PathTracer::sMeshBvhRootIndexGlobal = INVALID_UINT32;
+u32									PathTracer::sMeshBvhHeight = 0;
+PathTracer::BvhBuilderType			PathTracer::sBvhBuilderType = PathTracer::BvhBuilderTypeLBVH;
+bool								PathTracer::sBvhBuildMultithreaded = true;
+bool								PathTracer::sBvhCacheEnabled = true;
+bool								PathTracer::sBvhBuildGpu = false;
+bool								PathTracer::sMeshDataDirty = false;
+float								PathTracer::sMeshBvhSahCostAtBuild = 0.0f;
+float								PathTracer::sBvhBuildMilliseconds = 0.0f;
 vector<TrianglePT>					PathTracer::sTriangles;
 vector<MeshPT>						PathTracer::sMeshes;
+vector<MaterialPT>					PathTracer::sMaterials;
+vector<Texture*>					PathTracer::sMaterialAlbedoTextures;
+vector<Mesh*>						PathTracer::sMeshSources;
+vector<u32>							PathTracer::sMeshGeometryOwners;
+u32									PathTracer::sTriangleBvhCount = 0;
+unordered_map<u64, u32>				PathTracer::sMeshGeometryHashToOwner;
 vector<LightData>					PathTracer::sLightData;
+vector<LightBvhNode>				PathTracer::sLightBvhNodes;
+vector<AliasEntry>					PathTracer::sLightAliasEntries;
 vector<BVH>							PathTracer::sTriangleModelBVHs;
+vector<u32>							PathTracer::sTriangleBvhHeights;
+vector<AABB>						PathTracer::sMeshModelAABBs;
 vector<BVH>							PathTracer::sMeshWorldBVHs;
+vector<WideBVH>						PathTracer::sTriangleWideBVHs;
+vector<u32>							PathTracer::sTriangleWideBvhOffsets;
+vector<float>						PathTracer::sAdaptiveTileErrors(PT_ADAPTIVE_TILE_ERROR_BUFFER_SIZE, 1.0f);
+float								PathTracer::sAdaptiveGlobalError = 1.0f;
+u32									PathTracer::sAdaptiveActiveTileCount = PT_ADAPTIVE_TILE_COUNT;
+u32									PathTracer::sAdaptiveRestartFrame = 0;
 PassPathTracerBuildScene			PathTracer::sPathTracerRadixSortInitPass[BuildBvhType::BuildBvhTypeCount];
 PassPathTracerBuildScene			PathTracer::sPathTracerRadixSortPollPass[BuildBvhType::BuildBvhTypeCount];
 PassPathTracerBuildScene			PathTracer::sPathTracerRadixSortUpSweepPass[BuildBvhType::BuildBvhTypeCount];
@@ -28,6 +67,14 @@ PassPathTracerBuildScene			PathTracer::sPathTracerRadixSortReorderPass[BuildBvhT
 PassPathTracerBuildScene			PathTracer::sPathTracerBuildBvhPass[BuildBvhType::BuildBvhTypeCount];
 PassPathTracerBuildScene			PathTracer::sPathTracerBuildBvhUpdatePass[BuildBvhType::BuildBvhTypeCount];
 PassPathTracer						PathTracer::sPathTracerPass("path tracer pass", false, false);
+PassPathTracer						PathTracer::sPathTracerWavefrontGeneratePass("path tracer wavefront generate pass", false, false);
+PassPathTracer						PathTracer::sPathTracerWavefrontExtendPass[PT_MAXDEPTH_MAX];
+PassPathTracer						PathTracer::sPathTracerWavefrontSortPass[PT_MAXDEPTH_MAX];
+PassPathTracer						PathTracer::sPathTracerWavefrontShadePass[PT_MAXDEPTH_MAX];
+PassPathTracer						PathTracer::sPathTracerWavefrontConnectPass[PT_MAXDEPTH_MAX];
+PassPathTracer						PathTracer::sPathTracerWavefrontAccumulatePass("path tracer wavefront accumulate pass", false, false);
+PassPathTracer						PathTracer::sPathTracerAdaptiveTileErrorPass("path tracer adaptive tile error pass", false, false);
+vector<PassPathTracer*>				PathTracer::sPathTracerWavefrontPasses;
 PassDefault							PathTracer::sPathTracerCopyDepthPass("path tracer copy depth pass", false, true, false);
 PassDefault							PathTracer::sPathTracerDebugLinePass("path tracer debug line pass", true, true, false, PrimitiveType::LINE);
 PassDefault							PathTracer::sPathTracerDebugCubePass("path tracer debug cube pass", true, false, false, PrimitiveType::TRIANGLE);
@@ -35,6 +82,13 @@ PassDefault							PathTracer::sPathTracerDebugFullscreenPass("path tracer debug
 Mesh								PathTracer::sPathTracerDebugMeshLine("path tracer debug mesh line", Mesh::MeshType::LINE, XMFLOAT3(0, 0, 0), XMFLOAT3(0, 0, 0), XMFLOAT3(1, 1, 1));
 Mesh								PathTracer::sPathTracerDebugMeshCube("path tracer debug mesh cube", Mesh::MeshType::CUBE, XMFLOAT3(0, 0, 0), XMFLOAT3(0, 0, 0), XMFLOAT3(1, 1, 1));
 Shader								PathTracer::sPathTracerCS(Shader::ShaderType::COMPUTE_SHADER, "cs_pathtracer");
+Shader								PathTracer::sPathTracerWavefrontGenerateCS(Shader::ShaderType::COMPUTE_SHADER, "cs_pathtracer_wavefront_generate");
+Shader								PathTracer::sPathTracerWavefrontExtendCS(Shader::ShaderType::COMPUTE_SHADER, "cs_pathtracer_wavefront_extend");
+Shader								PathTracer::sPathTracerWavefrontSortCS(Shader::ShaderType::COMPUTE_SHADER, "cs_pathtracer_wavefront_sort");
+Shader								PathTracer::sPathTracerWavefrontShadeCS(Shader::ShaderType::COMPUTE_SHADER, "cs_pathtracer_wavefront_shade");
+Shader								PathTracer::sPathTracerWavefrontConnectCS(Shader::ShaderType::COMPUTE_SHADER, "cs_pathtracer_wavefront_connect");
+Shader								PathTracer::sPathTracerWavefrontAccumulateCS(Shader::ShaderType::COMPUTE_SHADER, "cs_pathtracer_wavefront_accumulate");
+Shader								PathTracer::sPathTracerAdaptiveTileErrorCS(Shader::ShaderType::COMPUTE_SHADER, "cs_pathtracer_adaptive_tile_error");
 Shader								PathTracer::sPathTracerRadixSortInitCS(Shader::ShaderType::COMPUTE_SHADER, "cs_pathtracer_radixsort_init");
 Shader								PathTracer::sPathTracerRadixSortPollCS(Shader::ShaderType::COMPUTE_SHADER, "cs_pathtracer_radixsort_poll");
 Shader								PathTracer::sPathTracerRadixSortUpSweepCS(Shader::ShaderType::COMPUTE_SHADER, "cs_pathtracer_radixsort_upsweep");
@@ -50,30 +104,39 @@ Shader								PathTracer::sPathTracerDebugFullscreenPS(Shader::ShaderType::PIXEL
 Shader								PathTracer::sPathTracerCopyDepthVS(Shader::ShaderType::VERTEX_SHADER, "vs_pathtracer_copydepth");
 Shader								PathTracer::sPathTracerCopyDepthPS(Shader::ShaderType::PIXEL_SHADER, "ps_pathtracer_copydepth");
 Shader								PathTracer::sPathTracerBlitBackbufferPS(Shader::ShaderType::PIXEL_SHADER, "ps_pathtracer_blitbackbuffer");
-Buffer								PathTracer::sLightDataBuffer("pt light data buffer", sizeof(LightData), sLightDataCountMax);
-Buffer								PathTracer::sTriangleBuffer("pt triangle buffer", sizeof(TrianglePT), PT_TRIANGLE_PER_SCENE_MAX);
-WriteBuffer							PathTracer::sMeshBuffer("pt mesh buffer", sizeof(MeshPT), PT_MESH_PER_SCENE_MAX);
+WriteBuffer							PathTracer::sLightDataBuffer("pt light data buffer", sizeof(LightData), 1); // grows with the lights of the scene
+WriteBuffer							PathTracer::sLightBvhBuffer("pt light bvh buffer", sizeof(LightBvhNode), 1);
+WriteBuffer							PathTracer::sLightAliasBuffer("pt light alias buffer", sizeof(AliasEntry), 1); // grows with the triangles of emissive meshes
+Buffer								PathTracer::sMaterialBuffer("pt material buffer", sizeof(MaterialPT), 1); // grows with the unique materials of the scene
+Buffer								PathTracer::sTriangleBuffer("pt triangle buffer", sizeof(TrianglePT), 1); // scene sized buffers start with 1 element and grow as meshes are added
+WriteBuffer							PathTracer::sMeshBuffer("pt mesh buffer", sizeof(MeshPT), 1);
 WriteBuffer							PathTracer::sGlobalBvhSettingsBuffer("pt global bvh settings buffer", sizeof(GlobalBvhSettings), 1);
-WriteBuffer							PathTracer::sTriangleBvhBuffer("pt triangle bvh buffer", sizeof(BVH), PT_TRIANGLE_BVH_PER_SCENE_MAX); // for each mesh we have, there is 1 fewer entry for bvh than for triangle, i.e. a[n] = 2^(n-1) then S[n] = 2^n-1, S[n-1]=a[n]-1
-WriteBuffer							PathTracer::sMeshBvhBuffer("pt mesh bvh buffer", sizeof(BVH), PT_MESH_BVH_PER_SCENE_MAX);
-WriteBuffer							PathTracer::sTempBvhBuffer("temporary bvh buffer", sizeof(BVH), PT_BVH_PER_SCENE_MAX); // temporary bvh buffer for building ONE bvh root
+WriteBuffer							PathTracer::sTriangleBvhBuffer("pt triangle bvh buffer", sizeof(BVH), 1); // for each mesh we have, there is 1 fewer entry for bvh than for triangle, i.e. a[n] = 2^(n-1) then S[n] = 2^n-1, S[n-1]=a[n]-1
+WriteBuffer							PathTracer::sMeshBvhBuffer("pt mesh bvh buffer", sizeof(BVH), 1);
+WriteBuffer							PathTracer::sTempBvhBuffer("temporary bvh buffer", sizeof(BVH), 1); // temporary bvh buffer for building ONE bvh root
 WriteBuffer							PathTracer::sRayBuffer("ray buffer", sizeof(Ray), sBackbufferWidth * sBackbufferHeight);
 WriteBuffer							PathTracer::sDebugRayBuffer("debug ray buffer", sizeof(Ray), PT_MAXDEPTH_MAX);
-WriteBuffer							PathTracer::sAabbProxyBuffer("aabb proxy buffer", sizeof(AabbProxy), PT_LEAF_PER_TREE_MAX); // largest triangle count per mesh is the total triangle count (e.g. when only 1 mesh is in the scene)
-WriteBuffer							PathTracer::sSortedAabbProxyBuffer("aabb sorted proxy buffer", sizeof(AabbProxy), PT_LEAF_PER_TREE_MAX);
-WriteBuffer							PathTracer::sRadixSortBitCountArrayBuffer("bit count array buffer", sizeof(XMUINT4), PT_LEAF_PER_TREE_MAX);
-WriteBuffer							PathTracer::sRadixSortPrefixSumAuxArrayBuffer("prefix sum aux array buffer", sizeof(XMUINT4), PT_RADIXSORT_THREAD_COUNT_MAX);
+WriteBuffer							PathTracer::sWavefrontPathBuffer("wavefront path buffer", sizeof(XMFLOAT4), PT_WAVEFRONT_PATH_COUNT * PT_WAVEFRONT_PATH_FIELD_COUNT);
+WriteBuffer							PathTracer::sWavefrontRayQueueBuffer("wavefront ray queue buffer", sizeof(XMFLOAT4), PT_WAVEFRONT_PATH_COUNT * PT_WAVEFRONT_RAY_FIELD_COUNT);
+WriteBuffer							PathTracer::sWavefrontHitQueueBuffer("wavefront hit queue buffer", sizeof(XMFLOAT4), PT_WAVEFRONT_PATH_COUNT * PT_WAVEFRONT_HIT_FIELD_COUNT);
+WriteBuffer							PathTracer::sWavefrontShadowQueueBuffer("wavefront shadow queue buffer", sizeof(XMFLOAT4), PT_WAVEFRONT_PATH_COUNT * PT_WAVEFRONT_SHADOW_RAY_PER_PATH * PT_WAVEFRONT_SHADOW_FIELD_COUNT);
+WriteBuffer							PathTracer::sWavefrontQueueCounterBuffer("wavefront queue counter buffer", sizeof(u32), PT_WAVEFRONT_COUNTER_COUNT);
+WriteBuffer							PathTracer::sWavefrontHitOrderBuffer("wavefront hit order buffer", sizeof(u32), PT_WAVEFRONT_PATH_COUNT);
+WriteBuffer							PathTracer::sAdaptiveTileErrorBuffer("adaptive tile error buffer", sizeof(float), PT_ADAPTIVE_TILE_ERROR_BUFFER_SIZE);
+WriteBuffer							PathTracer::sAabbProxyBuffer("aabb proxy buffer", sizeof(AabbProxy), 1); // largest triangle count per mesh is the total triangle count (e.g. when only 1 mesh is in the scene)
+WriteBuffer							PathTracer::sSortedAabbProxyBuffer("aabb sorted proxy buffer", sizeof(AabbProxy), 1);
+WriteBuffer							PathTracer::sRadixSortBitCountArrayBuffer("bit count array buffer", sizeof(XMUINT4), 1);
+WriteBuffer							PathTracer::sRadixSortPrefixSumAuxArrayBuffer("prefix sum aux array buffer", sizeof(XMUINT4), 1);
 RenderTexture						PathTracer::sBackbufferPT(TextureType::TEX_2D, "path tracer backbuffer", sBackbufferWidth, sBackbufferHeight, 1, 1, ReadFrom::COLOR, Format::R16G16B16A16_FLOAT, XMFLOAT4(0.0f, 0.0f, 0.0f, 0.0f));
+RenderTexture						PathTracer::sConvergencePT(TextureType::TEX_2D, "path tracer convergence", sBackbufferWidth, sBackbufferHeight, 1, 1, ReadFrom::COLOR, Format::R32G32B32A32_FLOAT, XMFLOAT4(0.0f, 0.0f, 0.0f, 0.0f));
+RenderTexture						PathTracer::sNormalDepthPT(TextureType::TEX_2D, "path tracer normal depth", sBackbufferWidth, sBackbufferHeight, 1, 1, ReadFrom::COLOR, Format::R32G32B32A32_FLOAT, XMFLOAT4(0.0f, 0.0f, 0.0f, 0.0f));
+RenderTexture						PathTracer::sAlbedoPT(TextureType::TEX_2D, "path tracer albedo", sBackbufferWidth, sBackbufferHeight, 1, 1, ReadFrom::COLOR, Format::R16G16B16A16_FLOAT, XMFLOAT4(0.0f, 0.0f, 0.0f, 0.0f));
 RenderTexture						PathTracer::sDebugBackbufferPT(TextureType::TEX_2D, "path tracer debug backbuffer", sBackbufferWidth, sBackbufferHeight, 1, 1, ReadFrom::COLOR, Format::R16G16B16A16_FLOAT, XMFLOAT4(0.0f, 0.0f, 0.0f, 0.0f));
 RenderTexture						PathTracer::sDepthbufferWritePT(TextureType::TEX_2D, "path tracer depthbuffer write", sBackbufferWidth, sBackbufferHeight, 1, 1, ReadFrom::COLOR, Format::R32_FLOAT, XMFLOAT4(DEPTH_FAR_REVERSED_Z_SWITCH, 0.0f, 0.0f, 0.0f));
 RenderTexture						PathTracer::sDepthbufferRenderPT(TextureType::TEX_2D, "path tracer depthbuffer read", sBackbufferWidth, sBackbufferHeight, 1, 1, ReadFrom::DEPTH, Format::D32_FLOAT, DEPTH_FAR_REVERSED_Z_SWITCH, 0);
 
 void PathTracer::InitPathTracer(Store& store, Scene& scene)
 {
-	fatalAssertf(PT_RADIXSORT_THREAD_COUNT_MAX <= 0x80000000, "We need power of 2 threads to do the sweeps, we can't find the next power of 2 with the current thread count %d!", PT_RADIXSORT_THREAD_COUNT_MAX);
-	// maximum thread group per dispatch is 65535 for D3D
-	fatalAssertf(PT_RADIXSORT_THREAD_COUNT_MAX <= PT_RADIXSORT_SWEEP_THREAD_PER_THREADGROUP * 65535, "Sweep operation can't be finished in 1 dispatch with the current thread count %d, we can only dispatch 65535 thread groups for each dispatch!", PT_RADIXSORT_THREAD_COUNT_MAX);
-
 	for (u8 i = 0; i < BuildBvhType::BuildBvhTypeCount; i++)
 	{
 		string buildBvhType = i == (u8)BuildBvhType::BuildBvhTypeTriangle ? "Triangle" : "Mesh";
@@ -132,11 +195,75 @@ void PathTracer::InitPathTracer(Store& store, Scene& scene)
 	sPathTracerPass.AddBuffer(&sMeshBvhBuffer);
 	sPathTracerPass.AddBuffer(&sTriangleBvhBuffer);
 	sPathTracerPass.AddBuffer(&sGlobalBvhSettingsBuffer);
+	sPathTracerPass.AddBuffer(&sLightBvhBuffer);
+	sPathTracerPass.AddBuffer(&sLightAliasBuffer);
+	sPathTracerPass.AddBuffer(&sMaterialBuffer);
 	sPathTracerPass.AddWriteBuffer(&sRayBuffer);
 	sPathTracerPass.AddWriteTexture(&sBackbufferPT, 0);
 	sPathTracerPass.AddWriteBuffer(&sDebugRayBuffer);
 	sPathTracerPass.AddWriteTexture(&sDepthbufferWritePT, 0);
+	sPathTracerPass.AddWriteTexture(&sConvergencePT, 0);
+	sPathTracerPass.AddWriteBuffer(&sAdaptiveTileErrorBuffer);
+	sPathTracerPass.AddWriteTexture(&sNormalDepthPT, 0);
+	sPathTracerPass.AddWriteTexture(&sAlbedoPT, 0);
 	sPathTracerPass.SetCamera(&gCameraMain);
+
+	// wavefront path tracer, one pass per stage per bounce so each bounce keeps its own uniform buffer within a frame
+	sPathTracerWavefrontGeneratePass.AddShader(&sPathTracerWavefrontGenerateCS);
+	sPathTracerWavefrontPasses.push_back(&sPathTracerWavefrontGeneratePass);
+	for (u32 i = 0; i < PT_MAXDEPTH_MAX; i++)
+	{
+		string bounceIndex = to_string(i);
+		sPathTracerWavefrontExtendPass[i].CreatePass("path tracer wavefront extend pass " + bounceIndex, false, false);
+		sPathTracerWavefrontSortPass[i].CreatePass("path tracer wavefront sort pass " + bounceIndex, false, false);
+		sPathTracerWavefrontShadePass[i].CreatePass("path tracer wavefront shade pass " + bounceIndex, false, false);
+		sPathTracerWavefrontConnectPass[i].CreatePass("path tracer wavefront connect pass " + bounceIndex, false, false);
+		sPathTracerWavefrontExtendPass[i].AddShader(&sPathTracerWavefrontExtendCS);
+		sPathTracerWavefrontSortPass[i].AddShader(&sPathTracerWavefrontSortCS);
+		sPathTracerWavefrontShadePass[i].AddShader(&sPathTracerWavefrontShadeCS);
+		sPathTracerWavefrontConnectPass[i].AddShader(&sPathTracerWavefrontConnectCS);
+		sPathTracerWavefrontExtendPass[i].mPassUniform.mWavefrontBounceIndex = i;
+		sPathTracerWavefrontSortPass[i].mPassUniform.mWavefrontBounceIndex = i;
+		sPathTracerWavefrontShadePass[i].mPassUniform.mWavefrontBounceIndex = i;
+		sPathTracerWavefrontConnectPass[i].mPassUniform.mWavefrontBounceIndex = i;
+		sPathTracerWavefrontPasses.push_back(&sPathTracerWavefrontExtendPass[i]);
+		sPathTracerWavefrontPasses.push_back(&sPathTracerWavefrontSortPass[i]);
+		sPathTracerWavefrontPasses.push_back(&sPathTracerWavefrontShadePass[i]);
+		sPathTracerWavefrontPasses.push_back(&sPathTracerWavefrontConnectPass[i]);
+	}
+	sPathTracerWavefrontAccumulatePass.AddShader(&sPathTracerWavefrontAccumulateCS);
+	sPathTracerWavefrontPasses.push_back(&sPathTracerWavefrontAccumulatePass);
+	for (PassPathTracer* pass : sPathTracerWavefrontPasses)
+	{
+		pass->AddBuffer(&sTriangleBuffer);
+		pass->AddBuffer(&sMeshBuffer);
+		pass->AddBuffer(&sLightDataBuffer);
+		pass->AddBuffer(&sMeshBvhBuffer);
+		pass->AddBuffer(&sTriangleBvhBuffer);
+		pass->AddBuffer(&sGlobalBvhSettingsBuffer);
+		pass->AddBuffer(&sLightBvhBuffer);
+		pass->AddBuffer(&sLightAliasBuffer);
+		pass->AddBuffer(&sMaterialBuffer);
+		pass->AddWriteBuffer(&sWavefrontPathBuffer);
+		pass->AddWriteBuffer(&sWavefrontRayQueueBuffer);
+		pass->AddWriteBuffer(&sWavefrontHitQueueBuffer);
+		pass->AddWriteBuffer(&sWavefrontShadowQueueBuffer);
+		pass->AddWriteBuffer(&sWavefrontQueueCounterBuffer);
+		pass->AddWriteTexture(&sBackbufferPT, 0);
+		pass->AddWriteTexture(&sDepthbufferWritePT, 0);
+		pass->AddWriteTexture(&sConvergencePT, 0);
+		pass->AddWriteBuffer(&sAdaptiveTileErrorBuffer);
+		pass->AddWriteBuffer(&sWavefrontHitOrderBuffer);
+		pass->AddWriteTexture(&sNormalDepthPT, 0);
+		pass->AddWriteTexture(&sAlbedoPT, 0);
+		pass->SetCamera(&gCameraMain);
+	}
+
+	// adaptive sampling, one thread group per tile
+	sPathTracerAdaptiveTileErrorPass.AddShader(&sPathTracerAdaptiveTileErrorCS);
+	sPathTracerAdaptiveTileErrorPass.AddWriteTexture(&sConvergencePT, 0);
+	sPathTracerAdaptiveTileErrorPass.AddWriteBuffer(&sAdaptiveTileErrorBuffer);
+
 	sPathTracerCopyDepthPass.AddMesh(&gFullscreenTriangle);
 	sPathTracerCopyDepthPass.AddShader(&sPathTracerCopyDepthVS);
 	sPathTracerCopyDepthPass.AddShader(&sPathTracerCopyDepthPS);
@@ -178,6 +305,9 @@ void PathTracer::InitPathTracer(Store& store, Scene& scene)
 		scene.AddPass(&sPathTracerBuildBvhUpdatePass[i]);
 	}
 	scene.AddPass(&sPathTracerPass);
+	for (PassPathTracer* pass : sPathTracerWavefrontPasses)
+		scene.AddPass(pass);
+	scene.AddPass(&sPathTracerAdaptiveTileErrorPass);
 	scene.AddPass(&sPathTracerCopyDepthPass);
 	scene.AddPass(&sPathTracerDebugLinePass);
 	scene.AddPass(&sPathTracerDebugCubePass);
@@ -195,6 +325,9 @@ void PathTracer::InitPathTracer(Store& store, Scene& scene)
 		store.AddPass(&sPathTracerBuildBvhUpdatePass[i]);
 	}
 	store.AddPass(&sPathTracerPass);
+	for (PassPathTracer* pass : sPathTracerWavefrontPasses)
+		store.AddPass(pass);
+	store.AddPass(&sPathTracerAdaptiveTileErrorPass);
 	store.AddMesh(&sPathTracerDebugMeshLine);
 	store.AddMesh(&sPathTracerDebugMeshCube);
 	store.AddPass(&sPathTracerCopyDepthPass);
@@ -202,6 +335,13 @@ void PathTracer::InitPathTracer(Store& store, Scene& scene)
 	store.AddPass(&sPathTracerDebugCubePass);
 	store.AddPass(&sPathTracerDebugFullscreenPass);
 	store.AddShader(&sPathTracerCS);
+	store.AddShader(&sPathTracerWavefrontGenerateCS);
+	store.AddShader(&sPathTracerWavefrontExtendCS);
+	store.AddShader(&sPathTracerWavefrontSortCS);
+	store.AddShader(&sPathTracerWavefrontShadeCS);
+	store.AddShader(&sPathTracerWavefrontConnectCS);
+	store.AddShader(&sPathTracerWavefrontAccumulateCS);
+	store.AddShader(&sPathTracerAdaptiveTileErrorCS);
 	store.AddShader(&sPathTracerRadixSortInitCS);
 	store.AddShader(&sPathTracerRadixSortPollCS);
 	store.AddShader(&sPathTracerRadixSortUpSweepCS);
@@ -218,6 +358,9 @@ void PathTracer::InitPathTracer(Store& store, Scene& scene)
 	store.AddShader(&sPathTracerCopyDepthPS);
 	store.AddShader(&sPathTracerBlitBackbufferPS);
 	store.AddBuffer(&sLightDataBuffer);
+	store.AddBuffer(&sLightBvhBuffer);
+	store.AddBuffer(&sLightAliasBuffer);
+	store.AddBuffer(&sMaterialBuffer);
 	store.AddBuffer(&sTriangleBuffer);
 	store.AddBuffer(&sMeshBuffer);
 	store.AddBuffer(&sGlobalBvhSettingsBuffer);
@@ -226,11 +369,21 @@ void PathTracer::InitPathTracer(Store& store, Scene& scene)
 	store.AddBuffer(&sTempBvhBuffer);
 	store.AddBuffer(&sRayBuffer);
 	store.AddBuffer(&sDebugRayBuffer);
+	store.AddBuffer(&sWavefrontPathBuffer);
+	store.AddBuffer(&sWavefrontRayQueueBuffer);
+	store.AddBuffer(&sWavefrontHitQueueBuffer);
+	store.AddBuffer(&sWavefrontShadowQueueBuffer);
+	store.AddBuffer(&sWavefrontQueueCounterBuffer);
+	store.AddBuffer(&sAdaptiveTileErrorBuffer);
+	store.AddBuffer(&sWavefrontHitOrderBuffer);
 	store.AddBuffer(&sAabbProxyBuffer);
 	store.AddBuffer(&sSortedAabbProxyBuffer);
 	store.AddBuffer(&sRadixSortBitCountArrayBuffer);
 	store.AddBuffer(&sRadixSortPrefixSumAuxArrayBuffer);
 	store.AddTexture(&sBackbufferPT);
+	store.AddTexture(&sConvergencePT);
+	store.AddTexture(&sNormalDepthPT);
+	store.AddTexture(&sAlbedoPT);
 	store.AddTexture(&sDebugBackbufferPT);
 	store.AddTexture(&sDepthbufferWritePT);
 	store.AddTexture(&sDepthbufferRenderPT);
@@ -250,9 +403,20 @@ void PathTracer::InitPathTracer(Store& store, Scene& scene)
 		}
 	}
 
-	// update BVH
-	if (!PARAM_buildBvhGpu.Get())
+	// update BVH, the builder was picked by ReadBvhBuilderArg
+	if (PARAM_noBvhCache.Get())
+		sBvhCacheEnabled = false;
+	sBvhBuildGpu = PARAM_buildBvhGpu.Get();
+	if (sBvhBuildGpu && !IsGpuBvhShallowEnough())
+	{
+		// the GPU builder can't bound its depth, the CPU build falls back to SAH for the trees that get too deep
+		displayfln("the GPU bvh would overflow the traversal stacks, building it on the CPU instead");
+		sBvhBuildGpu = false;
+	}
+	if (!sBvhBuildGpu)
 	{
+		if (PARAM_compareBvhBuilders.Get())
+			CompareBvhBuilders();
 		UpdateBvhCpu(scene);
 		if (PARAM_printBvh.Get())
 			PrintBVH();
@@ -264,20 +428,42 @@ void PathTracer::InitPathTracer(Store& store, Scene& scene)
 	{
 		sLightData.push_back(lights[i]->CreateLightData());
 	}
+	BuildMeshLights();
+	BuildLightBvh();
+	sLightDataBuffer.GrowElementCount(sLightData.size());
+	sLightBvhBuffer.GrowElementCount(sLightBvhNodes.size());
+	sLightAliasBuffer.GrowElementCount(sLightAliasEntries.size());
 
-	int triangleBvhPerScene = sTriangles.size() - sMeshes.size();
+	// triangle and mesh buffers already grew with every mesh, the rest depends on the largest tree in the scene
 	int meshBvhPerScene = sMeshes.size() - 1;
-	int bvhPerSceneMax = max(triangleBvhPerScene, meshBvhPerScene);
-	int leafPerTreeMax = max(trianglesPerMeshMax, sMeshes.size());
-	sTriangleBuffer.SetElementSizeAndCount(sizeof(TrianglePT), sTriangles.size());
-	sMeshBuffer.SetElementSizeAndCount(sizeof(MeshPT), sMeshes.size());
-	sTriangleBvhBuffer.SetElementSizeAndCount(sizeof(BVH), triangleBvhPerScene);
-	sMeshBvhBuffer.SetElementSizeAndCount(sizeof(BVH), meshBvhPerScene);
-	sTempBvhBuffer.SetElementSizeAndCount(sizeof(BVH), bvhPerSceneMax);
-	sAabbProxyBuffer.SetElementSizeAndCount(sizeof(AabbProxy), leafPerTreeMax);
-	sSortedAabbProxyBuffer.SetElementSizeAndCount(sizeof(AabbProxy), leafPerTreeMax);
-	sRadixSortBitCountArrayBuffer.SetElementSizeAndCount(sizeof(XMUINT4), leafPerTreeMax);
-	sRadixSortPrefixSumAuxArrayBuffer.SetElementSizeAndCount(sizeof(XMUINT4), NextPowerOfTwo32(leafPerTreeMax / PT_BUILDBVH_ENTRY_PER_THREAD));
+	int bvhPerSceneMax = MAX(trianglesPerMeshMax - 1, meshBvhPerScene);
+	int leafPerTreeMax = MAX(trianglesPerMeshMax, (int)sMeshes.size());
+	int radixSortSweepThreadCountMax = NextPowerOfTwo32(ROUNDUP_DIVISION(leafPerTreeMax, PT_BUILDBVH_ENTRY_PER_THREAD));
+	// maximum thread group per dispatch is 65535 for D3D
+	fatalAssertf(radixSortSweepThreadCountMax <= PT_RADIXSORT_SWEEP_THREAD_PER_THREADGROUP * 65535, "Sweep operation can't be finished in 1 dispatch with the current thread count %d, we can only dispatch 65535 thread groups for each dispatch!", radixSortSweepThreadCountMax);
+	sMeshBvhBuffer.GrowElementCount(meshBvhPerScene);
+	sTempBvhBuffer.GrowElementCount(bvhPerSceneMax);
+	sAabbProxyBuffer.GrowElementCount(leafPerTreeMax);
+	sSortedAabbProxyBuffer.GrowElementCount(leafPerTreeMax);
+	sRadixSortBitCountArrayBuffer.GrowElementCount(leafPerTreeMax);
+	sRadixSortPrefixSumAuxArrayBuffer.GrowElementCount(radixSortSweepThreadCountMax);
+}
+
+bool PathTracer::ReadBvhBuilderArg()
+{
+	string bvhBuilder;
+	if (!PARAM_bvhBuilder.GetAsString(bvhBuilder))
+		return true;
+	if (bvhBuilder == "sah")
+		sBvhBuilderType = BvhBuilderTypeSAH;
+	else if (bvhBuilder == "lbvh")
+		sBvhBuilderType = BvhBuilderTypeLBVH;
+	else
+	{
+		fprintf(stderr, "unknown bvh builder %s, expecting lbvh or sah\n", bvhBuilder.c_str());
+		return false;
+	}
+	return true;
 }
 
 int PathTracer::AddMeshesFromPass(Pass& pass)
@@ -286,44 +472,114 @@ int PathTracer::AddMeshesFromPass(Pass& pass)
 	vector<Mesh*>& meshes = pass.GetMeshes();
 	for (u32 i = 0; i < meshes.size(); i++)
 	{
-		vector<Texture*>& meshTextures = meshes[i]->GetTextures();
-		u32 meshTextureCount = meshTextures.size();
+		const int triangleCount = AddMesh(meshes[i], meshes[i]->mObjectUniform.mModel, meshes[i]->mObjectUniform.mModelInv);
+		if (triangleCount > trianglePerMeshMax)
+			trianglePerMeshMax = triangleCount;
+	}
+	return trianglePerMeshMax;
+}
+
+u32 PathTracer::AddMaterial(Mesh* mesh, Texture* albedoTexture, u32 albedoTextureIndex)
+{
+	MaterialPT material = {};
+	material.mMaterialType = mesh->GetMaterialType();
+	material.mAlbedo = mesh->GetAlbedo();
+	material.mRoughness = mesh->mObjectUniform.mRoughness;
+	material.mFresnel = mesh->mObjectUniform.mFresnel;
+	material.mMetallic = mesh->mObjectUniform.mMetallic;
+	material.mAlbedoTextureIndex = albedoTexture ? albedoTextureIndex : INVALID_UINT32;
+	material.mUseSceneParameters = 0;
+	const XMFLOAT3 emissive = mesh->GetEmissive();
+	if (emissive.x > 0.0f || emissive.y > 0.0f || emissive.z > 0.0f)
+	{
+		// emitters don't reflect, BuildMeshLights turns them into lights
+		material = {};
+		material.mMaterialType = MATERIAL_TYPE_EMISSIVE;
+		material.mAlbedoTextureIndex = INVALID_UINT32;
+		albedoTexture = nullptr;
+	}
+	else if (material.mMaterialType == MATERIAL_TYPE_INVALID)
+	{
+		// meshes without a material follow the material parameters of the UI
+		material.mMaterialType = MATERIAL_TYPE_GGX;
+		material.mUseSceneParameters = 1;
+	}
+
+	// textures are per instance, so instances of the same texture still share one material
+	for (u32 i = 0; i < sMaterials.size(); i++)
+	{
+		const MaterialPT& other = sMaterials[i];
+		if (other.mMaterialType == material.mMaterialType &&
+			other.mAlbedo.x == material.mAlbedo.x && other.mAlbedo.y == material.mAlbedo.y && other.mAlbedo.z == material.mAlbedo.z &&
+			other.mRoughness == material.mRoughness &&
+			other.mFresnel == material.mFresnel &&
+			other.mMetallic == material.mMetallic &&
+			other.mUseSceneParameters == material.mUseSceneParameters &&
+			sMaterialAlbedoTextures[i] == albedoTexture)
+			return i;
+	}
+	fatalAssertf(sMaterials.size() < PT_MATERIAL_COUNT_MAX, "more than %d unique materials, the wavefront material sort has a bucket per material", PT_MATERIAL_COUNT_MAX);
+	sMaterials.push_back(material);
+	sMaterialAlbedoTextures.push_back(albedoTexture);
+	sMaterialBuffer.GrowElementCount(sMaterials.size());
+	return sMaterials.size() - 1;
+}
+
+int PathTracer::AddMesh(Mesh* mesh, const XMFLOAT4X4& model, const XMFLOAT4X4& modelInv)
+{
+	const u32 meshIndex = sMeshes.size();
+	MeshPT mpt;
+	mpt.mModel = model;
+	mpt.mModelInv = modelInv;
+	mpt.mEmissive = mesh->GetEmissive();
+	mpt.mRootTriangleBvhIndexLocal = INVALID_UINT32;
+
+	// textures are per instance, only the first one (albedo) is read by the path tracer
+	vector<Texture*>& meshTextures = mesh->GetTextures();
+	mpt.mTextureIndexOffset = sMeshTextureCount;
+	mpt.mTextureCount = meshTextures.size();
+	sMeshTextureCount += meshTextures.size();
+	for (u32 i = 0; i < meshTextures.size(); i++)
+	{
+		sPathTracerPass.AddTexture(meshTextures[i]);
+		for (u32 j = 0; j < PT_MAXDEPTH_MAX; j++)
+			sPathTracerWavefrontShadePass[j].AddTexture(meshTextures[i]);
+	}
+	mpt.mMaterialIndex = AddMaterial(mesh, meshTextures.empty() ? nullptr : meshTextures[0], mpt.mTextureIndexOffset);
+	mpt.mMaterialType = sMaterials[mpt.mMaterialIndex].mMaterialType;
 
-		// triangles
+	// a mesh with the same vertices and indices as an earlier one is an instance of it, it only adds a transform
+	const u64 geometryHash = mesh->GetGeometryHash();
+	const auto owner = sMeshGeometryHashToOwner.find(geometryHash);
+	if (owner != sMeshGeometryHashToOwner.end() && mesh->HasSameGeometry(*sMeshSources[owner->second]))
+	{
+		const MeshPT& ownerMesh = sMeshes[owner->second];
+		mpt.mTriangleCount = ownerMesh.mTriangleCount;
+		mpt.mTriangleIndexLocalToGlobalOffset = ownerMesh.mTriangleIndexLocalToGlobalOffset;
+		mpt.mTriangleBvhIndexLocalToGlobalOffset = ownerMesh.mTriangleBvhIndexLocalToGlobalOffset;
+		sMeshGeometryOwners.push_back(owner->second);
+	}
+	else
+	{
 		vector<TrianglePT> triangles;
-		meshes[i]->ConvertMeshToTrianglesPT(triangles, sMeshes.size());
-
-		if (triangles.size() > trianglePerMeshMax)
-			trianglePerMeshMax = triangles.size();
-
-		// meshes
-		MeshPT mpt;
-		mpt.mModel = meshes[i]->mObjectUniform.mModel;
-		mpt.mModelInv = meshes[i]->mObjectUniform.mModelInv;
-		mpt.mMaterialType = MATERIAL_TYPE_GGX; // TODO: change this to an actual per object attribute
-		mpt.mEmissive = XMFLOAT3(0.0f, 0.0f, 0.0f);
-		mpt.mRoughness = 0.0f;
-		mpt.mFresnel = 0.0f;
-		mpt.mMetallic = 0.0f;
+		mesh->ConvertMeshToTrianglesPT(triangles, meshIndex);
 		mpt.mTriangleCount = triangles.size();
 		mpt.mTriangleIndexLocalToGlobalOffset = sTriangles.size();
-		mpt.mTriangleBvhIndexLocalToGlobalOffset = sTriangles.size() - sMeshes.size(); // for each mesh we have, there is 1 fewer entry for bvh than for triangle
-		mpt.mRootTriangleBvhIndexLocal = INVALID_UINT32;
-		mpt.mTextureIndexOffset = sMeshTextureCount;
-		mpt.mTextureCount = meshTextureCount;
-		sMeshTextureCount += meshTextureCount;
-		for (int j = 0; j < meshTextureCount; j++)
-			sPathTracerPass.AddTexture(meshTextures[j]);
-
-		// append
-		sMeshes.push_back(mpt);
+		mpt.mTriangleBvhIndexLocalToGlobalOffset = sTriangleBvhCount;
+		sTriangleBvhCount += triangles.size() - 1; // for each geometry we have, there is 1 fewer entry for bvh than for triangle
 		sTriangles.insert(sTriangles.end(), triangles.begin(), triangles.end());
-		fatalAssertf(sTriangles.size() < sTriangleBuffer.GetElementCount(), "triangle count %d exceeds structured buffer size %d, adjust PT_TOTAL_TRIANGLE_COUNT_MAX to a larger value", sTriangles.size(), PT_TRIANGLE_PER_SCENE_MAX);
-		fatalAssertf(sTriangleModelBVHs.size() < sTriangleBvhBuffer.GetElementCount(), "triangle BVH count %d exceeds structured buffer size %d, adjust PT_TOTAL_TRIANGLE_COUNT_MAX to a larger value", sTriangleModelBVHs.size(), PT_TRIANGLE_PER_SCENE_MAX);
-		fatalAssertf(sTriangles.size() < MAX_UINT32, "not sure how to index into a structured buffer which needs 64 bit integer to address"); // TODO: remove this limit
-		fatalAssertf(sTriangleModelBVHs.size() < MAX_UINT32, "not sure how to index into a structured buffer which needs 64 bit integer to address"); // TODO: remove this limit
+		fatalAssertf(sTriangles.size() < MAX_UINT32, "not sure how to index into a structured buffer which needs 64 bit integer to address");
+		sMeshGeometryOwners.push_back(meshIndex);
+		if (owner == sMeshGeometryHashToOwner.end())
+			sMeshGeometryHashToOwner[geometryHash] = meshIndex;
 	}
-	return trianglePerMeshMax;
+
+	sMeshes.push_back(mpt);
+	sMeshSources.push_back(mesh);
+	sTriangleBuffer.GrowElementCount(sTriangles.size());
+	sTriangleBvhBuffer.GrowElementCount(sTriangleBvhCount);
+	sMeshBuffer.GrowElementCount(sMeshes.size());
+	return mpt.mTriangleCount;
 }
 
 inline void CentroidOfAABB(const AABB& aabb, XMFLOAT3& centroid)
@@ -346,49 +602,165 @@ inline void TransformAABB(const XMFLOAT4X4& mat, const AABB& in, AABB& out)
 	XMStoreFloat3(&out.mMax, XMVectorMax(A, XMVectorMax(B, XMVectorMax(C, XMVectorMax(D, XMVectorMax(E, XMVectorMax(F, XMVectorMax(G, H))))))));
 }
 
+// on-disk triangle BVH of one mesh: header, BVH nodes, original triangle index of each leaf, Morton code of each leaf
+static const u32 BvhCacheMagic = 0x48564250; // "PBVH"
+static const u32 BvhCacheVersion = 3; // bump whenever a builder changes its output
+
+struct BvhCacheHeader
+{
+	u32 mMagic;
+	u32 mVersion;
+	u32 mBvhSize;
+	u32 mBuilderType;
+	u64 mContentHash;
+	u32 mLeafCount;
+	u32 mRootBvhIndexLocal;
+};
+
+inline size_t GetBvhCacheFileSize(u64 leafCount)
+{
+	return sizeof(BvhCacheHeader) + sizeof(BVH) * (leafCount - 1) + sizeof(u32) * leafCount * 2;
+}
+
+// FNV-1a over 32 bit words of the vertex data, the BVH only depends on the vertices and their order
+inline u64 HashTriangleVertices(const vector<TrianglePT>& triangles)
+{
+	u64 hash = 14695981039346656037ull;
+	for (const TrianglePT& triangle : triangles)
+	{
+		const u32* words = (const u32*)triangle.mVertices;
+		for (int i = 0; i < sizeof(triangle.mVertices) / sizeof(u32); i++)
+			hash = (hash ^ words[i]) * 1099511628211ull;
+	}
+	return hash;
+}
+
+// number of internal node levels on the longest path from the root, a depth first traversal never holds more entries than this
+inline u32 GetBvhHeight(const vector<BVH>& bvhGlobal, i64 bvhLocalToGlobalOffset, i64 rootBvhIndexLocal)
+{
+	u32 height = 0;
+	vector<pair<u32, u32>> stack; // local index, level
+	stack.push_back({ (u32)rootBvhIndexLocal, 1 });
+	while (!stack.empty())
+	{
+		const pair<u32, u32> entry = stack.back();
+		stack.pop_back();
+		height = MAX(height, entry.second);
+		const BVH& bvh = bvhGlobal[entry.first + bvhLocalToGlobalOffset];
+		if (!bvh.mLeftIsLeaf)
+			stack.push_back({ bvh.mLeftIndexLocal, entry.second + 1 });
+		if (!bvh.mRightIsLeaf)
+			stack.push_back({ bvh.mRightIndexLocal, entry.second + 1 });
+	}
+	return height;
+}
+
+// the shader traversal loops stop pushing once the stack reaches STACK_SIZE - 2, every tree has to stay below that
+static const u32 TriangleBvhHeightMax = PT_TRIANGLE_BVH_STACK_SIZE - 3;
+static const u32 MeshBvhHeightMax = PT_MESH_BVH_STACK_SIZE - 3;
+
+// the builders reorder the leaves, this keeps the index each triangle had before so the order can go into the triangle bvh cache
+struct TriangleLeafPT : TrianglePT
+{
+	u32 mSourceIndex;
+};
+
 void PathTracer::UpdateBvhCpu(Scene& scene)
 {
+	CpuTimer timer;
 	sTriangleModelBVHs.clear();
-	sMeshWorldBVHs.clear();
 
-	// process triangle BVH
-	for (int i = 0; i < sMeshes.size(); i++)
-	{
+	// process triangle BVH, every unique geometry owns a fixed range of the triangle and bvh arrays so they can be built independently
+	// instances point at the range of their owner and are not built again
+	sTriangleModelBVHs.resize(sTriangleBvhCount);
+	atomic<int> cacheHitCount(0);
+	auto buildTriangleBvh = [&](int i) {
 		MeshPT& mesh = sMeshes[i];
 		vector<TrianglePT> triangles(sTriangles.begin() + mesh.mTriangleIndexLocalToGlobalOffset, sTriangles.begin() + mesh.mTriangleIndexLocalToGlobalOffset + mesh.mTriangleCount);
-		fatalAssertf(mesh.mTriangleBvhIndexLocalToGlobalOffset == sTriangleModelBVHs.size(), "this should already be set");
-		mesh.mTriangleBvhIndexLocalToGlobalOffset = sTriangleModelBVHs.size();
-		mesh.mRootTriangleBvhIndexLocal = BuildBVH(triangles, sTriangleModelBVHs, i);
+		const u64 contentHash = sBvhCacheEnabled ? HashTriangleVertices(triangles) : 0;
+		if (sBvhCacheEnabled && LoadTriangleBvhCache(i, contentHash))
+		{
+			// caches written before the height bound may hold deeper trees, those are built again
+			const bool shallowEnough = GetBvhHeight(sTriangleModelBVHs, mesh.mTriangleBvhIndexLocalToGlobalOffset, mesh.mRootTriangleBvhIndexLocal) <= TriangleBvhHeightMax;
+			if (verifyf(shallowEnough, "triangle bvh cache of mesh %d is too deep for the traversal stack, building it again", i))
+			{
+				cacheHitCount++;
+				return;
+			}
+		}
+		vector<TriangleLeafPT> leaves(triangles.size());
+		for (u32 j = 0; j < triangles.size(); j++)
+		{
+			static_cast<TrianglePT&>(leaves[j]) = triangles[j];
+			leaves[j].mSourceIndex = j;
+		}
+		vector<BVH> bvhLocal;
+		mesh.mRootTriangleBvhIndexLocal = BuildBVH(leaves, bvhLocal, TriangleBvhHeightMax, i);
+		vector<u32> leafToTriangle(triangles.size());
+		for (u32 j = 0; j < triangles.size(); j++)
+		{
+			leafToTriangle[j] = leaves[j].mSourceIndex;
+			triangles[j] = leaves[j];
+		}
+		fatalAssertf(mesh.mTriangleBvhIndexLocalToGlobalOffset + bvhLocal.size() <= sTriangleModelBVHs.size(), "triangle bvh of mesh %d overflows its range", i);
+		copy(bvhLocal.begin(), bvhLocal.end(), sTriangleModelBVHs.begin() + mesh.mTriangleBvhIndexLocalToGlobalOffset);
 		copy(triangles.begin(), triangles.end(), sTriangles.begin() + mesh.mTriangleIndexLocalToGlobalOffset);
-	}
-
-	// process mesh BVH
-	vector<AabbProxy> meshProxies;
+		if (sBvhCacheEnabled)
+			SaveTriangleBvhCache(i, contentHash, leafToTriangle);
+	};
+	// large meshes spread their own build over all threads, small meshes are built in parallel with each other
+	vector<int> smallMeshes;
+	int ownerCount = 0;
 	for (int i = 0; i < sMeshes.size(); i++)
 	{
-		AabbProxy meshProxy;
-		XMFLOAT3 centroid;
-		TransformAABB(sMeshes[i].mModel, sTriangleModelBVHs[sMeshes[i].mRootTriangleBvhIndexLocal + sMeshes[i].mTriangleBvhIndexLocalToGlobalOffset].mAABB, meshProxy.mAABB);
-		CentroidOfAABB(meshProxy.mAABB, centroid);
-		meshProxy.mOriginalIndex = i;
-		meshProxy.mMortonCode = Mesh::GenerateMortonCode(centroid);
-		meshProxies.push_back(meshProxy);
+		if (sMeshGeometryOwners[i] != i)
+			continue;
+		ownerCount++;
+		if (sBvhBuildMultithreaded && sMeshes[i].mTriangleCount < PT_BVH_PARALLEL_BUILD_LEAF_MIN)
+			smallMeshes.push_back(i);
+		else
+			buildTriangleBvh(i);
 	}
-	sMeshBvhRootIndexGlobal = BuildBVH(meshProxies, sMeshWorldBVHs); // we look up actual indices through proxies so no need to overwrite mesh vector like we do for triangle vector to keep the new order
-
-	// correct mesh index for mesh BVH
-	for (int i = 0; i < sMeshWorldBVHs.size(); i++)
+	ThreadPool::ParallelFor(smallMeshes.size(), 1, [&](i64 begin, i64 end, u32) {
+		for (i64 i = begin; i < end; i++)
+			buildTriangleBvh(smallMeshes[i]);
+	});
+
+	// traversal stacks are bounded by the real height of each tree
+	sTriangleBvhHeights.resize(sMeshes.size());
+	ThreadPool::ParallelFor(sMeshes.size(), 1, [](i64 begin, i64 end, u32) {
+		for (i64 i = begin; i < end; i++)
+		{
+			if (sMeshGeometryOwners[i] == i)
+				sTriangleBvhHeights[i] = GetBvhHeight(sTriangleModelBVHs, sMeshes[i].mTriangleBvhIndexLocalToGlobalOffset, sMeshes[i].mRootTriangleBvhIndexLocal);
+		}
+	});
+	for (int i = 0; i < sMeshes.size(); i++)
 	{
-		if (sMeshWorldBVHs[i].mLeftIsLeaf)
-			sMeshWorldBVHs[i].mLeftIndexLocal = meshProxies[sMeshWorldBVHs[i].mLeftIndexLocal].mOriginalIndex;
-		if (sMeshWorldBVHs[i].mRightIsLeaf)
-			sMeshWorldBVHs[i].mRightIndexLocal = meshProxies[sMeshWorldBVHs[i].mRightIndexLocal].mOriginalIndex;
+		const u32 owner = sMeshGeometryOwners[i];
+		sMeshes[i].mRootTriangleBvhIndexLocal = sMeshes[owner].mRootTriangleBvhIndexLocal;
+		sTriangleBvhHeights[i] = sTriangleBvhHeights[owner];
 	}
+	for (int i = 0; i < sMeshes.size(); i++)
+		fatalAssertf(sTriangleBvhHeights[i] <= TriangleBvhHeightMax, "triangle bvh of mesh %d is %u levels deep, the shader traversal stack only holds %d entries", i, sTriangleBvhHeights[i], PT_TRIANGLE_BVH_STACK_SIZE);
+
+	// process mesh BVH
+	BuildMeshBvhCpu();
 
 	scene.mSceneUniform.mPathTracerMeshBvhCount = sMeshWorldBVHs.size();
 	scene.mSceneUniform.mPathTracerTriangleBvhCount = sTriangleModelBVHs.size();
 	scene.mSceneUniform.mPathTracerMeshBvhRootIndex = sMeshBvhRootIndexGlobal;
 	scene.SetUniformDirty();
+	sBvhBuildMilliseconds = timer.GetMilliseconds();
+	displayfln("update bvh cpu took %f ms, %d of %d triangle bvhs loaded from cache, %d instances share them", sBvhBuildMilliseconds, (int)cacheHitCount, ownerCount, (int)sMeshes.size() - ownerCount);
+}
+
+// every thread that owns entries needs a slot in the prefix sum, the last one included when the leaf count isn't a multiple of the entries per thread
+inline void GetRadixSortDispatchSizes(int leafCount, int& dispatchCount, int& sweepThreadCount, int& sweepDepthCount)
+{
+	dispatchCount = ceil((float)leafCount / PT_BUILDBVH_ENTRY_PER_DISPATCH);
+	sweepThreadCount = NextPowerOfTwo32(ROUNDUP_DIVISION(leafCount, PT_BUILDBVH_ENTRY_PER_THREAD));
+	sweepDepthCount = log2(sweepThreadCount);
 }
 
 void PathTracer::UpdateBvhGpuCommon(CommandList commandList, Scene& scene, BuildBvhType buildBvhType)
@@ -413,13 +785,17 @@ void PathTracer::UpdateBvhGpuCommon(CommandList commandList, Scene& scene, Build
 	int iterationCount = buildBvhType == BuildBvhType::BuildBvhTypeTriangle ? sMeshes.size() : 1;
 	for (int i = 0; i < iterationCount; i++)
 	{
+		// instances share the triangle BVH of their owner, the update pass hands them its root
+		if (buildBvhType == BuildBvhType::BuildBvhTypeTriangle && sMeshGeometryOwners[i] != i)
+			continue;
 		GPU_LABEL(commandList, "UpdateBvhGpu for entry %d", i);
 
 		int leafCount = buildBvhType == BuildBvhType::BuildBvhTypeTriangle ? sMeshes[i].mTriangleCount : sMeshes.size();
 		const int buildBvhDispatchCount = ceil((float)leafCount / PT_BUILDBVH_ENTRY_PER_DISPATCH);
-		const int radixSortDispatchCount = ceil((float)leafCount / PT_BUILDBVH_ENTRY_PER_DISPATCH);
-		const int radixSortSweepThreadCount = NextPowerOfTwo32(leafCount / PT_BUILDBVH_ENTRY_PER_THREAD);
-		const int radixSortSweepDepthCount = log2(radixSortSweepThreadCount);
+		int radixSortDispatchCount = 0;
+		int radixSortSweepThreadCount = 0;
+		int radixSortSweepDepthCount = 0;
+		GetRadixSortDispatchSizes(leafCount, radixSortDispatchCount, radixSortSweepThreadCount, radixSortSweepDepthCount);
 		fatalAssert(buildBvhDispatchCount > 0);
 		fatalAssert(radixSortDispatchCount > 0);
 		fatalAssert(radixSortSweepThreadCount > 0);
@@ -620,9 +996,10 @@ void PathTracer::UpdateBvhGpu(CommandList commandList, Scene& scene)
 {
 	UpdateTriangleBvhGpu(commandList, scene);
 	UpdateMeshBvhGpu(commandList, scene);
+	sMeshModelAABBs.clear(); // the CPU takes the mesh BVH over from this build the next time a mesh moves
 
 	scene.mSceneUniform.mPathTracerMeshBvhCount = sMeshes.size() - 1;
-	scene.mSceneUniform.mPathTracerTriangleBvhCount = sTriangles.size() - sMeshes.size();
+	scene.mSceneUniform.mPathTracerTriangleBvhCount = sTriangleBvhCount;
 	scene.mSceneUniform.mPathTracerMeshBvhRootIndex = INVALID_UINT32;
 	scene.SetUniformDirty();
 }
@@ -668,7 +1045,7 @@ void PrintBvhNode(const vector<BVH>& bvhsGlobal, const vector<T_LeafNode>& leafN
 	const i64 bvhGlobalIndex = localIndex + bvhLocalToGlobalOffset;
 	const BVH& bvh = bvhsGlobal[bvhGlobalIndex];
 	PrintSpaces(depth); 
-	displayf("bvh global index: %ld, ", bvhGlobalIndex); 
+	displayf("bvh global index: %lld, ", bvhGlobalIndex); 
 	PrintAABB(bvh.mAABB);
 	displayf("\n");
 	depth++;
@@ -708,6 +1085,8 @@ void PathTracer::PrintBVH()
 	displayfln(">>> Triangle BVH <<<");
 	for (int i = 0; i < sMeshes.size(); i++)
 	{
+		if (sMeshGeometryOwners[i] != i)
+			continue;
 		const MeshPT& mesh = sMeshes[i];
 		PrintBvhNode(sTriangleModelBVHs, sTriangles, mesh.mRootTriangleBvhIndexLocal, mesh.mTriangleBvhIndexLocalToGlobalOffset, mesh.mTriangleIndexLocalToGlobalOffset);
 	}
@@ -723,16 +1102,27 @@ void PathTracer::PreparePathTracer(CommandList commandList, Scene& scene)
 
 	sPathTracerPass.UpdateAllUniformBuffers();
 
+	for (PassPathTracer* pass : sPathTracerWavefrontPasses)
+	{
+		pass->mPassUniform.mTriangleCountPT = sTriangles.size();
+		pass->mPassUniform.mMeshCountPT = sMeshes.size();
+		pass->mPassUniform.mLightCountPT = sLightData.size();
+		pass->UpdateAllUniformBuffers();
+	}
+
 	sTriangleBuffer.SetBufferData(sTriangles.data(), sizeof(TrianglePT) * sTriangles.size());
 	sMeshBuffer.SetBufferData(sMeshes.data(), sizeof(MeshPT) * sMeshes.size());
 	sTriangleBvhBuffer.SetBufferData(sTriangleModelBVHs.data(), sizeof(BVH) * sTriangleModelBVHs.size());
 	sMeshBvhBuffer.SetBufferData(sMeshWorldBVHs.data(), sizeof(BVH) * sMeshWorldBVHs.size());
 	sLightDataBuffer.SetBufferData(sLightData.data(), sizeof(LightData) * sLightData.size());
+	sLightBvhBuffer.SetBufferData(sLightBvhNodes.data(), sizeof(LightBvhNode) * sLightBvhNodes.size());
+	sLightAliasBuffer.SetBufferData(sLightAliasEntries.data(), sizeof(AliasEntry) * sLightAliasEntries.size());
+	sMaterialBuffer.SetBufferData(sMaterials.data(), sizeof(MaterialPT) * sMaterials.size());
 	sRayBuffer.RecordSetBufferData(commandList, nullptr, sizeof(Ray) * sBackbufferWidth * sBackbufferHeight);
 	sDebugRayBuffer.RecordSetBufferData(commandList, nullptr, sizeof(Ray) * PT_MAXDEPTH_MAX);
 	sRadixSortPrefixSumAuxArrayBuffer.SetBufferData(nullptr, 0);
 
-	if (PARAM_buildBvhGpu.Get())
+	if (sBvhBuildGpu)
 	{
 		UpdateBvhGpu(commandList, scene);
 	}
@@ -740,17 +1130,127 @@ void PathTracer::PreparePathTracer(CommandList commandList, Scene& scene)
 	GPU_LABEL_END(commandList);
 }
 
+void PathTracer::UploadMeshDataIfDirty(CommandList commandList)
+{
+	if (sMeshDataDirty)
+	{
+		sMeshBuffer.RecordSetBufferData(commandList, sMeshes.data(), sizeof(MeshPT) * sMeshes.size());
+		// mesh lights follow their meshes
+		sLightDataBuffer.RecordSetBufferData(commandList, sLightData.data(), sizeof(LightData) * sLightData.size());
+		sLightBvhBuffer.RecordSetBufferData(commandList, sLightBvhNodes.data(), sizeof(LightBvhNode) * sLightBvhNodes.size());
+		sLightAliasBuffer.RecordSetBufferData(commandList, sLightAliasEntries.data(), sizeof(AliasEntry) * sLightAliasEntries.size());
+		// the mesh BVH is always refitted on the CPU, with -buildBvhGpu too, see BuildMeshBvhCpuFromGpu
+		sMeshBvhBuffer.RecordSetBufferData(commandList, sMeshWorldBVHs.data(), sizeof(BVH) * sMeshWorldBVHs.size());
+		sMeshDataDirty = false;
+	}
+}
+
 void PathTracer::RunPathTracer(CommandList commandList)
 {
+	UploadMeshDataIfDirty(commandList);
 	sBackbufferPT.MakeReadyToWrite(commandList);
 	sDepthbufferWritePT.MakeReadyToWrite(commandList);
+	sConvergencePT.MakeReadyToWrite(commandList);
+	sNormalDepthPT.MakeReadyToWrite(commandList);
+	sAlbedoPT.MakeReadyToWrite(commandList);
 	sDebugRayBuffer.MakeReadyToWrite(commandList);
+	sAdaptiveTileErrorBuffer.MakeReadyToWriteAuto(commandList);
 	gRenderer.RecordComputePass(
 		sPathTracerPass, 
 		commandList, 
 		gSceneDefault.mSceneUniform.mPathTracerThreadGroupPerTileX,
 		gSceneDefault.mSceneUniform.mPathTracerThreadGroupPerTileY,
 		1);
+	RecordAdaptiveTileErrors(commandList);
+}
+
+void PathTracer::RunPathTracerWavefront(CommandList commandList)
+{
+	GPU_LABEL_BEGIN(commandList, "PathTracer Wavefront");
+
+	UploadMeshDataIfDirty(commandList);
+	// queue sizes stay on the GPU, so every bounce up to the max depth is dispatched for the whole screen
+	// and the threads past the queue counter return right away
+	const u32 pathThreadGroupCount = PT_WAVEFRONT_PATH_COUNT / PT_WAVEFRONT_THREAD_PER_THREADGROUP;
+	const u32 shadowThreadGroupCount = pathThreadGroupCount * PT_WAVEFRONT_SHADOW_RAY_PER_PATH;
+	const u32 maxDepth = MIN(gSceneDefault.mSceneUniform.mPathTracerMaxDepth, (u32)PT_MAXDEPTH_MAX);
+	fatalAssertf(shadowThreadGroupCount <= 65535, "we can only dispatch 65535 thread groups for each dispatch!");
+	WriteBuffer* wavefrontBuffers[] = { &sWavefrontPathBuffer, &sWavefrontRayQueueBuffer, &sWavefrontHitQueueBuffer, &sWavefrontShadowQueueBuffer, &sWavefrontQueueCounterBuffer, &sAdaptiveTileErrorBuffer, &sWavefrontHitOrderBuffer };
+	auto makeReadyForNextStage = [&]()
+	{
+		for (WriteBuffer* buffer : wavefrontBuffers)
+			buffer->MakeReadyToWriteAuto(commandList);
+	};
+	sBackbufferPT.MakeReadyToWrite(commandList);
+	sDepthbufferWritePT.MakeReadyToWrite(commandList);
+	sConvergencePT.MakeReadyToWrite(commandList);
+	sNormalDepthPT.MakeReadyToWrite(commandList);
+	sAlbedoPT.MakeReadyToWrite(commandList);
+	makeReadyForNextStage();
+	gRenderer.RecordComputePass(sPathTracerWavefrontGeneratePass, commandList, pathThreadGroupCount, 1, 1);
+	for (u32 i = 0; i < maxDepth; i++)
+	{
+		makeReadyForNextStage();
+		gRenderer.RecordComputePass(sPathTracerWavefrontExtendPass[i], commandList, pathThreadGroupCount, 1, 1);
+		makeReadyForNextStage();
+		if (gSceneDefault.mSceneUniform.mPathTracerWavefrontSortByMaterial)
+		{
+			gRenderer.RecordComputePass(sPathTracerWavefrontSortPass[i], commandList, pathThreadGroupCount, 1, 1);
+			makeReadyForNextStage();
+		}
+		gRenderer.RecordComputePass(sPathTracerWavefrontShadePass[i], commandList, pathThreadGroupCount, 1, 1);
+		makeReadyForNextStage();
+		gRenderer.RecordComputePass(sPathTracerWavefrontConnectPass[i], commandList, shadowThreadGroupCount, 1, 1);
+	}
+	makeReadyForNextStage();
+	gRenderer.RecordComputePass(sPathTracerWavefrontAccumulatePass, commandList, pathThreadGroupCount, 1, 1);
+	RecordAdaptiveTileErrors(commandList);
+
+	GPU_LABEL_END(commandList);
+}
+
+void PathTracer::RecordAdaptiveTileErrors(CommandList commandList)
+{
+	if (!gSceneDefault.mSceneUniform.mPathTracerAdaptiveSampling)
+		return;
+	// the next frame skips tiles with these errors on the GPU, the CPU reads them back to decide when the image is done
+	sConvergencePT.MakeReadyToWriteAgain(commandList);
+	sAdaptiveTileErrorBuffer.MakeReadyToWriteAuto(commandList);
+	gRenderer.RecordComputePass(sPathTracerAdaptiveTileErrorPass, commandList, PT_ADAPTIVE_TILE_COUNT_X, PT_ADAPTIVE_TILE_COUNT_Y, 1);
+	sAdaptiveTileErrorBuffer.RecordPrepareToGetBufferData(commandList);
+}
+
+void PathTracer::ReadAdaptiveTileErrors(Scene& scene)
+{
+	const SceneUniform& sceneUniform = scene.mSceneUniform;
+	sAdaptiveGlobalError = 1.0f;
+	sAdaptiveActiveTileCount = PT_ADAPTIVE_TILE_COUNT;
+	if (!sceneUniform.mPathTracerAdaptiveSampling)
+		return;
+	sAdaptiveTileErrorBuffer.GetReadbackBufferData(sAdaptiveTileErrors.data(), sizeof(float) * PT_ADAPTIVE_TILE_ERROR_BUFFER_SIZE);
+	u32 frame;
+	memcpy(&frame, &sAdaptiveTileErrors[PT_ADAPTIVE_TILE_ERROR_FRAME], sizeof(u32));
+	// errors measured before the last restart belong to another image, pixels below the min sample count report an error of 1 on their own
+	if (frame <= sAdaptiveRestartFrame)
+		return;
+	float errorSum = 0.0f;
+	u32 activeTileCount = 0;
+	for (u32 i = 0; i < PT_ADAPTIVE_TILE_COUNT; i++)
+	{
+		errorSum += sAdaptiveTileErrors[i];
+		if (sAdaptiveTileErrors[i] >= sceneUniform.mPathTracerAdaptiveErrorThreshold)
+			activeTileCount++;
+	}
+	sAdaptiveGlobalError = errorSum / PT_ADAPTIVE_TILE_COUNT;
+	sAdaptiveActiveTileCount = activeTileCount;
+}
+
+bool PathTracer::IsAdaptiveTargetErrorReached(Scene& scene)
+{
+	const SceneUniform& sceneUniform = scene.mSceneUniform;
+	return sceneUniform.mPathTracerAdaptiveSampling &&
+		sceneUniform.mPathTracerCurrentSampleIndex >= MAX(sceneUniform.mPathTracerAdaptiveSampleCountMin, (u32)PT_ADAPTIVE_SAMPLE_COUNT_MIN) &&
+		sAdaptiveGlobalError <= sceneUniform.mPathTracerAdaptiveTargetError;
 }
 
 void PathTracer::CopyDepthBuffer(CommandList commandList)
@@ -781,6 +1281,10 @@ void PathTracer::Restart(Scene& scene)
 	scene.mSceneUniform.mPathTracerCurrentTileIndex = 0;
 	scene.mSceneUniform.mPathTracerCurrentSampleIndex = 0;
 	scene.mSceneUniform.mPathTracerCurrentDepth = 0;
+	sAdaptiveRestartFrame = gRenderer.mFrameCountSinceGameStart;
+	sAdaptiveGlobalError = 1.0f;
+	sAdaptiveActiveTileCount = PT_ADAPTIVE_TILE_COUNT;
+	Denoiser::Restart();
 }
 
 template<class T_LeafNode>
@@ -831,124 +1335,2265 @@ inline void InitAABB(const AabbProxy& meshProxyIn, AABB& aabbOut)
 	aabbOut = meshProxyIn.mAABB;
 }
 
+inline void InitEmptyAABB(AABB& aabb)
+{
+	aabb.mMin = XMFLOAT3(FLOAT_MAX, FLOAT_MAX, FLOAT_MAX);
+	aabb.mMax = XMFLOAT3(-FLOAT_MAX, -FLOAT_MAX, -FLOAT_MAX);
+}
+
+inline void GrowAABB(AABB& aabb, const XMFLOAT3& point)
+{
+	XMStoreFloat3(&aabb.mMin, XMVectorMin(XMLoadFloat3(&aabb.mMin), XMLoadFloat3(&point)));
+	XMStoreFloat3(&aabb.mMax, XMVectorMax(XMLoadFloat3(&aabb.mMax), XMLoadFloat3(&point)));
+}
+
+inline float SurfaceAreaOfAABB(const AABB& aabb)
+{
+	XMFLOAT3 extent;
+	XMStoreFloat3(&extent, XMVectorMax(XMLoadFloat3(&aabb.mMax) - XMLoadFloat3(&aabb.mMin), XMVectorZero()));
+	return 2.0f * (extent.x * extent.y + extent.y * extent.z + extent.z * extent.x);
+}
+
+inline float GetAxis(const XMFLOAT3& v, int axis)
+{
+	return axis == 0 ? v.x : (axis == 1 ? v.y : v.z);
+}
+
+template<class T_LeafNode>
+float ComputeSahCost(const vector<BVH>& bvhGlobal, i64 bvhLocalToGlobalOffset, i64 bvhCount, const vector<T_LeafNode>& leafGlobal, i64 leafLocalToGlobalOffset, i64 rootBvhIndexLocal)
+{
+	// C = (Ct * sum(SA(inner)) + Ci * sum(SA(leaf) * N(leaf))) / SA(root), every leaf holds exactly 1 primitive
+	const float rootArea = SurfaceAreaOfAABB(bvhGlobal[rootBvhIndexLocal + bvhLocalToGlobalOffset].mAABB);
+	if (rootArea <= 0.0f)
+		return 0.0f;
+	double cost = 0.0;
+	AABB leafAABB;
+	for (i64 i = 0; i < bvhCount; i++)
+	{
+		const BVH& bvh = bvhGlobal[i + bvhLocalToGlobalOffset];
+		cost += PT_SAH_TRAVERSAL_COST * SurfaceAreaOfAABB(bvh.mAABB);
+		if (bvh.mLeftIsLeaf)
+		{
+			InitAABB(leafGlobal[bvh.mLeftIndexLocal + leafLocalToGlobalOffset], leafAABB);
+			cost += PT_SAH_INTERSECTION_COST * SurfaceAreaOfAABB(leafAABB);
+		}
+		if (bvh.mRightIsLeaf)
+		{
+			InitAABB(leafGlobal[bvh.mRightIndexLocal + leafLocalToGlobalOffset], leafAABB);
+			cost += PT_SAH_INTERSECTION_COST * SurfaceAreaOfAABB(leafAABB);
+		}
+	}
+	return cost / rootArea;
+}
+
+template<class T_LeafNode>
+void RefitBVH(vector<BVH>& bvhGlobal, i64 bvhLocalToGlobalOffset, i64 rootBvhIndexLocal, const vector<T_LeafNode>& leafGlobal, i64 leafLocalToGlobalOffset)
+{
+	// keep the topology and merge the children of every node again, nodes are collected top down so walking the list backwards visits children before parents
+	vector<u32> nodes;
+	stack<u32> pending;
+	pending.push(rootBvhIndexLocal);
+	while (!pending.empty())
+	{
+		const u32 current = pending.top();
+		pending.pop();
+		nodes.push_back(current);
+		const BVH& bvh = bvhGlobal[current + bvhLocalToGlobalOffset];
+		if (!bvh.mLeftIsLeaf)
+			pending.push(bvh.mLeftIndexLocal);
+		if (!bvh.mRightIsLeaf)
+			pending.push(bvh.mRightIndexLocal);
+	}
+	for (auto it = nodes.rbegin(); it != nodes.rend(); it++)
+	{
+		BVH& bvh = bvhGlobal[*it + bvhLocalToGlobalOffset];
+		AABB lAABB;
+		AABB rAABB;
+		if (bvh.mLeftIsLeaf)
+			InitAABB(leafGlobal[bvh.mLeftIndexLocal + leafLocalToGlobalOffset], lAABB);
+		else
+			lAABB = bvhGlobal[bvh.mLeftIndexLocal + bvhLocalToGlobalOffset].mAABB;
+		if (bvh.mRightIsLeaf)
+			InitAABB(leafGlobal[bvh.mRightIndexLocal + leafLocalToGlobalOffset], rAABB);
+		else
+			rAABB = bvhGlobal[bvh.mRightIndexLocal + bvhLocalToGlobalOffset].mAABB;
+		MergeAABB(lAABB, rAABB, bvh.mAABB);
+	}
+}
+
+inline bool AabbEncloses(const AABB& outer, const AABB& inner)
+{
+	return outer.mMin.x <= inner.mMin.x && outer.mMin.y <= inner.mMin.y && outer.mMin.z <= inner.mMin.z &&
+		outer.mMax.x >= inner.mMax.x && outer.mMax.y >= inner.mMax.y && outer.mMax.z >= inner.mMax.z;
+}
+
+// returns the number of nodes whose AABB does not enclose the AABB of both children
+template<class T_LeafNode>
+i64 ValidateBvhBounds(const vector<BVH>& bvhGlobal, i64 bvhLocalToGlobalOffset, i64 bvhCount, const vector<T_LeafNode>& leafGlobal, i64 leafLocalToGlobalOffset)
+{
+	i64 errorCount = 0;
+	AABB childAABB;
+	for (i64 i = 0; i < bvhCount; i++)
+	{
+		const BVH& bvh = bvhGlobal[i + bvhLocalToGlobalOffset];
+		if (bvh.mLeftIsLeaf)
+			InitAABB(leafGlobal[bvh.mLeftIndexLocal + leafLocalToGlobalOffset], childAABB);
+		else
+			childAABB = bvhGlobal[bvh.mLeftIndexLocal + bvhLocalToGlobalOffset].mAABB;
+		bool valid = AabbEncloses(bvh.mAABB, childAABB);
+		if (bvh.mRightIsLeaf)
+			InitAABB(leafGlobal[bvh.mRightIndexLocal + leafLocalToGlobalOffset], childAABB);
+		else
+			childAABB = bvhGlobal[bvh.mRightIndexLocal + bvhLocalToGlobalOffset].mAABB;
+		valid = valid && AabbEncloses(bvh.mAABB, childAABB);
+		if (!valid)
+			errorCount++;
+	}
+	return errorCount;
+}
+
+// runs functor(begin, end, threadIndex) over [begin, end) split into a few chunks per thread, or in one go on this thread
+template<typename Functor>
+inline void ParallelRange(bool parallel, i64 begin, i64 end, Functor functor)
+{
+	if (!parallel)
+	{
+		functor(begin, end, 0);
+		return;
+	}
+	const i64 grainSize = RoundUpDivide<i64>(end - begin, ThreadPool::GetThreadCount() * 4);
+	ThreadPool::ParallelFor(end - begin, grainSize, [&](i64 b, i64 e, u32 threadIndex) { functor(begin + b, begin + e, threadIndex); });
+}
+
+// both sorts are stable, leaves with equal morton codes keep their original order so the serial and the parallel build match
+template<class T_LeafNode>
+void SortLeavesByMortonCode(vector<T_LeafNode>& leafLocal, bool parallel)
+{
+	if (!parallel)
+	{
+		std::stable_sort(leafLocal.begin(), leafLocal.end(), [](const T_LeafNode& a, const T_LeafNode& b)->bool { return a.mMortonCode > b.mMortonCode; });
+		return;
+	}
+
+	// stable LSD radix sort in descending order, the result does not depend on how the work is split between threads
+	const i64 leafCount = leafLocal.size();
+	const i64 bucketCount = 1 << PT_BVH_RADIXSORT_BIT_PER_PASS;
+	const i64 blockCount = parallel ? ThreadPool::GetThreadCount() * 4 : 1;
+	const i64 blockSize = RoundUpDivide<i64>(leafCount, blockCount);
+	vector<u32> keys(leafCount);
+	vector<u32> order(leafCount);
+	vector<u32> keysTemp(leafCount);
+	vector<u32> orderTemp(leafCount);
+	vector<u32> offsets(blockCount * bucketCount);
+	ParallelRange(parallel, 0, leafCount, [&](i64 begin, i64 end, u32) {
+		for (i64 i = begin; i < end; i++)
+		{
+			keys[i] = ~leafLocal[i].mMortonCode; // ascending order of the complement is descending order of the key
+			order[i] = i;
+		}
+	});
+	for (u32 shift = 0; shift < PT_RADIXSORT_BIT_PER_ENTRY; shift += PT_BVH_RADIXSORT_BIT_PER_PASS)
+	{
+		// 1. histogram per block
+		fill(offsets.begin(), offsets.end(), 0);
+		ThreadPool::ParallelFor(blockCount, 1, [&](i64 blockBegin, i64 blockEnd, u32) {
+			for (i64 block = blockBegin; block < blockEnd; block++)
+			{
+				u32* histogram = &offsets[block * bucketCount];
+				for (i64 i = block * blockSize; i < MIN((block + 1) * blockSize, leafCount); i++)
+					histogram[(keys[i] >> shift) & (bucketCount - 1)]++;
+			}
+		});
+		// 2. exclusive prefix sum, bucket major then block so equal digits keep their relative order
+		u32 sum = 0;
+		bool allInOneBucket = false;
+		for (i64 bucket = 0; bucket < bucketCount; bucket++)
+		{
+			const u32 bucketBegin = sum;
+			for (i64 block = 0; block < blockCount; block++)
+			{
+				const u32 count = offsets[block * bucketCount + bucket];
+				offsets[block * bucketCount + bucket] = sum;
+				sum += count;
+			}
+			allInOneBucket |= sum - bucketBegin == leafCount;
+		}
+		if (allInOneBucket) // this digit is the same for every key
+			continue;
+		// 3. scatter
+		ThreadPool::ParallelFor(blockCount, 1, [&](i64 blockBegin, i64 blockEnd, u32) {
+			for (i64 block = blockBegin; block < blockEnd; block++)
+			{
+				u32* offset = &offsets[block * bucketCount];
+				for (i64 i = block * blockSize; i < MIN((block + 1) * blockSize, leafCount); i++)
+				{
+					const u32 destination = offset[(keys[i] >> shift) & (bucketCount - 1)]++;
+					keysTemp[destination] = keys[i];
+					orderTemp[destination] = order[i];
+				}
+			}
+		});
+		keys.swap(keysTemp);
+		order.swap(orderTemp);
+	}
+	vector<T_LeafNode> sortedLeafLocal(leafCount);
+	ParallelRange(parallel, 0, leafCount, [&](i64 begin, i64 end, u32) {
+		for (i64 i = begin; i < end; i++)
+			sortedLeafLocal[i] = leafLocal[order[i]];
+	});
+	leafLocal.swap(sortedLeafLocal);
+}
+
+template<class T_LeafNode>
+i64 PathTracer::BuildBVH(vector<T_LeafNode>& leafLocal, vector<BVH>& bvhGlobal, u32 heightMax, u32 meshIndex)
+{
+	CpuTimer timer;
+	const i64 bvhLocalToGlobalOffset = bvhGlobal.size();
+	i64 rootBvhIndexLocal = sBvhBuilderType == BvhBuilderTypeSAH ?
+		BuildBvhSah(leafLocal, bvhGlobal, heightMax, meshIndex) :
+		BuildBvhLbvh(leafLocal, bvhGlobal, meshIndex);
+	if (sBvhBuilderType == BvhBuilderTypeLBVH && GetBvhHeight(bvhGlobal, bvhLocalToGlobalOffset, rootBvhIndexLocal) > heightMax)
+	{
+		// clustered leaves share the top bits of their Morton codes and chain the LBVH, the SAH builder bounds its depth
+		printf("lbvh of %lld leaves is deeper than %u levels, building it with sah instead\n", (i64)leafLocal.size(), heightMax);
+		bvhGlobal.resize(bvhLocalToGlobalOffset);
+		rootBvhIndexLocal = BuildBvhSah(leafLocal, bvhGlobal, heightMax, meshIndex);
+	}
+	const float buildTime = timer.GetMilliseconds();
+	printf("build bvh (%s) of %lld leaves took %f ms, SAH cost = %f\n",
+		sBvhBuilderType == BvhBuilderTypeSAH ? "sah" : "lbvh",
+		(i64)leafLocal.size(),
+		buildTime,
+		ComputeSahCost(bvhGlobal, bvhLocalToGlobalOffset, bvhGlobal.size() - bvhLocalToGlobalOffset, leafLocal, 0, rootBvhIndexLocal));
+	return rootBvhIndexLocal;
+}
+
 template<class T_LeafNode>
-i64 PathTracer::BuildBVH(vector<T_LeafNode>& leafLocal, vector<BVH>& bvhGlobal, u32 meshIndex)
+i64 PathTracer::BuildBvhLbvh(vector<T_LeafNode>& leafLocal, vector<BVH>& bvhGlobal, u32 meshIndex)
 {
 	// algorithm based on https://developer.nvidia.com/blog/parallelforall/wp-content/uploads/2012/11/karras2012hpg_paper.pdf
 	fatalAssertf(leafLocal.size() > 1 && leafLocal.size() < MAX_UINT32, "too many or too few triangles");
+	const bool parallel = sBvhBuildMultithreaded && leafLocal.size() >= PT_BVH_PARALLEL_BUILD_LEAF_MIN;
 	
 	// local bvh
 	vector<BVH> bvhLocal;
 
 	// 1. sort
-	std::sort(leafLocal.begin(), leafLocal.end(), [](const T_LeafNode& a, const T_LeafNode& b)->bool { return a.mMortonCode > b.mMortonCode; });
+	SortLeavesByMortonCode(leafLocal, parallel);
 
-	// 2. build tree
+	// 2. build tree, every internal node only depends on the sorted keys so they are all independent
 	bvhLocal.resize(leafLocal.size() - 1);
 	for (int i = 0; i < bvhLocal.size(); i++)
 		InitBVH(bvhLocal[i], meshIndex);
-	for (i64 i = 0; i < bvhLocal.size(); i++)
-	{
-		// Determine direction of the range (+1 or -1)
-		const i64 d = LongestCommonPrefix(leafLocal, i, i + 1) - LongestCommonPrefix(leafLocal, i, i - 1) > 0 ? 1 : -1;
-		// Compute upper bound for the length of the range
-		const int lcpMin = LongestCommonPrefix(leafLocal, i, i - d);
-		i64 lMax = 2;
-		while (LongestCommonPrefix(leafLocal, i, i + lMax * d) > lcpMin)
-			lMax *= 2;
-		// Find the other end using binary search
-		i64 l = 0;
-		i64 div = 2;
-		i64 t = lMax / div;
-		while (t >= 1)
-		{
-			if (LongestCommonPrefix(leafLocal, i, i + (l + t) * d) > lcpMin)
-				l = l + t;
-			if (t == 1)
-				break;
-			div *= 2;
-			t = lMax / div;
-		}
-		i64 j = i + l * d;
-		// Find the split position using binary search
-		int lcpNode = LongestCommonPrefix(leafLocal, i, j);
-		i64 s = 0;
-		div = 2;
-		t = RoundUpDivide(l, div);
-		while (t >= 1)
-		{
-			if (LongestCommonPrefix(leafLocal, i, i + (s + t) * d) > lcpNode)
-				s = s + t;
-			if (t == 1)
-				break;
-			div *= 2;
+	ParallelRange(parallel, 0, bvhLocal.size(), [&](i64 begin, i64 end, u32) {
+		for (i64 i = begin; i < end; i++)
+		{
+			// Determine direction of the range (+1 or -1)
+			const i64 d = LongestCommonPrefix(leafLocal, i, i + 1) - LongestCommonPrefix(leafLocal, i, i - 1) > 0 ? 1 : -1;
+			// Compute upper bound for the length of the range
+			const int lcpMin = LongestCommonPrefix(leafLocal, i, i - d);
+			i64 lMax = 2;
+			while (LongestCommonPrefix(leafLocal, i, i + lMax * d) > lcpMin)
+				lMax *= 2;
+			// Find the other end using binary search
+			i64 l = 0;
+			i64 div = 2;
+			i64 t = lMax / div;
+			while (t >= 1)
+			{
+				if (LongestCommonPrefix(leafLocal, i, i + (l + t) * d) > lcpMin)
+					l = l + t;
+				if (t == 1)
+					break;
+				div *= 2;
+				t = lMax / div;
+			}
+			i64 j = i + l * d;
+			// Find the split position using binary search
+			int lcpNode = LongestCommonPrefix(leafLocal, i, j);
+			i64 s = 0;
+			div = 2;
 			t = RoundUpDivide(l, div);
+			while (t >= 1)
+			{
+				if (LongestCommonPrefix(leafLocal, i, i + (s + t) * d) > lcpNode)
+					s = s + t;
+				if (t == 1)
+					break;
+				div *= 2;
+				t = RoundUpDivide(l, div);
+			}
+			const i64 split = i + s * d + MIN(d, 0);
+			fatalAssert(split >= 0 && split < bvhLocal.size());
+			// Output child pointers
+			const i64 leftIndex = split;
+			const i64 rightIndex = split + 1;
+			bvhLocal[i].mLeftIndexLocal = leftIndex;
+			bvhLocal[i].mLeftIsLeaf = leftIndex == MIN(i, j);
+			bvhLocal[i].mRightIndexLocal = rightIndex;
+			bvhLocal[i].mRightIsLeaf = rightIndex == MAX(i, j);
+			if (bvhLocal[i].mLeftIsLeaf) // left child is leaf
+				leafLocal[leftIndex].mBvhIndexLocal = i;
+			else
+				bvhLocal[leftIndex].mParentIndexLocal = i;
+			if (bvhLocal[i].mRightIsLeaf) // right child is leaf
+				leafLocal[rightIndex].mBvhIndexLocal = i;
+			else
+				bvhLocal[rightIndex].mParentIndexLocal = i;
 		}
-		const i64 split = i + s * d + MIN(d, 0);
-		fatalAssert(split >= 0 && split < bvhLocal.size());
-		// Output child pointers
-		const i64 leftIndex = split;
-		const i64 rightIndex = split + 1;
-		bvhLocal[i].mLeftIndexLocal = leftIndex;
-		bvhLocal[i].mLeftIsLeaf = leftIndex == MIN(i, j);
-		bvhLocal[i].mRightIndexLocal = rightIndex;
-		bvhLocal[i].mRightIsLeaf = rightIndex == MAX(i, j);
-		if (bvhLocal[i].mLeftIsLeaf) // left child is leaf
-			leafLocal[leftIndex].mBvhIndexLocal = i;
-		else
-			bvhLocal[leftIndex].mParentIndexLocal = i;
-		if (bvhLocal[i].mRightIsLeaf) // right child is leaf
-			leafLocal[rightIndex].mBvhIndexLocal = i;
-		else
-			bvhLocal[rightIndex].mParentIndexLocal = i;
-	}
+	});
 
-	// 3. update bvh
+	// 3. update bvh, the second thread to arrive at a node merges its children and moves on to the parent
+	vector<atomic<u32>> visited(bvhLocal.size());
+	vector<i64> maxHeights(parallel ? ThreadPool::GetThreadCount() : 1, -1);
 	i64 rootBvhIndexLocal = -1;
-	i64 maxHeight = -1;
-	for (i64 i = 0; i < leafLocal.size(); i++)
-	{
-		i64 current = leafLocal[i].mBvhIndexLocal;
-		fatalAssert(current >= 0 && current < bvhLocal.size());
-		i64 height = 0;
-		while (current != INVALID_UINT32)
+	ParallelRange(parallel, 0, leafLocal.size(), [&](i64 begin, i64 end, u32 threadIndex) {
+		for (i64 i = begin; i < end; i++)
 		{
-			height++;
-			u32 original = bvhLocal[current].mVisited++;
-
-			if (original < 1) // if this is the first time trying to visit current node, stop
-				break;
-			else
+			i64 current = leafLocal[i].mBvhIndexLocal;
+			fatalAssert(current >= 0 && current < bvhLocal.size());
+			i64 height = 0;
+			while (current != INVALID_UINT32)
 			{
-				i64 parent = bvhLocal[current].mParentIndexLocal;
-				if (parent == INVALID_UINT32)
+				height++;
+				u32 original = visited[current]++;
+
+				if (original < 1) // if this is the first time trying to visit current node, stop
+					break;
+				else
 				{
-					if (rootBvhIndexLocal != -1)
-						fatalAssert(rootBvhIndexLocal == current);
-					rootBvhIndexLocal = current;
+					i64 parent = bvhLocal[current].mParentIndexLocal;
+					if (parent == INVALID_UINT32)
+					{
+						if (rootBvhIndexLocal != -1)
+							fatalAssert(rootBvhIndexLocal == current);
+						rootBvhIndexLocal = current;
+					}
+					const u32 left = bvhLocal[current].mLeftIndexLocal;
+					const u32 right = bvhLocal[current].mRightIndexLocal;
+					AABB lAABB;
+					AABB rAABB;
+					if (bvhLocal[current].mLeftIsLeaf)
+						InitAABB(leafLocal[left], lAABB);
+					else
+						lAABB = bvhLocal[left].mAABB;
+					if (bvhLocal[current].mRightIsLeaf)
+						InitAABB(leafLocal[right], rAABB);
+					else
+						rAABB = bvhLocal[right].mAABB;
+					MergeAABB(lAABB, rAABB, bvhLocal[current].mAABB);
+					current = parent;
 				}
-				const u32 left = bvhLocal[current].mLeftIndexLocal;
-				const u32 right = bvhLocal[current].mRightIndexLocal;
-				AABB lAABB;
-				AABB rAABB;
-				if (bvhLocal[current].mLeftIsLeaf)
-					InitAABB(leafLocal[left], lAABB);
-				else
-					lAABB = bvhLocal[left].mAABB;
-				if (bvhLocal[current].mRightIsLeaf)
-					InitAABB(leafLocal[right], rAABB);
-				else
-					rAABB = bvhLocal[right].mAABB;
-				MergeAABB(lAABB, rAABB, bvhLocal[current].mAABB);
-				current = parent;
 			}
+			if (height > maxHeights[threadIndex])
+				maxHeights[threadIndex] = height;
 		}
-		if (height > maxHeight)
-			maxHeight = height;
-	}
-	displayfln("build bvh tree height = %ld", maxHeight);
+	});
+	ParallelRange(parallel, 0, bvhLocal.size(), [&](i64 begin, i64 end, u32) {
+		for (i64 i = begin; i < end; i++)
+			bvhLocal[i].mVisited = visited[i];
+	});
+	const i64 maxHeight = *max_element(maxHeights.begin(), maxHeights.end());
+	displayfln("build bvh tree height = %lld", maxHeight);
 	fatalAssert(rootBvhIndexLocal >= 0 && rootBvhIndexLocal < bvhLocal.size());
 	fatalAssert(rootBvhIndexLocal < INVALID_UINT32);
 	bvhGlobal.insert(bvhGlobal.end(), bvhLocal.begin(), bvhLocal.end());
 	return rootBvhIndexLocal;
 }
+
+struct SahBin
+{
+	AABB mAABB;
+	u32 mLeafCount;
+};
+
+inline int GetSahBinIndex(const XMFLOAT3& centroid, const AABB& centroidBounds, float binScale, int axis)
+{
+	const int binIndex = (GetAxis(centroid, axis) - GetAxis(centroidBounds.mMin, axis)) * binScale;
+	return CLAMP(binIndex, 0, PT_SAH_BIN_COUNT - 1);
+}
+
+// levels of internal nodes a balanced tree over leafCount leaves needs
+inline u32 GetBalancedBvhHeight(i64 leafCount)
+{
+	u32 height = 0;
+	while (((i64)1 << height) < leafCount)
+		height++;
+	return height;
+}
+
+// partitions order[begin, end) along the cheapest binned SAH split and returns the first index of the right half
+// both halves have to fit in childLevelCount levels, past that it splits at the median which always fits
+inline i64 SplitSah(vector<u32>& order, const vector<AABB>& leafAABBs, const vector<XMFLOAT3>& leafCentroids, i64 begin, i64 end, AABB& nodeAABB, u32 childLevelCount)
+{
+	const i64 leafCount = end - begin;
+	const bool parallel = PathTracer::sBvhBuildMultithreaded && leafCount >= PT_SAH_PARALLEL_BINNING_LEAF_MIN;
+	const u32 slotCount = parallel ? ThreadPool::GetThreadCount() : 1;
+
+	// per thread scratch, small nodes stay on the stack to avoid an allocation per node
+	AABB localBounds[2];
+	SahBin localBins[3 * PT_SAH_BIN_COUNT];
+	vector<AABB> sharedBounds;
+	vector<SahBin> sharedBins;
+	AABB* slotBounds = localBounds;
+	SahBin* slotBins = localBins;
+	if (parallel)
+	{
+		sharedBounds.resize(slotCount * 2);
+		sharedBins.resize(slotCount * 3 * PT_SAH_BIN_COUNT);
+		slotBounds = sharedBounds.data();
+		slotBins = sharedBins.data();
+	}
+
+	// node bounds and centroid bounds
+	for (u32 i = 0; i < slotCount * 2; i++)
+		InitEmptyAABB(slotBounds[i]);
+	ParallelRange(parallel, begin, end, [&](i64 b, i64 e, u32 slot) {
+		AABB& bounds = slotBounds[slot * 2];
+		AABB& centroidBounds = slotBounds[slot * 2 + 1];
+		for (i64 i = b; i < e; i++)
+		{
+			MergeAABB(bounds, leafAABBs[order[i]], bounds);
+			GrowAABB(centroidBounds, leafCentroids[order[i]]);
+		}
+	});
+	AABB centroidBounds = slotBounds[1];
+	nodeAABB = slotBounds[0];
+	for (u32 i = 1; i < slotCount; i++)
+	{
+		MergeAABB(nodeAABB, slotBounds[i * 2], nodeAABB);
+		MergeAABB(centroidBounds, slotBounds[i * 2 + 1], centroidBounds);
+	}
+
+	float binScale[3];
+	for (int axis = 0; axis < 3; axis++)
+	{
+		const float extent = GetAxis(centroidBounds.mMax, axis) - GetAxis(centroidBounds.mMin, axis);
+		binScale[axis] = extent > 0.0f ? PT_SAH_BIN_COUNT / extent : 0.0f;
+	}
+
+	// bin along all 3 axes
+	for (u32 i = 0; i < slotCount * 3 * PT_SAH_BIN_COUNT; i++)
+	{
+		InitEmptyAABB(slotBins[i].mAABB);
+		slotBins[i].mLeafCount = 0;
+	}
+	ParallelRange(parallel, begin, end, [&](i64 b, i64 e, u32 slot) {
+		SahBin* bins = &slotBins[slot * 3 * PT_SAH_BIN_COUNT];
+		for (i64 i = b; i < e; i++)
+		{
+			for (int axis = 0; axis < 3; axis++)
+			{
+				if (binScale[axis] == 0.0f)
+					continue;
+				SahBin& bin = bins[axis * PT_SAH_BIN_COUNT + GetSahBinIndex(leafCentroids[order[i]], centroidBounds, binScale[axis], axis)];
+				MergeAABB(bin.mAABB, leafAABBs[order[i]], bin.mAABB);
+				bin.mLeafCount++;
+			}
+		}
+	});
+	for (u32 i = 1; i < slotCount; i++)
+	{
+		for (int j = 0; j < 3 * PT_SAH_BIN_COUNT; j++)
+		{
+			MergeAABB(slotBins[j].mAABB, slotBins[i * 3 * PT_SAH_BIN_COUNT + j].mAABB, slotBins[j].mAABB);
+			slotBins[j].mLeafCount += slotBins[i * 3 * PT_SAH_BIN_COUNT + j].mLeafCount;
+		}
+	}
+
+	// sweep the bins to find the cheapest split
+	float bestCost = FLOAT_MAX;
+	int bestAxis = -1;
+	int bestBin = -1;
+	for (int axis = 0; axis < 3; axis++)
+	{
+		if (binScale[axis] == 0.0f)
+			continue;
+		const SahBin* bins = &slotBins[axis * PT_SAH_BIN_COUNT];
+		float rightArea[PT_SAH_BIN_COUNT];
+		u32 rightCount[PT_SAH_BIN_COUNT];
+		AABB accumulated;
+		u32 accumulatedCount = 0;
+		InitEmptyAABB(accumulated);
+		for (int j = PT_SAH_BIN_COUNT - 1; j > 0; j--)
+		{
+			MergeAABB(accumulated, bins[j].mAABB, accumulated);
+			accumulatedCount += bins[j].mLeafCount;
+			rightArea[j] = SurfaceAreaOfAABB(accumulated);
+			rightCount[j] = accumulatedCount;
+		}
+		accumulatedCount = 0;
+		InitEmptyAABB(accumulated);
+		for (int j = 0; j < PT_SAH_BIN_COUNT - 1; j++)
+		{
+			MergeAABB(accumulated, bins[j].mAABB, accumulated);
+			accumulatedCount += bins[j].mLeafCount;
+			if (accumulatedCount == 0 || rightCount[j + 1] == 0)
+				continue;
+			const float cost = accumulatedCount * SurfaceAreaOfAABB(accumulated) + rightCount[j + 1] * rightArea[j + 1];
+			if (cost < bestCost)
+			{
+				bestCost = cost;
+				bestAxis = axis;
+				bestBin = j;
+			}
+		}
+	}
+
+	i64 split = begin;
+	if (bestAxis >= 0)
+	{
+		auto it = std::partition(order.begin() + begin, order.begin() + end, [&](u32 leaf) {
+			return GetSahBinIndex(leafCentroids[leaf], centroidBounds, binScale[bestAxis], bestAxis) <= bestBin;
+		});
+		split = it - order.begin();
+	}
+	if (split <= begin || split >= end)
+	{
+		// all centroids are (almost) at the same spot, fall back to a median split
+		split = begin + leafCount / 2;
+	}
+	const i64 leftCount = split - begin;
+	const i64 rightCount = end - split;
+	if (GetBalancedBvhHeight(MAX(leftCount, rightCount)) > childLevelCount)
+	{
+		// a long run of lopsided splits, balance this node along the widest centroid axis
+		int axis = 0;
+		for (int i = 1; i < 3; i++)
+		{
+			if (GetAxis(centroidBounds.mMax, i) - GetAxis(centroidBounds.mMin, i) > GetAxis(centroidBounds.mMax, axis) - GetAxis(centroidBounds.mMin, axis))
+				axis = i;
+		}
+		split = begin + leafCount / 2;
+		std::nth_element(order.begin() + begin, order.begin() + split, order.begin() + end, [&](u32 a, u32 b) {
+			return GetAxis(leafCentroids[a], axis) < GetAxis(leafCentroids[b], axis);
+		});
+	}
+	return split;
+}
+
+template<class T_LeafNode>
+i64 PathTracer::BuildBvhSah(vector<T_LeafNode>& leafLocal, vector<BVH>& bvhGlobal, u32 heightMax, u32 meshIndex)
+{
+	// binned SAH builder based on https://www.sci.utah.edu/~wald/Publications/2007/ParallelBVHBuild/fastbuild.pdf
+	// every leaf still holds exactly 1 primitive so the output has the same layout as the LBVH builder
+	fatalAssertf(leafLocal.size() > 1 && leafLocal.size() < MAX_UINT32, "too many or too few triangles");
+	const i64 leafCount = leafLocal.size();
+	fatalAssertf(GetBalancedBvhHeight(leafCount) <= heightMax, "%lld leaves don't fit in %u levels", leafCount, heightMax);
+	vector<AABB> leafAABBs(leafCount);
+	vector<XMFLOAT3> leafCentroids(leafCount);
+	vector<u32> order(leafCount);
+	vector<u32> leafParents(leafCount);
+	ThreadPool::ParallelFor(leafCount, PT_SAH_PARALLEL_BINNING_LEAF_MIN, [&](i64 begin, i64 end, u32) {
+		for (i64 i = begin; i < end; i++)
+		{
+			InitAABB(leafLocal[i], leafAABBs[i]);
+			CentroidOfAABB(leafAABBs[i], leafCentroids[i]);
+			order[i] = i;
+		}
+	});
+
+	// local bvh
+	vector<BVH> bvhLocal(leafCount - 1);
+	for (i64 i = 0; i < bvhLocal.size(); i++)
+	{
+		InitBVH(bvhLocal[i], meshIndex);
+		bvhLocal[i].mVisited = 2; // match the LBVH output where both children have visited each node
+	}
+
+	// top down, root is always at index 0
+	struct SahBuildTask
+	{
+		i64 mBegin;
+		i64 mEnd;
+		u32 mBvhIndexLocal;
+		i64 mHeight;
+	};
+	stack<SahBuildTask> tasks;
+	tasks.push({ 0, leafCount, 0, 1 });
+	u32 bvhCount = 1;
+	i64 maxHeight = 0;
+	while (!tasks.empty())
+	{
+		const SahBuildTask task = tasks.top();
+		tasks.pop();
+		maxHeight = MAX(maxHeight, task.mHeight);
+		BVH& bvh = bvhLocal[task.mBvhIndexLocal];
+		const i64 split = SplitSah(order, leafAABBs, leafCentroids, task.mBegin, task.mEnd, bvh.mAABB, heightMax - (u32)task.mHeight);
+
+		// left child
+		if (split - task.mBegin == 1)
+		{
+			bvh.mLeftIndexLocal = task.mBegin;
+			bvh.mLeftIsLeaf = 1;
+			leafParents[task.mBegin] = task.mBvhIndexLocal;
+		}
+		else
+		{
+			bvh.mLeftIndexLocal = bvhCount++;
+			bvhLocal[bvh.mLeftIndexLocal].mParentIndexLocal = task.mBvhIndexLocal;
+			tasks.push({ task.mBegin, split, bvh.mLeftIndexLocal, task.mHeight + 1 });
+		}
+
+		// right child
+		if (task.mEnd - split == 1)
+		{
+			bvh.mRightIndexLocal = split;
+			bvh.mRightIsLeaf = 1;
+			leafParents[split] = task.mBvhIndexLocal;
+		}
+		else
+		{
+			bvh.mRightIndexLocal = bvhCount++;
+			bvhLocal[bvh.mRightIndexLocal].mParentIndexLocal = task.mBvhIndexLocal;
+			tasks.push({ split, task.mEnd, bvh.mRightIndexLocal, task.mHeight + 1 });
+		}
+	}
+	fatalAssert(bvhCount == bvhLocal.size());
+
+	// leaves are referenced by their position in the final order
+	vector<T_LeafNode> sortedLeafLocal(leafCount);
+	for (i64 i = 0; i < leafCount; i++)
+	{
+		sortedLeafLocal[i] = leafLocal[order[i]];
+		sortedLeafLocal[i].mBvhIndexLocal = leafParents[i];
+	}
+	leafLocal.swap(sortedLeafLocal);
+
+	displayfln("build bvh tree height = %lld", maxHeight);
+	bvhGlobal.insert(bvhGlobal.end(), bvhLocal.begin(), bvhLocal.end());
+	return 0;
+}
+
+static const u32 LightBvhDepthMax = PT_LIGHT_BVH_STACK_SIZE - 2; // a traversal pops an internal node above this depth and pushes its 2 children
+
+inline float GetMaxComponent(const XMFLOAT3& v)
+{
+	return MAX(MAX(v.x, v.y), v.z);
+}
+
+inline void InitEmptyLightBvhNode(LightBvhNode& node)
+{
+	node.mAabbMin = XMFLOAT3(FLOAT_MAX, FLOAT_MAX, FLOAT_MAX);
+	node.mAabbMax = XMFLOAT3(-FLOAT_MAX, -FLOAT_MAX, -FLOAT_MAX);
+	node.mPower = 0.0f;
+	node.mAxis = XMFLOAT3(0.0f, 0.0f, 1.0f);
+	node.mCosThetaO = 1.0f;
+	node.mCosThetaE = 1.0f;
+	node.mLeftIndex = INVALID_UINT32;
+	node.mRightIndex = INVALID_UINT32;
+	node.mIsLeaf = 0;
+	node.mTwoSided = 0;
+}
+
+// point lights emit the same in every direction, quads and meshes emit on both sides as EvaluateLight assumes
+inline void InitLightBvhLeaf(const LightData& ld, u32 lightIndex, LightBvhNode& node)
+{
+	InitEmptyLightBvhNode(node);
+	node.mLeftIndex = lightIndex;
+	node.mIsLeaf = 1;
+	if (ld.mLightType == LIGHT_TYPE_MESH)
+	{
+		// BuildMeshLights keeps the bounds of the triangles in the light data
+		XMStoreFloat3(&node.mAabbMin, XMLoadFloat3(&ld.mPosWorld) - XMLoadFloat3(&ld.mScale));
+		XMStoreFloat3(&node.mAabbMax, XMLoadFloat3(&ld.mPosWorld) + XMLoadFloat3(&ld.mScale));
+		node.mAxis = ld.mDirWorld;
+		node.mPower = 2.0f * XM_PI * ld.mArea * GetMaxComponent(ld.mColor);
+		node.mCosThetaO = ld.mAngle;
+		node.mCosThetaE = 0.0f;
+		node.mTwoSided = 1;
+	}
+	else if (ld.mLightType == LIGHT_TYPE_QUAD)
+	{
+		// the quad spans mScale along x and y of the light space
+		for (int i = 0; i < 4; i++)
+		{
+			const XMVECTOR cornerLocal = XMVectorSet(i & 1 ? ld.mScale.x : -ld.mScale.x, i & 2 ? ld.mScale.y : -ld.mScale.y, 0.0f, 1.0f);
+			XMStoreFloat3(&node.mAabbMin, XMVectorMin(XMLoadFloat3(&node.mAabbMin), XMVector4Transform(cornerLocal, XMLoadFloat4x4(&ld.mViewInv))));
+			XMStoreFloat3(&node.mAabbMax, XMVectorMax(XMLoadFloat3(&node.mAabbMax), XMVector4Transform(cornerLocal, XMLoadFloat4x4(&ld.mViewInv))));
+		}
+		XMStoreFloat3(&node.mAxis, XMVector3Normalize(XMLoadFloat3(&ld.mDirWorld)));
+		node.mPower = 2.0f * XM_PI * ld.mArea * GetMaxComponent(ld.mColor);
+		node.mCosThetaO = 1.0f;
+		node.mCosThetaE = 0.0f;
+		node.mTwoSided = 1;
+	}
+	else
+	{
+		// LIGHT_TYPE_POINT, intersected as a sphere of PT_POINT_LIGHT_RADIUS
+		const XMVECTOR pos = XMLoadFloat3(&ld.mPosWorld);
+		XMStoreFloat3(&node.mAabbMin, pos - XMVectorReplicate(PT_POINT_LIGHT_RADIUS));
+		XMStoreFloat3(&node.mAabbMax, pos + XMVectorReplicate(PT_POINT_LIGHT_RADIUS));
+		node.mPower = 4.0f * XM_PI * GetMaxComponent(ld.mColor);
+		node.mCosThetaO = -1.0f;
+		node.mCosThetaE = 0.0f;
+	}
+}
+
+// smallest cone around both cones, pbrt-v4's DirectionCone Union
+inline void MergeDirectionCones(FXMVECTOR axisA, float cosThetaA, FXMVECTOR axisB, float cosThetaB, XMVECTOR& axis, float& cosTheta)
+{
+	const float thetaA = acosf(CLAMP(cosThetaA, -1.0f, 1.0f));
+	const float thetaB = acosf(CLAMP(cosThetaB, -1.0f, 1.0f));
+	const float cosThetaD = CLAMP(XMVectorGetX(XMVector3Dot(axisA, axisB)), -1.0f, 1.0f);
+	const float thetaD = acosf(cosThetaD);
+	if (MIN(thetaD + thetaB, XM_PI) <= thetaA)
+	{
+		axis = axisA;
+		cosTheta = cosThetaA;
+		return;
+	}
+	if (MIN(thetaD + thetaA, XM_PI) <= thetaB)
+	{
+		axis = axisB;
+		cosTheta = cosThetaB;
+		return;
+	}
+	const float thetaO = (thetaA + thetaD + thetaB) / 2.0f;
+	const XMVECTOR towardB = axisB - axisA * cosThetaD;
+	const float towardBLength = XMVectorGetX(XMVector3Length(towardB));
+	if (thetaO >= XM_PI || towardBLength == 0.0f)
+	{
+		axis = axisA;
+		cosTheta = -1.0f;
+		return;
+	}
+	// rotate axis A toward axis B in the plane of both
+	const float thetaR = thetaO - thetaA;
+	axis = XMVector3Normalize(axisA * cosf(thetaR) + towardB * (sinf(thetaR) / towardBLength));
+	cosTheta = cosf(thetaO);
+}
+
+inline void MergeLightBounds(const LightBvhNode& a, const LightBvhNode& b, LightBvhNode& out)
+{
+	LightBvhNode merged;
+	InitEmptyLightBvhNode(merged);
+	XMStoreFloat3(&merged.mAabbMin, XMVectorMin(XMLoadFloat3(&a.mAabbMin), XMLoadFloat3(&b.mAabbMin)));
+	XMStoreFloat3(&merged.mAabbMax, XMVectorMax(XMLoadFloat3(&a.mAabbMax), XMLoadFloat3(&b.mAabbMax)));
+	merged.mPower = a.mPower + b.mPower;
+	// lights that emit nothing are still in the box so rays can hit them, but they don't widen the cones
+	if (a.mPower > 0.0f && b.mPower > 0.0f)
+	{
+		XMVECTOR axis;
+		MergeDirectionCones(XMLoadFloat3(&a.mAxis), a.mCosThetaO, XMLoadFloat3(&b.mAxis), b.mCosThetaO, axis, merged.mCosThetaO);
+		XMStoreFloat3(&merged.mAxis, axis);
+		merged.mCosThetaE = MIN(a.mCosThetaE, b.mCosThetaE);
+		merged.mTwoSided = a.mTwoSided || b.mTwoSided;
+	}
+	else
+	{
+		const LightBvhNode& emitting = a.mPower > 0.0f ? a : b;
+		merged.mAxis = emitting.mAxis;
+		merged.mCosThetaO = emitting.mCosThetaO;
+		merged.mCosThetaE = emitting.mCosThetaE;
+		merged.mTwoSided = emitting.mTwoSided;
+	}
+	out = merged;
+}
+
+// pbrt-v4's surface area orientation heuristic, power times the solid angle the cones emit to times the area,
+// the node's aspect ratio along the split axis penalizes splits across thin boxes
+inline float GetLightBvhCost(const LightBvhNode& bounds, const AABB& nodeAABB, int axis)
+{
+	const float thetaO = acosf(CLAMP(bounds.mCosThetaO, -1.0f, 1.0f));
+	const float thetaE = acosf(CLAMP(bounds.mCosThetaE, -1.0f, 1.0f));
+	const float thetaW = MIN(thetaO + thetaE, XM_PI);
+	const float sinThetaO = sqrtf(MAX(1.0f - bounds.mCosThetaO * bounds.mCosThetaO, 0.0f));
+	const float solidAngle = 2.0f * XM_PI * (1.0f - bounds.mCosThetaO) +
+		XM_PI / 2.0f * (2.0f * thetaW * sinThetaO - cosf(thetaO - 2.0f * thetaW) - 2.0f * thetaO * sinThetaO + bounds.mCosThetaO);
+	XMFLOAT3 diagonal;
+	XMStoreFloat3(&diagonal, XMLoadFloat3(&nodeAABB.mMax) - XMLoadFloat3(&nodeAABB.mMin));
+	AABB aabb;
+	aabb.mMin = bounds.mAabbMin;
+	aabb.mMax = bounds.mAabbMax;
+	return bounds.mPower * solidAngle * (GetMaxComponent(diagonal) / GetAxis(diagonal, axis)) * SurfaceAreaOfAABB(aabb);
+}
+
+inline int GetLightBvhBinIndex(const XMFLOAT3& centroid, const AABB& centroidBounds, float binScale, int axis)
+{
+	const int binIndex = (GetAxis(centroid, axis) - GetAxis(centroidBounds.mMin, axis)) * binScale;
+	return CLAMP(binIndex, 0, PT_LIGHT_BVH_BIN_COUNT - 1);
+}
+
+// partitions order[begin, end) along the cheapest binned split and returns the first index of the right half,
+// a split is only taken if both halves can still be built below LightBvhDepthMax
+inline u32 SplitLightBvh(vector<u32>& order, const vector<LightBvhNode>& leaves, const vector<XMFLOAT3>& centroids, u32 begin, u32 end, u32 depth, const LightBvhNode& node)
+{
+	AABB centroidBounds;
+	InitEmptyAABB(centroidBounds);
+	for (u32 i = begin; i < end; i++)
+		GrowAABB(centroidBounds, centroids[order[i]]);
+	AABB nodeAABB;
+	nodeAABB.mMin = node.mAabbMin;
+	nodeAABB.mMax = node.mAabbMax;
+	const u32 childLevelCount = LightBvhDepthMax - (depth + 1);
+	const u64 childLeafCountMax = childLevelCount >= 32 ? MAX_UINT32 : (1ull << childLevelCount);
+
+	float bestCost = FLOAT_MAX;
+	int bestAxis = -1;
+	int bestBin = -1;
+	float binScale[3];
+	for (int axis = 0; axis < 3; axis++)
+	{
+		const float extent = GetAxis(centroidBounds.mMax, axis) - GetAxis(centroidBounds.mMin, axis);
+		binScale[axis] = extent > 0.0f ? PT_LIGHT_BVH_BIN_COUNT / extent : 0.0f;
+		if (binScale[axis] == 0.0f)
+			continue;
+		LightBvhNode bins[PT_LIGHT_BVH_BIN_COUNT];
+		u32 binCounts[PT_LIGHT_BVH_BIN_COUNT] = {};
+		for (int j = 0; j < PT_LIGHT_BVH_BIN_COUNT; j++)
+			InitEmptyLightBvhNode(bins[j]);
+		for (u32 i = begin; i < end; i++)
+		{
+			const int binIndex = GetLightBvhBinIndex(centroids[order[i]], centroidBounds, binScale[axis], axis);
+			MergeLightBounds(bins[binIndex], leaves[order[i]], bins[binIndex]);
+			binCounts[binIndex]++;
+		}
+
+		// sweep the bins from the right, then from the left
+		float rightCost[PT_LIGHT_BVH_BIN_COUNT];
+		u32 rightCount[PT_LIGHT_BVH_BIN_COUNT];
+		LightBvhNode accumulated;
+		u32 accumulatedCount = 0;
+		InitEmptyLightBvhNode(accumulated);
+		for (int j = PT_LIGHT_BVH_BIN_COUNT - 1; j > 0; j--)
+		{
+			MergeLightBounds(accumulated, bins[j], accumulated);
+			accumulatedCount += binCounts[j];
+			rightCost[j] = accumulatedCount ? GetLightBvhCost(accumulated, nodeAABB, axis) : 0.0f;
+			rightCount[j] = accumulatedCount;
+		}
+		accumulatedCount = 0;
+		InitEmptyLightBvhNode(accumulated);
+		for (int j = 0; j < PT_LIGHT_BVH_BIN_COUNT - 1; j++)
+		{
+			MergeLightBounds(accumulated, bins[j], accumulated);
+			accumulatedCount += binCounts[j];
+			if (accumulatedCount == 0 || rightCount[j + 1] == 0 || accumulatedCount > childLeafCountMax || rightCount[j + 1] > childLeafCountMax)
+				continue;
+			const float cost = GetLightBvhCost(accumulated, nodeAABB, axis) + rightCost[j + 1];
+			if (cost < bestCost)
+			{
+				bestCost = cost;
+				bestAxis = axis;
+				bestBin = j;
+			}
+		}
+	}
+
+	if (bestAxis >= 0)
+	{
+		auto it = std::partition(order.begin() + begin, order.begin() + end, [&](u32 leaf) {
+			return GetLightBvhBinIndex(centroids[leaf], centroidBounds, binScale[bestAxis], bestAxis) <= bestBin;
+		});
+		return it - order.begin();
+	}
+
+	// all centroids are at the same spot or every binned split is too unbalanced, the median split always fits
+	int widestAxis = 0;
+	for (int axis = 1; axis < 3; axis++)
+	{
+		if (GetAxis(centroidBounds.mMax, axis) - GetAxis(centroidBounds.mMin, axis) > GetAxis(centroidBounds.mMax, widestAxis) - GetAxis(centroidBounds.mMin, widestAxis))
+			widestAxis = axis;
+	}
+	const u32 split = begin + (end - begin) / 2;
+	std::nth_element(order.begin() + begin, order.begin() + split, order.begin() + end, [&](u32 a, u32 b) {
+		return GetAxis(centroids[a], widestAxis) < GetAxis(centroids[b], widestAxis);
+	});
+	return split;
+}
+
+void PathTracer::BuildLightBvh()
+{
+	sLightBvhNodes.clear();
+	const u32 lightCount = sLightData.size();
+	if (lightCount == 0)
+		return;
+	vector<LightBvhNode> leaves(lightCount);
+	vector<XMFLOAT3> centroids(lightCount);
+	vector<u32> order(lightCount);
+	for (u32 i = 0; i < lightCount; i++)
+	{
+		InitLightBvhLeaf(sLightData[i], i, leaves[i]);
+		XMStoreFloat3(&centroids[i], (XMLoadFloat3(&leaves[i].mAabbMin) + XMLoadFloat3(&leaves[i].mAabbMax)) / 2);
+		order[i] = i;
+	}
+
+	// top down, root is always at index 0 and the 2 children of a node are next to each other
+	struct LightBvhBuildTask
+	{
+		u32 mBegin;
+		u32 mEnd;
+		u32 mNodeIndex;
+		u32 mDepth;
+	};
+	stack<LightBvhBuildTask> tasks;
+	tasks.push({ 0, lightCount, 0, 0 });
+	sLightBvhNodes.resize(1);
+	sLightBvhNodes.reserve(2 * lightCount - 1);
+	u32 maxDepth = 0;
+	while (!tasks.empty())
+	{
+		const LightBvhBuildTask task = tasks.top();
+		tasks.pop();
+		maxDepth = MAX(maxDepth, task.mDepth);
+		if (task.mEnd - task.mBegin == 1)
+		{
+			sLightBvhNodes[task.mNodeIndex] = leaves[order[task.mBegin]];
+			continue;
+		}
+		LightBvhNode node;
+		InitEmptyLightBvhNode(node);
+		for (u32 i = task.mBegin; i < task.mEnd; i++)
+			MergeLightBounds(node, leaves[order[i]], node);
+		const u32 split = SplitLightBvh(order, leaves, centroids, task.mBegin, task.mEnd, task.mDepth, node);
+		node.mLeftIndex = sLightBvhNodes.size();
+		node.mRightIndex = node.mLeftIndex + 1;
+		sLightBvhNodes[task.mNodeIndex] = node;
+		sLightBvhNodes.resize(sLightBvhNodes.size() + 2);
+		tasks.push({ task.mBegin, split, node.mLeftIndex, task.mDepth + 1 });
+		tasks.push({ split, task.mEnd, node.mRightIndex, task.mDepth + 1 });
+	}
+	fatalAssert(sLightBvhNodes.size() == 2 * lightCount - 1);
+	fatalAssertf(maxDepth <= LightBvhDepthMax, "light bvh depth %u doesn't fit the traversal stack", maxDepth);
+	displayfln("light bvh: %u lights, depth %u", lightCount, maxDepth);
+}
+
+// Vose's alias method, every entry holds the same share 1 / n of the total weight as its own weight topped up by one heavier alias
+inline void BuildAliasTable(const vector<float>& weights, AliasEntry* entries)
+{
+	const u32 count = weights.size();
+	double weightSum = 0.0;
+	for (float weight : weights)
+		weightSum += weight;
+	vector<double> scaled(count);
+	vector<u32> small;
+	vector<u32> large;
+	for (u32 i = 0; i < count; i++)
+	{
+		scaled[i] = weightSum > 0.0 ? weights[i] * count / weightSum : 1.0;
+		if (scaled[i] < 1.0)
+			small.push_back(i);
+		else
+			large.push_back(i);
+	}
+	while (!small.empty() && !large.empty())
+	{
+		const u32 lighter = small.back();
+		small.pop_back();
+		const u32 heavier = large.back();
+		entries[lighter].mProbability = (float)scaled[lighter];
+		entries[lighter].mAlias = heavier;
+		scaled[heavier] -= 1.0 - scaled[lighter];
+		if (scaled[heavier] < 1.0)
+		{
+			large.pop_back();
+			small.push_back(heavier);
+		}
+	}
+	// what is left is 1 up to rounding
+	for (u32 i : large)
+	{
+		entries[i].mProbability = 1.0f;
+		entries[i].mAlias = i;
+	}
+	for (u32 i : small)
+	{
+		entries[i].mProbability = 1.0f;
+		entries[i].mAlias = i;
+	}
+}
+
+inline void GetTriangleWorldPositions(const MeshPT& mesh, const TrianglePT& triangle, XMVECTOR* positions)
+{
+	for (int i = 0; i < 3; i++)
+	{
+		const FLOAT3& pos = triangle.mVertices[i].pos;
+		positions[i] = XMVector4Transform(XMVectorSet(pos.x, pos.y, pos.z, 1.0f), XMLoadFloat4x4(&mesh.mModel));
+	}
+}
+
+void PathTracer::BuildMeshLights()
+{
+	sLightData.erase(remove_if(sLightData.begin(), sLightData.end(), [](const LightData& ld) { return ld.mLightType == LIGHT_TYPE_MESH; }), sLightData.end());
+	sLightAliasEntries.clear();
+	for (u32 meshIndex = 0; meshIndex < sMeshes.size(); meshIndex++)
+	{
+		const MeshPT& mesh = sMeshes[meshIndex];
+		if (mesh.mMaterialType != MATERIAL_TYPE_EMISSIVE)
+			continue;
+
+		// triangles are picked by power, which is their world space area as the radiance is the same over the mesh,
+		// so the area pdf of a light sample is 1 / mArea wherever it lands
+		vector<float> powers(mesh.mTriangleCount);
+		XMVECTOR aabbMin = XMVectorReplicate(FLOAT_MAX);
+		XMVECTOR aabbMax = XMVectorReplicate(-FLOAT_MAX);
+		XMVECTOR axis = XMVectorZero();
+		float cosThetaO = 1.0f;
+		float area = 0.0f;
+		for (u32 i = 0; i < mesh.mTriangleCount; i++)
+		{
+			XMVECTOR positions[3];
+			GetTriangleWorldPositions(mesh, sTriangles[mesh.mTriangleIndexLocalToGlobalOffset + i], positions);
+			for (int j = 0; j < 3; j++)
+			{
+				aabbMin = XMVectorMin(aabbMin, positions[j]);
+				aabbMax = XMVectorMax(aabbMax, positions[j]);
+			}
+			const XMVECTOR cross = XMVector3Cross(positions[1] - positions[0], positions[2] - positions[0]);
+			const float crossLength = XMVectorGetX(XMVector3Length(cross));
+			powers[i] = 0.5f * crossLength * GetMaxComponent(mesh.mEmissive);
+			area += 0.5f * crossLength;
+			if (crossLength <= 0.0f)
+				continue;
+			// both sides emit, so a normal can be flipped to the side of the cone so far
+			XMVECTOR normal = cross / crossLength;
+			if (XMVectorGetX(XMVector3Dot(axis, axis)) == 0.0f)
+			{
+				axis = normal;
+				continue;
+			}
+			if (XMVectorGetX(XMVector3Dot(axis, normal)) < 0.0f)
+				normal = -normal;
+			MergeDirectionCones(axis, cosThetaO, normal, 1.0f, axis, cosThetaO);
+		}
+		if (area <= 0.0f)
+			continue;
+
+		LightData ld = {};
+		ld.mLightType = LIGHT_TYPE_MESH;
+		ld.mMeshIndex = meshIndex;
+		ld.mAliasEntryOffset = sLightAliasEntries.size();
+		ld.mColor = mesh.mEmissive;
+		ld.mArea = area;
+		ld.mTextureIndex = -1;
+		// the light BVH reads the bounds of the triangles from the center, half extent, cone axis and cone angle
+		XMStoreFloat3(&ld.mPosWorld, (aabbMin + aabbMax) * 0.5f);
+		XMStoreFloat3(&ld.mScale, (aabbMax - aabbMin) * 0.5f);
+		XMStoreFloat3(&ld.mDirWorld, XMVectorGetX(XMVector3Dot(axis, axis)) > 0.0f ? axis : XMVectorSet(0.0f, 0.0f, 1.0f, 0.0f));
+		ld.mAngle = cosThetaO;
+		sLightAliasEntries.resize(sLightAliasEntries.size() + mesh.mTriangleCount);
+		BuildAliasTable(powers, &sLightAliasEntries[ld.mAliasEntryOffset]);
+		sLightData.push_back(ld);
+		displayfln("mesh light %s: %u triangles, area %f", sMeshSources[meshIndex] ? sMeshSources[meshIndex]->GetDebugName().c_str() : "", mesh.mTriangleCount, area);
+	}
+}
+
+void PathTracer::CompareBvhBuilders()
+{
+	printf(">>> BVH builder comparison <<<\n");
+	double totalTime[BvhBuilderTypeCount] = {};
+	double totalCost[BvhBuilderTypeCount] = {};
+	for (int i = 0; i < sMeshes.size(); i++)
+	{
+		if (sMeshGeometryOwners[i] != i)
+			continue;
+		const MeshPT& mesh = sMeshes[i];
+		float buildTime[BvhBuilderTypeCount];
+		float sahCost[BvhBuilderTypeCount];
+		for (u8 j = 0; j < BvhBuilderTypeCount; j++)
+		{
+			vector<TrianglePT> triangles(sTriangles.begin() + mesh.mTriangleIndexLocalToGlobalOffset, sTriangles.begin() + mesh.mTriangleIndexLocalToGlobalOffset + mesh.mTriangleCount);
+			vector<BVH> bvhs;
+			CpuTimer timer;
+			const i64 root = j == BvhBuilderTypeSAH ? BuildBvhSah(triangles, bvhs, TriangleBvhHeightMax, i) : BuildBvhLbvh(triangles, bvhs, i);
+			buildTime[j] = timer.GetMilliseconds();
+			sahCost[j] = ComputeSahCost(bvhs, 0, bvhs.size(), triangles, 0, root);
+			totalTime[j] += buildTime[j];
+			totalCost[j] += sahCost[j];
+		}
+		printf("mesh %d [%s] %u triangles: lbvh %f ms SAH cost %f | sah %f ms SAH cost %f\n",
+			i, sMeshSources[i]->GetDebugName().c_str(), mesh.mTriangleCount,
+			buildTime[BvhBuilderTypeLBVH], sahCost[BvhBuilderTypeLBVH],
+			buildTime[BvhBuilderTypeSAH], sahCost[BvhBuilderTypeSAH]);
+	}
+	printf("total: lbvh %f ms SAH cost %f | sah %f ms SAH cost %f\n",
+		totalTime[BvhBuilderTypeLBVH], totalCost[BvhBuilderTypeLBVH],
+		totalTime[BvhBuilderTypeSAH], totalCost[BvhBuilderTypeSAH]);
+	printf("==============================\n");
+}
+
+bool PathTracer::ValidateMultithreadedBvhBuild(Scene& scene)
+{
+	printf(">>> multithreaded BVH build validation <<<\n");
+	const vector<TrianglePT> trianglesOriginal = sTriangles;
+	const bool cacheEnabled = sBvhCacheEnabled;
+	sBvhCacheEnabled = false;
+
+	sBvhBuildMultithreaded = false;
+	CpuTimer timer;
+	UpdateBvhCpu(scene);
+	const float singleThreadedTime = timer.GetMilliseconds();
+	const vector<TrianglePT> trianglesSingleThreaded = sTriangles;
+	const vector<BVH> triangleBvhsSingleThreaded = sTriangleModelBVHs;
+	const vector<BVH> meshBvhsSingleThreaded = sMeshWorldBVHs;
+
+	sTriangles = trianglesOriginal;
+	sBvhBuildMultithreaded = true;
+	timer.Reset();
+	UpdateBvhCpu(scene);
+	const float multithreadedTime = timer.GetMilliseconds();
+
+	auto identical = [](const auto& a, const auto& b) { return a.size() == b.size() && memcmp(a.data(), b.data(), a.size() * sizeof(a[0])) == 0; };
+	const bool trianglesMatch = identical(sTriangles, trianglesSingleThreaded);
+	const bool triangleBvhsMatch = identical(sTriangleModelBVHs, triangleBvhsSingleThreaded);
+	const bool meshBvhsMatch = identical(sMeshWorldBVHs, meshBvhsSingleThreaded);
+	const bool passed = trianglesMatch && triangleBvhsMatch && meshBvhsMatch;
+	printf("%u threads: single threaded %f ms, multithreaded %f ms, speed up %fx\n", ThreadPool::GetThreadCount(), singleThreadedTime, multithreadedTime, singleThreadedTime / MAX(multithreadedTime, 0.001f));
+	if (!passed)
+		fprintf(stderr, "multithreaded BVH build differs from the single threaded build on %u threads: triangles %s, triangle bvh %s, mesh bvh %s\n", ThreadPool::GetThreadCount(), trianglesMatch ? "match" : "MISMATCH", triangleBvhsMatch ? "match" : "MISMATCH", meshBvhsMatch ? "match" : "MISMATCH");
+	sBvhCacheEnabled = cacheEnabled;
+	printf("==============================\n");
+	return passed;
+}
+
+inline void InitMeshProxy(const MeshPT& mesh, const AABB& modelAABB, u32 meshIndex, AabbProxy& meshProxyOut)
+{
+	XMFLOAT3 centroid;
+	TransformAABB(mesh.mModel, modelAABB, meshProxyOut.mAABB);
+	CentroidOfAABB(meshProxyOut.mAABB, centroid);
+	meshProxyOut.mOriginalIndex = meshIndex;
+	meshProxyOut.mMortonCode = Mesh::GenerateMortonCode(centroid);
+}
+
+// world space proxy of every mesh in mesh order
+void PathTracer::InitMeshProxies(vector<AabbProxy>& meshProxies)
+{
+	meshProxies.resize(sMeshes.size());
+	for (int i = 0; i < sMeshes.size(); i++)
+	{
+		const MeshPT& mesh = sMeshes[i];
+		const AABB& modelAABB = sBvhBuildGpu ? sMeshModelAABBs[i] : sTriangleModelBVHs[mesh.mRootTriangleBvhIndexLocal + mesh.mTriangleBvhIndexLocalToGlobalOffset].mAABB;
+		InitMeshProxy(mesh, modelAABB, i, meshProxies[i]);
+	}
+}
+
+void PathTracer::BuildMeshBvhCpu()
+{
+	sMeshWorldBVHs.clear();
+	vector<AabbProxy> meshProxies;
+	InitMeshProxies(meshProxies);
+	sMeshBvhRootIndexGlobal = BuildBVH(meshProxies, sMeshWorldBVHs, MeshBvhHeightMax); // we look up actual indices through proxies so no need to overwrite mesh vector like we do for triangle vector to keep the new order
+	sMeshBvhSahCostAtBuild = ComputeSahCost(sMeshWorldBVHs, 0, sMeshWorldBVHs.size(), meshProxies, 0, sMeshBvhRootIndexGlobal);
+	sMeshBvhHeight = GetBvhHeight(sMeshWorldBVHs, 0, sMeshBvhRootIndexGlobal);
+	fatalAssertf(sMeshBvhHeight <= MeshBvhHeightMax, "mesh bvh is %u levels deep, the shader traversal stack only holds %d entries", sMeshBvhHeight, PT_MESH_BVH_STACK_SIZE);
+
+	// correct mesh index for mesh BVH
+	for (int i = 0; i < sMeshWorldBVHs.size(); i++)
+	{
+		if (sMeshWorldBVHs[i].mLeftIsLeaf)
+			sMeshWorldBVHs[i].mLeftIndexLocal = meshProxies[sMeshWorldBVHs[i].mLeftIndexLocal].mOriginalIndex;
+		if (sMeshWorldBVHs[i].mRightIsLeaf)
+			sMeshWorldBVHs[i].mRightIndexLocal = meshProxies[sMeshWorldBVHs[i].mRightIndexLocal].mOriginalIndex;
+	}
+}
+
+// the GPU builder runs the same LBVH construction over the same Morton codes, so the CPU builder can tell how deep its trees get
+// only checked for the initial build, moving meshes only change the mesh BVH
+bool PathTracer::IsGpuBvhShallowEnough()
+{
+	vector<BVH> triangleBvhs(sTriangleBvhCount);
+	vector<MeshPT> meshes = sMeshes;
+	for (int i = 0; i < meshes.size(); i++)
+	{
+		if (sMeshGeometryOwners[i] != i)
+			continue;
+		vector<TrianglePT> triangles(sTriangles.begin() + meshes[i].mTriangleIndexLocalToGlobalOffset, sTriangles.begin() + meshes[i].mTriangleIndexLocalToGlobalOffset + meshes[i].mTriangleCount);
+		vector<BVH> bvhLocal;
+		meshes[i].mRootTriangleBvhIndexLocal = BuildBvhLbvh(triangles, bvhLocal, i);
+		const u32 height = GetBvhHeight(bvhLocal, 0, meshes[i].mRootTriangleBvhIndexLocal);
+		if (height > TriangleBvhHeightMax)
+		{
+			displayfln("gpu triangle bvh of mesh %d would be %u levels deep", i, height);
+			return false;
+		}
+		copy(bvhLocal.begin(), bvhLocal.end(), triangleBvhs.begin() + meshes[i].mTriangleBvhIndexLocalToGlobalOffset);
+	}
+	vector<AabbProxy> meshProxies(meshes.size());
+	for (int i = 0; i < meshes.size(); i++)
+	{
+		meshes[i].mRootTriangleBvhIndexLocal = meshes[sMeshGeometryOwners[i]].mRootTriangleBvhIndexLocal;
+		InitMeshProxy(meshes[i], triangleBvhs[meshes[i].mRootTriangleBvhIndexLocal + meshes[i].mTriangleBvhIndexLocalToGlobalOffset].mAABB, i, meshProxies[i]);
+	}
+	vector<BVH> meshBvhs;
+	const i64 root = BuildBvhLbvh(meshProxies, meshBvhs, INVALID_UINT32);
+	const u32 height = GetBvhHeight(meshBvhs, 0, root);
+	if (height > MeshBvhHeightMax)
+	{
+		displayfln("gpu mesh bvh would be %u levels deep", height);
+		return false;
+	}
+	return true;
+}
+
+// the GPU builds the mesh BVH along with the triangle BVHs, the CPU takes the mesh BVH over the first time a mesh moves so that
+// moving meshes refit it like the CPU build does instead of building every tree again
+void PathTracer::BuildMeshBvhCpuFromGpu()
+{
+	// the GPU wrote the triangle BVH roots into the mesh buffer, the next upload of sMeshes must keep them
+	vector<MeshPT> meshesGpu(sMeshes.size());
+	sMeshBuffer.GetBufferData(meshesGpu.data(), sizeof(MeshPT) * meshesGpu.size());
+	sMeshModelAABBs.resize(sMeshes.size());
+	for (int i = 0; i < sMeshes.size(); i++)
+	{
+		sMeshes[i].mRootTriangleBvhIndexLocal = meshesGpu[i].mRootTriangleBvhIndexLocal;
+		// instances come after their owner, the GPU leaves the triangles in their original order and the root encloses exactly all of them
+		const u32 owner = sMeshGeometryOwners[i];
+		if (owner != i)
+		{
+			sMeshModelAABBs[i] = sMeshModelAABBs[owner];
+			continue;
+		}
+		const MeshPT& mesh = sMeshes[i];
+		InitEmptyAABB(sMeshModelAABBs[i]);
+		for (u32 j = 0; j < mesh.mTriangleCount; j++)
+		{
+			AABB triangleAABB;
+			InitAABB(sTriangles[mesh.mTriangleIndexLocalToGlobalOffset + j], triangleAABB);
+			MergeAABB(sMeshModelAABBs[i], triangleAABB, sMeshModelAABBs[i]);
+		}
+	}
+	BuildMeshBvhCpu();
+}
+
+float PathTracer::RefitMeshBvhCpu()
+{
+	// mesh BVH leaves already point at the original mesh indices, so the proxies stay in mesh order
+	vector<AabbProxy> meshProxies;
+	InitMeshProxies(meshProxies);
+	RefitBVH(sMeshWorldBVHs, 0, sMeshBvhRootIndexGlobal, meshProxies, 0);
+	return ComputeSahCost(sMeshWorldBVHs, 0, sMeshWorldBVHs.size(), meshProxies, 0, sMeshBvhRootIndexGlobal);
+}
+
+bool PathTracer::RefitOrRebuildMeshBvhCpu()
+{
+	// triangle BVHs are in model space so only the mesh BVH is affected by transforms
+	const float sahCost = RefitMeshBvhCpu();
+	if (sahCost <= sMeshBvhSahCostAtBuild * PT_BVH_REFIT_REBUILD_SAH_RATIO)
+		return false;
+	displayfln("mesh bvh SAH cost went from %f to %f after refit, rebuilding", sMeshBvhSahCostAtBuild, sahCost);
+	BuildMeshBvhCpu();
+	return true;
+}
+
+bool PathTracer::UpdateMeshTransforms(Scene& scene)
+{
+	bool moved = false;
+	bool emissiveMoved = false;
+	for (int i = 0; i < sMeshes.size(); i++)
+	{
+		const ObjectUniform& objectUniform = sMeshSources[i]->mObjectUniform;
+		if (memcmp(&sMeshes[i].mModel, &objectUniform.mModel, sizeof(XMFLOAT4X4)) == 0)
+			continue;
+		sMeshes[i].mModel = objectUniform.mModel;
+		sMeshes[i].mModelInv = objectUniform.mModelInv;
+		moved = true;
+		emissiveMoved |= sMeshes[i].mMaterialType == MATERIAL_TYPE_EMISSIVE;
+	}
+	if (!moved)
+		return false;
+	if (emissiveMoved)
+	{
+		// the light count and the alias table sizes stay the same, so the light buffers don't grow
+		BuildMeshLights();
+		BuildLightBvh();
+	}
+	if (sBvhBuildGpu && sMeshModelAABBs.empty())
+		BuildMeshBvhCpuFromGpu();
+	else
+		RefitOrRebuildMeshBvhCpu();
+	scene.mSceneUniform.mPathTracerMeshBvhCount = sMeshWorldBVHs.size();
+	scene.mSceneUniform.mPathTracerMeshBvhRootIndex = sMeshBvhRootIndexGlobal;
+	scene.SetUniformDirty();
+	sMeshDataDirty = true;
+	return true;
+}
+
+bool PathTracer::ValidateBvhRefit(Scene& scene)
+{
+	printf(">>> BVH refit validation <<<\n");
+	if (sBvhBuildGpu)
+	{
+		fprintf(stderr, "-validateBvhRefit checks the mesh bvh of the CPU build, run it without -buildBvhGpu\n");
+		return false;
+	}
+	const vector<MeshPT> meshesOriginal = sMeshes;
+	const AABB& sceneAABB = sMeshWorldBVHs[sMeshBvhRootIndexGlobal].mAABB;
+	const float sceneSize = XMVectorGetX(XMVector3Length(XMLoadFloat3(&sceneAABB.mMax) - XMLoadFloat3(&sceneAABB.mMin)));
+	const int stepCount = 8;
+	i64 errorCount = 0;
+	int rebuildCount = 0;
+	for (int step = 1; step <= stepCount; step++)
+	{
+		// every mesh drifts away from its original spot a little further each step
+		for (int i = 0; i < sMeshes.size(); i++)
+		{
+			const float distance = sceneSize * 0.05f * step;
+			const XMMATRIX offset = XMMatrixTranslation(sinf(i * 1.7f + step) * distance, cosf(i * 0.9f + step) * distance, sinf(i * 2.3f - step) * distance);
+			const XMMATRIX model = XMLoadFloat4x4(&meshesOriginal[i].mModel) * offset;
+			XMStoreFloat4x4(&sMeshes[i].mModel, model);
+			XMStoreFloat4x4(&sMeshes[i].mModelInv, XMMatrixInverse(nullptr, model));
+		}
+		const bool rebuilt = RefitOrRebuildMeshBvhCpu();
+		rebuildCount += rebuilt;
+
+		vector<AabbProxy> meshProxies;
+		InitMeshProxies(meshProxies);
+		const i64 stepErrorCount = ValidateBvhBounds(sMeshWorldBVHs, 0, sMeshWorldBVHs.size(), meshProxies, 0);
+		errorCount += stepErrorCount;
+		printf("step %d: %s, SAH cost %f (%f at last build), %lld nodes with bad bounds\n",
+			step, rebuilt ? "rebuilt" : "refitted",
+			ComputeSahCost(sMeshWorldBVHs, 0, sMeshWorldBVHs.size(), meshProxies, 0, sMeshBvhRootIndexGlobal), sMeshBvhSahCostAtBuild,
+			stepErrorCount);
+		if (stepErrorCount > 0)
+			fprintf(stderr, "step %d: %lld nodes of the %s mesh bvh do not enclose their children\n", step, stepErrorCount, rebuilt ? "rebuilt" : "refitted");
+	}
+	printf("%d steps, %d rebuilds, %lld nodes with bad bounds\n", stepCount, rebuildCount, errorCount);
+
+	// restore the original scene
+	sMeshes = meshesOriginal;
+	BuildMeshBvhCpu();
+	scene.mSceneUniform.mPathTracerMeshBvhRootIndex = sMeshBvhRootIndexGlobal;
+	scene.SetUniformDirty();
+	printf("==============================\n");
+	return errorCount == 0;
+}
+
+// picks the smallest exponent for which origin + 255 * scale still reaches max
+inline u32 GetWideBvhExponent(float origin, float max)
+{
+	const float extent = max - origin;
+	int exponent = extent > 0.0f ? (int)ceilf(log2f(extent / 255.0f)) + 127 : 1;
+	exponent = CLAMP(exponent, 1, 254);
+	while (exponent < 254 && origin + 255.0f * ldexpf(1.0f, exponent - 127) < max)
+		exponent++;
+	return exponent;
+}
+
+inline void SetWideBvhQuantized(UINT* packed, u32 child, u32 axis, u32 value)
+{
+	UINT& entry = packed[axis * PT_WIDE_BVH_PACKED_UINT_COUNT + child / 4];
+	const u32 shift = (child & 3) * 8;
+	entry = (entry & ~(0xff << shift)) | (value << shift);
+}
+
+inline void QuantizeWideBvhNode(WideBVH& node, const AABB& nodeAABB, const AABB* childAABBs, u32 childCount)
+{
+	// decoded bounds are conservative, they always enclose the original child bounds
+	node.mOrigin = nodeAABB.mMin;
+	const u32 exponentX = GetWideBvhExponent(nodeAABB.mMin.x, nodeAABB.mMax.x);
+	const u32 exponentY = GetWideBvhExponent(nodeAABB.mMin.y, nodeAABB.mMax.y);
+	const u32 exponentZ = GetWideBvhExponent(nodeAABB.mMin.z, nodeAABB.mMax.z);
+	node.mExponents = exponentX | (exponentY << 8) | (exponentZ << 16) | (childCount << 24);
+	// slots past the child count are never tested
+	for (u32 i = 0; i < PT_WIDE_BVH_PACKED_UINT_COUNT * 3; i++)
+	{
+		node.mQuantizedMin[i] = 0;
+		node.mQuantizedMax[i] = 0;
+	}
+	for (u32 child = 0; child < childCount; child++)
+	{
+		for (u32 axis = 0; axis < 3; axis++)
+		{
+			const float origin = GetAxis(node.mOrigin, axis);
+			const float scale = GetWideBvhScale(node.mExponents, axis);
+			const float childMin = GetAxis(childAABBs[child].mMin, axis);
+			const float childMax = GetAxis(childAABBs[child].mMax, axis);
+			int quantizedMin = CLAMP((int)floorf((childMin - origin) / scale), 0, 255);
+			int quantizedMax = CLAMP((int)ceilf((childMax - origin) / scale), 0, 255);
+			while (quantizedMin > 0 && origin + quantizedMin * scale > childMin)
+				quantizedMin--;
+			while (quantizedMax < 255 && origin + quantizedMax * scale < childMax)
+				quantizedMax++;
+			SetWideBvhQuantized(node.mQuantizedMin, child, axis, quantizedMin);
+			SetWideBvhQuantized(node.mQuantizedMax, child, axis, quantizedMax);
+		}
+	}
+}
+
+template<class T_LeafNode>
+void CollapseBVH(const vector<BVH>& bvhGlobal, i64 bvhLocalToGlobalOffset, i64 rootBvhIndexLocal, const vector<T_LeafNode>& leafGlobal, i64 leafLocalToGlobalOffset, u32 meshIndex, vector<WideBVH>& wideLocal)
+{
+	// every wide node starts with the two children of a binary node and keeps opening the internal child with the largest surface area until it is full
+	struct WideChild
+	{
+		u32 mIndexLocal;
+		bool mIsLeaf;
+		AABB mAABB;
+	};
+	struct CollapseTask
+	{
+		u32 mBvhIndexLocal;
+		u32 mWideIndexLocal;
+	};
+	auto makeChild = [&](u32 indexLocal, bool isLeaf) {
+		WideChild child;
+		child.mIndexLocal = indexLocal;
+		child.mIsLeaf = isLeaf;
+		if (isLeaf)
+			InitAABB(leafGlobal[indexLocal + leafLocalToGlobalOffset], child.mAABB);
+		else
+			child.mAABB = bvhGlobal[indexLocal + bvhLocalToGlobalOffset].mAABB;
+		return child;
+	};
+
+	wideLocal.clear();
+	wideLocal.push_back(WideBVH());
+	stack<CollapseTask> tasks;
+	tasks.push({ (u32)rootBvhIndexLocal, 0 });
+	while (!tasks.empty())
+	{
+		const CollapseTask task = tasks.top();
+		tasks.pop();
+		const BVH& bvh = bvhGlobal[task.mBvhIndexLocal + bvhLocalToGlobalOffset];
+		WideChild children[PT_WIDE_BVH_WIDTH];
+		u32 childCount = 0;
+		children[childCount++] = makeChild(bvh.mLeftIndexLocal, bvh.mLeftIsLeaf);
+		children[childCount++] = makeChild(bvh.mRightIndexLocal, bvh.mRightIsLeaf);
+		while (childCount < PT_WIDE_BVH_WIDTH)
+		{
+			int largest = -1;
+			float largestArea = -1.0f;
+			for (u32 i = 0; i < childCount; i++)
+			{
+				const float area = SurfaceAreaOfAABB(children[i].mAABB);
+				if (!children[i].mIsLeaf && area > largestArea)
+				{
+					largest = i;
+					largestArea = area;
+				}
+			}
+			if (largest < 0)
+				break;
+			const BVH& opened = bvhGlobal[children[largest].mIndexLocal + bvhLocalToGlobalOffset];
+			children[largest] = makeChild(opened.mLeftIndexLocal, opened.mLeftIsLeaf);
+			children[childCount++] = makeChild(opened.mRightIndexLocal, opened.mRightIsLeaf);
+		}
+
+		WideBVH node;
+		AABB childAABBs[PT_WIDE_BVH_WIDTH];
+		node.mLeafMask = 0;
+		node.mMeshIndex = meshIndex;
+		for (u32 i = 0; i < PT_WIDE_BVH_WIDTH; i++)
+		{
+			if (i >= childCount)
+			{
+				node.mChildIndexLocal[i] = INVALID_UINT32;
+				continue;
+			}
+			childAABBs[i] = children[i].mAABB;
+			if (children[i].mIsLeaf)
+			{
+				node.mChildIndexLocal[i] = children[i].mIndexLocal;
+				node.mLeafMask |= 1 << i;
+			}
+			else
+			{
+				node.mChildIndexLocal[i] = wideLocal.size();
+				wideLocal.push_back(WideBVH());
+				tasks.push({ children[i].mIndexLocal, node.mChildIndexLocal[i] });
+			}
+		}
+		QuantizeWideBvhNode(node, bvh.mAABB, childAABBs, childCount);
+		wideLocal[task.mWideIndexLocal] = node;
+	}
+}
+
+void PathTracer::UpdateWideBvhCpu()
+{
+	CpuTimer timer;
+	vector<vector<WideBVH>> wideBVHs(sMeshes.size());
+	ThreadPool::ParallelFor(sMeshes.size(), 1, [&](i64 begin, i64 end, u32) {
+		for (i64 i = begin; i < end; i++)
+		{
+			if (sMeshGeometryOwners[i] != i)
+				continue;
+			const MeshPT& mesh = sMeshes[i];
+			CollapseBVH(sTriangleModelBVHs, mesh.mTriangleBvhIndexLocalToGlobalOffset, mesh.mRootTriangleBvhIndexLocal, sTriangles, mesh.mTriangleIndexLocalToGlobalOffset, i, wideBVHs[i]);
+		}
+	});
+	sTriangleWideBVHs.clear();
+	sTriangleWideBvhOffsets.clear();
+	for (int i = 0; i < sMeshes.size(); i++)
+	{
+		// instances come after their owner and reuse its wide BVH
+		if (sMeshGeometryOwners[i] != i)
+		{
+			sTriangleWideBvhOffsets.push_back(sTriangleWideBvhOffsets[sMeshGeometryOwners[i]]);
+			continue;
+		}
+		sTriangleWideBvhOffsets.push_back(sTriangleWideBVHs.size());
+		sTriangleWideBVHs.insert(sTriangleWideBVHs.end(), wideBVHs[i].begin(), wideBVHs[i].end());
+	}
+	displayfln("collapse %d binary bvh nodes into %d %d-wide bvh nodes (%d bytes -> %d bytes) took %f ms",
+		(int)sTriangleModelBVHs.size(), (int)sTriangleWideBVHs.size(), PT_WIDE_BVH_WIDTH,
+		(int)(sTriangleModelBVHs.size() * sizeof(BVH)), (int)(sTriangleWideBVHs.size() * sizeof(WideBVH)),
+		timer.GetMilliseconds());
+}
+
+string PathTracer::GetTriangleBvhCacheFilePathName(u64 contentHash)
+{
+	char fileName[64];
+	sprintf_s(fileName, COUNT_OF(fileName), "bvh_%016llx_%s.bin", contentHash, sBvhBuilderType == BvhBuilderTypeSAH ? "sah" : "lbvh");
+	return CachePath + fileName;
+}
+
+bool PathTracer::LoadTriangleBvhCache(u32 meshIndex, u64 contentHash)
+{
+	MeshPT& mesh = sMeshes[meshIndex];
+	const string filePathName = GetTriangleBvhCacheFilePathName(contentHash);
+	MappedFile file;
+	if (!file.Open(filePathName))
+		return false;
+	const u64 leafCount = mesh.mTriangleCount;
+	const u64 bvhCount = leafCount - 1;
+	const BvhCacheHeader* header = (const BvhCacheHeader*)file.GetData();
+	const bool headerValid = file.GetSize() == GetBvhCacheFileSize(leafCount) &&
+		header->mMagic == BvhCacheMagic &&
+		header->mVersion == BvhCacheVersion &&
+		header->mBvhSize == sizeof(BVH) &&
+		header->mBuilderType == sBvhBuilderType &&
+		header->mContentHash == contentHash &&
+		header->mLeafCount == leafCount &&
+		header->mRootBvhIndexLocal < bvhCount;
+	if (!verifyf(headerValid, "ignoring stale triangle bvh cache %s", filePathName.c_str()))
+		return false;
+	const BVH* bvhCached = (const BVH*)(file.GetData() + sizeof(BvhCacheHeader));
+	const u32* leafToTriangle = (const u32*)(bvhCached + bvhCount);
+	const u32* mortonCodes = leafToTriangle + leafCount;
+	bool leafToTriangleValid = true;
+	for (u64 i = 0; i < leafCount; i++)
+		leafToTriangleValid = leafToTriangleValid && leafToTriangle[i] < leafCount;
+	if (!verifyf(leafToTriangleValid, "ignoring corrupted triangle bvh cache %s", filePathName.c_str()))
+		return false;
+
+	// reorder the triangles the way the builder did, the cache only stores where each leaf came from
+	const vector<TrianglePT> triangles(sTriangles.begin() + mesh.mTriangleIndexLocalToGlobalOffset, sTriangles.begin() + mesh.mTriangleIndexLocalToGlobalOffset + leafCount);
+	TrianglePT* leafGlobal = &sTriangles[mesh.mTriangleIndexLocalToGlobalOffset];
+	for (u64 i = 0; i < leafCount; i++)
+	{
+		leafGlobal[i] = triangles[leafToTriangle[i]];
+		leafGlobal[i].mMortonCode = mortonCodes[i];
+	}
+	BVH* bvhGlobal = &sTriangleModelBVHs[mesh.mTriangleBvhIndexLocalToGlobalOffset];
+	for (u64 i = 0; i < bvhCount; i++)
+	{
+		bvhGlobal[i] = bvhCached[i];
+		bvhGlobal[i].mMeshIndex = meshIndex;
+		if (bvhGlobal[i].mLeftIsLeaf)
+			leafGlobal[bvhGlobal[i].mLeftIndexLocal].mBvhIndexLocal = (u32)i;
+		if (bvhGlobal[i].mRightIsLeaf)
+			leafGlobal[bvhGlobal[i].mRightIndexLocal].mBvhIndexLocal = (u32)i;
+	}
+	mesh.mRootTriangleBvhIndexLocal = header->mRootBvhIndexLocal;
+	return true;
+}
+
+void PathTracer::SaveTriangleBvhCache(u32 meshIndex, u64 contentHash, const vector<u32>& leafToTriangle)
+{
+	const MeshPT& mesh = sMeshes[meshIndex];
+	BvhCacheHeader header;
+	header.mMagic = BvhCacheMagic;
+	header.mVersion = BvhCacheVersion;
+	header.mBvhSize = sizeof(BVH);
+	header.mBuilderType = sBvhBuilderType;
+	header.mContentHash = contentHash;
+	header.mLeafCount = mesh.mTriangleCount;
+	header.mRootBvhIndexLocal = mesh.mRootTriangleBvhIndexLocal;
+	vector<u32> mortonCodes(mesh.mTriangleCount);
+	for (u32 i = 0; i < mesh.mTriangleCount; i++)
+		mortonCodes[i] = sTriangles[mesh.mTriangleIndexLocalToGlobalOffset + i].mMortonCode;
+
+	// meshes with the same content share a file, write to a file of our own first so a reader never sees a partial file
+	CreateDirectoryA(CachePath.c_str(), nullptr);
+	const string filePathName = GetTriangleBvhCacheFilePathName(contentHash);
+	const string tempFilePathName = filePathName + "." + to_string(meshIndex) + ".tmp";
+	{
+		fstream file;
+		file.open(tempFilePathName, ios::out | ios::binary | ios::trunc);
+		if (!verifyf(file.is_open(), "can't write triangle bvh cache %s", tempFilePathName.c_str()))
+			return;
+		file.write((const char*)&header, sizeof(header));
+		file.write((const char*)&sTriangleModelBVHs[mesh.mTriangleBvhIndexLocalToGlobalOffset], sizeof(BVH) * (mesh.mTriangleCount - 1));
+		file.write((const char*)leafToTriangle.data(), sizeof(u32) * leafToTriangle.size());
+		file.write((const char*)mortonCodes.data(), sizeof(u32) * mortonCodes.size());
+	}
+	if (!verifyf(MoveFileExA(tempFilePathName.c_str(), filePathName.c_str(), MOVEFILE_REPLACE_EXISTING), "can't write triangle bvh cache %s", filePathName.c_str()))
+		DeleteFileA(tempFilePathName.c_str());
+}
+
+bool PathTracer::ValidateBvhCache(Scene& scene)
+{
+	printf(">>> BVH cache validation <<<\n");
+	const vector<TrianglePT> trianglesOriginal = sTriangles;
+	const bool cacheEnabled = sBvhCacheEnabled;
+
+	// the first pass writes the meshes that are not cached yet, so the second pass reads every mesh back from disk
+	sBvhCacheEnabled = true;
+	UpdateBvhCpu(scene);
+	sTriangles = trianglesOriginal;
+	CpuTimer timer;
+	UpdateBvhCpu(scene);
+	const float cachedTime = timer.GetMilliseconds();
+	const vector<TrianglePT> trianglesCached = sTriangles;
+	const vector<BVH> triangleBvhsCached = sTriangleModelBVHs;
+	const vector<MeshPT> meshesCached = sMeshes;
+
+	sTriangles = trianglesOriginal;
+	sBvhCacheEnabled = false;
+	timer.Reset();
+	UpdateBvhCpu(scene);
+	const float rebuildTime = timer.GetMilliseconds();
+
+	int mismatchMeshCount = 0;
+	for (int i = 0; i < sMeshes.size(); i++)
+	{
+		if (sMeshGeometryOwners[i] != i)
+			continue;
+		const MeshPT& mesh = sMeshes[i];
+		const bool rootMatch = mesh.mRootTriangleBvhIndexLocal == meshesCached[i].mRootTriangleBvhIndexLocal;
+		const bool bvhMatch = memcmp(&sTriangleModelBVHs[mesh.mTriangleBvhIndexLocalToGlobalOffset], &triangleBvhsCached[mesh.mTriangleBvhIndexLocalToGlobalOffset], sizeof(BVH) * (mesh.mTriangleCount - 1)) == 0;
+		int leafOrderMismatchCount = 0;
+		int mortonMismatchCount = 0;
+		int leafParentMismatchCount = 0;
+		for (u32 j = mesh.mTriangleIndexLocalToGlobalOffset; j < mesh.mTriangleIndexLocalToGlobalOffset + mesh.mTriangleCount; j++)
+		{
+			leafOrderMismatchCount += memcmp(sTriangles[j].mVertices, trianglesCached[j].mVertices, sizeof(sTriangles[j].mVertices)) != 0;
+			mortonMismatchCount += sTriangles[j].mMortonCode != trianglesCached[j].mMortonCode;
+			leafParentMismatchCount += sTriangles[j].mBvhIndexLocal != trianglesCached[j].mBvhIndexLocal;
+		}
+		if (rootMatch && bvhMatch && !leafOrderMismatchCount && !mortonMismatchCount && !leafParentMismatchCount)
+			continue;
+		mismatchMeshCount++;
+		fprintf(stderr, "mesh %d (%s): root %s, bvh nodes %s, %d leaves in a different order, %d different morton codes, %d different leaf parents\n",
+			i, sMeshSources[i]->GetDebugName().c_str(),
+			rootMatch ? "match" : "MISMATCH",
+			bvhMatch ? "match" : "MISMATCH",
+			leafOrderMismatchCount, mortonMismatchCount, leafParentMismatchCount);
+	}
+	printf("loading from cache %f ms, rebuilding %f ms, %d of %d meshes differ\n", cachedTime, rebuildTime, mismatchMeshCount, (int)sMeshes.size());
+	if (mismatchMeshCount > 0)
+		fprintf(stderr, "cached triangle BVHs of %d meshes differ from a fresh build\n", mismatchMeshCount);
+	sBvhCacheEnabled = cacheEnabled;
+	printf("==============================\n");
+	return mismatchMeshCount == 0;
+}
+
+bool PathTracer::ValidateLargeMeshBuild(Scene& scene)
+{
+	printf(">>> large mesh validation <<<\n");
+	const u32 triangleCount = PARAM_validateLargeMesh.GetAsInt() > 0 ? PARAM_validateLargeMesh.GetAsInt() : 1000000;
+	vector<TrianglePT> trianglesOriginal;
+	vector<MeshPT> meshesOriginal;
+	vector<Mesh*> meshSourcesOriginal;
+	vector<u32> meshGeometryOwnersOriginal;
+	unordered_map<u64, u32> meshGeometryHashToOwnerOriginal;
+	const vector<MaterialPT> materialsOriginal = sMaterials;
+	const vector<Texture*> materialAlbedoTexturesOriginal = sMaterialAlbedoTextures;
+	trianglesOriginal.swap(sTriangles);
+	meshesOriginal.swap(sMeshes);
+	meshSourcesOriginal.swap(sMeshSources);
+	meshGeometryOwnersOriginal.swap(sMeshGeometryOwners);
+	meshGeometryHashToOwnerOriginal.swap(sMeshGeometryHashToOwner);
+	const u32 triangleBvhCountOriginal = sTriangleBvhCount;
+	const u32 meshTextureCountOriginal = sMeshTextureCount;
+	sTriangleBvhCount = 0;
+	const bool cacheEnabled = sBvhCacheEnabled;
+	sBvhCacheEnabled = false;
+
+	// a bumpy sphere tessellated to the requested triangle count, plus a quad under it because the mesh BVH needs 2 leaves
+	const u32 columnCount = MAX((u32)sqrtf(triangleCount / 2.0f), 2u);
+	const u32 trianglesPerRow = columnCount * 2;
+	const u32 rowCount = ROUNDUP_DIVISION(triangleCount, trianglesPerRow);
+	const float radiusMin = 0.95f;
+	const float radiusMax = 1.05f;
+	vector<Vertex> vertices((rowCount + 1) * (columnCount + 1));
+	ThreadPool::ParallelFor(vertices.size(), 4096, [&](i64 begin, i64 end, u32) {
+		for (i64 i = begin; i < end; i++)
+		{
+			const float theta = XM_PI * (i / (columnCount + 1)) / rowCount;
+			const float phi = XM_2PI * (i % (columnCount + 1)) / columnCount;
+			const float radius = (radiusMin + radiusMax) / 2.0f + (radiusMax - radiusMin) / 2.0f * sinf(phi * 7.0f) * sinf(theta * 11.0f);
+			memset(&vertices[i], 0, sizeof(Vertex));
+			vertices[i].pos = XMFLOAT3(radius * sinf(theta) * cosf(phi), radius * cosf(theta), radius * sinf(theta) * sinf(phi));
+		}
+	});
+	vector<uint32_t> indices(triangleCount * 3);
+	ThreadPool::ParallelFor(triangleCount, 4096, [&](i64 begin, i64 end, u32) {
+		for (i64 i = begin; i < end; i++)
+		{
+			const u32 row = (u32)(i / trianglesPerRow);
+			const u32 column = (u32)(i % trianglesPerRow / 2);
+			const u32 corner = row * (columnCount + 1) + column;
+			const u32 cornerBelow = corner + columnCount + 1;
+			indices[i * 3] = corner;
+			indices[i * 3 + 1] = i % 2 ? cornerBelow + 1 : cornerBelow;
+			indices[i * 3 + 2] = i % 2 ? corner + 1 : cornerBelow + 1;
+		}
+	});
+	Mesh sphere("large mesh validation sphere", Mesh::MeshType::PLANE, XMFLOAT3(0.0f, 0.0f, 0.0f), XMFLOAT3(0.0f, 0.0f, 0.0f), XMFLOAT3(1.0f, 1.0f, 1.0f));
+	sphere.SetGeometry(vertices, indices);
+	Mesh quad("large mesh validation quad", Mesh::MeshType::PLANE, XMFLOAT3(0.0f, -2.0f, 0.0f), XMFLOAT3(0.0f, 0.0f, 0.0f), XMFLOAT3(4.0f, 1.0f, 4.0f));
+
+	// the meshes are added like the ones of a scene pass so the buffers grow the same way, they keep that size afterwards
+	PassDefault pass("large mesh validation pass", false, false, true);
+	pass.AddMesh(&sphere);
+	pass.AddMesh(&quad);
+	const int trianglesPerMeshMax = AddMeshesFromPass(pass);
+	const bool buffersFit = trianglesPerMeshMax == triangleCount &&
+		sTriangleBuffer.GetElementCount() >= sTriangles.size() &&
+		sTriangleBvhBuffer.GetElementCount() >= sTriangleBvhCount &&
+		sMeshBuffer.GetElementCount() >= sMeshes.size();
+
+	CpuTimer timer;
+	UpdateBvhCpu(scene);
+	const float buildTime = timer.GetMilliseconds();
+	const i64 errorCount = ValidateBvhBounds(sTriangleModelBVHs, 0, triangleCount - 1, sTriangles, 0);
+
+	// every ray aimed at the center from outside has to hit the sphere shell, except where the last row is only partially filled
+	// rays that miss are checked against all triangles to tell BVH errors from rays slipping between triangles
+	mt19937 generator(0);
+	uniform_real_distribution<float> distribution(-1.0f, 1.0f);
+	const float thetaFilled = XM_PI * (triangleCount / trianglesPerRow) / rowCount;
+	int rayCount = 0;
+	int missCount = 0;
+	int crackCount = 0;
+	u64 nodeVisitCount = 0;
+	for (int i = 0; i < 4096; i++)
+	{
+		XMFLOAT3 dir;
+		XMStoreFloat3(&dir, XMVector3Normalize(XMVectorSet(distribution(generator), distribution(generator), distribution(generator), 0.0f)));
+		if (acosf(-dir.y) >= thetaFilled)
+			continue;
+		rayCount++;
+		const PathTracerCpu::RayCpu ray = PathTracerCpu::MakeRay(XMFLOAT3(-dir.x * 3.0f, -dir.y * 3.0f, -dir.z * 3.0f), dir);
+		PathTracerCpu::HitCpu hit;
+		const bool hitSphere = PathTracerCpu::IntersectTriangleBVH(0, ray, hit) && hit.mT >= 3.0f - radiusMax && hit.mT <= 3.0f - radiusMin;
+		nodeVisitCount += hit.mNodeVisitCount;
+		if (hitSphere)
+			continue;
+		PathTracerCpu::HitCpu hitReference;
+		PathTracerCpu::IntersectTrianglesBruteForce(0, ray, hitReference);
+		if (hitReference.mTriangleIndex == hit.mTriangleIndex && hitReference.mT == hit.mT)
+			crackCount++;
+		else
+			missCount++;
+	}
+	const bool passed = errorCount == 0 && missCount == 0 && buffersFit;
+	printf("%u triangles: build %f ms, tree height %u, %lld nodes with bad bounds, %d of %d rays missed by the BVH, %d slipped between triangles, %f nodes per ray, buffers %s\n",
+		triangleCount, buildTime, sTriangleBvhHeights[0], errorCount, missCount, rayCount, crackCount, (float)nodeVisitCount / MAX(rayCount, 1), buffersFit ? "fit" : "are too small");
+	if (!passed)
+		fprintf(stderr, "large mesh BVH of %u triangles is broken: %lld nodes with bad bounds, %d of %d rays missed by the BVH, buffers %s\n",
+			triangleCount, errorCount, missCount, rayCount, buffersFit ? "fit" : "are too small");
+
+	trianglesOriginal.swap(sTriangles);
+	meshesOriginal.swap(sMeshes);
+	meshSourcesOriginal.swap(sMeshSources);
+	meshGeometryOwnersOriginal.swap(sMeshGeometryOwners);
+	meshGeometryHashToOwnerOriginal.swap(sMeshGeometryHashToOwner);
+	sMaterials = materialsOriginal;
+	sMaterialAlbedoTextures = materialAlbedoTexturesOriginal;
+	sTriangleBvhCount = triangleBvhCountOriginal;
+	sMeshTextureCount = meshTextureCountOriginal;
+	vector<BVH>().swap(sTriangleModelBVHs);
+	sBvhCacheEnabled = cacheEnabled;
+	printf("==============================\n");
+	return passed;
+}
+
+bool PathTracer::BenchmarkRayPackets(Scene& scene)
+{
+	string fileNames = "rex.obj,gameboy.obj";
+	PARAM_benchmarkRayPackets.GetAsString(fileNames);
+	vector<string> meshNames;
+	stringstream ss(fileNames);
+	string fileName;
+	while (getline(ss, fileName, ','))
+		meshNames.push_back(fileName);
+	if (meshNames.empty())
+	{
+		fprintf(stderr, "no mesh to benchmark ray packets on\n");
+		return false;
+	}
+
+	// the benchmark meshes stand in for the scene
+	vector<TrianglePT> trianglesOriginal;
+	vector<MeshPT> meshesOriginal;
+	vector<Mesh*> meshSourcesOriginal;
+	vector<u32> meshGeometryOwnersOriginal;
+	unordered_map<u64, u32> meshGeometryHashToOwnerOriginal;
+	trianglesOriginal.swap(sTriangles);
+	meshesOriginal.swap(sMeshes);
+	meshSourcesOriginal.swap(sMeshSources);
+	meshGeometryOwnersOriginal.swap(sMeshGeometryOwners);
+	meshGeometryHashToOwnerOriginal.swap(sMeshGeometryHashToOwner);
+	const u32 triangleBvhCountOriginal = sTriangleBvhCount;
+	sTriangleBvhCount = 0;
+
+	vector<Mesh*> meshes;
+	for (u32 i = 0; i < MAX(meshNames.size(), (size_t)2); i++) // the mesh BVH needs 2 leaves, a single mesh is loaded twice
+	{
+		Mesh* mesh = new Mesh(meshNames[i % meshNames.size()], Mesh::MeshType::MESH, XMFLOAT3(0.0f, 0.0f, 0.0f), XMFLOAT3(0.0f, 0.0f, 0.0f), XMFLOAT3(1.0f, 1.0f, 1.0f), meshNames[i % meshNames.size()]);
+		XMFLOAT4X4 identity;
+		XMStoreFloat4x4(&identity, XMMatrixIdentity());
+		AddMesh(mesh, identity, identity);
+		meshes.push_back(mesh);
+	}
+	UpdateBvhCpu(scene);
+	const bool passed = PathTracerCpu::BenchmarkRayPackets(meshNames);
+
+	for (Mesh* mesh : meshes)
+		delete mesh;
+	trianglesOriginal.swap(sTriangles);
+	meshesOriginal.swap(sMeshes);
+	meshSourcesOriginal.swap(sMeshSources);
+	meshGeometryOwnersOriginal.swap(sMeshGeometryOwners);
+	meshGeometryHashToOwnerOriginal.swap(sMeshGeometryHashToOwner);
+	sTriangleBvhCount = triangleBvhCountOriginal;
+	vector<BVH>().swap(sTriangleModelBVHs);
+	return passed;
+}
+
+bool PathTracer::StressTestInstances(Scene& scene)
+{
+	printf(">>> instancing stress test <<<\n");
+	if (sBvhBuildGpu)
+	{
+		fprintf(stderr, "-stressInstances builds its instances with the CPU builder, run it without -buildBvhGpu\n");
+		return false;
+	}
+	const string fileName = "ball.obj";
+	const u32 instanceCount = PARAM_stressInstances.GetAsInt() > 0 ? PARAM_stressInstances.GetAsInt() : 10000;
+	vector<TrianglePT> trianglesOriginal;
+	vector<MeshPT> meshesOriginal;
+	vector<Mesh*> meshSourcesOriginal;
+	vector<u32> meshGeometryOwnersOriginal;
+	unordered_map<u64, u32> meshGeometryHashToOwnerOriginal;
+	trianglesOriginal.swap(sTriangles);
+	meshesOriginal.swap(sMeshes);
+	meshSourcesOriginal.swap(sMeshSources);
+	meshGeometryOwnersOriginal.swap(sMeshGeometryOwners);
+	meshGeometryHashToOwnerOriginal.swap(sMeshGeometryHashToOwner);
+	const u32 triangleBvhCountOriginal = sTriangleBvhCount;
+	const bool cacheEnabled = sBvhCacheEnabled;
+	sBvhCacheEnabled = false;
+
+	// every instance points at the same source mesh, so the whole test loads the obj once
+	bool passed = true;
+	Mesh* mesh = new Mesh(fileName, Mesh::MeshType::MESH, XMFLOAT3(0.0f, 0.0f, 0.0f), XMFLOAT3(0.0f, 0.0f, 0.0f), XMFLOAT3(1.0f, 1.0f, 1.0f), fileName);
+	const u32 instanceCounts[] = { MAX(instanceCount / 100, 2u), MAX(instanceCount / 10, 2u), MAX(instanceCount, 2u) };
+	for (u32 count : instanceCounts)
+	{
+		sTriangles.clear();
+		sMeshes.clear();
+		sMeshSources.clear();
+		sMeshGeometryOwners.clear();
+		sMeshGeometryHashToOwner.clear();
+		sTriangleBvhCount = 0;
+
+		// instances sit on a jittered grid with random rotations and scales, the spacing leaves room for the largest scale
+		mt19937 generator(0);
+		uniform_real_distribution<float> distribution(0.0f, 1.0f);
+		const u32 gridSize = (u32)ceilf(powf((float)count, 1.0f / 3.0f));
+		const float spacing = 4.0f;
+		CpuTimer timer;
+		for (u32 i = 0; i < count; i++)
+		{
+			const XMVECTOR position = XMVectorSet((float)(i % gridSize), (float)(i / gridSize % gridSize), (float)(i / gridSize / gridSize), 0.0f) * spacing;
+			const XMMATRIX model =
+				XMMatrixScaling(0.5f + distribution(generator), 0.5f + distribution(generator), 0.5f + distribution(generator)) *
+				XMMatrixRotationRollPitchYaw(distribution(generator) * XM_2PI, distribution(generator) * XM_2PI, distribution(generator) * XM_2PI) *
+				XMMatrixTranslationFromVector(position);
+			XMFLOAT4X4 modelFloat4x4;
+			XMFLOAT4X4 modelInvFloat4x4;
+			XMStoreFloat4x4(&modelFloat4x4, model);
+			XMStoreFloat4x4(&modelInvFloat4x4, XMMatrixInverse(nullptr, model));
+			AddMesh(mesh, modelFloat4x4, modelInvFloat4x4);
+		}
+		const float addTime = timer.GetMilliseconds();
+		timer.Reset();
+		UpdateBvhCpu(scene);
+		const float buildTime = timer.GetMilliseconds();
+
+		// a ray from outside aimed at the center of an instance has to hit it through the shared BVH, and agree with the brute force test
+		int rayCount = 0;
+		int missCount = 0;
+		for (int i = 0; i < 1024; i++)
+		{
+			const u32 meshIndex = (u32)(distribution(generator) * count) % count;
+			const MeshPT& instance = sMeshes[meshIndex];
+			const XMMATRIX model = XMLoadFloat4x4(&instance.mModel);
+			const XMMATRIX modelInv = XMLoadFloat4x4(&instance.mModelInv);
+			const AABB& bounds = sTriangleModelBVHs[instance.mRootTriangleBvhIndexLocal + instance.mTriangleBvhIndexLocalToGlobalOffset].mAABB;
+			const XMVECTOR center = XMVector3TransformCoord((XMLoadFloat3(&bounds.mMin) + XMLoadFloat3(&bounds.mMax)) * 0.5f, model);
+			const XMVECTOR dir = XMVector3Normalize(XMVectorSet(distribution(generator) - 0.5f, distribution(generator) - 0.5f, distribution(generator) - 0.5f, 0.0f));
+			const XMVECTOR ori = center - dir * spacing;
+			XMFLOAT3 oriModel;
+			XMFLOAT3 dirModel;
+			XMStoreFloat3(&oriModel, XMVector3TransformCoord(ori, modelInv));
+			XMStoreFloat3(&dirModel, XMVector3Normalize(XMVector3TransformNormal(dir, modelInv)));
+			const PathTracerCpu::RayCpu rayModel = PathTracerCpu::MakeRay(oriModel, dirModel);
+			PathTracerCpu::HitCpu hit;
+			PathTracerCpu::HitCpu hitReference;
+			const bool hitInstance = PathTracerCpu::IntersectTriangleBVH(meshIndex, rayModel, hit);
+			PathTracerCpu::IntersectTrianglesBruteForce(meshIndex, rayModel, hitReference);
+			rayCount++;
+			if (!hitInstance || hit.mT != hitReference.mT)
+				missCount++;
+		}
+
+		// what the same scene takes when every mesh owns a copy of its triangles and triangle BVH
+		const u64 triangleCountUnshared = (u64)sMeshes[0].mTriangleCount * count;
+		const u64 triangleBvhCountUnshared = (u64)(sMeshes[0].mTriangleCount - 1) * count;
+		const u64 meshDataSize = sMeshes.size() * sizeof(MeshPT) + sMeshWorldBVHs.size() * sizeof(BVH);
+		const u64 sharedSize = sTriangles.size() * sizeof(TrianglePT) + sTriangleModelBVHs.size() * sizeof(BVH) + meshDataSize;
+		const u64 unsharedSize = triangleCountUnshared * sizeof(TrianglePT) + triangleBvhCountUnshared * sizeof(BVH) + meshDataSize;
+		printf("%u instances of %s: %d triangles (%llu unshared), %d triangle bvh nodes (%llu unshared), %d mesh bvh nodes, %f MB (%f MB unshared), add %f ms, build %f ms, %d of %d rays missed their instance\n",
+			count, fileName.c_str(),
+			(int)sTriangles.size(), triangleCountUnshared,
+			(int)sTriangleModelBVHs.size(), triangleBvhCountUnshared,
+			(int)sMeshWorldBVHs.size(),
+			sharedSize / (1024.0f * 1024.0f), unsharedSize / (1024.0f * 1024.0f),
+			addTime, buildTime, missCount, rayCount);
+		if (missCount > 0)
+		{
+			fprintf(stderr, "%d of %d rays missed their instance among %u instances of %s, instances don't trace through their shared triangle BVH\n", missCount, rayCount, count, fileName.c_str());
+			passed = false;
+		}
+	}
+	delete mesh;
+
+	trianglesOriginal.swap(sTriangles);
+	meshesOriginal.swap(sMeshes);
+	meshSourcesOriginal.swap(sMeshSources);
+	meshGeometryOwnersOriginal.swap(sMeshGeometryOwners);
+	meshGeometryHashToOwnerOriginal.swap(sMeshGeometryHashToOwner);
+	sTriangleBvhCount = triangleBvhCountOriginal;
+	vector<BVH>().swap(sTriangleModelBVHs);
+	sBvhCacheEnabled = cacheEnabled;
+	printf("==============================\n");
+	return passed;
+}
+
+// CPU emulation of cs_pathtracer_radixsort_*.hlsl, one loop iteration per GPU thread and the same buffer layout
+// the bit group width is a parameter so wider radices can be evaluated, PT_RADIXSORT_BIT_PER_BITGROUP bits is what the shaders do
+enum RadixSortStageCpu
+{
+	RadixSortStageInit,
+	RadixSortStagePoll,
+	RadixSortStageUpSweep,
+	RadixSortStageDownSweep,
+	RadixSortStageReorder,
+	RadixSortStageCount,
+};
+
+static const char* RadixSortStageNames[RadixSortStageCount] = { "init", "poll", "up sweep", "down sweep", "reorder" };
+
+struct RadixSortTrafficCpu
+{
+	u64 mDispatchCount = 0;
+	u64 mBytesRead = 0;
+	u64 mBytesWritten = 0;
+};
+
+struct RadixSortEmulatorCpu
+{
+	u32 mBitPerGroup = PT_RADIXSORT_BIT_PER_BITGROUP;
+	u32 mBucketCount = 0;
+	u32 mLeafCount = 0;
+	int mDispatchCount = 0; // the uniforms UpdateBvhGpuCommon sets
+	int mSweepThreadCount = 0;
+	int mSweepDepthCount = 0;
+	vector<AabbProxy> mProxyBuffer; // sAabbProxyBuffer and sSortedAabbProxyBuffer
+	vector<AabbProxy> mSortedProxyBuffer;
+	vector<u32> mBitCountArray; // 2 uints per bucket per entry, the count of each bucket before the entry in its thread then the bucket of the entry one hot, a uint4 for 1 bit
+	vector<u32> mPrefixSumAuxArray; // 2 uints per bucket per sweep thread, the count of each bucket then whatever the sweeps leave in the rest of the uint4
+	vector<u32> mReorderOffset; // GlobalBvhSettings::mRadixSortReorderOffset, the count of every bucket but the last in the last sweep thread
+	RadixSortTrafficCpu mTraffic[RadixSortStageCount];
+};
+
+// the buffers keep whatever the last mesh left in them on the GPU, garbage makes reads of elements nobody wrote show up as errors
+inline void InitRadixSortEmulator(RadixSortEmulatorCpu& emulator, const vector<u32>& keys, u32 bitPerGroup)
+{
+	emulator.mBitPerGroup = bitPerGroup;
+	emulator.mBucketCount = 1 << bitPerGroup;
+	emulator.mLeafCount = (u32)keys.size();
+	GetRadixSortDispatchSizes(emulator.mLeafCount, emulator.mDispatchCount, emulator.mSweepThreadCount, emulator.mSweepDepthCount);
+	AabbProxy garbage;
+	memset(&garbage, 0xcd, sizeof(garbage));
+	emulator.mProxyBuffer.assign(keys.size(), garbage);
+	emulator.mSortedProxyBuffer.assign(keys.size(), garbage);
+	emulator.mBitCountArray.assign(keys.size() * emulator.mBucketCount * 2, 0xcdcdcdcd);
+	emulator.mPrefixSumAuxArray.assign((size_t)NextPowerOfTwo32(emulator.mSweepThreadCount) * emulator.mBucketCount * 2, 0xcdcdcdcd);
+	emulator.mReorderOffset.assign(emulator.mBucketCount - 1, 0xcdcdcdcd);
+	for (int i = 0; i < RadixSortStageCount; i++)
+		emulator.mTraffic[i] = RadixSortTrafficCpu();
+	for (u32 i = 0; i < emulator.mLeafCount; i++)
+	{
+		// the triangle path of cs_pathtracer_radixsort_init, the keys stand in for the morton codes of the triangles
+		memset(&emulator.mProxyBuffer[i].mAABB, 0, sizeof(AABB));
+		emulator.mProxyBuffer[i].mMortonCode = keys[i];
+		emulator.mProxyBuffer[i].mOriginalIndex = i;
+		emulator.mProxyBuffer[i].mBvhIndexLocal = emulator.mLeafCount;
+	}
+	RadixSortTrafficCpu& traffic = emulator.mTraffic[RadixSortStageInit];
+	traffic.mDispatchCount += emulator.mDispatchCount;
+	traffic.mBytesRead += (u64)emulator.mLeafCount * (sizeof(Vertex) * 3 + sizeof(UINT));
+	traffic.mBytesWritten += (u64)emulator.mLeafCount * sizeof(AabbProxy) + (u64)(emulator.mLeafCount - 1) * sizeof(BVH);
+}
+
+// threads past the last entry and the last sweep thread do nothing, they are counted as dispatched but not iterated
+inline u32 GetRadixSortBucket(const RadixSortEmulatorCpu& emulator, u32 key, u32 bitGroupIndex)
+{
+	const u32 bucketShift = bitGroupIndex * emulator.mBitPerGroup;
+	const u32 bucketMask = (emulator.mBucketCount - 1) << bucketShift;
+	return (key & bucketMask) >> bucketShift;
+}
+
+inline void EmulateRadixSortPoll(RadixSortEmulatorCpu& emulator, u32 bitGroupIndex)
+{
+	const u32 bucketCount = emulator.mBucketCount;
+	const i64 threadCount = MIN((i64)emulator.mDispatchCount * PT_BUILDBVH_THREAD_PER_DISPATCH, MAX((i64)ROUNDUP_DIVISION(emulator.mLeafCount, PT_BUILDBVH_ENTRY_PER_THREAD), (i64)emulator.mSweepThreadCount));
+	RadixSortTrafficCpu& traffic = emulator.mTraffic[RadixSortStagePoll];
+	traffic.mDispatchCount += emulator.mDispatchCount;
+	vector<u32> sum(bucketCount);
+	for (i64 threadIndex = 0; threadIndex < threadCount; threadIndex++)
+	{
+		fill(sum.begin(), sum.end(), 0);
+		for (u32 i = 0; i < PT_BUILDBVH_ENTRY_PER_THREAD; i++)
+		{
+			const i64 entryIndex = i + threadIndex * PT_BUILDBVH_ENTRY_PER_THREAD;
+			if (entryIndex >= emulator.mLeafCount)
+				continue;
+			const u32 bucket = GetRadixSortBucket(emulator, emulator.mProxyBuffer[entryIndex].mMortonCode, bitGroupIndex);
+			u32* bitCount = &emulator.mBitCountArray[entryIndex * bucketCount * 2];
+			for (u32 j = 0; j < bucketCount; j++)
+			{
+				bitCount[j] = sum[j];
+				bitCount[bucketCount + j] = j == bucket;
+			}
+			sum[bucket]++;
+			traffic.mBytesRead += sizeof(UINT);
+			traffic.mBytesWritten += bucketCount * 2 * sizeof(UINT);
+		}
+		if (threadIndex < emulator.mSweepThreadCount)
+		{
+			u32* aux = &emulator.mPrefixSumAuxArray[threadIndex * bucketCount * 2];
+			for (u32 j = 0; j < bucketCount; j++)
+			{
+				aux[j] = sum[j];
+				aux[bucketCount + j] = 0;
+			}
+			traffic.mBytesWritten += bucketCount * 2 * sizeof(UINT);
+		}
+		if (threadIndex == emulator.mSweepThreadCount - 1)
+		{
+			for (u32 j = 0; j < bucketCount - 1; j++)
+				emulator.mReorderOffset[j] = sum[j];
+			traffic.mBytesWritten += (bucketCount - 1) * sizeof(UINT);
+		}
+	}
+}
+
+// the threads of one sweep dispatch touch disjoint elements, running them in order is the same as running them in parallel
+inline void EmulateRadixSortUpSweep(RadixSortEmulatorCpu& emulator, int dispatchIndex)
+{
+	const u32 bucketCount = emulator.mBucketCount;
+	const u32 d = dispatchIndex;
+	const u32 n = NextPowerOfTwo32(emulator.mSweepThreadCount);
+	RadixSortTrafficCpu& traffic = emulator.mTraffic[RadixSortStageUpSweep];
+	traffic.mDispatchCount++;
+	for (u32 k = 0; k < n; k += NTH_POWER_OF_TWO((d + 1)))
+	{
+		const u32 selfIndex = k + NTH_POWER_OF_TWO((d + 1)) - 1;
+		const u32 siblingIndex = k + NTH_POWER_OF_TWO(d) - 1;
+		u32* self = &emulator.mPrefixSumAuxArray[selfIndex * bucketCount * 2];
+		u32* sibling = &emulator.mPrefixSumAuxArray[siblingIndex * bucketCount * 2];
+		for (u32 j = 0; j < bucketCount; j++)
+		{
+			const u32 selfSum = self[j];
+			self[j] = selfSum + sibling[j];
+			sibling[bucketCount + j] = selfSum;
+		}
+		self[bucketCount] = selfIndex;
+		self[bucketCount + 1] = siblingIndex;
+		traffic.mBytesRead += bucketCount * 2 * sizeof(UINT);
+		traffic.mBytesWritten += bucketCount * 4 * sizeof(UINT);
+	}
+}
+
+inline void EmulateRadixSortDownSweep(RadixSortEmulatorCpu& emulator, int dispatchIndex)
+{
+	const u32 bucketCount = emulator.mBucketCount;
+	const u32 d = emulator.mSweepDepthCount - dispatchIndex - 1;
+	const u32 n = NextPowerOfTwo32(emulator.mSweepThreadCount);
+	RadixSortTrafficCpu& traffic = emulator.mTraffic[RadixSortStageDownSweep];
+	traffic.mDispatchCount++;
+	if (dispatchIndex == 0)
+	{
+		for (u32 j = 0; j < bucketCount; j++)
+			emulator.mPrefixSumAuxArray[(n - 1) * bucketCount * 2 + j] = 0;
+		traffic.mBytesWritten += bucketCount * sizeof(UINT);
+	}
+	for (u32 k = 0; k < n; k += NTH_POWER_OF_TWO((d + 1)))
+	{
+		const u32 selfIndex = k + NTH_POWER_OF_TWO((d + 1)) - 1;
+		const u32 siblingIndex = k + NTH_POWER_OF_TWO(d) - 1;
+		u32* self = &emulator.mPrefixSumAuxArray[selfIndex * bucketCount * 2];
+		u32* sibling = &emulator.mPrefixSumAuxArray[siblingIndex * bucketCount * 2];
+		for (u32 j = 0; j < bucketCount; j++)
+		{
+			const u32 siblingSum = sibling[j];
+			sibling[j] = self[j];
+			self[j] += siblingSum;
+		}
+		sibling[bucketCount] = siblingIndex;
+		sibling[bucketCount + 1] = selfIndex;
+		traffic.mBytesRead += bucketCount * 3 * sizeof(UINT);
+		traffic.mBytesWritten += bucketCount * 3 * sizeof(UINT);
+	}
+}
+
+inline void EmulateRadixSortReorder(RadixSortEmulatorCpu& emulator, u32 bitGroupIndex)
+{
+	const u32 bucketCount = emulator.mBucketCount;
+	const i64 threadCount = MIN((i64)emulator.mDispatchCount * PT_BUILDBVH_THREAD_PER_DISPATCH, (i64)ROUNDUP_DIVISION(emulator.mLeafCount, PT_BUILDBVH_ENTRY_PER_THREAD));
+	RadixSortTrafficCpu& traffic = emulator.mTraffic[RadixSortStageReorder];
+	traffic.mDispatchCount += emulator.mDispatchCount;
+	// the first entry of each bucket, the exclusive prefix sum of the last sweep thread plus what that thread counted itself
+	vector<u32> bucketOffset(bucketCount, 0);
+	const u32* lastAux = &emulator.mPrefixSumAuxArray[(emulator.mSweepThreadCount - 1) * bucketCount * 2];
+	for (u32 j = 1; j < bucketCount; j++)
+		bucketOffset[j] = bucketOffset[j - 1] + lastAux[j - 1] + emulator.mReorderOffset[j - 1];
+	for (i64 threadIndex = 0; threadIndex < threadCount; threadIndex++)
+	{
+		traffic.mBytesRead += (bucketCount - 1) * 2 * sizeof(UINT);
+		for (u32 i = 0; i < PT_BUILDBVH_ENTRY_PER_THREAD; i++)
+		{
+			const i64 entryIndex = i + threadIndex * PT_BUILDBVH_ENTRY_PER_THREAD;
+			if (entryIndex >= emulator.mLeafCount)
+				continue;
+			const u32 bucket = GetRadixSortBucket(emulator, emulator.mProxyBuffer[entryIndex].mMortonCode, bitGroupIndex);
+			// a thread past the sweep threads reads an element the sweeps never wrote, or past the end of the buffer
+			const u64 auxIndex = threadIndex * bucketCount * 2 + bucket;
+			const u32 threadOffset = auxIndex < emulator.mPrefixSumAuxArray.size() ? emulator.mPrefixSumAuxArray[auxIndex] : 0xcdcdcdcd;
+			const u32 newEntryIndex = emulator.mBitCountArray[entryIndex * bucketCount * 2 + bucket] + threadOffset + bucketOffset[bucket];
+			traffic.mBytesRead += sizeof(UINT) * 3 + sizeof(AabbProxy);
+			traffic.mBytesWritten += sizeof(AabbProxy);
+			if (newEntryIndex >= emulator.mLeafCount)
+				continue; // out of bounds writes are dropped, the missing entry fails the validation
+			emulator.mSortedProxyBuffer[newEntryIndex] = emulator.mProxyBuffer[entryIndex];
+		}
+	}
+}
+
+// the pass sequence of UpdateBvhGpuCommon, the sorted entries end up in mProxyBuffer after the last ping pong swap
+inline void EmulateRadixSort(RadixSortEmulatorCpu& emulator)
+{
+	const u32 bitGroupCount = PT_RADIXSORT_BIT_PER_ENTRY / emulator.mBitPerGroup;
+	for (u32 bitGroupIndex = 0; bitGroupIndex < bitGroupCount; bitGroupIndex++)
+	{
+		EmulateRadixSortPoll(emulator, bitGroupIndex);
+		for (int k = 0; k < emulator.mSweepDepthCount; k++)
+			EmulateRadixSortUpSweep(emulator, k);
+		for (int k = 0; k < emulator.mSweepDepthCount; k++)
+			EmulateRadixSortDownSweep(emulator, k);
+		EmulateRadixSortReorder(emulator, bitGroupIndex);
+		emulator.mProxyBuffer.swap(emulator.mSortedProxyBuffer);
+	}
+}
+
+// entries that are out of order, sorting by key then original index is what a stable radix sort has to produce
+inline u32 CountRadixSortErrors(const RadixSortEmulatorCpu& emulator, const vector<u32>& keys)
+{
+	vector<pair<u32, u32>> reference(keys.size());
+	for (u32 i = 0; i < keys.size(); i++)
+		reference[i] = make_pair(keys[i], i);
+	sort(reference.begin(), reference.end());
+	u32 errorCount = 0;
+	for (u32 i = 0; i < keys.size(); i++)
+	{
+		const AabbProxy& proxy = emulator.mProxyBuffer[i];
+		if (proxy.mMortonCode != reference[i].first || proxy.mOriginalIndex != reference[i].second || proxy.mBvhIndexLocal != keys.size())
+			errorCount++;
+	}
+	return errorCount;
+}
+
+bool PathTracer::ValidateRadixSort()
+{
+	printf(">>> radix sort validation <<<\n");
+	const u32 leafCounts[] = { 2, 3, 63, 64, 65, 127, 128, 129, 1000, 4095, 4097, 65537, 300007, 1 << 20 };
+	const char* keySetNames[] = { "random", "equal", "sorted", "reversed", "few unique", "top bit", "single bit", "morton" };
+	mt19937 generator(0);
+	RadixSortEmulatorCpu emulator;
+	vector<u32> keys;
+	u32 failedCount = 0;
+	for (u32 leafCount : leafCounts)
+	{
+		for (u32 keySet = 0; keySet < _countof(keySetNames); keySet++)
+		{
+			keys.resize(leafCount);
+			for (u32 i = 0; i < leafCount; i++)
+			{
+				switch (keySet)
+				{
+				case 0: keys[i] = generator(); break;
+				case 1: keys[i] = 0xdeadbeef; break;
+				case 2: keys[i] = i * 2654435; break;
+				case 3: keys[i] = ~(i * 2654435); break;
+				case 4: keys[i] = generator() % 4; break;
+				case 5: keys[i] = i % 2 ? 0x80000000 : 0x7fffffff; break;
+				case 6: keys[i] = 1u << (i % 32); break;
+				default: keys[i] = generator() & 0x3fffffff; break; // 10 bits per axis leave the top 2 bits alone
+				}
+			}
+			InitRadixSortEmulator(emulator, keys, PT_RADIXSORT_BIT_PER_BITGROUP);
+			EmulateRadixSort(emulator);
+			const u32 errorCount = CountRadixSortErrors(emulator, keys);
+			if (errorCount)
+			{
+				fprintf(stderr, "%u %s keys: %u entries out of place, sweep thread count %d for %u threads with entries\n",
+					leafCount, keySetNames[keySet], errorCount, emulator.mSweepThreadCount, (u32)ROUNDUP_DIVISION(leafCount, PT_BUILDBVH_ENTRY_PER_THREAD));
+				failedCount++;
+			}
+		}
+	}
+	printf("%u of %u key sets sorted wrong\n", failedCount, (u32)(_countof(leafCounts) * _countof(keySetNames)));
+
+	// passes and traffic of the largest key set for the current and wider radices, every width is validated as well
+	keys.resize(leafCounts[_countof(leafCounts) - 1]);
+	for (u32& key : keys)
+		key = generator();
+	for (u32 bitPerGroup = 1; bitPerGroup <= 8; bitPerGroup *= 2)
+	{
+		InitRadixSortEmulator(emulator, keys, bitPerGroup);
+		CpuTimer timer;
+		EmulateRadixSort(emulator);
+		const float emulationTime = timer.GetMilliseconds();
+		const u32 errorCount = CountRadixSortErrors(emulator, keys);
+		const u32 bitGroupCount = PT_RADIXSORT_BIT_PER_ENTRY / bitPerGroup;
+		u64 dispatchCount = 0;
+		u64 byteCount = 0;
+		printf("%u bit radix%s, %u keys: %u bit groups, %u entries out of place, emulated in %f ms\n", bitPerGroup, bitPerGroup == PT_RADIXSORT_BIT_PER_BITGROUP ? " (shaders)" : "", (u32)keys.size(), bitGroupCount, errorCount, emulationTime);
+		for (int i = 0; i < RadixSortStageCount; i++)
+		{
+			const RadixSortTrafficCpu& traffic = emulator.mTraffic[i];
+			const u32 passCount = i == RadixSortStageInit ? 1 : bitGroupCount;
+			printf("    %-10s %u passes, %llu dispatches, %f MB read and %f MB written per pass\n",
+				RadixSortStageNames[i], passCount, traffic.mDispatchCount, traffic.mBytesRead / passCount / 1048576.0, traffic.mBytesWritten / passCount / 1048576.0);
+			dispatchCount += traffic.mDispatchCount;
+			byteCount += traffic.mBytesRead + traffic.mBytesWritten;
+		}
+		printf("    total      %llu dispatches, %f MB moved\n", dispatchCount, byteCount / 1048576.0);
+		if (errorCount)
+		{
+			fprintf(stderr, "%u bit radix: %u of %u keys out of place\n", bitPerGroup, errorCount, (u32)keys.size());
+			failedCount++;
+		}
+	}
+	if (failedCount > 0)
+		fprintf(stderr, "radix sort emulation doesn't match std::sort on %u key sets\n", failedCount);
+	printf("==============================\n");
+	return failedCount == 0;
+}
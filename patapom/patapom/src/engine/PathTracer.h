@@ -17,19 +17,54 @@ public:
 		BuildBvhTypeMesh = PT_BUILDBVH_TYPE_MESH, 
 		BuildBvhTypeCount = PT_BUILDBVH_TYPE_COUNT 
 	};
-	static const int sLightDataCountMax;
+	enum BvhBuilderType : u8
+	{
+		BvhBuilderTypeLBVH,
+		BvhBuilderTypeSAH,
+		BvhBuilderTypeCount
+	};
+	static BvhBuilderType sBvhBuilderType;
+	static bool sBvhBuildMultithreaded;
+	static bool sBvhCacheEnabled; // load triangle BVHs from CachePath when the mesh content matches, and save them after building
+	static bool sBvhBuildGpu; // -buildBvhGpu, unless the GPU trees would be too deep for the traversal stacks
+	static bool sMeshDataDirty; // mesh transforms or mesh BVH changed since the last upload
+	static float sMeshBvhSahCostAtBuild;
+	static float sBvhBuildMilliseconds; // time the last UpdateBvhCpu took
 	static const int sThreadGroupCountX;
 	static const int sThreadGroupCountY;
 	static const int sBackbufferWidth;
 	static const int sBackbufferHeight;
 	static u32 sMeshTextureCount;
 	static u32 sMeshBvhRootIndexGlobal;
+	static u32 sMeshBvhHeight; // internal node levels of the mesh BVH, bounds its traversal stack
 	static vector<TrianglePT> sTriangles;
 	static vector<MeshPT> sMeshes;
+	static vector<MaterialPT> sMaterials; // unique materials of the meshes, see MeshPT::mMaterialIndex
+	static vector<Mesh*> sMeshSources; // source mesh of each MeshPT
+	static vector<u32> sMeshGeometryOwners; // first mesh with the same geometry as each mesh, instances share its triangles and triangle BVH
+	static u32 sTriangleBvhCount; // triangle BVH nodes of every unique geometry
 	static vector<LightData> sLightData;
+	static vector<LightBvhNode> sLightBvhNodes; // built from sLightData by BuildLightBvh
+	static vector<AliasEntry> sLightAliasEntries; // one table per mesh light, see LightData::mAliasEntryOffset
 	static vector<BVH> sTriangleModelBVHs;
+	static vector<u32> sTriangleBvhHeights; // internal node levels of the triangle BVH of each mesh, bounds its traversal stack
+	static vector<AABB> sMeshModelAABBs; // root bounds of the triangle BVH of each mesh, only filled when the GPU built the triangle BVHs, see BuildMeshBvhCpuFromGpu
 	static vector<BVH> sMeshWorldBVHs;
+	static vector<WideBVH> sTriangleWideBVHs; // only built on demand for CPU traversal
+	static vector<u32> sTriangleWideBvhOffsets; // local to global offset of each mesh, the root of each mesh is at local index 0
+	static vector<float> sAdaptiveTileErrors; // last tile errors read back from the GPU
+	static float sAdaptiveGlobalError; // mean of sAdaptiveTileErrors, 1 until the errors of the current image are read back
+	static u32 sAdaptiveActiveTileCount; // tiles still above the error threshold
+	static u32 sAdaptiveRestartFrame;
 	static PassPathTracer sPathTracerPass;
+	static PassPathTracer sPathTracerWavefrontGeneratePass;
+	static PassPathTracer sPathTracerWavefrontExtendPass[PT_MAXDEPTH_MAX];
+	static PassPathTracer sPathTracerWavefrontSortPass[PT_MAXDEPTH_MAX];
+	static PassPathTracer sPathTracerWavefrontShadePass[PT_MAXDEPTH_MAX];
+	static PassPathTracer sPathTracerWavefrontConnectPass[PT_MAXDEPTH_MAX];
+	static PassPathTracer sPathTracerWavefrontAccumulatePass;
+	static PassPathTracer sPathTracerAdaptiveTileErrorPass;
+	static vector<PassPathTracer*> sPathTracerWavefrontPasses; // every wavefront pass, they all bind the same resources
 	static PassPathTracerBuildScene sPathTracerRadixSortInitPass[BuildBvhType::BuildBvhTypeCount];
 	static PassPathTracerBuildScene sPathTracerRadixSortPollPass[BuildBvhType::BuildBvhTypeCount];
 	static PassPathTracerBuildScene sPathTracerRadixSortUpSweepPass[BuildBvhType::BuildBvhTypeCount];
@@ -44,6 +79,13 @@ public:
 	static Mesh sPathTracerDebugMeshLine;
 	static Mesh sPathTracerDebugMeshCube;
 	static Shader sPathTracerCS;
+	static Shader sPathTracerWavefrontGenerateCS;
+	static Shader sPathTracerWavefrontExtendCS;
+	static Shader sPathTracerWavefrontSortCS;
+	static Shader sPathTracerWavefrontShadeCS;
+	static Shader sPathTracerWavefrontConnectCS;
+	static Shader sPathTracerWavefrontAccumulateCS;
+	static Shader sPathTracerAdaptiveTileErrorCS;
 	static Shader sPathTracerRadixSortInitCS;
 	static Shader sPathTracerRadixSortPollCS;
 	static Shader sPathTracerRadixSortUpSweepCS;
@@ -59,7 +101,10 @@ public:
 	static Shader sPathTracerCopyDepthVS;
 	static Shader sPathTracerCopyDepthPS;
 	static Shader sPathTracerBlitBackbufferPS;
-	static Buffer sLightDataBuffer;
+	static WriteBuffer sLightDataBuffer;
+	static WriteBuffer sLightBvhBuffer; // write buffers so moving mesh lights can be uploaded within a frame like sMeshBuffer
+	static WriteBuffer sLightAliasBuffer;
+	static Buffer sMaterialBuffer;
 	static Buffer sTriangleBuffer;
 	static WriteBuffer sMeshBuffer;
 	static WriteBuffer sGlobalBvhSettingsBuffer;
@@ -68,31 +113,88 @@ public:
 	static WriteBuffer sTempBvhBuffer;
 	static WriteBuffer sRayBuffer;
 	static WriteBuffer sDebugRayBuffer;
+	static WriteBuffer sWavefrontPathBuffer;
+	static WriteBuffer sWavefrontRayQueueBuffer;
+	static WriteBuffer sWavefrontHitQueueBuffer;
+	static WriteBuffer sWavefrontShadowQueueBuffer;
+	static WriteBuffer sWavefrontQueueCounterBuffer;
+	static WriteBuffer sWavefrontHitOrderBuffer; // hit queue entries sorted by material, only written when the scene sorts by material
+	static WriteBuffer sAdaptiveTileErrorBuffer;
 	static WriteBuffer sAabbProxyBuffer;
 	static WriteBuffer sSortedAabbProxyBuffer;
 	static WriteBuffer sRadixSortBitCountArrayBuffer;
 	static WriteBuffer sRadixSortPrefixSumAuxArrayBuffer;
 	static RenderTexture sBackbufferPT;
+	static RenderTexture sConvergencePT; // sample count, mean luminance, Welford M2 and relative error of every pixel
+	static RenderTexture sNormalDepthPT; // mean first hit normal and distance to the eye, guides the denoiser
+	static RenderTexture sAlbedoPT; // mean first hit albedo, the denoiser filters the color divided by it
 	static RenderTexture sDebugBackbufferPT;
 	static RenderTexture sDepthbufferWritePT;
 	static RenderTexture sDepthbufferRenderPT;
 	static Camera sCameraDummyPT;
+	static bool ReadBvhBuilderArg(); // false if -bvhBuilder names neither lbvh nor sah, call before InitPathTracer
 	static void InitPathTracer(Store& store, Scene& scene);
 	static int AddMeshesFromPass(Pass& pass);
 	static void UpdateBvhCpu(Scene& scene);
+	static bool UpdateMeshTransforms(Scene& scene); // returns true if any mesh moved
+	static void UpdateWideBvhCpu();
+	static void BuildMeshLights(); // replaces the mesh lights of sLightData with one per emissive mesh
+	static void BuildLightBvh();
 	static void UpdateBvhGpu(CommandList commandList, Scene& scene);
 	static void PrintBVH();
 	static void PreparePathTracer(CommandList commandList, Scene& scene);
 	static void RunPathTracer(CommandList commandList);
+	static void RunPathTracerWavefront(CommandList commandList); // all bounces of one sample per pixel, one dispatch per stage per bounce
+	static void ReadAdaptiveTileErrors(Scene& scene); // before recording, the errors are from whichever earlier frame the GPU finished last
+	static bool IsAdaptiveTargetErrorReached(Scene& scene);
 	static void CopyDepthBuffer(CommandList commandList);
 	static void DebugDraw(CommandList commandList);
 	static void Shutdown();
 	static void Restart(Scene& scene);
+	// headless reports, main runs one on the default scene after InitPathTracer and quits, false when the check fails
+	static bool ValidateMultithreadedBvhBuild(Scene& scene);
+	static bool ValidateBvhRefit(Scene& scene);
+	static bool ValidateBvhCache(Scene& scene);
+	static bool ValidateLargeMeshBuild(Scene& scene);
+	static bool BenchmarkRayPackets(Scene& scene);
+	static bool StressTestInstances(Scene& scene);
+	static bool ValidateRadixSort();
 
 private:
+	static unordered_map<u64, u32> sMeshGeometryHashToOwner; // geometry hash of every unique geometry, to its first mesh
+	static vector<Texture*> sMaterialAlbedoTextures; // albedo texture of each material, part of the key that makes materials unique
+	static u32 AddMaterial(Mesh* mesh, Texture* albedoTexture, u32 albedoTextureIndex); // returns the index of a matching material, adds one if there is none
+	static int AddMesh(Mesh* mesh, const XMFLOAT4X4& model, const XMFLOAT4X4& modelInv); // returns the triangle count of the mesh
+	template<class T_LeafNode>
+	static i64 BuildBVH(vector<T_LeafNode>& leafLocal, vector<BVH>& bvhGlobal, u32 heightMax, u32 meshIndex = INVALID_UINT32); // no deeper than heightMax, see GetBvhHeight
 	template<class T_LeafNode>
-	static i64 BuildBVH(vector<T_LeafNode>& leafLocal, vector<BVH>& bvhGlobal, u32 meshIndex = INVALID_UINT32);
+	static i64 BuildBvhLbvh(vector<T_LeafNode>& leafLocal, vector<BVH>& bvhGlobal, u32 meshIndex);
+	template<class T_LeafNode>
+	static i64 BuildBvhSah(vector<T_LeafNode>& leafLocal, vector<BVH>& bvhGlobal, u32 heightMax, u32 meshIndex);
+	static void CompareBvhBuilders();
+	static string GetTriangleBvhCacheFilePathName(u64 contentHash);
+	static bool LoadTriangleBvhCache(u32 meshIndex, u64 contentHash);
+	static void SaveTriangleBvhCache(u32 meshIndex, u64 contentHash, const vector<u32>& leafToTriangle);
+	static void InitMeshProxies(vector<AabbProxy>& meshProxies);
+	static void BuildMeshBvhCpu();
+	static void BuildMeshBvhCpuFromGpu();
+	static bool IsGpuBvhShallowEnough();
+	static float RefitMeshBvhCpu();
+	static bool RefitOrRebuildMeshBvhCpu();
 	static void UpdateBvhGpuCommon(CommandList commandList, Scene& scene, BuildBvhType buildBvhType);
 	static void UpdateTriangleBvhGpu(CommandList commandList, Scene& scene);
 	static void UpdateMeshBvhGpu(CommandList commandList, Scene& scene);
+	static void UploadMeshDataIfDirty(CommandList commandList);
+	static void RecordAdaptiveTileErrors(CommandList commandList);
 };
+
+// flags of the headless reports, main.cpp runs the matching report from its SceneReports table
+extern CommandLineArg PARAM_validateBvhMultithreaded;
+extern CommandLineArg PARAM_validateBvhRefit;
+extern CommandLineArg PARAM_benchmarkWideBvh;
+extern CommandLineArg PARAM_validateBvhCache;
+extern CommandLineArg PARAM_validateLargeMesh;
+extern CommandLineArg PARAM_benchmarkRayPackets;
+extern CommandLineArg PARAM_validateWatertightTriangles;
+extern CommandLineArg PARAM_stressInstances;
+extern CommandLineArg PARAM_validateRadixSort;
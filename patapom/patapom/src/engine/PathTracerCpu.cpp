@@ -0,0 +1,3970 @@
+﻿#include "PathTracerCpu.h"
+#include "Texture.h"
+#include "ThreadPool.h"
+#include "../dependency/stb_image.h"
+#include <random>
+#include <deque>
+#include <array>
+#include <intrin.h>
+#include <malloc.h>
+
+CommandLineArg PARAM_packetCoherence("-packetCoherence"); // ray packets whose mean direction is shorter than this (0.9 by default) are traced one ray at a time
+CommandLineArg PARAM_cpuTileSize("-cpuTileSize"); // edge length in pixels of the tiles the CPU reference hands out to threads, 16 by default
+CommandLineArg PARAM_cpuWavefront("-cpuWavefront"); // render the CPU reference with the stages of the wavefront mode, reports queue sizes and time per stage
+CommandLineArg PARAM_compareSamplers("-compareSamplers"); // RMSE of every sampler against a random sampler reference of the CPU reference sample count, at each power of 2 spp up to this (64 by default)
+CommandLineArg PARAM_benchmarkLightBvh("-benchmarkLightBvh"); // variance and time of uniform and light BVH light selection over 10, 100 and 10000 random quad lights, at this spp (the CPU reference sample count by default)
+CommandLineArg PARAM_validateMeshLights("-validateMeshLights"); // irradiance from every mesh light at random points around it, light sampling against cosine weighted hemisphere sampling with this many samples per point (4096 by default)
+CommandLineArg PARAM_whiteFurnace("-whiteFurnace"); // albedo of every material type at a few view angles with this many samples (65536 by default), importance sampling against uniform hemisphere sampling
+CommandLineArg PARAM_cpuTimeBudget("-cpuTimeBudget"); // stop the CPU reference after the sample that runs past this many seconds, the sample count is then only an upper bound
+CommandLineArg PARAM_cpuDenoise("-cpuDenoise"); // render the CPU reference with the first hit features, write them next to the image and denoise it like the GPU denoiser
+CommandLineArg PARAM_denoiseFile("-denoiseFile"); // denoise this PFM and the feature files -cpuDenoise wrote next to it, without rendering
+CommandLineArg PARAM_benchmarkDenoiser("-benchmarkDenoiser"); // PSNR before and after denoising at 1, 4 and 16 spp against a reference of the CPU reference sample count, and the time the filter takes
+CommandLineArg PARAM_cpuAdaptive("-cpuAdaptive"); // render the CPU reference with adaptive sampling until the mean tile error drops below this (the UI target error by default), and report the time uniform sampling takes to the same error
+
+inline float RayTriangleCpu(const Triangle& tri, const PathTracerCpu::RayCpu& ray)
+{
+	// Moller-Trumbore
+	const XMVECTOR ori = XMLoadFloat3(&ray.mOri);
+	const XMVECTOR dir = XMLoadFloat3(&ray.mDir);
+	const XMVECTOR v0 = XMLoadFloat3(&tri.mVertices[0].pos);
+	const XMVECTOR e1 = XMLoadFloat3(&tri.mVertices[1].pos) - v0;
+	const XMVECTOR e2 = XMLoadFloat3(&tri.mVertices[2].pos) - v0;
+	const XMVECTOR p = XMVector3Cross(dir, e2);
+	const float det = XMVectorGetX(XMVector3Dot(e1, p));
+	if (fabsf(det) < FLOAT_MIN)
+		return -1.0f;
+	const float invDet = 1.0f / det;
+	const XMVECTOR s = ori - v0;
+	const float u = XMVectorGetX(XMVector3Dot(s, p)) * invDet;
+	if (u < 0.0f || u > 1.0f)
+		return -1.0f;
+	const XMVECTOR q = XMVector3Cross(s, e1);
+	const float v = XMVectorGetX(XMVector3Dot(dir, q)) * invDet;
+	if (v < 0.0f || u + v > 1.0f)
+		return -1.0f;
+	return XMVectorGetX(XMVector3Dot(e2, q)) * invDet;
+}
+
+inline float RayTriangleWatertightCpu(const Triangle& tri, const PathTracerCpu::RayCpu& ray)
+{
+	// Woop et al. 2013, shear the triangle so the ray runs along +z through the origin, then the edge functions
+	// are evaluated on the same 2D coordinates by neighboring triangles and can't leave a gap between them
+	const float dir[3] = { ray.mDir.x, ray.mDir.y, ray.mDir.z };
+	const float dirAbs[3] = { fabsf(dir[0]), fabsf(dir[1]), fabsf(dir[2]) };
+	const int kz = dirAbs[0] > dirAbs[1] ? (dirAbs[0] > dirAbs[2] ? 0 : 2) : (dirAbs[1] > dirAbs[2] ? 1 : 2);
+	int kx = (kz + 1) % 3;
+	int ky = (kx + 1) % 3;
+	if (dir[kz] < 0.0f)
+		swap(kx, ky); // keep the winding
+	const float shearX = dir[kx] / dir[kz];
+	const float shearY = dir[ky] / dir[kz];
+	const float shearZ = 1.0f / dir[kz];
+
+	const float a[3] = { tri.mVertices[0].pos.x - ray.mOri.x, tri.mVertices[0].pos.y - ray.mOri.y, tri.mVertices[0].pos.z - ray.mOri.z };
+	const float b[3] = { tri.mVertices[1].pos.x - ray.mOri.x, tri.mVertices[1].pos.y - ray.mOri.y, tri.mVertices[1].pos.z - ray.mOri.z };
+	const float c[3] = { tri.mVertices[2].pos.x - ray.mOri.x, tri.mVertices[2].pos.y - ray.mOri.y, tri.mVertices[2].pos.z - ray.mOri.z };
+	const float ax = a[kx] - shearX * a[kz];
+	const float ay = a[ky] - shearY * a[kz];
+	const float bx = b[kx] - shearX * b[kz];
+	const float by = b[ky] - shearY * b[kz];
+	const float cx = c[kx] - shearX * c[kz];
+	const float cy = c[ky] - shearY * c[kz];
+	// an edge shared by two triangles gets exactly negated edge functions as long as the compiler doesn't fuse these
+	// into multiply-adds, MSVC only does that with /fp:contract or /fp:fast
+	float u = cx * by - cy * bx;
+	float v = ax * cy - ay * cx;
+	float w = bx * ay - by * ax;
+
+	// an edge function that rounds to exactly 0 is redone in double so the ray goes to exactly one side of the edge
+	if (u == 0.0f || v == 0.0f || w == 0.0f)
+	{
+		u = (float)((double)cx * (double)by - (double)cy * (double)bx);
+		v = (float)((double)ax * (double)cy - (double)ay * (double)cx);
+		w = (float)((double)bx * (double)ay - (double)by * (double)ax);
+	}
+	if ((u < 0.0f || v < 0.0f || w < 0.0f) && (u > 0.0f || v > 0.0f || w > 0.0f))
+		return -1.0f;
+	const float det = u + v + w;
+	if (det == 0.0f)
+		return -1.0f;
+	const float t = (u * shearZ * a[kz] + v * shearZ * b[kz] + w * shearZ * c[kz]) / det;
+	return t > 0.0f ? t : -1.0f;
+}
+
+inline float RayTrianglePlaneCpu(const Triangle& tri, const PathTracerCpu::RayCpu& ray)
+{
+	// RayTriangle of cs_pathtracer.hlsl, plane hit followed by three edge tests, only used to compare against
+	const XMVECTOR ori = XMLoadFloat3(&ray.mOri);
+	const XMVECTOR dir = XMLoadFloat3(&ray.mDir);
+	const XMVECTOR p0 = XMLoadFloat3(&tri.mVertices[0].pos);
+	const XMVECTOR p1 = XMLoadFloat3(&tri.mVertices[1].pos);
+	const XMVECTOR p2 = XMLoadFloat3(&tri.mVertices[2].pos);
+	const XMVECTOR nor = XMVector3Normalize(XMVector3Cross(p1 - p0, p2 - p0));
+	const float norDotDir = XMVectorGetX(XMVector3Dot(nor, dir));
+	const float t = norDotDir == 0.0f ? 0.0f : XMVectorGetX(XMVector3Dot(nor, p0 - ori)) / norDotDir;
+	if (t <= 0.0f)
+		return -1.0f;
+	const XMVECTOR p = ori + dir * t;
+	const float sign01 = XMVectorGetX(XMVector3Dot(nor, XMVector3Cross(p1 - p0, p - p0)));
+	const float sign12 = XMVectorGetX(XMVector3Dot(nor, XMVector3Cross(p2 - p1, p - p1)));
+	const float sign20 = XMVectorGetX(XMVector3Dot(nor, XMVector3Cross(p0 - p2, p - p2)));
+	return sign01 > 0.0f && sign12 > 0.0f && sign20 > 0.0f ? t : -1.0f;
+}
+
+inline bool RayAabbCpu(const AABB& aabb, const PathTracerCpu::RayCpu& ray, float tMax, float& tNear)
+{
+	// slab test
+	const float tx0 = (aabb.mMin.x - ray.mOri.x) * ray.mInvDir.x;
+	const float tx1 = (aabb.mMax.x - ray.mOri.x) * ray.mInvDir.x;
+	const float ty0 = (aabb.mMin.y - ray.mOri.y) * ray.mInvDir.y;
+	const float ty1 = (aabb.mMax.y - ray.mOri.y) * ray.mInvDir.y;
+	const float tz0 = (aabb.mMin.z - ray.mOri.z) * ray.mInvDir.z;
+	const float tz1 = (aabb.mMax.z - ray.mOri.z) * ray.mInvDir.z;
+	tNear = MAX(MAX(MIN(tx0, tx1), MIN(ty0, ty1)), MAX(MIN(tz0, tz1), 0.0f));
+	const float tFar = MIN(MIN(MAX(tx0, tx1), MAX(ty0, ty1)), MIN(MAX(tz0, tz1), tMax));
+	return tNear <= tFar;
+}
+
+bool PathTracerCpu::sWatertightTriangles = false;
+
+inline void IntersectLeafCpu(u32 triangleIndex, const PathTracerCpu::RayCpu& ray, PathTracerCpu::HitCpu& hit)
+{
+	const float t = PathTracerCpu::sWatertightTriangles ?
+		RayTriangleWatertightCpu(PathTracer::sTriangles[triangleIndex], ray) :
+		RayTriangleCpu(PathTracer::sTriangles[triangleIndex], ray);
+	if (t > 0.0f && t < hit.mT)
+	{
+		hit.mT = t;
+		hit.mTriangleIndex = triangleIndex;
+	}
+}
+
+PathTracerCpu::RayCpu PathTracerCpu::MakeRay(const XMFLOAT3& ori, const XMFLOAT3& dir)
+{
+	// keep the reciprocal finite so the slab test never multiplies 0 by infinity
+	auto safeInverse = [](float x) { return 1.0f / (fabsf(x) > FLOAT_MIN ? x : (x < 0.0f ? -FLOAT_MIN : FLOAT_MIN)); };
+	RayCpu ray;
+	ray.mOri = ori;
+	ray.mDir = dir;
+	ray.mInvDir = XMFLOAT3(safeInverse(dir.x), safeInverse(dir.y), safeInverse(dir.z));
+	return ray;
+}
+
+bool PathTracerCpu::IntersectTrianglesBruteForce(u32 meshIndex, const RayCpu& rayModel, HitCpu& hit)
+{
+	const MeshPT& mesh = PathTracer::sMeshes[meshIndex];
+	hit.mT = FLOAT_MAX;
+	hit.mTriangleIndex = INVALID_UINT32;
+	hit.mNodeVisitCount = 0;
+	for (u32 i = 0; i < mesh.mTriangleCount; i++)
+		IntersectLeafCpu(i + mesh.mTriangleIndexLocalToGlobalOffset, rayModel, hit);
+	return hit.mTriangleIndex != INVALID_UINT32;
+}
+
+bool PathTracerCpu::IntersectTriangleBVH(u32 meshIndex, const RayCpu& rayModel, HitCpu& hit)
+{
+	const MeshPT& mesh = PathTracer::sMeshes[meshIndex];
+	hit.mT = FLOAT_MAX;
+	hit.mTriangleIndex = INVALID_UINT32;
+	hit.mNodeVisitCount = 0;
+	float tNear;
+	if (!RayAabbCpu(PathTracer::sTriangleModelBVHs[mesh.mRootTriangleBvhIndexLocal + mesh.mTriangleBvhIndexLocalToGlobalOffset].mAABB, rayModel, hit.mT, tNear))
+		return false;
+
+	// a depth first traversal holds at most one entry per level of the tree
+	const u32 stackSize = PathTracer::sTriangleBvhHeights[meshIndex] + 1;
+	u32* stack = (u32*)_alloca(sizeof(u32) * stackSize);
+	u32 top = 0;
+	stack[top++] = mesh.mRootTriangleBvhIndexLocal;
+	while (top > 0)
+	{
+		const BVH& bvh = PathTracer::sTriangleModelBVHs[stack[--top] + mesh.mTriangleBvhIndexLocalToGlobalOffset];
+		hit.mNodeVisitCount++;
+
+		// leaves are tested right away, internal children are tested here and the nearer one is visited first
+		u32 internalChildren[2];
+		float internalNear[2];
+		u32 internalCount = 0;
+		const u32 childIndices[2] = { bvh.mLeftIndexLocal, bvh.mRightIndexLocal };
+		const u32 childIsLeaf[2] = { bvh.mLeftIsLeaf, bvh.mRightIsLeaf };
+		for (int i = 0; i < 2; i++)
+		{
+			if (childIsLeaf[i])
+			{
+				IntersectLeafCpu(childIndices[i] + mesh.mTriangleIndexLocalToGlobalOffset, rayModel, hit);
+			}
+			else if (RayAabbCpu(PathTracer::sTriangleModelBVHs[childIndices[i] + mesh.mTriangleBvhIndexLocalToGlobalOffset].mAABB, rayModel, hit.mT, tNear))
+			{
+				internalChildren[internalCount] = childIndices[i];
+				internalNear[internalCount] = tNear;
+				internalCount++;
+			}
+		}
+		if (internalCount == 2 && internalNear[0] < internalNear[1])
+		{
+			swap(internalChildren[0], internalChildren[1]);
+		}
+		fatalAssertf(top + internalCount <= stackSize, "bvh traversal stack overflow");
+		for (u32 i = 0; i < internalCount; i++)
+			stack[top++] = internalChildren[i];
+	}
+	return hit.mTriangleIndex != INVALID_UINT32;
+}
+
+inline __m128 UnpackWideBvhQuantized(UINT packed)
+{
+	// 4 x 8 bit -> 4 x float
+	const __m128i zero = _mm_setzero_si128();
+	return _mm_cvtepi32_ps(_mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(packed), zero), zero));
+}
+
+bool PathTracerCpu::IntersectTriangleWideBVH(u32 meshIndex, const RayCpu& rayModel, HitCpu& hit)
+{
+	const MeshPT& mesh = PathTracer::sMeshes[meshIndex];
+	const u32 wideOffset = PathTracer::sTriangleWideBvhOffsets[meshIndex];
+	hit.mT = FLOAT_MAX;
+	hit.mTriangleIndex = INVALID_UINT32;
+	hit.mNodeVisitCount = 0;
+	float tNear;
+	if (!RayAabbCpu(PathTracer::sTriangleModelBVHs[mesh.mRootTriangleBvhIndexLocal + mesh.mTriangleBvhIndexLocalToGlobalOffset].mAABB, rayModel, hit.mT, tNear))
+		return false;
+
+	const __m128 oriX = _mm_set1_ps(rayModel.mOri.x);
+	const __m128 oriY = _mm_set1_ps(rayModel.mOri.y);
+	const __m128 oriZ = _mm_set1_ps(rayModel.mOri.z);
+	const __m128 invDirX = _mm_set1_ps(rayModel.mInvDir.x);
+	const __m128 invDirY = _mm_set1_ps(rayModel.mInvDir.y);
+	const __m128 invDirZ = _mm_set1_ps(rayModel.mInvDir.z);
+	// collapsing never makes the tree deeper, and every level leaves at most PT_WIDE_BVH_WIDTH - 1 siblings behind
+	const u32 stackSize = PathTracer::sTriangleBvhHeights[meshIndex] * (PT_WIDE_BVH_WIDTH - 1) + 1;
+	u32* stack = (u32*)_alloca(sizeof(u32) * stackSize);
+	u32 top = 0;
+	stack[top++] = 0;
+	while (top > 0)
+	{
+		const WideBVH& node = PathTracer::sTriangleWideBVHs[stack[--top] + wideOffset];
+		hit.mNodeVisitCount++;
+		const u32 childCount = GetWideBvhChildCount(node.mExponents);
+		const __m128 originX = _mm_set1_ps(node.mOrigin.x);
+		const __m128 originY = _mm_set1_ps(node.mOrigin.y);
+		const __m128 originZ = _mm_set1_ps(node.mOrigin.z);
+		const __m128 scaleX = _mm_set1_ps(GetWideBvhScale(node.mExponents, 0));
+		const __m128 scaleY = _mm_set1_ps(GetWideBvhScale(node.mExponents, 1));
+		const __m128 scaleZ = _mm_set1_ps(GetWideBvhScale(node.mExponents, 2));
+
+		// test 4 children at a time, decoding matches DecodeWideBvhChildAABB
+		u32 internalChildren[PT_WIDE_BVH_WIDTH];
+		float internalNear[PT_WIDE_BVH_WIDTH];
+		u32 internalCount = 0;
+		for (u32 group = 0; group < PT_WIDE_BVH_PACKED_UINT_COUNT && group * 4 < childCount; group++)
+		{
+			const __m128 minX = _mm_add_ps(originX, _mm_mul_ps(UnpackWideBvhQuantized(node.mQuantizedMin[group]), scaleX));
+			const __m128 minY = _mm_add_ps(originY, _mm_mul_ps(UnpackWideBvhQuantized(node.mQuantizedMin[group + PT_WIDE_BVH_PACKED_UINT_COUNT]), scaleY));
+			const __m128 minZ = _mm_add_ps(originZ, _mm_mul_ps(UnpackWideBvhQuantized(node.mQuantizedMin[group + PT_WIDE_BVH_PACKED_UINT_COUNT * 2]), scaleZ));
+			const __m128 maxX = _mm_add_ps(originX, _mm_mul_ps(UnpackWideBvhQuantized(node.mQuantizedMax[group]), scaleX));
+			const __m128 maxY = _mm_add_ps(originY, _mm_mul_ps(UnpackWideBvhQuantized(node.mQuantizedMax[group + PT_WIDE_BVH_PACKED_UINT_COUNT]), scaleY));
+			const __m128 maxZ = _mm_add_ps(originZ, _mm_mul_ps(UnpackWideBvhQuantized(node.mQuantizedMax[group + PT_WIDE_BVH_PACKED_UINT_COUNT * 2]), scaleZ));
+			const __m128 tx0 = _mm_mul_ps(_mm_sub_ps(minX, oriX), invDirX);
+			const __m128 tx1 = _mm_mul_ps(_mm_sub_ps(maxX, oriX), invDirX);
+			const __m128 ty0 = _mm_mul_ps(_mm_sub_ps(minY, oriY), invDirY);
+			const __m128 ty1 = _mm_mul_ps(_mm_sub_ps(maxY, oriY), invDirY);
+			const __m128 tz0 = _mm_mul_ps(_mm_sub_ps(minZ, oriZ), invDirZ);
+			const __m128 tz1 = _mm_mul_ps(_mm_sub_ps(maxZ, oriZ), invDirZ);
+			const __m128 tNears = _mm_max_ps(_mm_max_ps(_mm_min_ps(tx0, tx1), _mm_min_ps(ty0, ty1)), _mm_max_ps(_mm_min_ps(tz0, tz1), _mm_setzero_ps()));
+			const __m128 tFars = _mm_min_ps(_mm_min_ps(_mm_max_ps(tx0, tx1), _mm_max_ps(ty0, ty1)), _mm_min_ps(_mm_max_ps(tz0, tz1), _mm_set1_ps(hit.mT)));
+			u32 hitMask = _mm_movemask_ps(_mm_cmple_ps(tNears, tFars));
+			hitMask &= (1 << MIN(childCount - group * 4, 4)) - 1;
+			alignas(16) float tNearArray[4];
+			_mm_store_ps(tNearArray, tNears);
+			while (hitMask)
+			{
+				unsigned long lane;
+				_BitScanForward(&lane, hitMask);
+				hitMask &= hitMask - 1;
+				const u32 child = group * 4 + lane;
+				if (node.mLeafMask & (1 << child))
+				{
+					IntersectLeafCpu(node.mChildIndexLocal[child] + mesh.mTriangleIndexLocalToGlobalOffset, rayModel, hit);
+				}
+				else
+				{
+					internalChildren[internalCount] = node.mChildIndexLocal[child];
+					internalNear[internalCount] = tNearArray[lane];
+					internalCount++;
+				}
+			}
+		}
+
+		// push far to near so the nearest child is popped first
+		for (u32 i = 1; i < internalCount; i++)
+		{
+			for (u32 j = i; j > 0 && internalNear[j - 1] < internalNear[j]; j--)
+			{
+				swap(internalNear[j - 1], internalNear[j]);
+				swap(internalChildren[j - 1], internalChildren[j]);
+			}
+		}
+		fatalAssertf(top + internalCount <= stackSize, "wide bvh traversal stack overflow");
+		for (u32 i = 0; i < internalCount; i++)
+			stack[top++] = internalChildren[i];
+	}
+	return hit.mTriangleIndex != INVALID_UINT32;
+}
+
+bool PathTracerCpu::BenchmarkWideBVH()
+{
+	printf(">>> wide BVH benchmark <<<\n");
+	if (PathTracer::sBvhBuildGpu)
+	{
+		fprintf(stderr, "-benchmarkWideBvh collapses the triangle bvhs of the CPU build, run it without -buildBvhGpu\n");
+		return false;
+	}
+	PathTracer::UpdateWideBvhCpu();
+
+	// rays start on a sphere around each mesh and aim at random points inside its bounds, all in model space
+	const int rayCountPerMesh = 1 << 16;
+	mt19937 generator(0);
+	uniform_real_distribution<float> distribution(0.0f, 1.0f);
+	vector<RayCpu> rays;
+	vector<u32> rayMeshIndices;
+	for (u32 i = 0; i < PathTracer::sMeshes.size(); i++)
+	{
+		const MeshPT& mesh = PathTracer::sMeshes[i];
+		const AABB& bounds = PathTracer::sTriangleModelBVHs[mesh.mRootTriangleBvhIndexLocal + mesh.mTriangleBvhIndexLocalToGlobalOffset].mAABB;
+		const XMVECTOR boundsMin = XMLoadFloat3(&bounds.mMin);
+		const XMVECTOR boundsMax = XMLoadFloat3(&bounds.mMax);
+		const XMVECTOR center = (boundsMin + boundsMax) * 0.5f;
+		const float radius = XMVectorGetX(XMVector3Length(boundsMax - boundsMin));
+		for (int j = 0; j < rayCountPerMesh; j++)
+		{
+			const float z = distribution(generator) * 2.0f - 1.0f;
+			const float phi = distribution(generator) * TWO_PI;
+			const float r = sqrtf(MAX(0.0f, 1.0f - z * z));
+			const XMVECTOR ori = center + XMVectorSet(r * cosf(phi), r * sinf(phi), z, 0.0f) * radius;
+			const XMVECTOR target = boundsMin + (boundsMax - boundsMin) * XMVectorSet(distribution(generator), distribution(generator), distribution(generator), 0.0f);
+			XMFLOAT3 oriModel;
+			XMFLOAT3 dirModel;
+			XMStoreFloat3(&oriModel, ori);
+			XMStoreFloat3(&dirModel, XMVector3Normalize(target - ori));
+			rays.push_back(MakeRay(oriModel, dirModel));
+			rayMeshIndices.push_back(i);
+		}
+	}
+
+	vector<HitCpu> hitsBinary(rays.size());
+	vector<HitCpu> hitsWide(rays.size());
+	CpuTimer timer;
+	for (int i = 0; i < rays.size(); i++)
+		IntersectTriangleBVH(rayMeshIndices[i], rays[i], hitsBinary[i]);
+	const float binaryTime = timer.GetMilliseconds();
+	timer.Reset();
+	for (int i = 0; i < rays.size(); i++)
+		IntersectTriangleWideBVH(rayMeshIndices[i], rays[i], hitsWide[i]);
+	const float wideTime = timer.GetMilliseconds();
+
+	u64 binaryNodeVisitCount = 0;
+	u64 wideNodeVisitCount = 0;
+	int hitCount = 0;
+	int mismatchCount = 0;
+	for (int i = 0; i < rays.size(); i++)
+	{
+		binaryNodeVisitCount += hitsBinary[i].mNodeVisitCount;
+		wideNodeVisitCount += hitsWide[i].mNodeVisitCount;
+		hitCount += hitsBinary[i].mTriangleIndex != INVALID_UINT32;
+		// quantized bounds are conservative so both layouts have to find the same closest hit
+		if (hitsBinary[i].mT != hitsWide[i].mT)
+			mismatchCount++;
+	}
+	printf("%d rays, %d hits, single thread\n", (int)rays.size(), hitCount);
+	printf("binary: %f Mrays/s, %f nodes per ray, %d bytes per node\n",
+		rays.size() / (binaryTime * 1000.0f), (float)binaryNodeVisitCount / rays.size(), (int)sizeof(BVH));
+	printf("%d-wide: %f Mrays/s, %f nodes per ray, %d bytes per node\n",
+		PT_WIDE_BVH_WIDTH, rays.size() / (wideTime * 1000.0f), (float)wideNodeVisitCount / rays.size(), (int)sizeof(WideBVH));
+	if (mismatchCount > 0)
+		fprintf(stderr, "wide bvh traversal differs from binary bvh traversal, %d of %d rays disagree on the closest hit\n", mismatchCount, (int)rays.size());
+	printf("==============================\n");
+	return mismatchCount == 0;
+}
+
+struct TriangleKernelStatsCpu
+{
+	const char* mName;
+	int mEdgeMissCount;
+	int mVertexMissCount;
+	int mTimedHitCount;
+	float mNanosecondsPerTest;
+};
+
+template <float (*RayTriangle)(const Triangle&, const PathTracerCpu::RayCpu&)>
+TriangleKernelStatsCpu TestTriangleKernelCpu(const char* name, const vector<Triangle>& triangles, const vector<PathTracerCpu::RayCpu>& rays,
+	const vector<vector<u32>>& rayTriangles, int edgeRayCount)
+{
+	TriangleKernelStatsCpu stats = { name, 0, 0, 0, 0.0f };
+	for (int i = 0; i < rays.size(); i++)
+	{
+		// every ray aims at a point its triangles share, so at least one of them has to report a hit
+		bool hit = false;
+		for (u32 triangleIndex : rayTriangles[i])
+			hit = hit || RayTriangle(triangles[triangleIndex], rays[i]) > 0.0f;
+		if (!hit)
+			(i < edgeRayCount ? stats.mEdgeMissCount : stats.mVertexMissCount)++;
+	}
+
+	// cost per test with hits and misses mixed, each ray against a run of triangles around its target
+	const int triangleRunLength = 32;
+	int hitCount = 0;
+	CpuTimer timer;
+	for (int i = 0; i < rays.size(); i++)
+	{
+		const u32 triangleFirst = MIN(rayTriangles[i][0], (u32)triangles.size() - triangleRunLength);
+		for (u32 j = triangleFirst; j < triangleFirst + triangleRunLength; j++)
+			hitCount += RayTriangle(triangles[j], rays[i]) > 0.0f;
+	}
+	stats.mNanosecondsPerTest = timer.GetMilliseconds() * 1000000.0f / (rays.size() * triangleRunLength);
+	volatile int timedHitCount = hitCount; // a volatile store can't be optimized away, neither can the timed loop
+	stats.mTimedHitCount = timedHitCount;
+	return stats;
+}
+
+bool PathTracerCpu::ValidateWatertightTriangles()
+{
+	printf(">>> watertight triangle test <<<\n");
+
+	// jittered heightfield grid, every interior edge is shared by 2 triangles and every interior vertex by 6
+	const int gridSize = 128;
+	const int vertexCountX = gridSize + 1;
+	mt19937 generator(0);
+	uniform_real_distribution<float> distribution(0.0f, 1.0f);
+	vector<XMFLOAT3> positions;
+	for (int z = 0; z < vertexCountX; z++)
+	{
+		for (int x = 0; x < vertexCountX; x++)
+		{
+			const bool border = x == 0 || z == 0 || x == gridSize || z == gridSize;
+			const float jitterX = border ? 0.0f : (distribution(generator) - 0.5f) * 0.3f;
+			const float jitterZ = border ? 0.0f : (distribution(generator) - 0.5f) * 0.3f;
+			positions.push_back(XMFLOAT3((x + jitterX) * 0.0731f - 4.0f, distribution(generator) * 0.02f + 1.3f, (z + jitterZ) * 0.0731f - 4.0f));
+		}
+	}
+	vector<Triangle> triangles;
+	vector<array<u32, 3>> triangleVertexIndices;
+	for (int z = 0; z < gridSize; z++)
+	{
+		for (int x = 0; x < gridSize; x++)
+		{
+			const u32 v00 = z * vertexCountX + x;
+			const u32 v10 = v00 + 1;
+			const u32 v01 = v00 + vertexCountX;
+			const u32 v11 = v01 + 1;
+			triangleVertexIndices.push_back({ v00, v01, v11 });
+			triangleVertexIndices.push_back({ v00, v11, v10 });
+		}
+	}
+	vector<vector<u32>> vertexTriangles(positions.size());
+	for (u32 i = 0; i < triangleVertexIndices.size(); i++)
+	{
+		Triangle triangle = {};
+		for (int j = 0; j < 3; j++)
+		{
+			triangle.mVertices[j].pos = positions[triangleVertexIndices[i][j]];
+			vertexTriangles[triangleVertexIndices[i][j]].push_back(i);
+		}
+		triangles.push_back(triangle);
+	}
+
+	// half the rays come straight down so they run exactly through vertices and along the grid axes, the rest are tilted
+	vector<RayCpu> rays;
+	vector<vector<u32>> rayTriangles;
+	auto addRay = [&](const XMVECTOR target, const vector<u32>& targetTriangles) {
+		const bool straightDown = rays.size() % 2 == 0;
+		const XMVECTOR dir = straightDown ? XMVectorSet(0.0f, -1.0f, 0.0f, 0.0f) :
+			XMVector3Normalize(XMVectorSet(distribution(generator) - 0.5f, -1.0f, distribution(generator) - 0.5f, 0.0f));
+		XMFLOAT3 ori;
+		XMFLOAT3 dirFloat3;
+		XMStoreFloat3(&ori, target - dir * (1.0f + distribution(generator) * 10.0f));
+		XMStoreFloat3(&dirFloat3, dir);
+		rays.push_back(MakeRay(ori, dirFloat3));
+		rayTriangles.push_back(targetTriangles);
+	};
+	for (u32 i = 0; i < triangleVertexIndices.size(); i++)
+	{
+		for (int j = 0; j < 3; j++)
+		{
+			// visit each shared edge once, from the triangle with the lower index
+			const u32 va = triangleVertexIndices[i][j];
+			const u32 vb = triangleVertexIndices[i][(j + 1) % 3];
+			vector<u32> edgeTriangles;
+			for (u32 triangleIndex : vertexTriangles[va])
+			{
+				const array<u32, 3>& indices = triangleVertexIndices[triangleIndex];
+				if (indices[0] == vb || indices[1] == vb || indices[2] == vb)
+					edgeTriangles.push_back(triangleIndex);
+			}
+			if (edgeTriangles.size() != 2 || edgeTriangles[0] != i)
+				continue;
+			const float s = distribution(generator);
+			addRay(XMVectorLerp(XMLoadFloat3(&positions[va]), XMLoadFloat3(&positions[vb]), s), edgeTriangles);
+		}
+	}
+	const int edgeRayCount = (int)rays.size();
+	for (u32 i = 0; i < positions.size(); i++)
+	{
+		if (vertexTriangles[i].size() == 6)
+			addRay(XMLoadFloat3(&positions[i]), vertexTriangles[i]);
+	}
+
+	const TriangleKernelStatsCpu kernelStats[] = {
+		TestTriangleKernelCpu<RayTriangleCpu>("moller-trumbore", triangles, rays, rayTriangles, edgeRayCount),
+		TestTriangleKernelCpu<RayTrianglePlaneCpu>("plane and edges", triangles, rays, rayTriangles, edgeRayCount),
+		TestTriangleKernelCpu<RayTriangleWatertightCpu>("watertight", triangles, rays, rayTriangles, edgeRayCount),
+	};
+	printf("%d triangles, %d rays at shared edges, %d rays at shared vertices\n",
+		(int)triangles.size(), edgeRayCount, (int)rays.size() - edgeRayCount);
+	bool valid = kernelStats[2].mEdgeMissCount == 0 && kernelStats[2].mVertexMissCount == 0;
+	if (!valid)
+		fprintf(stderr, "watertight triangle test let %d rays through at shared edges and %d at shared vertices\n", kernelStats[2].mEdgeMissCount, kernelStats[2].mVertexMissCount);
+	for (const TriangleKernelStatsCpu& stats : kernelStats)
+	{
+		printf("%s: %d edge misses, %d vertex misses, %d hits in the timed loop, %f ns per test\n", stats.mName, stats.mEdgeMissCount, stats.mVertexMissCount, stats.mTimedHitCount, stats.mNanosecondsPerTest);
+		if (stats.mTimedHitCount == 0)
+			fprintf(stderr, "%s triangle test never hit anything in the timed loop\n", stats.mName);
+		valid = valid && stats.mTimedHitCount > 0;
+	}
+	printf("==============================\n");
+	return valid;
+}
+
+// ray packets, each lane of a SIMD register holds one ray and every instruction set gets the same traversal through these wrappers
+struct SimdSseCpu
+{
+	typedef __m128 Float;
+	static const u32 sWidth = 4;
+	static Float Set1(float x) { return _mm_set1_ps(x); }
+	static Float Load(const float* p) { return _mm_load_ps(p); }
+	static void Store(float* p, Float x) { _mm_store_ps(p, x); }
+	static Float Add(Float a, Float b) { return _mm_add_ps(a, b); }
+	static Float Sub(Float a, Float b) { return _mm_sub_ps(a, b); }
+	static Float Mul(Float a, Float b) { return _mm_mul_ps(a, b); }
+	static Float Div(Float a, Float b) { return _mm_div_ps(a, b); }
+	static Float Min(Float a, Float b) { return _mm_min_ps(a, b); }
+	static Float Max(Float a, Float b) { return _mm_max_ps(a, b); }
+	static u32 LessEqual(Float a, Float b) { return _mm_movemask_ps(_mm_cmple_ps(a, b)); }
+	static u32 Less(Float a, Float b) { return _mm_movemask_ps(_mm_cmplt_ps(a, b)); }
+};
+
+struct SimdAvx2Cpu
+{
+	typedef __m256 Float;
+	static const u32 sWidth = 8;
+	static Float Set1(float x) { return _mm256_set1_ps(x); }
+	static Float Load(const float* p) { return _mm256_load_ps(p); }
+	static void Store(float* p, Float x) { _mm256_store_ps(p, x); }
+	static Float Add(Float a, Float b) { return _mm256_add_ps(a, b); }
+	static Float Sub(Float a, Float b) { return _mm256_sub_ps(a, b); }
+	static Float Mul(Float a, Float b) { return _mm256_mul_ps(a, b); }
+	static Float Div(Float a, Float b) { return _mm256_div_ps(a, b); }
+	static Float Min(Float a, Float b) { return _mm256_min_ps(a, b); }
+	static Float Max(Float a, Float b) { return _mm256_max_ps(a, b); }
+	static u32 LessEqual(Float a, Float b) { return _mm256_movemask_ps(_mm256_cmp_ps(a, b, _CMP_LE_OQ)); }
+	static u32 Less(Float a, Float b) { return _mm256_movemask_ps(_mm256_cmp_ps(a, b, _CMP_LT_OQ)); }
+};
+
+struct SimdAvx512Cpu
+{
+	typedef __m512 Float;
+	static const u32 sWidth = 16;
+	static Float Set1(float x) { return _mm512_set1_ps(x); }
+	static Float Load(const float* p) { return _mm512_load_ps(p); }
+	static void Store(float* p, Float x) { _mm512_store_ps(p, x); }
+	static Float Add(Float a, Float b) { return _mm512_add_ps(a, b); }
+	static Float Sub(Float a, Float b) { return _mm512_sub_ps(a, b); }
+	static Float Mul(Float a, Float b) { return _mm512_mul_ps(a, b); }
+	static Float Div(Float a, Float b) { return _mm512_div_ps(a, b); }
+	static Float Min(Float a, Float b) { return _mm512_min_ps(a, b); }
+	static Float Max(Float a, Float b) { return _mm512_max_ps(a, b); }
+	static u32 LessEqual(Float a, Float b) { return _mm512_cmp_ps_mask(a, b, _CMP_LE_OQ); }
+	static u32 Less(Float a, Float b) { return _mm512_cmp_ps_mask(a, b, _CMP_LT_OQ); }
+};
+
+// a packet in SoA layout, lanes without a ray have a negative tMax so they never hit anything
+struct alignas(64) RayPacketCpu
+{
+	float mOriX[PathTracerCpu::sPacketWidthMax];
+	float mOriY[PathTracerCpu::sPacketWidthMax];
+	float mOriZ[PathTracerCpu::sPacketWidthMax];
+	float mDirX[PathTracerCpu::sPacketWidthMax];
+	float mDirY[PathTracerCpu::sPacketWidthMax];
+	float mDirZ[PathTracerCpu::sPacketWidthMax];
+	float mInvDirX[PathTracerCpu::sPacketWidthMax];
+	float mInvDirY[PathTracerCpu::sPacketWidthMax];
+	float mInvDirZ[PathTracerCpu::sPacketWidthMax];
+	float mTMax[PathTracerCpu::sPacketWidthMax];
+};
+
+template<typename Simd>
+inline u32 RayAabbPacketCpu(const AABB& aabb, const RayPacketCpu& packet, float& tNearMin)
+{
+	// same slab test as RayAabbCpu in every lane, tNearMin is the nearest entry among the lanes that hit
+	const typename Simd::Float tx0 = Simd::Mul(Simd::Sub(Simd::Set1(aabb.mMin.x), Simd::Load(packet.mOriX)), Simd::Load(packet.mInvDirX));
+	const typename Simd::Float tx1 = Simd::Mul(Simd::Sub(Simd::Set1(aabb.mMax.x), Simd::Load(packet.mOriX)), Simd::Load(packet.mInvDirX));
+	const typename Simd::Float ty0 = Simd::Mul(Simd::Sub(Simd::Set1(aabb.mMin.y), Simd::Load(packet.mOriY)), Simd::Load(packet.mInvDirY));
+	const typename Simd::Float ty1 = Simd::Mul(Simd::Sub(Simd::Set1(aabb.mMax.y), Simd::Load(packet.mOriY)), Simd::Load(packet.mInvDirY));
+	const typename Simd::Float tz0 = Simd::Mul(Simd::Sub(Simd::Set1(aabb.mMin.z), Simd::Load(packet.mOriZ)), Simd::Load(packet.mInvDirZ));
+	const typename Simd::Float tz1 = Simd::Mul(Simd::Sub(Simd::Set1(aabb.mMax.z), Simd::Load(packet.mOriZ)), Simd::Load(packet.mInvDirZ));
+	const typename Simd::Float tNear = Simd::Max(Simd::Max(Simd::Min(tx0, tx1), Simd::Min(ty0, ty1)), Simd::Max(Simd::Min(tz0, tz1), Simd::Set1(0.0f)));
+	const typename Simd::Float tFar = Simd::Min(Simd::Min(Simd::Max(tx0, tx1), Simd::Max(ty0, ty1)), Simd::Min(Simd::Max(tz0, tz1), Simd::Load(packet.mTMax)));
+	u32 hitMask = Simd::LessEqual(tNear, tFar);
+	alignas(64) float tNearArray[Simd::sWidth];
+	Simd::Store(tNearArray, tNear);
+	tNearMin = FLOAT_MAX;
+	for (u32 mask = hitMask; mask; mask &= mask - 1)
+	{
+		unsigned long lane;
+		_BitScanForward(&lane, mask);
+		tNearMin = MIN(tNearMin, tNearArray[lane]);
+	}
+	return hitMask;
+}
+
+template<typename Simd>
+inline void IntersectLeafPacketCpu(u32 triangleIndex, RayPacketCpu& packet, PathTracerCpu::HitCpu* hits)
+{
+	// Moller-Trumbore in every lane with the triangle broadcast, written in the order of RayTriangleCpu
+	typedef typename Simd::Float Float;
+	const Triangle& tri = PathTracer::sTriangles[triangleIndex];
+	const XMFLOAT3& p0 = tri.mVertices[0].pos;
+	const XMFLOAT3& p1 = tri.mVertices[1].pos;
+	const XMFLOAT3& p2 = tri.mVertices[2].pos;
+	const Float e1x = Simd::Set1(p1.x - p0.x);
+	const Float e1y = Simd::Set1(p1.y - p0.y);
+	const Float e1z = Simd::Set1(p1.z - p0.z);
+	const Float e2x = Simd::Set1(p2.x - p0.x);
+	const Float e2y = Simd::Set1(p2.y - p0.y);
+	const Float e2z = Simd::Set1(p2.z - p0.z);
+	const Float dirX = Simd::Load(packet.mDirX);
+	const Float dirY = Simd::Load(packet.mDirY);
+	const Float dirZ = Simd::Load(packet.mDirZ);
+	const Float px = Simd::Sub(Simd::Mul(dirY, e2z), Simd::Mul(dirZ, e2y));
+	const Float py = Simd::Sub(Simd::Mul(dirZ, e2x), Simd::Mul(dirX, e2z));
+	const Float pz = Simd::Sub(Simd::Mul(dirX, e2y), Simd::Mul(dirY, e2x));
+	const Float det = Simd::Add(Simd::Add(Simd::Mul(e1x, px), Simd::Mul(e1y, py)), Simd::Mul(e1z, pz));
+	const Float zero = Simd::Set1(0.0f);
+	const Float one = Simd::Set1(1.0f);
+	u32 mask = ~Simd::Less(Simd::Max(det, Simd::Sub(zero, det)), Simd::Set1(FLOAT_MIN));
+	if (!(mask & ((1u << Simd::sWidth) - 1)))
+		return;
+	const Float invDet = Simd::Div(one, det);
+	const Float sx = Simd::Sub(Simd::Load(packet.mOriX), Simd::Set1(p0.x));
+	const Float sy = Simd::Sub(Simd::Load(packet.mOriY), Simd::Set1(p0.y));
+	const Float sz = Simd::Sub(Simd::Load(packet.mOriZ), Simd::Set1(p0.z));
+	const Float u = Simd::Mul(Simd::Add(Simd::Add(Simd::Mul(sx, px), Simd::Mul(sy, py)), Simd::Mul(sz, pz)), invDet);
+	mask &= ~Simd::Less(u, zero) & ~Simd::Less(one, u);
+	const Float qx = Simd::Sub(Simd::Mul(sy, e1z), Simd::Mul(sz, e1y));
+	const Float qy = Simd::Sub(Simd::Mul(sz, e1x), Simd::Mul(sx, e1z));
+	const Float qz = Simd::Sub(Simd::Mul(sx, e1y), Simd::Mul(sy, e1x));
+	const Float v = Simd::Mul(Simd::Add(Simd::Add(Simd::Mul(dirX, qx), Simd::Mul(dirY, qy)), Simd::Mul(dirZ, qz)), invDet);
+	mask &= ~Simd::Less(v, zero) & ~Simd::Less(one, Simd::Add(u, v));
+	const Float t = Simd::Mul(Simd::Add(Simd::Add(Simd::Mul(e2x, qx), Simd::Mul(e2y, qy)), Simd::Mul(e2z, qz)), invDet);
+	mask &= Simd::Less(zero, t) & Simd::Less(t, Simd::Load(packet.mTMax));
+	alignas(64) float tArray[Simd::sWidth];
+	Simd::Store(tArray, t);
+	for (; mask; mask &= mask - 1)
+	{
+		unsigned long lane;
+		_BitScanForward(&lane, mask);
+		packet.mTMax[lane] = tArray[lane];
+		hits[lane].mT = tArray[lane];
+		hits[lane].mTriangleIndex = triangleIndex;
+	}
+}
+
+template<typename Simd>
+inline void IntersectTriangleBvhPacketCpu(u32 meshIndex, const PathTracerCpu::RayCpu* raysModel, PathTracerCpu::HitCpu* hits, u32 rayCount)
+{
+	const MeshPT& mesh = PathTracer::sMeshes[meshIndex];
+	RayPacketCpu packet;
+	for (u32 lane = 0; lane < Simd::sWidth; lane++)
+	{
+		const PathTracerCpu::RayCpu& ray = raysModel[MIN(lane, rayCount - 1)];
+		packet.mOriX[lane] = ray.mOri.x;
+		packet.mOriY[lane] = ray.mOri.y;
+		packet.mOriZ[lane] = ray.mOri.z;
+		packet.mDirX[lane] = ray.mDir.x;
+		packet.mDirY[lane] = ray.mDir.y;
+		packet.mDirZ[lane] = ray.mDir.z;
+		packet.mInvDirX[lane] = ray.mInvDir.x;
+		packet.mInvDirY[lane] = ray.mInvDir.y;
+		packet.mInvDirZ[lane] = ray.mInvDir.z;
+		packet.mTMax[lane] = lane < rayCount ? FLOAT_MAX : -1.0f;
+	}
+	PathTracerCpu::HitCpu laneHits[Simd::sWidth];
+	for (u32 lane = 0; lane < Simd::sWidth; lane++)
+	{
+		laneHits[lane].mT = FLOAT_MAX;
+		laneHits[lane].mTriangleIndex = INVALID_UINT32;
+	}
+
+	// a node is entered when any lane hits it, lanes that missed it are masked out by the slab test again at every child
+	u32 nodeVisitCount = 0;
+	float tNear;
+	if (RayAabbPacketCpu<Simd>(PathTracer::sTriangleModelBVHs[mesh.mRootTriangleBvhIndexLocal + mesh.mTriangleBvhIndexLocalToGlobalOffset].mAABB, packet, tNear))
+	{
+		const u32 stackSize = PathTracer::sTriangleBvhHeights[meshIndex] + 1;
+		u32* stack = (u32*)_alloca(sizeof(u32) * stackSize);
+		u32 top = 0;
+		stack[top++] = mesh.mRootTriangleBvhIndexLocal;
+		while (top > 0)
+		{
+			const BVH& bvh = PathTracer::sTriangleModelBVHs[stack[--top] + mesh.mTriangleBvhIndexLocalToGlobalOffset];
+			nodeVisitCount++;
+			u32 internalChildren[2];
+			float internalNear[2];
+			u32 internalCount = 0;
+			const u32 childIndices[2] = { bvh.mLeftIndexLocal, bvh.mRightIndexLocal };
+			const u32 childIsLeaf[2] = { bvh.mLeftIsLeaf, bvh.mRightIsLeaf };
+			for (int i = 0; i < 2; i++)
+			{
+				if (childIsLeaf[i])
+				{
+					IntersectLeafPacketCpu<Simd>(childIndices[i] + mesh.mTriangleIndexLocalToGlobalOffset, packet, laneHits);
+				}
+				else if (RayAabbPacketCpu<Simd>(PathTracer::sTriangleModelBVHs[childIndices[i] + mesh.mTriangleBvhIndexLocalToGlobalOffset].mAABB, packet, tNear))
+				{
+					internalChildren[internalCount] = childIndices[i];
+					internalNear[internalCount] = tNear;
+					internalCount++;
+				}
+			}
+			if (internalCount == 2 && internalNear[0] < internalNear[1])
+				swap(internalChildren[0], internalChildren[1]);
+			fatalAssertf(top + internalCount <= stackSize, "packet bvh traversal stack overflow");
+			for (u32 i = 0; i < internalCount; i++)
+				stack[top++] = internalChildren[i];
+		}
+	}
+	for (u32 i = 0; i < rayCount; i++)
+	{
+		hits[i] = laneHits[i];
+		hits[i].mNodeVisitCount = nodeVisitCount;
+	}
+}
+
+PathTracerCpu::SimdLevel PathTracerCpu::GetSimdLevel()
+{
+	static SimdLevel simdLevel = []() {
+		// AVX needs OS support for the wider registers on top of the CPU feature bits
+		int info[4];
+		__cpuidex(info, 0, 0);
+		const int leafCount = info[0];
+		__cpuidex(info, 1, 0);
+		const bool osxsave = (info[2] & (1 << 27)) != 0;
+		const bool avx = (info[2] & (1 << 28)) != 0;
+		if (!osxsave || !avx || leafCount < 7)
+			return SimdLevelSSE;
+		const u64 xcr0 = _xgetbv(0);
+		__cpuidex(info, 7, 0);
+		const bool avx2 = (info[1] & (1 << 5)) != 0 && (xcr0 & 0x6) == 0x6;
+		const bool avx512 = (info[1] & (1 << 16)) != 0 && (xcr0 & 0xE6) == 0xE6;
+		return avx512 ? SimdLevelAVX512 : (avx2 ? SimdLevelAVX2 : SimdLevelSSE);
+	}();
+	return simdLevel;
+}
+
+u32 PathTracerCpu::GetPacketWidth(SimdLevel simdLevel)
+{
+	const u32 widths[SimdLevelCount] = { SimdSseCpu::sWidth, SimdAvx2Cpu::sWidth, SimdAvx512Cpu::sWidth };
+	return widths[simdLevel];
+}
+
+bool PathTracerCpu::IntersectTriangleBvhPacket(u32 meshIndex, const RayCpu* raysModel, HitCpu* hits, u32 rayCount, SimdLevel simdLevel)
+{
+	fatalAssertf(rayCount > 0 && rayCount <= GetPacketWidth(simdLevel), "%u rays don't fit in a packet of %u", rayCount, GetPacketWidth(simdLevel));
+
+	// the length of the mean direction drops from 1 as the rays spread out, below the threshold most lanes would idle
+	static const float coherenceMin = []() {
+		vector<float> coherence;
+		return PARAM_packetCoherence.GetAsFloatVec(coherence) && coherence.size() > 0 ? coherence[0] : 0.9f;
+	}();
+	XMVECTOR dirSum = XMVectorZero();
+	for (u32 i = 0; i < rayCount; i++)
+		dirSum += XMLoadFloat3(&raysModel[i].mDir);
+	// the SIMD leaf test is Moller-Trumbore only, the watertight test goes through single rays too
+	if (sWatertightTriangles || XMVectorGetX(XMVector3Length(dirSum)) < coherenceMin * rayCount)
+	{
+		for (u32 i = 0; i < rayCount; i++)
+			IntersectTriangleBVH(meshIndex, raysModel[i], hits[i]);
+		return false;
+	}
+
+	if (simdLevel == SimdLevelAVX512)
+		IntersectTriangleBvhPacketCpu<SimdAvx512Cpu>(meshIndex, raysModel, hits, rayCount);
+	else if (simdLevel == SimdLevelAVX2)
+		IntersectTriangleBvhPacketCpu<SimdAvx2Cpu>(meshIndex, raysModel, hits, rayCount);
+	else
+		IntersectTriangleBvhPacketCpu<SimdSseCpu>(meshIndex, raysModel, hits, rayCount);
+	return true;
+}
+
+bool PathTracerCpu::BenchmarkRayPackets(const vector<string>& meshNames)
+{
+	printf(">>> ray packet benchmark <<<\n");
+	const SimdLevel simdLevelMax = GetSimdLevel();
+	const char* simdLevelNames[SimdLevelCount] = { "SSE", "AVX2", "AVX-512" };
+	printf("widest instruction set: %s\n", simdLevelNames[simdLevelMax]);
+	bool passed = true;
+
+	// a pinhole camera looks at each mesh from outside its bounds, pixels are grouped into square-ish tiles of one packet each
+	// shadow rays go from the primary hits to a point light above the camera, ordered by the same tiles
+	const u32 imageSize = 512;
+	for (u32 meshIndex = 0; meshIndex < meshNames.size(); meshIndex++)
+	{
+		const MeshPT& mesh = PathTracer::sMeshes[meshIndex];
+		const AABB& bounds = PathTracer::sTriangleModelBVHs[mesh.mRootTriangleBvhIndexLocal + mesh.mTriangleBvhIndexLocalToGlobalOffset].mAABB;
+		const XMVECTOR boundsMin = XMLoadFloat3(&bounds.mMin);
+		const XMVECTOR boundsMax = XMLoadFloat3(&bounds.mMax);
+		const XMVECTOR center = (boundsMin + boundsMax) * 0.5f;
+		const float radius = XMVectorGetX(XMVector3Length(boundsMax - boundsMin)) * 0.5f;
+		const XMVECTOR eye = center + XMVectorSet(0.3f, 0.4f, -1.0f, 0.0f) * (radius * 2.0f);
+		const XMVECTOR light = eye + XMVectorSet(0.0f, 1.0f, 0.0f, 0.0f) * (radius * 2.0f);
+		const XMVECTOR forward = XMVector3Normalize(center - eye);
+		const XMVECTOR right = XMVector3Normalize(XMVector3Cross(XMVectorSet(0.0f, 1.0f, 0.0f, 0.0f), forward));
+		const XMVECTOR up = XMVector3Cross(forward, right);
+		const float tanHalfFov = 0.45f;
+
+		for (u32 simdLevel = 0; simdLevel <= (u32)simdLevelMax; simdLevel++)
+		{
+			const u32 width = GetPacketWidth((SimdLevel)simdLevel);
+			const u32 tileX = width == 8 ? 4 : (u32)sqrtf((float)width);
+			const u32 tileY = width / tileX;
+
+			vector<RayCpu> primaryRays;
+			for (u32 y0 = 0; y0 < imageSize; y0 += tileY)
+			{
+				for (u32 x0 = 0; x0 < imageSize; x0 += tileX)
+				{
+					for (u32 y = y0; y < y0 + tileY; y++)
+					{
+						for (u32 x = x0; x < x0 + tileX; x++)
+						{
+							const float u = ((x + 0.5f) / imageSize * 2.0f - 1.0f) * tanHalfFov;
+							const float v = ((y + 0.5f) / imageSize * -2.0f + 1.0f) * tanHalfFov;
+							XMFLOAT3 ori;
+							XMFLOAT3 dir;
+							XMStoreFloat3(&ori, eye);
+							XMStoreFloat3(&dir, XMVector3Normalize(forward + right * u + up * v));
+							primaryRays.push_back(MakeRay(ori, dir));
+						}
+					}
+				}
+			}
+
+			// primary rays
+			const u32 rayCount = primaryRays.size();
+			vector<HitCpu> hitsSingle(rayCount);
+			vector<HitCpu> hitsPacket(rayCount);
+			CpuTimer timer;
+			for (u32 i = 0; i < rayCount; i++)
+				IntersectTriangleBVH(meshIndex, primaryRays[i], hitsSingle[i]);
+			const float primarySingleTime = timer.GetMilliseconds();
+			u32 fallbackCount = 0;
+			timer.Reset();
+			for (u32 i = 0; i < rayCount; i += width)
+				fallbackCount += !IntersectTriangleBvhPacket(meshIndex, &primaryRays[i], &hitsPacket[i], width, (SimdLevel)simdLevel);
+			const float primaryPacketTime = timer.GetMilliseconds();
+
+			// shadow rays only exist where the primary ray hit, a packet takes the next width of them in tile order
+			vector<RayCpu> shadowRays;
+			for (u32 i = 0; i < rayCount; i++)
+			{
+				if (hitsSingle[i].mTriangleIndex == INVALID_UINT32)
+					continue;
+				const XMVECTOR p = XMLoadFloat3(&primaryRays[i].mOri) + XMLoadFloat3(&primaryRays[i].mDir) * hitsSingle[i].mT;
+				const XMVECTOR dir = XMVector3Normalize(light - p);
+				XMFLOAT3 ori;
+				XMFLOAT3 dirFloat3;
+				XMStoreFloat3(&ori, p + dir * (radius * PT_SPAWN_RAY_BIAS));
+				XMStoreFloat3(&dirFloat3, dir);
+				shadowRays.push_back(MakeRay(ori, dirFloat3));
+			}
+			const u32 shadowRayCount = shadowRays.size();
+			vector<HitCpu> shadowHitsSingle(shadowRayCount);
+			vector<HitCpu> shadowHitsPacket(shadowRayCount);
+			timer.Reset();
+			for (u32 i = 0; i < shadowRayCount; i++)
+				IntersectTriangleBVH(meshIndex, shadowRays[i], shadowHitsSingle[i]);
+			const float shadowSingleTime = timer.GetMilliseconds();
+			u32 shadowFallbackCount = 0;
+			timer.Reset();
+			for (u32 i = 0; i < shadowRayCount; i += width)
+				shadowFallbackCount += !IntersectTriangleBvhPacket(meshIndex, &shadowRays[i], &shadowHitsPacket[i], MIN(width, shadowRayCount - i), (SimdLevel)simdLevel);
+			const float shadowPacketTime = timer.GetMilliseconds();
+
+			// every lane has to find the same closest hit as the single ray, a different triangle is only fine for a tie on a shared edge
+			u64 singleNodeVisitCount = 0;
+			u64 packetNodeVisitCount = 0;
+			u32 mismatchCount = 0;
+			for (u32 pass = 0; pass < 2; pass++)
+			{
+				const vector<HitCpu>& single = pass ? shadowHitsSingle : hitsSingle;
+				const vector<HitCpu>& packet = pass ? shadowHitsPacket : hitsPacket;
+				for (u32 i = 0; i < single.size(); i++)
+				{
+					singleNodeVisitCount += single[i].mNodeVisitCount;
+					if (i % width == 0)
+						packetNodeVisitCount += packet[i].mNodeVisitCount;
+					const bool singleHit = single[i].mTriangleIndex != INVALID_UINT32;
+					const bool packetHit = packet[i].mTriangleIndex != INVALID_UINT32;
+					if (singleHit != packetHit || (single[i].mTriangleIndex != packet[i].mTriangleIndex && fabsf(single[i].mT - packet[i].mT) > single[i].mT * 1e-5f))
+						mismatchCount++;
+				}
+			}
+			printf("%s, %u triangles, %s %u-wide packets of %ux%u pixels, single thread:\n", meshNames[meshIndex].c_str(), mesh.mTriangleCount, simdLevelNames[simdLevel], width, tileX, tileY);
+			printf("primary: %u rays, single %f Mrays/s, packet %f Mrays/s, %u of %u packets fell back to single rays\n",
+				rayCount, rayCount / (primarySingleTime * 1000.0f), rayCount / (primaryPacketTime * 1000.0f), fallbackCount, ROUNDUP_DIVISION(rayCount, width));
+			printf("shadow: %u rays, single %f Mrays/s, packet %f Mrays/s, %u of %u packets fell back to single rays\n",
+				shadowRayCount, shadowRayCount / (shadowSingleTime * 1000.0f), shadowRayCount / (shadowPacketTime * 1000.0f), shadowFallbackCount, ROUNDUP_DIVISION(shadowRayCount, width));
+			printf("%f nodes per single ray, %f nodes per packet, %u rays disagree on the closest hit\n",
+				(float)singleNodeVisitCount / (rayCount + shadowRayCount), (float)packetNodeVisitCount / (ROUNDUP_DIVISION(rayCount, width) + ROUNDUP_DIVISION(shadowRayCount, width)), mismatchCount);
+			// when the compiler contracts multiply-adds the two paths round differently and a few rays grazing an edge can flip
+			if (mismatchCount * 10000 > rayCount + shadowRayCount)
+			{
+				fprintf(stderr, "%s: %s packet traversal differs from single ray traversal on %u of %u rays\n", meshNames[meshIndex].c_str(), simdLevelNames[simdLevel], mismatchCount, rayCount + shadowRayCount);
+				passed = false;
+			}
+		}
+	}
+	printf("==============================\n");
+	return passed;
+}
+
+// reference renderer, the functions below follow cs_pathtracer.hlsl one to one with a Cpu suffix so the two can be read side by side
+
+enum IntersectionTypeCpu : u8
+{
+	IntersectionTypeNone,
+	IntersectionTypeMaterial,
+	IntersectionTypeLight
+};
+
+struct IntersectionCpu
+{
+	IntersectionTypeCpu mType;
+	u32 mTriangleIndex;
+	u32 mMeshIndex;
+	u32 mLightIndex;
+	XMVECTOR mPointWorld;
+	XMVECTOR mPointModel;
+};
+
+struct SurfaceCpu
+{
+	XMVECTOR mAlbedo;
+	XMVECTOR mPosWorld;
+	XMVECTOR mNorWorld;
+	XMVECTOR mTanWorld;
+	XMVECTOR mEmissive;
+	XMFLOAT2 mUV;
+	float mRoughness;
+	float mFresnel;
+	float mMetallic;
+	float mSpecularity;
+	u32 mMaterialType;
+};
+
+// same as DenoiseFeatures of PathTracerDenoiseUtil.hlsli, a miss has no normal and no distance
+struct DenoiseFeaturesCpu
+{
+	XMFLOAT3 mNormal;
+	float mHitDistance;
+	XMFLOAT3 mAlbedo;
+};
+
+struct TextureCpu
+{
+	u32 mWidth;
+	u32 mHeight;
+	vector<XMFLOAT4> mTexels;
+};
+
+struct ReferenceSceneCpu
+{
+	const SceneUniform* mSceneUniform;
+	vector<const TextureCpu*> mMeshAlbedos; // nullptr for meshes without textures
+	bool mUseBVH;
+};
+
+inline u32 HashCpu(u32 seed)
+{
+	seed = (seed ^ 61u) ^ (seed >> 16u);
+	seed *= 9u;
+	seed = seed ^ (seed >> 4u);
+	seed *= 0x27d4eb2du;
+	seed = seed ^ (seed >> 15u);
+	return seed;
+}
+
+inline float FRandomCpu(u32& state)
+{
+	// same LCG and mantissa trick as frandom so a seed produces the same sequence on both sides
+	state = 1664525u * state + 1013904223u;
+	const u32 irand = (state & 0x007FFFFFu) | 0x3F800000u;
+	float f;
+	memcpy(&f, &irand, sizeof(f));
+	return f - 1.0f;
+}
+
+inline XMFLOAT2 FRandom2Cpu(u32& state)
+{
+	const float x = FRandomCpu(state);
+	const float y = FRandomCpu(state);
+	return XMFLOAT2(x, y);
+}
+
+inline u32 ReverseBitsCpu(u32 x)
+{
+	x = (x << 16) | (x >> 16);
+	x = ((x & 0x00ff00ffu) << 8) | ((x & 0xff00ff00u) >> 8);
+	x = ((x & 0x0f0f0f0fu) << 4) | ((x & 0xf0f0f0f0u) >> 4);
+	x = ((x & 0x33333333u) << 2) | ((x & 0xccccccccu) >> 2);
+	x = ((x & 0x55555555u) << 1) | ((x & 0xaaaaaaaau) >> 1);
+	return x;
+}
+
+inline u32 NestedUniformScrambleCpu(u32 x, u32 seed)
+{
+	x = ReverseBitsCpu(x);
+	x += seed;
+	x ^= x * 0x6c50b47cu;
+	x ^= x * 0xb82f1e52u;
+	x ^= x * 0xc7afe638u;
+	x ^= x * 0x8d22f6e6u;
+	return ReverseBitsCpu(x);
+}
+
+// PathSampler of PathTracerSamplerUtil.hlsli, every sampler returns the same numbers as the shader for the same pixel, sample index and dimension
+class PathSamplerCpu
+{
+public:
+	// the random state starts like the seed of a camera ray, the sample index stands in for the frame count
+	PathSamplerCpu(const SceneUniform& sceneUniform, u32 x, u32 y, u32 sampleIndex) :
+		mSceneUniform(sceneUniform),
+		mX(x),
+		mY(y),
+		mPixelSeed(HashCpu(HashCpu(HashCpu(sceneUniform.mPathTracerSamplerSeed) + x) + y)),
+		mSampleIndex(sampleIndex),
+		mRandomState(HashCpu(HashCpu(HashCpu(sampleIndex) + x) + y))
+	{
+	}
+
+	u32 GetRandomState() const { return mRandomState; }
+	void SetRandomState(u32 randomState) { mRandomState = randomState; }
+
+	XMFLOAT2 Get2D(u32 dimension)
+	{
+		const u32 type = mSceneUniform.mPathTracerSampler;
+		if (type == PT_SAMPLER_RANDOM || dimension >= mSceneUniform.mPathTracerSamplerDimensionMax)
+			return FRandom2Cpu(mRandomState);
+		u32 x, y;
+		if (type == PT_SAMPLER_SOBOL)
+		{
+			GetShuffledSobol2D(HashCpu(mPixelSeed + dimension), mSceneUniform.mPathTracerSamplerOwenScrambling != 0, x, y);
+			return ToUnitFloat2(x, y);
+		}
+		// the same points for every pixel, shifted by the R2 lattice over the pixel position
+		GetShuffledSobol2D(HashCpu(HashCpu(mSceneUniform.mPathTracerSamplerSeed) + dimension), true, x, y);
+		return ToUnitFloat2(
+			x + mX * PT_SAMPLER_R2_GENERATOR_X + mY * PT_SAMPLER_R2_GENERATOR_Y,
+			y + mX * PT_SAMPLER_R2_GENERATOR_Y + mY * PT_SAMPLER_R2_GENERATOR_X);
+	}
+
+	float Get1D(u32 dimension)
+	{
+		if (mSceneUniform.mPathTracerSampler == PT_SAMPLER_RANDOM || dimension >= mSceneUniform.mPathTracerSamplerDimensionMax)
+			return FRandomCpu(mRandomState);
+		return Get2D(dimension).x;
+	}
+
+	static u32 GetBounceDimension(u32 bounceIndex, u32 dimensionInBounce)
+	{
+		return PT_SAMPLE_DIMENSION_BOUNCE_START + bounceIndex * PT_SAMPLE_DIMENSION_PER_BOUNCE + dimensionInBounce;
+	}
+
+private:
+	const SceneUniform& mSceneUniform;
+	u32 mX;
+	u32 mY;
+	u32 mPixelSeed;
+	u32 mSampleIndex;
+	u32 mRandomState;
+
+	static XMFLOAT2 ToUnitFloat2(u32 x, u32 y)
+	{
+		return XMFLOAT2((x >> 8) * (1.0f / 16777216.0f), (y >> 8) * (1.0f / 16777216.0f));
+	}
+
+	void GetShuffledSobol2D(u32 seed, bool owenScrambling, u32& x, u32& y) const
+	{
+		x = 0;
+		y = 0;
+		u32 direction = 0x80000000u;
+		u32 index = NestedUniformScrambleCpu(mSampleIndex, seed);
+		for (u32 bit = 0; index; bit++, index >>= 1)
+		{
+			if (index & 1)
+			{
+				x ^= 0x80000000u >> bit;
+				y ^= direction;
+			}
+			direction ^= direction >> 1;
+		}
+		const u32 seedX = HashCpu(seed);
+		const u32 seedY = HashCpu(seedX);
+		x = owenScrambling ? NestedUniformScrambleCpu(x, seedX) : x ^ seedX;
+		y = owenScrambling ? NestedUniformScrambleCpu(y, seedY) : y ^ seedY;
+	}
+};
+
+inline float SaturateCpu(float x)
+{
+	// NaN becomes 0 like saturate does on the GPU
+	return x > 0.0f ? (x < 1.0f ? x : 1.0f) : 0.0f;
+}
+
+inline float Dot3Cpu(FXMVECTOR a, FXMVECTOR b)
+{
+	return XMVectorGetX(XMVector3Dot(a, b));
+}
+
+inline float Length3Cpu(FXMVECTOR v)
+{
+	return XMVectorGetX(XMVector3Length(v));
+}
+
+inline bool IsNotBlackCpu(FXMVECTOR col)
+{
+	return XMVectorGetX(col) > 0.0f || XMVectorGetY(col) > 0.0f || XMVectorGetZ(col) > 0.0f;
+}
+
+inline XMVECTOR TransformPointCpu(FXMVECTOR p, const XMFLOAT4X4& mat)
+{
+	// mul(mat, float4(p, 1.0f)).xyz in the shader
+	return XMVectorSetW(XMVector4Transform(XMVectorSetW(p, 1.0f), XMLoadFloat4x4(&mat)), 0.0f);
+}
+
+inline XMVECTOR TransformDirCpu(FXMVECTOR v, const XMFLOAT4X4& mat)
+{
+	// mul(mat, float4(v, 0.0f)).xyz in the shader
+	return XMVector4Transform(XMVectorSetW(v, 0.0f), XMLoadFloat4x4(&mat));
+}
+
+inline float CosThetaCpu(FXMVECTOR w, FXMVECTOR nor)
+{
+	return Dot3Cpu(w, nor);
+}
+
+inline float TanThetaCpu(FXMVECTOR w, FXMVECTOR nor)
+{
+	const float b = Dot3Cpu(w, nor);
+	const float a = Length3Cpu(w - b * nor);
+	return a / b;
+}
+
+inline float GgxDCpu(float cosThetaH, float alpha)
+{
+	const float temp = cosThetaH * cosThetaH * (alpha * alpha - 1.0f) + 1.0f;
+	return alpha * alpha / (PI * temp * temp);
+}
+
+inline float GgxGCpu(float tanThetaI, float tanThetaO, float alpha)
+{
+	const float alpha2 = alpha * alpha;
+	const float AI = (-1.0f + sqrtf(1.0f + alpha2 * tanThetaI * tanThetaI)) / 2.0f;
+	const float AO = (-1.0f + sqrtf(1.0f + alpha2 * tanThetaO * tanThetaO)) / 2.0f;
+	return 1.0f / (1.0f + AI + AO);
+}
+
+inline float GgxPdfCpu(FXMVECTOR wo, FXMVECTOR wh, FXMVECTOR nor, float alpha)
+{
+	const float cosTheta = CosThetaCpu(wh, nor);
+	return GgxDCpu(cosTheta, alpha) * fabsf(cosTheta) / (4.0f * Dot3Cpu(wo, wh));
+}
+
+inline float GgxNoFresnelCpu(FXMVECTOR wi, FXMVECTOR wo, FXMVECTOR wh, GXMVECTOR nor, float roughness)
+{
+	return SaturateCpu(GgxDCpu(CosThetaCpu(wh, nor), roughness) * GgxGCpu(TanThetaCpu(wi, nor), TanThetaCpu(wo, nor), roughness) / (4.0f * CosThetaCpu(wi, nor) * CosThetaCpu(wo, nor)));
+}
+
+inline XMVECTOR ImportanceSampleGgxCpu(const XMFLOAT2& xi, float roughness, FXMVECTOR nor)
+{
+	const float a = roughness * roughness;
+	const float phi = 2.0f * PI * xi.x;
+	const float cosTheta = sqrtf((1.0f - xi.y) / (1.0f + (a * a - 1.0f) * xi.y));
+	const float sinTheta = sqrtf(1.0f - cosTheta * cosTheta);
+	const XMVECTOR up = fabsf(XMVectorGetZ(nor)) < 0.999f ? XMVectorSet(0.0f, 0.0f, 1.0f, 0.0f) : XMVectorSet(1.0f, 0.0f, 0.0f, 0.0f);
+	const XMVECTOR tangentX = XMVector3Normalize(XMVector3Cross(up, nor));
+	const XMVECTOR tangentY = XMVector3Cross(nor, tangentX);
+	// tangent to world space
+	return tangentX * (sinTheta * cosf(phi)) + tangentY * (sinTheta * sinf(phi)) + nor * cosTheta;
+}
+
+inline float FresnelCpu(float vDotH, float F0)
+{
+	// Schlick approximation
+	return F0 + (1.0f - F0) * powf(1.0f - vDotH, 5.0f);
+}
+
+inline XMVECTOR BrdfGgxCpu(const SurfaceCpu& sd, FXMVECTOR wi, FXMVECTOR wo)
+{
+	if (Dot3Cpu(wi, sd.mNorWorld) < 0.0f || Dot3Cpu(wo, sd.mNorWorld) < 0.0f)
+		return XMVectorZero();
+
+	XMVECTOR wh = wo + wi;
+	if (Length3Cpu(wh) == 0.0f)
+	{
+		// if wo and wi point to the opposite directions
+		// use the perpendicular on the normal's side as the wh
+		const XMVECTOR tangent = XMVector3Normalize(XMVector3Cross(sd.mNorWorld, wi));
+		wh = XMVector3Normalize(XMVector3Cross(wi, tangent));
+	}
+	else
+		wh = XMVector3Normalize(wh);
+
+	const float specular = SaturateCpu(FresnelCpu(Dot3Cpu(wh, wo), sd.mFresnel) * GgxNoFresnelCpu(wi, wo, wh, sd.mNorWorld, sd.mRoughness));
+	const float diffuse = ONE_OVER_PI;
+	return sd.mAlbedo * ((diffuse * (1.0f - sd.mMetallic) + specular * sd.mMetallic) * SaturateCpu(CosThetaCpu(wi, sd.mNorWorld)));
+}
+
+inline XMVECTOR SampleTextureCpu(const TextureCpu& texture, const XMFLOAT2& uv)
+{
+	// bilinear with wrap addressing on the top mip, same as SampleLevel(gSamplerLinear, uv, 0.0f)
+	const float x = uv.x * texture.mWidth - 0.5f;
+	const float y = uv.y * texture.mHeight - 0.5f;
+	const float x0 = floorf(x);
+	const float y0 = floorf(y);
+	const float fx = x - x0;
+	const float fy = y - y0;
+	auto wrap = [](float i, u32 size) { const i64 wrapped = (i64)i % (i64)size; return (u32)(wrapped < 0 ? wrapped + size : wrapped); };
+	const u32 ix0 = wrap(x0, texture.mWidth);
+	const u32 ix1 = wrap(x0 + 1.0f, texture.mWidth);
+	const u32 iy0 = wrap(y0, texture.mHeight);
+	const u32 iy1 = wrap(y0 + 1.0f, texture.mHeight);
+	const XMVECTOR t00 = XMLoadFloat4(&texture.mTexels[ix0 + iy0 * texture.mWidth]);
+	const XMVECTOR t10 = XMLoadFloat4(&texture.mTexels[ix1 + iy0 * texture.mWidth]);
+	const XMVECTOR t01 = XMLoadFloat4(&texture.mTexels[ix0 + iy1 * texture.mWidth]);
+	const XMVECTOR t11 = XMLoadFloat4(&texture.mTexels[ix1 + iy1 * texture.mWidth]);
+	return XMVectorLerp(XMVectorLerp(t00, t10, fx), XMVectorLerp(t01, t11, fx), fy);
+}
+
+inline float RaySphereCpu(FXMVECTOR p, float r, FXMVECTOR ori, FXMVECTOR dir)
+{
+	const XMVECTOR v = p - ori;
+	const float t = Dot3Cpu(v, dir);
+	if (t > 0.0f && Length3Cpu(v - t * dir) < r)
+		return t;
+	else
+		return -1.0f;
+}
+
+inline float RayPlaneCpu(FXMVECTOR p, FXMVECTOR nor, FXMVECTOR ori, GXMVECTOR dir)
+{
+	// return 0.0f when ray is parallel to plane
+	const float norDotDir = Dot3Cpu(nor, dir);
+	if (norDotDir == 0.0f)
+		return 0.0f;
+	else
+		return Dot3Cpu(nor, p - ori) / norDotDir;
+}
+
+inline float RayQuadCpu(const LightData& ld, FXMVECTOR ori, FXMVECTOR dir)
+{
+	// early reject
+	const float t = RayPlaneCpu(XMLoadFloat3(&ld.mPosWorld), XMLoadFloat3(&ld.mDirWorld), ori, dir);
+	if (t <= 0.0f)
+		return t;
+
+	// the light view matrix takes world space to quad space, the view is rigid so t is the same in both
+	const XMVECTOR pLocal = TransformPointCpu(ori + dir * t, ld.mView);
+	if (fabsf(XMVectorGetX(pLocal)) < ld.mScale.x && fabsf(XMVectorGetY(pLocal)) < ld.mScale.y)
+		return t;
+	else
+		return -1.0f;
+}
+
+inline float RayLightCpu(const LightData& ld, FXMVECTOR ori, FXMVECTOR dir)
+{
+	float t = -1.0f;
+	if (ld.mLightType == LIGHT_TYPE_POINT)
+		t = RaySphereCpu(XMLoadFloat3(&ld.mPosWorld), PT_POINT_LIGHT_RADIUS, ori, dir);
+	else if (ld.mLightType == LIGHT_TYPE_QUAD)
+		t = RayQuadCpu(ld, ori, dir);
+	return t;
+}
+
+inline float IntersectLightsCpu(IntersectionCpu& it, FXMVECTOR ori, FXMVECTOR dir)
+{
+	float tMin = -1.0f;
+	if (PathTracer::sLightBvhNodes.empty())
+		return tMin;
+	XMFLOAT3 oriFloat3;
+	XMFLOAT3 dirFloat3;
+	XMStoreFloat3(&oriFloat3, ori);
+	XMStoreFloat3(&dirFloat3, dir);
+	const PathTracerCpu::RayCpu ray = PathTracerCpu::MakeRay(oriFloat3, dirFloat3);
+	u32 stack[PT_LIGHT_BVH_STACK_SIZE];
+	u32 top = 0;
+	stack[top++] = 0;
+	while (top > 0)
+	{
+		const LightBvhNode& node = PathTracer::sLightBvhNodes[stack[--top]];
+		AABB aabb;
+		aabb.mMin = node.mAabbMin;
+		aabb.mMax = node.mAabbMax;
+		// the light is inside its box so a box entered past the closest hit cannot hold a closer one
+		float tNear = 0.0f;
+		if (!RayAabbCpu(aabb, ray, tMin > 0.0f ? tMin : FLOAT_MAX, tNear))
+			continue;
+		if (!node.mIsLeaf)
+		{
+			stack[top++] = node.mLeftIndex;
+			stack[top++] = node.mRightIndex;
+			continue;
+		}
+		const u32 i = node.mLeftIndex;
+		const float t = RayLightCpu(PathTracer::sLightData[i], ori, dir);
+		if (t > 0.0f && (t < tMin || tMin < 0.0f))
+		{
+			tMin = t;
+			it.mType = IntersectionTypeLight;
+			it.mLightIndex = i;
+			it.mPointWorld = ori + dir * t;
+			it.mPointModel = it.mPointWorld; // lights are in world space
+		}
+	}
+	return tMin;
+}
+
+inline float TraverseMeshLeafCpu(const ReferenceSceneCpu& scene, IntersectionCpu& it, u32 meshIndex, FXMVECTOR ori, FXMVECTOR dir)
+{
+	// triangle BVHs are in model space, t is converted back to world space on the way out
+	const MeshPT& mesh = PathTracer::sMeshes[meshIndex];
+	const XMVECTOR oriModel = TransformPointCpu(ori, mesh.mModelInv);
+	XMVECTOR dirModel = TransformDirCpu(dir, mesh.mModelInv);
+	const float dirModelLength = Length3Cpu(dirModel);
+	dirModel = dirModel / dirModelLength;
+	XMFLOAT3 oriModelFloat3;
+	XMFLOAT3 dirModelFloat3;
+	XMStoreFloat3(&oriModelFloat3, oriModel);
+	XMStoreFloat3(&dirModelFloat3, dirModel);
+	PathTracerCpu::HitCpu hit;
+	const PathTracerCpu::RayCpu rayModel = PathTracerCpu::MakeRay(oriModelFloat3, dirModelFloat3);
+	const bool hitMesh = scene.mUseBVH ?
+		PathTracerCpu::IntersectTriangleBVH(meshIndex, rayModel, hit) :
+		PathTracerCpu::IntersectTrianglesBruteForce(meshIndex, rayModel, hit);
+	if (!hitMesh)
+		return -1.0f;
+	it.mType = IntersectionTypeMaterial;
+	it.mTriangleIndex = hit.mTriangleIndex;
+	it.mMeshIndex = meshIndex;
+	it.mPointModel = oriModel + dirModel * hit.mT;
+	it.mPointWorld = TransformPointCpu(it.mPointModel, mesh.mModel);
+	return hit.mT / dirModelLength;
+}
+
+inline float TraverseMeshBvhCpu(const ReferenceSceneCpu& scene, IntersectionCpu& it, FXMVECTOR ori, FXMVECTOR dir)
+{
+	float tMin = FLOAT_MAX;
+	IntersectionCpu itLeaf;
+	if (!scene.mUseBVH)
+	{
+		for (u32 i = 0; i < PathTracer::sMeshes.size(); i++)
+		{
+			const float t = TraverseMeshLeafCpu(scene, itLeaf, i, ori, dir);
+			if (t > 0.0f && t < tMin)
+			{
+				tMin = t;
+				it = itLeaf;
+			}
+		}
+		return tMin == FLOAT_MAX ? -1.0f : tMin;
+	}
+
+	XMFLOAT3 oriFloat3;
+	XMFLOAT3 dirFloat3;
+	XMStoreFloat3(&oriFloat3, ori);
+	XMStoreFloat3(&dirFloat3, dir);
+	const PathTracerCpu::RayCpu ray = PathTracerCpu::MakeRay(oriFloat3, dirFloat3);
+	const u32 stackSize = PathTracer::sMeshBvhHeight + 1;
+	u32* stack = (u32*)_alloca(sizeof(u32) * stackSize);
+	u32 top = 0;
+	float tNear;
+	if (RayAabbCpu(PathTracer::sMeshWorldBVHs[PathTracer::sMeshBvhRootIndexGlobal].mAABB, ray, tMin, tNear))
+		stack[top++] = PathTracer::sMeshBvhRootIndexGlobal;
+	while (top > 0)
+	{
+		const BVH& bvh = PathTracer::sMeshWorldBVHs[stack[--top]];
+		u32 internalChildren[2];
+		float internalNear[2];
+		u32 internalCount = 0;
+		const u32 childIndices[2] = { bvh.mLeftIndexLocal, bvh.mRightIndexLocal };
+		const u32 childIsLeaf[2] = { bvh.mLeftIsLeaf, bvh.mRightIsLeaf };
+		for (int i = 0; i < 2; i++)
+		{
+			if (childIsLeaf[i])
+			{
+				const float t = TraverseMeshLeafCpu(scene, itLeaf, childIndices[i], ori, dir);
+				if (t > 0.0f && t < tMin)
+				{
+					tMin = t;
+					it = itLeaf;
+				}
+			}
+			else if (RayAabbCpu(PathTracer::sMeshWorldBVHs[childIndices[i]].mAABB, ray, tMin, tNear))
+			{
+				internalChildren[internalCount] = childIndices[i];
+				internalNear[internalCount] = tNear;
+				internalCount++;
+			}
+		}
+		if (internalCount == 2 && internalNear[0] < internalNear[1])
+			swap(internalChildren[0], internalChildren[1]);
+		fatalAssertf(top + internalCount <= stackSize, "mesh bvh traversal stack overflow");
+		for (u32 i = 0; i < internalCount; i++)
+			stack[top++] = internalChildren[i];
+	}
+	return tMin == FLOAT_MAX ? -1.0f : tMin;
+}
+
+inline bool IntersectCpu(const ReferenceSceneCpu& scene, IntersectionCpu& it, FXMVECTOR oriIn, FXMVECTOR dir, u64& rayCount)
+{
+	rayCount++;
+	const XMVECTOR ori = oriIn + dir * PT_SPAWN_RAY_BIAS;
+	IntersectionCpu itTriangles = {};
+	IntersectionCpu itLights = {};
+	const float tTriangles = TraverseMeshBvhCpu(scene, itTriangles, ori, dir);
+	const float tLights = IntersectLightsCpu(itLights, ori, dir);
+	if (tTriangles > 0.0f && (tLights <= 0.0f || tTriangles < tLights))
+		it = itTriangles;
+	else if (tLights > 0.0f)
+		it = itLights;
+	else
+		return false;
+	return true;
+}
+
+inline XMVECTOR GetTriangleNormalWorldCpu(const MeshPT& mesh, const TrianglePT& tri)
+{
+	const XMVECTOR p0 = TransformPointCpu(XMLoadFloat3(&tri.mVertices[0].pos), mesh.mModel);
+	const XMVECTOR p1 = TransformPointCpu(XMLoadFloat3(&tri.mVertices[1].pos), mesh.mModel);
+	const XMVECTOR p2 = TransformPointCpu(XMLoadFloat3(&tri.mVertices[2].pos), mesh.mModel);
+	return XMVector3Normalize(XMVector3Cross(p1 - p0, p2 - p0));
+}
+
+// n is the geometric normal at p for mesh lights, same as IsLightVisibleInternal in the shader
+inline bool IsLightVisibleCpu(const ReferenceSceneCpu& scene, u32 lightIndex, FXMVECTOR ori, FXMVECTOR dir, XMVECTOR& p, XMVECTOR& n, u64& rayCount)
+{
+	IntersectionCpu it = {};
+	n = XMVectorZero();
+	if (!IntersectCpu(scene, it, ori, dir, rayCount))
+		return false;
+	if (it.mType == IntersectionTypeLight && it.mLightIndex == lightIndex)
+	{
+		p = it.mPointWorld;
+		return true;
+	}
+	const LightData& ld = PathTracer::sLightData[lightIndex];
+	if (it.mType == IntersectionTypeMaterial && ld.mLightType == LIGHT_TYPE_MESH && ld.mMeshIndex == it.mMeshIndex)
+	{
+		p = it.mPointWorld;
+		n = GetTriangleNormalWorldCpu(PathTracer::sMeshes[it.mMeshIndex], PathTracer::sTriangles[it.mTriangleIndex]);
+		return true;
+	}
+	return false;
+}
+
+inline bool IsLightVisibleCpu(const ReferenceSceneCpu& scene, u32 lightIndex, FXMVECTOR ori, FXMVECTOR dir, XMVECTOR& p, u64& rayCount)
+{
+	XMVECTOR n;
+	return IsLightVisibleCpu(scene, lightIndex, ori, dir, p, n, rayCount);
+}
+
+inline bool IsLightSampleVisibleCpu(const ReferenceSceneCpu& scene, u32 lightIndex, FXMVECTOR ori, FXMVECTOR samplePoint, XMVECTOR& p, u64& rayCount)
+{
+	const XMVECTOR oriToSample = samplePoint - ori;
+	if (!IsLightVisibleCpu(scene, lightIndex, ori, XMVector3Normalize(oriToSample), p, rayCount))
+		return false;
+	return PathTracer::sLightData[lightIndex].mLightType != LIGHT_TYPE_MESH || Length3Cpu(p - samplePoint) <= Length3Cpu(oriToSample) * PT_MESH_LIGHT_SAMPLE_TOLERANCE;
+}
+
+inline void EvaluateSurfaceCpu(const ReferenceSceneCpu& scene, SurfaceCpu& sd, const IntersectionCpu& it)
+{
+	if (it.mType == IntersectionTypeMaterial)
+	{
+		const TrianglePT& tri = PathTracer::sTriangles[it.mTriangleIndex];
+		const MeshPT& mesh = PathTracer::sMeshes[it.mMeshIndex]; // instances share triangles, the triangle only knows the first mesh with its geometry
+		// barycentric interpolation from sub triangle areas
+		const XMVECTOR p = it.mPointModel;
+		const XMVECTOR p0 = XMLoadFloat3(&tri.mVertices[0].pos);
+		const XMVECTOR p1 = XMLoadFloat3(&tri.mVertices[1].pos);
+		const XMVECTOR p2 = XMLoadFloat3(&tri.mVertices[2].pos);
+		const float s = 0.5f * Length3Cpu(XMVector3Cross(p0 - p1, p0 - p2));
+		const float s0 = 0.5f * Length3Cpu(XMVector3Cross(p - p1, p - p2)) / s;
+		const float s1 = 0.5f * Length3Cpu(XMVector3Cross(p - p2, p - p0)) / s;
+		const float s2 = 0.5f * Length3Cpu(XMVector3Cross(p - p0, p - p1)) / s;
+		const XMVECTOR uv = s0 * XMLoadFloat2(&tri.mVertices[0].uv) + s1 * XMLoadFloat2(&tri.mVertices[1].uv) + s2 * XMLoadFloat2(&tri.mVertices[2].uv);
+		const XMVECTOR norModel = s0 * XMLoadFloat3(&tri.mVertices[0].nor) + s1 * XMLoadFloat3(&tri.mVertices[1].nor) + s2 * XMLoadFloat3(&tri.mVertices[2].nor);
+		const XMVECTOR tanModel = s0 * XMLoadFloat4(&tri.mVertices[0].tan) + s1 * XMLoadFloat4(&tri.mVertices[1].tan) + s2 * XMLoadFloat4(&tri.mVertices[2].tan);
+		XMStoreFloat2(&sd.mUV, uv);
+		// mul(float4(normalModel, 0.0f), modelInv) in the shader, the normal is not renormalized there either
+		sd.mNorWorld = XMVectorSetW(XMVector4Transform(XMVectorSetW(norModel, 0.0f), XMMatrixTranspose(XMLoadFloat4x4(&mesh.mModelInv))), 0.0f);
+		sd.mTanWorld = XMVectorSetW(TransformDirCpu(tanModel, mesh.mModel), XMVectorGetW(tanModel));
+		const MaterialPT& material = PathTracer::sMaterials[mesh.mMaterialIndex];
+		sd.mSpecularity = scene.mSceneUniform->mSpecularity;
+		if (material.mUseSceneParameters)
+		{
+			sd.mAlbedo = XMLoadFloat4(&scene.mSceneUniform->mStandardColor);
+			sd.mRoughness = scene.mSceneUniform->mRoughness;
+			sd.mFresnel = scene.mSceneUniform->mFresnel;
+			sd.mMetallic = scene.mSceneUniform->mMetallic;
+		}
+		else
+		{
+			sd.mAlbedo = XMLoadFloat3(&material.mAlbedo);
+			sd.mRoughness = material.mRoughness;
+			sd.mFresnel = material.mFresnel;
+			sd.mMetallic = material.mMetallic;
+		}
+		if (!scene.mSceneUniform->mUsePerPassTextures && material.mAlbedoTextureIndex != INVALID_UINT32 && scene.mMeshAlbedos[it.mMeshIndex])
+			sd.mAlbedo = SampleTextureCpu(*scene.mMeshAlbedos[it.mMeshIndex], XMFLOAT2(sd.mUV.x, 1.0f - sd.mUV.y));
+		sd.mAlbedo = XMVectorSetW(sd.mAlbedo, 0.0f);
+		sd.mPosWorld = it.mPointWorld;
+		sd.mMaterialType = material.mMaterialType;
+		if (mesh.mMaterialType == MATERIAL_TYPE_EMISSIVE)
+			sd.mEmissive = XMLoadFloat3(&mesh.mEmissive);
+	}
+	else if (it.mType == IntersectionTypeLight)
+	{
+		sd.mEmissive = XMLoadFloat3(&PathTracer::sLightData[it.mLightIndex].mColor);
+	}
+}
+
+// lightNor is only read for mesh lights
+inline XMVECTOR EvaluateLightCpu(FXMVECTOR itPos, FXMVECTOR lightPos, FXMVECTOR lightNor, u32 lightIndex, XMVECTOR& wi, float& pdf)
+{
+	const LightData& ld = PathTracer::sLightData[lightIndex];
+	XMVECTOR nLight = XMVectorZero();
+	pdf = 0.0f;
+	if (ld.mLightType == LIGHT_TYPE_MESH)
+	{
+		pdf = 1.0f / ld.mArea; // triangles are picked by area
+		nLight = lightNor;
+	}
+	else if (ld.mLightType == LIGHT_TYPE_POINT)
+	{
+		pdf = 0.0f; // delta light has 0 chance to be hit
+		nLight = lightPos - itPos;
+	}
+	else if (ld.mLightType == LIGHT_TYPE_QUAD)
+	{
+		pdf = 1.0f / ld.mArea;
+		// mul(float4(nLight, 0.0f), ld.mView) in the shader
+		nLight = XMVector4Transform(XMVectorSet(0.0f, 0.0f, 1.0f, 0.0f), XMMatrixTranspose(XMLoadFloat4x4(&ld.mView)));
+	}
+	const XMVECTOR itPosToLight = lightPos - itPos;
+	wi = XMVector3Normalize(itPosToLight);
+	const float absDot = fabsf(Dot3Cpu(nLight, -wi)); // solid angle
+	if (absDot == 0.0f)
+	{
+		pdf = 0.0f;
+		return XMVectorZero();
+	}
+	const float d = Length3Cpu(itPosToLight);
+	pdf *= d * d / absDot; // adjust due to solid angle
+	return XMLoadFloat3(&ld.mColor);
+}
+
+inline XMVECTOR EvaluateLightCpu(FXMVECTOR itPos, FXMVECTOR lightPos, u32 lightIndex, XMVECTOR& wi, float& pdf)
+{
+	return EvaluateLightCpu(itPos, lightPos, XMVectorZero(), lightIndex, wi, pdf);
+}
+
+// same as SampleMeshLight in the shader
+inline XMVECTOR SampleMeshLightCpu(const LightData& ld, const XMFLOAT2& xi, XMVECTOR& n)
+{
+	const MeshPT& mesh = PathTracer::sMeshes[ld.mMeshIndex];
+	const float scaled = xi.x * mesh.mTriangleCount;
+	const u32 entryIndex = MIN((u32)scaled, mesh.mTriangleCount - 1);
+	const AliasEntry& entry = PathTracer::sLightAliasEntries[ld.mAliasEntryOffset + entryIndex];
+	float u = scaled - entryIndex;
+	u32 triangleIndex = entryIndex;
+	if (u < entry.mProbability)
+	{
+		u = u / entry.mProbability;
+	}
+	else
+	{
+		u = (u - entry.mProbability) / (1.0f - entry.mProbability);
+		triangleIndex = entry.mAlias;
+	}
+	u = MIN(u, PT_ONE_MINUS_EPSILON);
+	const TrianglePT& tri = PathTracer::sTriangles[mesh.mTriangleIndexLocalToGlobalOffset + triangleIndex];
+	const XMVECTOR p0 = TransformPointCpu(XMLoadFloat3(&tri.mVertices[0].pos), mesh.mModel);
+	const XMVECTOR p1 = TransformPointCpu(XMLoadFloat3(&tri.mVertices[1].pos), mesh.mModel);
+	const XMVECTOR p2 = TransformPointCpu(XMLoadFloat3(&tri.mVertices[2].pos), mesh.mModel);
+	n = XMVector3Normalize(XMVector3Cross(p1 - p0, p2 - p0));
+	const float sqrtU = sqrtf(u);
+	const float b0 = 1.0f - sqrtU;
+	const float b1 = xi.y * sqrtU;
+	return p0 * b0 + p1 * b1 + p2 * (1.0f - b0 - b1);
+}
+
+inline XMVECTOR SampleLightCpu(FXMVECTOR itPos, const XMFLOAT2& xi, u32 lightIndex, XMVECTOR& p, XMVECTOR& wi, float& pdf)
+{
+	const LightData& ld = PathTracer::sLightData[lightIndex];
+	XMVECTOR n = XMVectorZero();
+	p = XMVectorZero();
+	if (ld.mLightType == LIGHT_TYPE_MESH)
+		p = SampleMeshLightCpu(ld, xi, n);
+	else if (ld.mLightType == LIGHT_TYPE_POINT)
+		p = XMLoadFloat3(&ld.mPosWorld);
+	else if (ld.mLightType == LIGHT_TYPE_QUAD)
+		p = TransformPointCpu(XMVectorSet((xi.x * 2.0f - 1.0f) * ld.mScale.x, (xi.y * 2.0f - 1.0f) * ld.mScale.y, 0.0f, 0.0f), ld.mViewInv); // local to world space
+	return EvaluateLightCpu(itPos, p, n, lightIndex, wi, pdf);
+}
+
+// cos(a - b) and sin(a - b) with a - b clamped to at least 0, from the sine and cosine of a and b
+inline float CosSubClampedCpu(float sinA, float cosA, float sinB, float cosB)
+{
+	return cosA > cosB ? 1.0f : cosA * cosB + sinA * sinB;
+}
+
+inline float SinSubClampedCpu(float sinA, float cosA, float sinB, float cosB)
+{
+	return cosA > cosB ? 0.0f : sinA * cosB - cosA * sinB;
+}
+
+// GetLightBvhImportance of the shader
+inline float GetLightBvhImportanceCpu(const LightBvhNode& node, FXMVECTOR pos, FXMVECTOR nor)
+{
+	if (node.mPower <= 0.0f)
+		return 0.0f;
+	const XMVECTOR center = (XMLoadFloat3(&node.mAabbMin) + XMLoadFloat3(&node.mAabbMax)) * 0.5f;
+	const XMVECTOR centerToPos = pos - center;
+	const float distance2 = Dot3Cpu(centerToPos, centerToPos);
+	const XMVECTOR halfExtent = XMLoadFloat3(&node.mAabbMax) - center;
+	const float r2 = Dot3Cpu(halfExtent, halfExtent);
+	const float d2 = MAX(distance2, sqrtf(r2)); // pbrt-v4 keeps the distance away from 0 with half the diagonal
+	const XMVECTOR wi = distance2 > 0.0f ? centerToPos / sqrtf(distance2) : XMVectorZero();
+	float cosThetaW = Dot3Cpu(XMLoadFloat3(&node.mAxis), wi);
+	if (node.mTwoSided)
+		cosThetaW = fabsf(cosThetaW);
+	const float sinThetaW = sqrtf(SaturateCpu(1.0f - cosThetaW * cosThetaW));
+	// inside the bounding sphere of the node light can come from anywhere
+	const bool inside = distance2 <= r2;
+	const float sinThetaB = inside ? 0.0f : sqrtf(r2 / distance2);
+	const float cosThetaB = inside ? -1.0f : sqrtf(SaturateCpu(1.0f - r2 / distance2));
+	const float sinThetaO = sqrtf(SaturateCpu(1.0f - node.mCosThetaO * node.mCosThetaO));
+	const float cosThetaX = CosSubClampedCpu(sinThetaW, cosThetaW, sinThetaO, node.mCosThetaO);
+	const float sinThetaX = SinSubClampedCpu(sinThetaW, cosThetaW, sinThetaO, node.mCosThetaO);
+	const float cosThetaP = CosSubClampedCpu(sinThetaX, cosThetaX, sinThetaB, cosThetaB);
+	if (cosThetaP <= node.mCosThetaE)
+		return 0.0f;
+	float importance = node.mPower * cosThetaP / d2;
+	if (Dot3Cpu(nor, nor) > 0.0f)
+	{
+		const float cosThetaI = fabsf(Dot3Cpu(wi, XMVector3Normalize(nor)));
+		const float sinThetaI = sqrtf(SaturateCpu(1.0f - cosThetaI * cosThetaI));
+		importance *= CosSubClampedCpu(sinThetaI, cosThetaI, sinThetaB, cosThetaB);
+	}
+	return MAX(importance, 0.0f);
+}
+
+// SampleLightIndex of the shader, INVALID_UINT32 means no light can reach pos
+inline u32 SampleLightIndexCpu(const SceneUniform& uScene, FXMVECTOR pos, FXMVECTOR nor, float u, float& pdf)
+{
+	pdf = 0.0f;
+	const u32 lightCount = PathTracer::sLightData.size();
+	if (lightCount == 0)
+		return INVALID_UINT32;
+	if (uScene.mPathTracerLightSelection == PT_LIGHT_SELECTION_UNIFORM)
+	{
+		pdf = 1.0f / lightCount;
+		const u32 lightIndex = (u32)(u * lightCount);
+		return MIN(lightIndex, lightCount - 1);
+	}
+	const vector<LightBvhNode>& nodes = PathTracer::sLightBvhNodes;
+	const LightBvhNode* node = &nodes[0];
+	if (node->mIsLeaf && GetLightBvhImportanceCpu(*node, pos, nor) <= 0.0f)
+		return INVALID_UINT32;
+	float pmf = 1.0f;
+	while (!node->mIsLeaf)
+	{
+		const LightBvhNode& left = nodes[node->mLeftIndex];
+		const LightBvhNode& right = nodes[node->mRightIndex];
+		const float importanceLeft = GetLightBvhImportanceCpu(left, pos, nor);
+		const float importanceRight = GetLightBvhImportanceCpu(right, pos, nor);
+		if (importanceLeft <= 0.0f && importanceRight <= 0.0f)
+			return INVALID_UINT32;
+		const float pLeft = importanceLeft / (importanceLeft + importanceRight);
+		if (u < pLeft)
+		{
+			u = MIN(u / pLeft, PT_ONE_MINUS_EPSILON);
+			pmf *= pLeft;
+			node = &left;
+		}
+		else
+		{
+			u = (u - pLeft) / (1.0f - pLeft);
+			u = MIN(u, PT_ONE_MINUS_EPSILON);
+			pmf *= 1.0f - pLeft;
+			node = &right;
+		}
+	}
+	pdf = pmf;
+	return node->mLeftIndex;
+}
+
+inline bool IsSpecularMaterialCpu(u32 materialType)
+{
+	return materialType == MATERIAL_TYPE_SPECULAR_REFLECTIIVE || materialType == MATERIAL_TYPE_SPECULAR_TRANSMISSIVE;
+}
+
+inline float FresnelDielectricCpu(float cosThetaI, float eta)
+{
+	const float sinThetaT2 = (1.0f - cosThetaI * cosThetaI) / (eta * eta);
+	if (sinThetaT2 >= 1.0f)
+		return 1.0f; // total internal reflection
+	const float cosThetaT = sqrtf(1.0f - sinThetaT2);
+	const float rParallel = (eta * cosThetaI - cosThetaT) / (eta * cosThetaI + cosThetaT);
+	const float rPerpendicular = (cosThetaI - eta * cosThetaT) / (cosThetaI + eta * cosThetaT);
+	return 0.5f * (rParallel * rParallel + rPerpendicular * rPerpendicular);
+}
+
+inline float FresnelF0ToEtaCpu(float F0)
+{
+	const float sqrtF0 = sqrtf(SaturateCpu(F0));
+	return (1.0f + sqrtF0) / MAX(1.0f - sqrtF0, 0.001f);
+}
+
+inline XMVECTOR SampleCosineHemisphereCpu(const XMFLOAT2& xi, FXMVECTOR nor)
+{
+	const float r = sqrtf(xi.x);
+	const float phi = 2.0f * PI * xi.y;
+	const XMVECTOR up = fabsf(XMVectorGetZ(nor)) < 0.999f ? XMVectorSet(0.0f, 0.0f, 1.0f, 0.0f) : XMVectorSet(1.0f, 0.0f, 0.0f, 0.0f);
+	const XMVECTOR tangentX = XMVector3Normalize(XMVector3Cross(up, nor));
+	const XMVECTOR tangentY = XMVector3Cross(nor, tangentX);
+	return tangentX * (r * cosf(phi)) + tangentY * (r * sinf(phi)) + nor * sqrtf(MAX(0.0f, 1.0f - xi.x));
+}
+
+// cosine term in LTE is handled in BRDF functions
+inline XMVECTOR EvaluateMaterialCpu(const SurfaceCpu& sd, FXMVECTOR wo, FXMVECTOR wi, float& pdf)
+{
+	// specular materials can't be evaluated but only sampled, and emitters don't reflect
+	pdf = 0.0f;
+	if (sd.mMaterialType == MATERIAL_TYPE_DIFFUSE)
+	{
+		const XMVECTOR nor = XMVector3Normalize(sd.mNorWorld);
+		const float cosThetaI = Dot3Cpu(wi, nor);
+		if (cosThetaI > 0.0f && Dot3Cpu(wo, nor) > 0.0f)
+		{
+			pdf = cosThetaI * ONE_OVER_PI;
+			return sd.mAlbedo * (cosThetaI * ONE_OVER_PI);
+		}
+	}
+	else if (sd.mMaterialType == MATERIAL_TYPE_GGX)
+	{
+		// the diffuse and specular lobes are sampled in proportion to their weights, see SampleMaterialCpu
+		const XMVECTOR wh = XMVector3Normalize(wi + wo);
+		const float specularPdf = MAX(GgxPdfCpu(wo, wh, sd.mNorWorld, sd.mRoughness), 0.0f);
+		const float diffusePdf = MAX(Dot3Cpu(wi, XMVector3Normalize(sd.mNorWorld)), 0.0f) * ONE_OVER_PI;
+		pdf = diffusePdf + (specularPdf - diffusePdf) * sd.mMetallic;
+		return BrdfGgxCpu(sd, wi, wo);
+	}
+	return XMVectorZero();
+}
+
+// delta materials return a pdf of 1 for the lobe they picked
+inline XMVECTOR SampleMaterialCpu(const SurfaceCpu& sd, const XMFLOAT2& xi, FXMVECTOR wo, XMVECTOR& wi, float& pdf)
+{
+	wi = XMVectorZero();
+	if (sd.mMaterialType == MATERIAL_TYPE_DIFFUSE)
+	{
+		wi = SampleCosineHemisphereCpu(xi, XMVector3Normalize(sd.mNorWorld));
+	}
+	else if (sd.mMaterialType == MATERIAL_TYPE_GGX)
+	{
+		if (xi.x < sd.mMetallic)
+		{
+			// ImportanceSampleGgxCpu squares the roughness like the IBL prefilter, while GgxDCpu and GgxPdfCpu take it as alpha
+			const XMVECTOR wh = ImportanceSampleGgxCpu(XMFLOAT2(xi.x / sd.mMetallic, xi.y), sqrtf(sd.mRoughness), sd.mNorWorld);
+			wi = 2.0f * Dot3Cpu(wo, wh) * wh - wo;
+		}
+		else
+			wi = SampleCosineHemisphereCpu(XMFLOAT2((xi.x - sd.mMetallic) / (1.0f - sd.mMetallic), xi.y), XMVector3Normalize(sd.mNorWorld));
+	}
+	else if (sd.mMaterialType == MATERIAL_TYPE_SPECULAR_REFLECTIIVE)
+	{
+		const XMVECTOR nor = XMVector3Normalize(sd.mNorWorld);
+		const float cosThetaO = Dot3Cpu(wo, nor);
+		pdf = 0.0f;
+		if (cosThetaO <= 0.0f)
+			return XMVectorZero();
+		wi = 2.0f * cosThetaO * nor - wo;
+		pdf = 1.0f;
+		return sd.mAlbedo + (XMVectorSet(1.0f, 1.0f, 1.0f, 0.0f) - sd.mAlbedo) * powf(1.0f - cosThetaO, 5.0f);
+	}
+	else if (sd.mMaterialType == MATERIAL_TYPE_SPECULAR_TRANSMISSIVE)
+	{
+		XMVECTOR nor = XMVector3Normalize(sd.mNorWorld);
+		float eta = FresnelF0ToEtaCpu(sd.mFresnel);
+		float cosThetaO = Dot3Cpu(wo, nor);
+		if (cosThetaO < 0.0f)
+		{
+			// leaving the medium
+			eta = 1.0f / eta;
+			cosThetaO = -cosThetaO;
+			nor = -nor;
+		}
+		const float reflectance = FresnelDielectricCpu(cosThetaO, eta);
+		pdf = 1.0f;
+		if (xi.x < reflectance)
+		{
+			wi = 2.0f * cosThetaO * nor - wo;
+		}
+		else
+		{
+			const float sinThetaT2 = (1.0f - cosThetaO * cosThetaO) / (eta * eta);
+			wi = -wo / eta + (cosThetaO / eta - sqrtf(1.0f - sinThetaT2)) * nor;
+		}
+		return sd.mAlbedo;
+	}
+	return EvaluateMaterialCpu(sd, wo, wi, pdf);
+}
+
+inline float PowerHeuristicCpu(int nf, float fPdf, int ng, float gPdf)
+{
+	const float f = nf * fPdf;
+	const float g = ng * gPdf;
+	return (f * f) / (f * f + g * g);
+}
+
+// PathTrace and PathTraceCommon of the shader in one loop, rayCount counts closest hit queries
+inline XMVECTOR PathTraceCpu(const ReferenceSceneCpu& scene, PathSamplerCpu& sampler, FXMVECTOR eyePos, FXMVECTOR eyeDir, u64& rayCount, DenoiseFeaturesCpu* firstHitFeatures = nullptr)
+{
+	const SceneUniform& uScene = *scene.mSceneUniform;
+	const u32 minDepth = uScene.mPathTracerMinDepth;
+	const u32 maxDepth = uScene.mPathTracerMaxDepth;
+	const u32 lightCount = PathTracer::sLightData.size();
+	XMVECTOR ori = eyePos;
+	XMVECTOR dir = eyeDir;
+	XMVECTOR throughput = XMVectorSet(1.0f, 1.0f, 1.0f, 0.0f);
+	XMVECTOR result = XMVectorZero();
+	u32 remainingDepth = maxDepth;
+	bool isLastBounceSpecular = false;
+	bool terminated = false;
+	if (firstHitFeatures)
+		*firstHitFeatures = { XMFLOAT3(0.0f, 0.0f, 0.0f), 0.0f, XMFLOAT3(1.0f, 1.0f, 1.0f) };
+	while (!terminated && remainingDepth > 0)
+	{
+		terminated = true; // assume this ray will be terminated for early exits
+		const u32 bounceIndex = maxDepth - remainingDepth;
+		remainingDepth--;
+		const XMVECTOR wo = -dir;
+
+		// I. intersection detection
+		IntersectionCpu it = {};
+		if (!IntersectCpu(scene, it, ori, dir, rayCount))
+			break;
+
+		if (uScene.mPathTracerMode == PT_MODE_DEBUG_TRIANGLE_INTERSECTION)
+			return XMVectorSet(((float)it.mTriangleIndex + 1.0f) / PathTracer::sTriangles.size(), 0.0f, 0.0f, 0.0f);
+		else if (uScene.mPathTracerMode == PT_MODE_DEBUG_LIGHT_INTERSECTION)
+			return XMVectorSet(0.0f, ((float)it.mLightIndex + 1.0f) / lightCount, 0.0f, 0.0f);
+		else if (uScene.mPathTracerMode == PT_MODE_DEBUG_MESH_INTERSECTION)
+			return XMVectorSet(0.0f, 0.0f, ((float)it.mMeshIndex + 1.0f) / PathTracer::sMeshes.size(), 0.0f);
+
+		SurfaceCpu sd = {};
+		EvaluateSurfaceCpu(scene, sd, it);
+
+		// lights are not demodulated, their color is all emission
+		if (firstHitFeatures && bounceIndex == 0)
+		{
+			XMStoreFloat3(&firstHitFeatures->mNormal, sd.mNorWorld);
+			firstHitFeatures->mHitDistance = Length3Cpu(it.mPointWorld - ori);
+			if (it.mType != IntersectionTypeLight && sd.mMaterialType != MATERIAL_TYPE_EMISSIVE)
+				XMStoreFloat3(&firstHitFeatures->mAlbedo, sd.mAlbedo);
+		}
+
+		if (uScene.mPathTracerMode == PT_MODE_DEBUG_ALBEDO)
+			return sd.mAlbedo;
+		else if (uScene.mPathTracerMode == PT_MODE_DEBUG_NORMAL)
+			return XMVectorSetW(sd.mNorWorld * 0.5f + XMVectorReplicate(0.5f), 0.0f);
+
+		// no need to include light source except for first bounce or specular bounce,
+		// because both direct and indirect light bounces are covered explicitly
+		if (remainingDepth == maxDepth - 1 || isLastBounceSpecular)
+			result += throughput * sd.mEmissive;
+
+		// terminate on lights, emissive meshes included
+		if (it.mType == IntersectionTypeLight || sd.mMaterialType == MATERIAL_TYPE_EMISSIVE)
+			break;
+
+		XMVECTOR Ld = XMVectorZero();
+
+		// 2. sample light
+		float lightPdf = 1.0f;
+		const XMFLOAT2 lightXi = sampler.Get2D(PathSamplerCpu::GetBounceDimension(bounceIndex, PT_SAMPLE_DIMENSION_LIGHT));
+		float lightSelectionPdf = 0.0f;
+		const u32 lightIndex = SampleLightIndexCpu(uScene, it.mPointWorld, sd.mNorWorld, sampler.Get1D(PathSamplerCpu::GetBounceDimension(bounceIndex, PT_SAMPLE_DIMENSION_LIGHT_SELECTION)), lightSelectionPdf);
+		if (lightIndex != INVALID_UINT32)
+		{
+			XMVECTOR lightWi = XMVectorZero();
+			XMVECTOR lightPoint = XMVectorZero();
+			XMVECTOR lightSamplePoint = XMVectorZero();
+			const XMVECTOR lightCol = SampleLightCpu(it.mPointWorld, lightXi, lightIndex, lightSamplePoint, lightWi, lightPdf);
+			if (IsNotBlackCpu(lightCol))
+			{
+				float lightMaterialPdf = 1.0f;
+				const XMVECTOR lightMaterialCol = EvaluateMaterialCpu(sd, wo, lightWi, lightMaterialPdf);
+				if (IsNotBlackCpu(lightMaterialCol) && lightMaterialPdf > 0.0f && IsLightSampleVisibleCpu(scene, lightIndex, it.mPointWorld, lightSamplePoint, lightPoint, rayCount))
+				{
+					if (lightPdf > 0.0f)
+						Ld += lightCol * lightMaterialCol * (PowerHeuristicCpu(1, lightPdf, 1, lightMaterialPdf) / lightPdf);
+					else // delta light
+						Ld += lightCol * lightMaterialCol;
+				}
+			}
+		}
+
+		// 3. sample material, delta materials pick up the light on the next bounce
+		if (lightPdf > 0.0f && !IsSpecularMaterialCpu(sd.mMaterialType))
+		{
+			float materialPdf = 1.0f;
+			XMVECTOR materialWi = XMVectorZero();
+			XMVECTOR materialLightPoint = XMVectorZero();
+			XMVECTOR materialLightNor = XMVectorZero();
+			const XMFLOAT2 materialXi = sampler.Get2D(PathSamplerCpu::GetBounceDimension(bounceIndex, PT_SAMPLE_DIMENSION_MATERIAL));
+			const XMVECTOR materialCol = SampleMaterialCpu(sd, materialXi, wo, materialWi, materialPdf);
+			if (lightIndex != INVALID_UINT32 && IsNotBlackCpu(materialCol) && materialPdf > 0.0f && IsLightVisibleCpu(scene, lightIndex, it.mPointWorld, materialWi, materialLightPoint, materialLightNor, rayCount))
+			{
+				XMVECTOR materialLightWi;
+				float materialLightPdf = 1.0f;
+				const XMVECTOR materialLightCol = EvaluateLightCpu(it.mPointWorld, materialLightPoint, materialLightNor, lightIndex, materialLightWi, materialLightPdf);
+				if (materialLightPdf > 0.0f)
+					Ld += materialCol * materialLightCol * (PowerHeuristicCpu(1, materialPdf, 1, materialLightPdf) / materialPdf);
+				// no delta light when sampling material
+			}
+		}
+
+		// 4. final color, both samples are of the selected light
+		if (lightSelectionPdf > 0.0f)
+			result += Ld * throughput / lightSelectionPdf;
+
+		// 5. GI
+		float giPdf = 0.0f;
+		XMVECTOR giWi = XMVectorZero();
+		const XMFLOAT2 giXi = sampler.Get2D(PathSamplerCpu::GetBounceDimension(bounceIndex, PT_SAMPLE_DIMENSION_BSDF));
+		const XMVECTOR giColor = SampleMaterialCpu(sd, giXi, wo, giWi, giPdf);
+		if (!IsNotBlackCpu(giColor) || giPdf <= 0.0f)
+			break;
+		isLastBounceSpecular = IsSpecularMaterialCpu(sd.mMaterialType);
+		throughput *= giColor / giPdf;
+
+		// 6. spawn new ray
+		ori = it.mPointWorld;
+		dir = giWi;
+
+		// II. russian roulette
+		if (uScene.mPathTracerEnableRussianRoulette && remainingDepth <= maxDepth - minDepth)
+		{
+			// survive with the probability of the max throughput, dividing by it keeps the estimate unbiased
+			const float survival = MIN(MAX(MAX(XMVectorGetX(throughput), XMVectorGetY(throughput)), XMVectorGetZ(throughput)), 1.0f);
+			if (survival <= sampler.Get1D(PathSamplerCpu::GetBounceDimension(bounceIndex, PT_SAMPLE_DIMENSION_RUSSIAN_ROULETTE)))
+				break;
+			throughput /= survival;
+		}
+
+		terminated = remainingDepth == 0;
+	}
+	return result;
+}
+
+inline bool LoadTextureCpu(const string& fileName, TextureCpu& texture)
+{
+	// 16 bit load keeps 8 bit images exact, texels are normalized like a UNORM texture
+	int width = 0;
+	int height = 0;
+	int channelCountOriginal = 0;
+	stbi_us* data = stbi_load_16((AssetPath + fileName).c_str(), &width, &height, &channelCountOriginal, STBI_rgb_alpha);
+	if (!data)
+		return false;
+	texture.mWidth = width;
+	texture.mHeight = height;
+	texture.mTexels.resize(width * height);
+	for (int i = 0; i < width * height; i++)
+		texture.mTexels[i] = XMFLOAT4(data[i * 4] / 65535.0f, data[i * 4 + 1] / 65535.0f, data[i * 4 + 2] / 65535.0f, data[i * 4 + 3] / 65535.0f);
+	stbi_image_free(data);
+	return true;
+}
+
+inline bool WriteImagePfmCpu(const string& filePathName, u32 width, u32 height, const vector<XMFLOAT3>& pixels)
+{
+	// rows go from bottom to top, a negative scale means little endian
+	fstream file;
+	file.open(filePathName, ios::out | ios::binary | ios::trunc);
+	if (!file.is_open())
+		return false;
+	const string header = "PF\n" + to_string(width) + " " + to_string(height) + "\n-1.0\n";
+	file.write(header.c_str(), header.size());
+	for (i64 y = (i64)height - 1; y >= 0; y--)
+		file.write((const char*)&pixels[y * width], sizeof(XMFLOAT3) * width);
+	return true;
+}
+
+inline u32 Crc32Cpu(const u8* data, size_t size, u32 crc = 0)
+{
+	crc = ~crc;
+	for (size_t i = 0; i < size; i++)
+	{
+		crc ^= data[i];
+		for (int bit = 0; bit < 8; bit++)
+			crc = (crc >> 1) ^ (0xEDB88320u & (0u - (crc & 1u)));
+	}
+	return ~crc;
+}
+
+inline void AppendBigEndianCpu(vector<u8>& bytes, u32 value)
+{
+	bytes.push_back((u8)(value >> 24));
+	bytes.push_back((u8)(value >> 16));
+	bytes.push_back((u8)(value >> 8));
+	bytes.push_back((u8)value);
+}
+
+// 8 bit RGB with Reinhard and the same gamma as LinearToGamma of ShaderInclude.hlsli,
+// the zlib stream uses stored blocks so no compressor is needed, the files are only as big as the raw pixels
+inline bool WriteImagePngCpu(const string& filePathName, u32 width, u32 height, const vector<XMFLOAT3>& pixels)
+{
+	vector<u8> scanlines;
+	scanlines.reserve((width * 3 + 1) * height);
+	for (u32 y = 0; y < height; y++)
+	{
+		scanlines.push_back(0); // no filter
+		for (u32 x = 0; x < width; x++)
+		{
+			const float* linear = &pixels[x + y * width].x;
+			for (u32 channel = 0; channel < 3; channel++)
+			{
+				const float tonemapped = MAX(linear[channel], 0.0f) / (1.0f + MAX(linear[channel], 0.0f));
+				scanlines.push_back((u8)(powf(tonemapped, 1.0f / 2.2f) * 255.0f + 0.5f));
+			}
+		}
+	}
+
+	const u32 storedBlockSizeMax = 65535;
+	vector<u8> idat = { 'I', 'D', 'A', 'T', 0x78, 0x01 };
+	u32 adlerA = 1;
+	u32 adlerB = 0;
+	for (size_t offset = 0; offset < scanlines.size(); offset += storedBlockSizeMax)
+	{
+		const u32 blockSize = (u32)MIN(scanlines.size() - offset, (size_t)storedBlockSizeMax);
+		idat.push_back(offset + blockSize == scanlines.size() ? 1 : 0);
+		idat.push_back((u8)blockSize);
+		idat.push_back((u8)(blockSize >> 8));
+		idat.push_back((u8)~blockSize);
+		idat.push_back((u8)(~blockSize >> 8));
+		idat.insert(idat.end(), scanlines.begin() + offset, scanlines.begin() + offset + blockSize);
+		for (u32 i = 0; i < blockSize; i++)
+		{
+			adlerA = (adlerA + scanlines[offset + i]) % 65521;
+			adlerB = (adlerB + adlerA) % 65521;
+		}
+	}
+	AppendBigEndianCpu(idat, (adlerB << 16) | adlerA);
+
+	vector<u8> ihdr = { 'I', 'H', 'D', 'R' };
+	AppendBigEndianCpu(ihdr, width);
+	AppendBigEndianCpu(ihdr, height);
+	ihdr.insert(ihdr.end(), { 8, 2, 0, 0, 0 }); // 8 bit RGB, deflate, no filter method, no interlace
+	vector<u8> iend = { 'I', 'E', 'N', 'D' };
+
+	fstream file;
+	file.open(filePathName, ios::out | ios::binary | ios::trunc);
+	if (!file.is_open())
+		return false;
+	const u8 signature[] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+	file.write((const char*)signature, sizeof(signature));
+	for (const vector<u8>* chunk : { &ihdr, &idat, &iend })
+	{
+		vector<u8> header;
+		AppendBigEndianCpu(header, (u32)chunk->size() - 4); // the chunk type is not part of the length
+		vector<u8> footer;
+		AppendBigEndianCpu(footer, Crc32Cpu(chunk->data(), chunk->size()));
+		file.write((const char*)header.data(), header.size());
+		file.write((const char*)chunk->data(), chunk->size());
+		file.write((const char*)footer.data(), footer.size());
+	}
+	return !file.fail();
+}
+
+// image.pfm becomes image.png
+inline string ReplaceExtensionCpu(const string& filePathName, const string& extension)
+{
+	const size_t dot = filePathName.rfind('.');
+	const size_t slash = filePathName.find_last_of("/\\");
+	return dot == string::npos || (slash != string::npos && dot < slash) ? filePathName + extension : filePathName.substr(0, dot) + extension;
+}
+
+// only reads what WriteImagePfmCpu writes, 3 little endian floats per pixel
+inline bool ReadImagePfmCpu(const string& filePathName, u32 width, u32 height, vector<XMFLOAT3>& pixels)
+{
+	fstream file;
+	file.open(filePathName, ios::in | ios::binary);
+	if (!file.is_open())
+		return false;
+	string format;
+	u32 fileWidth = 0;
+	u32 fileHeight = 0;
+	float scale = 0.0f;
+	file >> format >> fileWidth >> fileHeight >> scale;
+	file.get(); // single whitespace before the pixels
+	if (format != "PF" || fileWidth != width || fileHeight != height || scale >= 0.0f)
+		return false;
+	pixels.resize(width * height);
+	for (i64 y = (i64)height - 1; y >= 0; y--)
+		file.read((char*)&pixels[y * width], sizeof(XMFLOAT3) * width);
+	return !file.fail();
+}
+
+// tiles of the CPU reference are dealt out as one deque per thread, owners pop from the front and idle threads steal from the back of others
+struct TileQueueCpu
+{
+	mutex mMutex;
+	deque<u32> mTiles;
+};
+
+struct TileThreadStatsCpu
+{
+	float mBusyMilliseconds;
+	u32 mTileCount;
+	u32 mStolenTileCount;
+};
+
+class TileSchedulerCpu
+{
+public:
+	static const u32 sHistogramBucketCount = 24; // bucket i counts tiles that took [2^i, 2^(i+1)) microseconds
+
+	TileSchedulerCpu(u32 width, u32 height, u32 tileSize, u32 threadCount) :
+		mWidth(width),
+		mHeight(height),
+		mTileSize(tileSize),
+		mTileCountX(ROUNDUP_DIVISION(width, tileSize)),
+		mTileCountY(ROUNDUP_DIVISION(height, tileSize)),
+		mThreadCount(threadCount),
+		mWallMilliseconds(0.0f),
+		mPassCount(0),
+		mTileCost(mTileCountX * mTileCountY, 0.0f),
+		mQueues(threadCount),
+		mThreadStats(threadCount, TileThreadStatsCpu{}),
+		mHistogram(sHistogramBucketCount, 0)
+	{
+	}
+
+	u32 GetTileCount() const { return mTileCountX * mTileCountY; }
+
+	void GetTileRect(u32 tileIndex, u32& x0, u32& y0, u32& x1, u32& y1) const
+	{
+		x0 = (tileIndex % mTileCountX) * mTileSize;
+		y0 = (tileIndex / mTileCountX) * mTileSize;
+		x1 = MIN(x0 + mTileSize, mWidth);
+		y1 = MIN(y0 + mTileSize, mHeight);
+	}
+
+	// renders every tile once, renderTile(tileIndex, threadIndex) must only touch the pixels of its tile
+	template<typename Functor>
+	void Run(Functor renderTile)
+	{
+		Partition();
+		CpuTimer timer;
+		ThreadPool::ParallelFor(mThreadCount, 1, [&](i64 begin, i64 end, u32 threadIndex)
+		{
+			TileThreadStatsCpu& stats = mThreadStats[threadIndex];
+			u32 tileIndex;
+			bool stolen;
+			while (PopTile(threadIndex, tileIndex, stolen))
+			{
+				CpuTimer tileTimer;
+				renderTile(tileIndex, threadIndex);
+				const float tileMilliseconds = tileTimer.GetMilliseconds();
+				mTileCost[tileIndex] = tileMilliseconds;
+				stats.mBusyMilliseconds += tileMilliseconds;
+				stats.mTileCount++;
+				if (stolen)
+					stats.mStolenTileCount++;
+			}
+		});
+		mWallMilliseconds += timer.GetMilliseconds();
+		mPassCount++;
+		for (float cost : mTileCost)
+		{
+			const u32 microseconds = (u32)(cost * 1000.0f);
+			u32 bucket = 0;
+			while (bucket + 1 < sHistogramBucketCount && (microseconds >> (bucket + 1)) > 0)
+				bucket++;
+			mHistogram[bucket]++;
+		}
+	}
+
+	void PrintStats() const
+	{
+		// utilization is the time a thread spent inside tiles over the wall time of all passes
+		float busyMax = 0.0f;
+		float busySum = 0.0f;
+		for (u32 i = 0; i < mThreadCount; i++)
+		{
+			const TileThreadStatsCpu& stats = mThreadStats[i];
+			printf("thread %u: %u tiles, %u stolen, utilization %f\n", i, stats.mTileCount, stats.mStolenTileCount, stats.mBusyMilliseconds / mWallMilliseconds);
+			busyMax = MAX(busyMax, stats.mBusyMilliseconds);
+			busySum += stats.mBusyMilliseconds;
+		}
+		printf("%u passes of %ux%u tiles of %u pixels, load imbalance (max/mean busy time) = %f\n", mPassCount, mTileCountX, mTileCountY, mTileSize, busyMax * mThreadCount / busySum);
+		u32 histogramMax = 0;
+		for (u32 count : mHistogram)
+			histogramMax = MAX(histogramMax, count);
+		printf("tile time histogram:\n");
+		for (u32 i = 0; i < sHistogramBucketCount; i++)
+		{
+			if (mHistogram[i] == 0)
+				continue;
+			const string bar((size_t)ROUNDUP_DIVISION(mHistogram[i] * 40, histogramMax), '#');
+			printf("%8u - %8u us: %8u %s\n", i == 0 ? 0 : 1 << i, 1 << (i + 1), mHistogram[i], bar.c_str());
+		}
+	}
+
+private:
+	u32 mWidth;
+	u32 mHeight;
+	u32 mTileSize;
+	u32 mTileCountX;
+	u32 mTileCountY;
+	u32 mThreadCount;
+	float mWallMilliseconds;
+	u32 mPassCount;
+	vector<float> mTileCost; // milliseconds each tile took in the last pass
+	vector<TileQueueCpu> mQueues;
+	vector<TileThreadStatsCpu> mThreadStats;
+	vector<u32> mHistogram;
+
+	void Partition()
+	{
+		// split the tiles in scanline order into one contiguous run per thread of roughly equal cost from the last pass,
+		// the first pass has no cost yet and splits by tile count
+		const u32 tileCount = GetTileCount();
+		float costSum = 0.0f;
+		for (float cost : mTileCost)
+			costSum += cost;
+		const bool hasCost = costSum > 0.0f;
+		if (!hasCost)
+			costSum = (float)tileCount;
+		u32 threadIndex = 0;
+		float costPrefix = 0.0f;
+		for (u32 i = 0; i < tileCount; i++)
+		{
+			const float cost = hasCost ? mTileCost[i] : 1.0f;
+			// a tile goes to the thread whose share contains the middle of the tile
+			while (threadIndex + 1 < mThreadCount && costPrefix + cost * 0.5f >= costSum * (threadIndex + 1) / mThreadCount)
+				threadIndex++;
+			mQueues[threadIndex].mTiles.push_back(i);
+			costPrefix += cost;
+		}
+	}
+
+	bool PopTile(u32 threadIndex, u32& tileIndex, bool& stolen)
+	{
+		// tiles are only added in Partition, so finding every queue empty once means the pass is done for this thread
+		for (u32 i = 0; i < mThreadCount; i++)
+		{
+			TileQueueCpu& queue = mQueues[(threadIndex + i) % mThreadCount];
+			lock_guard<mutex> lock(queue.mMutex);
+			if (queue.mTiles.empty())
+				continue;
+			stolen = i > 0;
+			if (stolen)
+			{
+				tileIndex = queue.mTiles.back();
+				queue.mTiles.pop_back();
+			}
+			else
+			{
+				tileIndex = queue.mTiles.front();
+				queue.mTiles.pop_front();
+			}
+			return true;
+		}
+		return false;
+	}
+};
+
+struct CameraCpu
+{
+	XMFLOAT4X4 mProjInv;
+	XMFLOAT4X4 mViewInv;
+	XMFLOAT3 mEyePos;
+	float mNearClipPlane;
+};
+
+// camera rays are generated exactly like the compute shader does
+inline XMVECTOR GenerateCameraRayCpu(const CameraCpu& camera, u32 x, u32 y, PathSamplerCpu& sampler)
+{
+	const XMFLOAT2 jitter = sampler.Get2D(PT_SAMPLE_DIMENSION_LENS);
+	const XMVECTOR ndcNearPos = XMVectorSet((x + jitter.x) / PT_BACKBUFFER_WIDTH * 2.0f - 1.0f, (y + jitter.y) / PT_BACKBUFFER_HEIGHT * -2.0f + 1.0f, REVERSED_Z_SWITCH(0.0f, 1.0f), 1.0f);
+	XMVECTOR viewNearPos = XMVector4Transform(ndcNearPos * camera.mNearClipPlane, XMLoadFloat4x4(&camera.mProjInv));
+	viewNearPos /= XMVectorSplatW(viewNearPos);
+	const XMVECTOR viewDir = XMVector3Normalize(XMVectorSetW(viewNearPos, 0.0f));
+	return XMVector3Normalize(TransformDirCpu(viewDir, camera.mViewInv));
+}
+
+// the queues of the wavefront path tracer hold one array per field like the float4 buffers of PathTracerWavefrontResourceUtil.hlsli,
+// a chunk of a stage stages its appends locally and reserves room for all of them with one atomic add
+struct WavefrontRayQueueCpu
+{
+	struct Entry
+	{
+		u32 mPathIndex;
+		XMFLOAT3 mOri;
+		XMFLOAT3 mDir;
+	};
+
+	vector<u32> mPathIndex;
+	vector<XMFLOAT3> mOri;
+	vector<XMFLOAT3> mDir;
+	atomic<u32> mCount;
+
+	void Resize(u32 capacity)
+	{
+		mPathIndex.resize(capacity);
+		mOri.resize(capacity);
+		mDir.resize(capacity);
+		mCount = 0;
+	}
+
+	void Set(u32 entryIndex, const Entry& entry)
+	{
+		mPathIndex[entryIndex] = entry.mPathIndex;
+		mOri[entryIndex] = entry.mOri;
+		mDir[entryIndex] = entry.mDir;
+	}
+
+	void Append(const vector<Entry>& entries)
+	{
+		const u32 first = mCount.fetch_add((u32)entries.size());
+		for (u32 i = 0; i < entries.size(); i++)
+			Set(first + i, entries[i]);
+	}
+};
+
+struct WavefrontHitQueueCpu
+{
+	struct Entry
+	{
+		u32 mPathIndex;
+		u32 mTriangleIndex;
+		u32 mMeshIndex;
+		u32 mLightIndex;
+		IntersectionTypeCpu mType;
+		XMFLOAT3 mPointWorld;
+		XMFLOAT3 mPointModel;
+		XMFLOAT3 mDir;
+	};
+
+	vector<u32> mPathIndex;
+	vector<u32> mTriangleIndex;
+	vector<u32> mMeshIndex;
+	vector<u32> mLightIndex;
+	vector<IntersectionTypeCpu> mType;
+	vector<XMFLOAT3> mPointWorld;
+	vector<XMFLOAT3> mPointModel;
+	vector<XMFLOAT3> mDir;
+	atomic<u32> mCount;
+
+	void Resize(u32 capacity)
+	{
+		mPathIndex.resize(capacity);
+		mTriangleIndex.resize(capacity);
+		mMeshIndex.resize(capacity);
+		mLightIndex.resize(capacity);
+		mType.resize(capacity);
+		mPointWorld.resize(capacity);
+		mPointModel.resize(capacity);
+		mDir.resize(capacity);
+		mCount = 0;
+	}
+
+	void Append(const vector<Entry>& entries)
+	{
+		const u32 first = mCount.fetch_add((u32)entries.size());
+		for (u32 i = 0; i < entries.size(); i++)
+		{
+			const Entry& entry = entries[i];
+			mPathIndex[first + i] = entry.mPathIndex;
+			mTriangleIndex[first + i] = entry.mTriangleIndex;
+			mMeshIndex[first + i] = entry.mMeshIndex;
+			mLightIndex[first + i] = entry.mLightIndex;
+			mType[first + i] = entry.mType;
+			mPointWorld[first + i] = entry.mPointWorld;
+			mPointModel[first + i] = entry.mPointModel;
+			mDir[first + i] = entry.mDir;
+		}
+	}
+
+	IntersectionCpu GetIntersection(u32 entryIndex) const
+	{
+		IntersectionCpu it = {};
+		it.mType = mType[entryIndex];
+		it.mTriangleIndex = mTriangleIndex[entryIndex];
+		it.mMeshIndex = mMeshIndex[entryIndex];
+		it.mLightIndex = mLightIndex[entryIndex];
+		it.mPointWorld = XMLoadFloat3(&mPointWorld[entryIndex]);
+		it.mPointModel = XMLoadFloat3(&mPointModel[entryIndex]);
+		return it;
+	}
+};
+
+struct WavefrontShadowQueueCpu
+{
+	struct Entry
+	{
+		u32 mPathIndex;
+		u32 mLightIndex;
+		XMFLOAT3 mOri;
+		XMFLOAT3 mDir;
+		XMFLOAT3 mContribution;
+		float mMaterialPdf; // 0 for light samples, their contribution only needs the visibility test
+	};
+
+	vector<u32> mPathIndex;
+	vector<u32> mLightIndex;
+	vector<XMFLOAT3> mOri;
+	vector<XMFLOAT3> mDir;
+	vector<XMFLOAT3> mContribution;
+	vector<float> mMaterialPdf;
+	atomic<u32> mCount;
+
+	void Resize(u32 capacity)
+	{
+		mPathIndex.resize(capacity);
+		mLightIndex.resize(capacity);
+		mOri.resize(capacity);
+		mDir.resize(capacity);
+		mContribution.resize(capacity);
+		mMaterialPdf.resize(capacity);
+		mCount = 0;
+	}
+
+	void Append(const vector<Entry>& entries)
+	{
+		const u32 first = mCount.fetch_add((u32)entries.size());
+		for (u32 i = 0; i < entries.size(); i++)
+		{
+			const Entry& entry = entries[i];
+			mPathIndex[first + i] = entry.mPathIndex;
+			mLightIndex[first + i] = entry.mLightIndex;
+			mOri[first + i] = entry.mOri;
+			mDir[first + i] = entry.mDir;
+			mContribution[first + i] = entry.mContribution;
+			mMaterialPdf[first + i] = entry.mMaterialPdf;
+		}
+	}
+};
+
+inline u32 CountBits64(u64 bits)
+{
+	u32 count = 0;
+	for (; bits; bits &= bits - 1)
+		count++;
+	return count;
+}
+
+enum WavefrontStageCpu : u8
+{
+	WavefrontStageGenerate,
+	WavefrontStageExtend,
+	WavefrontStageSort,
+	WavefrontStageShade,
+	WavefrontStageConnect,
+	WavefrontStageAccumulate,
+	WavefrontStageCount
+};
+
+// CPU version of PathTracer::RunPathTracerWavefront, same stages in the same order with one ParallelFor per stage,
+// the queue counters are read back after every stage so only bounces with rays left are run
+class WavefrontCpu
+{
+public:
+	static const i64 sGrainSize = 1024;
+
+	WavefrontCpu(const ReferenceSceneCpu& scene, const CameraCpu& camera, u32 width, u32 height) :
+		mScene(scene),
+		mCamera(camera),
+		mWidth(width),
+		mHeight(height),
+		mPathCount(width * height),
+		mSampleCount(0),
+		mStageMilliseconds(WavefrontStageCount, 0.0f),
+		mQueueSizeSums(PT_WAVEFRONT_QUEUE_COUNTER_COUNT, 0),
+		mWarpCount(0),
+		mWarpMaterialCountSum(0),
+		mWarpMaterialCountSumSorted(0)
+	{
+		mThroughput.resize(mPathCount);
+		mRadiance.resize(mPathCount);
+		mLightSampleRadiance.resize(mPathCount);
+		mMaterialSampleRadiance.resize(mPathCount);
+		mSeed.resize(mPathCount);
+		mIsLastBounceSpecular.resize(mPathCount);
+		mHitOrder.resize(mPathCount);
+		mRays.Resize(mPathCount);
+		mHits.Resize(mPathCount);
+		mShadowRays.Resize(mPathCount * PT_WAVEFRONT_SHADOW_RAY_PER_PATH);
+	}
+
+	// one sample of every pixel, the radiance of each path is added to its pixel
+	void RenderSample(u32 sampleIndex, vector<XMFLOAT3>& pixels, vector<u64>& rayCounts)
+	{
+		const u32 maxDepth = MIN(mScene.mSceneUniform->mPathTracerMaxDepth, (u32)PT_MAXDEPTH_MAX);
+		RunStage(WavefrontStageGenerate, [&]() { Generate(sampleIndex); });
+		for (u32 i = 0; i < maxDepth && mRays.mCount > 0; i++)
+		{
+			mQueueSizeSums[PT_WAVEFRONT_QUEUE_RAY * PT_MAXDEPTH_MAX + i] += mRays.mCount;
+			RunStage(WavefrontStageExtend, [&]() { Extend(rayCounts); });
+			mQueueSizeSums[PT_WAVEFRONT_QUEUE_HIT * PT_MAXDEPTH_MAX + i] += mHits.mCount;
+			if (mScene.mSceneUniform->mPathTracerWavefrontSortByMaterial)
+			{
+				RunStage(WavefrontStageSort, [&]() { Sort(); });
+				CountWarpMaterials();
+			}
+			RunStage(WavefrontStageShade, [&]() { Shade(sampleIndex, i); });
+			mQueueSizeSums[PT_WAVEFRONT_QUEUE_SHADOW * PT_MAXDEPTH_MAX + i] += mShadowRays.mCount;
+			RunStage(WavefrontStageConnect, [&]() { Connect(rayCounts); });
+		}
+		RunStage(WavefrontStageAccumulate, [&]() { Accumulate(pixels); });
+		mSampleCount++;
+	}
+
+	void PrintStats() const
+	{
+		static const char* stageNames[WavefrontStageCount] = { "generate", "extend", "sort", "shade", "connect", "accumulate" };
+		float totalMilliseconds = 0.0f;
+		for (float milliseconds : mStageMilliseconds)
+			totalMilliseconds += milliseconds;
+		printf("wavefront stages over %u samples:\n", mSampleCount);
+		for (u32 i = 0; i < WavefrontStageCount; i++)
+			printf("%-10s %10f ms, %f ms per sample, %f of the total\n", stageNames[i], mStageMilliseconds[i], mStageMilliseconds[i] / mSampleCount, mStageMilliseconds[i] / totalMilliseconds);
+		printf("average queue sizes per sample, as a fraction of the path count in parentheses:\n");
+		printf("%6s %20s %20s %20s\n", "bounce", "ray", "hit", "shadow");
+		for (u32 i = 0; i < PT_MAXDEPTH_MAX; i++)
+		{
+			const u64 raySum = mQueueSizeSums[PT_WAVEFRONT_QUEUE_RAY * PT_MAXDEPTH_MAX + i];
+			const u64 hitSum = mQueueSizeSums[PT_WAVEFRONT_QUEUE_HIT * PT_MAXDEPTH_MAX + i];
+			const u64 shadowSum = mQueueSizeSums[PT_WAVEFRONT_QUEUE_SHADOW * PT_MAXDEPTH_MAX + i];
+			if (raySum == 0)
+				break;
+			const double pathSum = (double)mPathCount * mSampleCount;
+			printf("%6u %10llu (%.3f) %10llu (%.3f) %10llu (%.3f)\n", i,
+				raySum / mSampleCount, raySum / pathSum,
+				hitSum / mSampleCount, hitSum / pathSum,
+				shadowSum / mSampleCount, shadowSum / pathSum);
+		}
+		if (mWarpCount > 0)
+			printf("distinct materials per %u hits shaded together, %f in queue order, %f in material order\n", WarpSize, (double)mWarpMaterialCountSum / mWarpCount, (double)mWarpMaterialCountSumSorted / mWarpCount);
+	}
+
+private:
+	const ReferenceSceneCpu& mScene;
+	CameraCpu mCamera;
+	u32 mWidth;
+	u32 mHeight;
+	u32 mPathCount;
+	u32 mSampleCount;
+	vector<float> mStageMilliseconds; // summed over all bounces and samples
+	vector<u64> mQueueSizeSums; // queue * PT_MAXDEPTH_MAX + bounce, summed over all samples
+	static const u32 WarpSize = 32;
+	u64 mWarpCount;
+	u64 mWarpMaterialCountSum; // distinct materials of each group of WarpSize hits, summed over all bounces and samples
+	u64 mWarpMaterialCountSumSorted;
+	// paths, indexed by pixel
+	vector<XMFLOAT3> mThroughput;
+	vector<XMFLOAT3> mRadiance;
+	vector<XMFLOAT3> mLightSampleRadiance; // written by connect only
+	vector<XMFLOAT3> mMaterialSampleRadiance; // written by connect only
+	vector<u32> mSeed;
+	vector<u8> mIsLastBounceSpecular;
+	vector<u32> mHitOrder; // hit queue entries in material order, written by sort
+	// stages of a bounce run one after another, so each queue is emptied by the stage that consumes it before it is refilled
+	WavefrontRayQueueCpu mRays;
+	WavefrontHitQueueCpu mHits;
+	WavefrontShadowQueueCpu mShadowRays;
+
+	template<typename Functor>
+	void RunStage(WavefrontStageCpu stage, Functor functor)
+	{
+		CpuTimer timer;
+		functor();
+		mStageMilliseconds[stage] += timer.GetMilliseconds();
+	}
+
+	void Generate(u32 sampleIndex)
+	{
+		// every path starts with a camera ray, so the ray queue is filled in path order without atomics
+		ThreadPool::ParallelFor(mPathCount, sGrainSize, [&](i64 begin, i64 end, u32 threadIndex)
+		{
+			WavefrontRayQueueCpu::Entry ray;
+			XMStoreFloat3(&ray.mOri, XMLoadFloat3(&mCamera.mEyePos));
+			for (i64 i = begin; i < end; i++)
+			{
+				const u32 pathIndex = (u32)i;
+				PathSamplerCpu sampler(*mScene.mSceneUniform, pathIndex % mWidth, pathIndex / mWidth, sampleIndex);
+				XMStoreFloat3(&ray.mDir, GenerateCameraRayCpu(mCamera, pathIndex % mWidth, pathIndex / mWidth, sampler));
+				ray.mPathIndex = pathIndex;
+				mRays.Set(pathIndex, ray);
+				mThroughput[pathIndex] = XMFLOAT3(1.0f, 1.0f, 1.0f);
+				mRadiance[pathIndex] = XMFLOAT3(0.0f, 0.0f, 0.0f);
+				mLightSampleRadiance[pathIndex] = XMFLOAT3(0.0f, 0.0f, 0.0f);
+				mMaterialSampleRadiance[pathIndex] = XMFLOAT3(0.0f, 0.0f, 0.0f);
+				mSeed[pathIndex] = sampler.GetRandomState();
+				mIsLastBounceSpecular[pathIndex] = false;
+			}
+		});
+		mRays.mCount = mPathCount;
+	}
+
+	void Extend(vector<u64>& rayCounts)
+	{
+		mHits.mCount = 0;
+		ThreadPool::ParallelFor(mRays.mCount, sGrainSize, [&](i64 begin, i64 end, u32 threadIndex)
+		{
+			vector<WavefrontHitQueueCpu::Entry> hits;
+			hits.reserve(end - begin);
+			u64 rayCount = 0;
+			for (i64 i = begin; i < end; i++)
+			{
+				IntersectionCpu it = {};
+				if (!IntersectCpu(mScene, it, XMLoadFloat3(&mRays.mOri[i]), XMLoadFloat3(&mRays.mDir[i]), rayCount))
+					continue;
+				WavefrontHitQueueCpu::Entry hit;
+				hit.mPathIndex = mRays.mPathIndex[i];
+				hit.mTriangleIndex = it.mTriangleIndex;
+				hit.mMeshIndex = it.mMeshIndex;
+				hit.mLightIndex = it.mLightIndex;
+				hit.mType = it.mType;
+				XMStoreFloat3(&hit.mPointWorld, it.mPointWorld);
+				XMStoreFloat3(&hit.mPointModel, it.mPointModel);
+				hit.mDir = mRays.mDir[i];
+				hits.push_back(hit);
+			}
+			mHits.Append(hits);
+			rayCounts[threadIndex] += rayCount;
+		});
+	}
+
+	u32 GetMaterialBucket(u32 entryIndex) const
+	{
+		if (mHits.mType[entryIndex] == IntersectionTypeLight)
+			return PT_MATERIAL_COUNT_MAX;
+		return PathTracer::sMeshes[mHits.mMeshIndex[entryIndex]].mMaterialIndex;
+	}
+
+	// counting sort of the hits by material like cs_pathtracer_wavefront_sort, serial and stable since it's a single pass over the queue
+	void Sort()
+	{
+		u32 offsets[PT_WAVEFRONT_MATERIAL_BUCKET_COUNT] = {};
+		for (u32 i = 0; i < mHits.mCount; i++)
+			offsets[GetMaterialBucket(i)]++;
+		u32 offset = 0;
+		for (u32 i = 0; i < PT_WAVEFRONT_MATERIAL_BUCKET_COUNT; i++)
+		{
+			const u32 count = offsets[i];
+			offsets[i] = offset;
+			offset += count;
+		}
+		for (u32 i = 0; i < mHits.mCount; i++)
+			mHitOrder[offsets[GetMaterialBucket(i)]++] = i;
+	}
+
+	// how many material branches a GPU warp would run in shade, before and after sorting
+	void CountWarpMaterials()
+	{
+		for (u32 i = 0; i < mHits.mCount; i += WarpSize)
+		{
+			u64 buckets = 0;
+			u64 bucketsSorted = 0;
+			for (u32 j = i; j < MIN(i + WarpSize, (u32)mHits.mCount); j++)
+			{
+				buckets |= 1ull << GetMaterialBucket(j);
+				bucketsSorted |= 1ull << GetMaterialBucket(mHitOrder[j]);
+			}
+			mWarpMaterialCountSum += CountBits64(buckets);
+			mWarpMaterialCountSumSorted += CountBits64(bucketsSorted);
+			mWarpCount++;
+		}
+	}
+
+	// PathTraceCpu after the closest hit, light and material samples go to the shadow queue instead of being traced here
+	void Shade(u32 sampleIndex, u32 bounceIndex)
+	{
+		const SceneUniform& uScene = *mScene.mSceneUniform;
+		const u32 minDepth = uScene.mPathTracerMinDepth;
+		const u32 maxDepth = uScene.mPathTracerMaxDepth;
+		const u32 remainingDepth = maxDepth - 1 - bounceIndex;
+		mRays.mCount = 0;
+		mShadowRays.mCount = 0;
+		ThreadPool::ParallelFor(mHits.mCount, sGrainSize, [&](i64 begin, i64 end, u32 threadIndex)
+		{
+			vector<WavefrontRayQueueCpu::Entry> rays;
+			vector<WavefrontShadowQueueCpu::Entry> shadowRays;
+			rays.reserve(end - begin);
+			shadowRays.reserve((end - begin) * PT_WAVEFRONT_SHADOW_RAY_PER_PATH);
+			for (i64 i = begin; i < end; i++)
+			{
+				const u32 entryIndex = uScene.mPathTracerWavefrontSortByMaterial ? mHitOrder[i] : (u32)i; // neighbouring iterations shade the same material
+				const u32 pathIndex = mHits.mPathIndex[entryIndex];
+				const IntersectionCpu it = mHits.GetIntersection(entryIndex);
+				const XMVECTOR wo = -XMLoadFloat3(&mHits.mDir[entryIndex]);
+				XMVECTOR throughput = XMLoadFloat3(&mThroughput[pathIndex]);
+				XMVECTOR radiance = XMLoadFloat3(&mRadiance[pathIndex]);
+				PathSamplerCpu sampler(uScene, pathIndex % mWidth, pathIndex / mWidth, sampleIndex);
+				sampler.SetRandomState(mSeed[pathIndex]);
+				bool isLastBounceSpecular = mIsLastBounceSpecular[pathIndex] != 0;
+
+				SurfaceCpu sd = {};
+				EvaluateSurfaceCpu(mScene, sd, it);
+
+				// no need to include light source except for first bounce or specular bounce,
+				// because both direct and indirect light bounces are covered explicitly
+				if (bounceIndex == 0 || isLastBounceSpecular)
+					radiance += throughput * sd.mEmissive;
+
+				// terminate on lights, emissive meshes included
+				if (it.mType != IntersectionTypeLight && sd.mMaterialType != MATERIAL_TYPE_EMISSIVE)
+				{
+					WavefrontShadowQueueCpu::Entry shadowRay;
+					shadowRay.mPathIndex = pathIndex;
+					XMStoreFloat3(&shadowRay.mOri, it.mPointWorld);
+
+					// 2. sample light
+					float lightPdf = 1.0f;
+					const XMFLOAT2 lightXi = sampler.Get2D(PathSamplerCpu::GetBounceDimension(bounceIndex, PT_SAMPLE_DIMENSION_LIGHT));
+					float lightSelectionPdf = 0.0f;
+					const u32 lightIndex = SampleLightIndexCpu(uScene, it.mPointWorld, sd.mNorWorld, sampler.Get1D(PathSamplerCpu::GetBounceDimension(bounceIndex, PT_SAMPLE_DIMENSION_LIGHT_SELECTION)), lightSelectionPdf);
+					shadowRay.mLightIndex = lightIndex;
+					if (lightIndex != INVALID_UINT32)
+					{
+						XMVECTOR lightWi = XMVectorZero();
+						XMVECTOR lightSamplePoint = XMVectorZero();
+						const XMVECTOR lightCol = SampleLightCpu(it.mPointWorld, lightXi, lightIndex, lightSamplePoint, lightWi, lightPdf);
+						if (IsNotBlackCpu(lightCol))
+						{
+							float lightMaterialPdf = 1.0f;
+							const XMVECTOR lightMaterialCol = EvaluateMaterialCpu(sd, wo, lightWi, lightMaterialPdf);
+							if (IsNotBlackCpu(lightMaterialCol) && lightMaterialPdf > 0.0f)
+							{
+								const float weight = lightPdf > 0.0f ? PowerHeuristicCpu(1, lightPdf, 1, lightMaterialPdf) / lightPdf : 1.0f; // 1 for delta lights
+								XMStoreFloat3(&shadowRay.mDir, lightSamplePoint - it.mPointWorld); // ends at the sampled point, same as the shader
+								XMStoreFloat3(&shadowRay.mContribution, lightCol * lightMaterialCol * throughput * (weight / lightSelectionPdf));
+								shadowRay.mMaterialPdf = 0.0f;
+								shadowRays.push_back(shadowRay);
+							}
+						}
+					}
+
+					// 3. sample material, connect evaluates the light once the point on it is known
+					// delta materials pick up the light on the next bounce
+					if (lightPdf > 0.0f && !IsSpecularMaterialCpu(sd.mMaterialType))
+					{
+						float materialPdf = 1.0f;
+						XMVECTOR materialWi = XMVectorZero();
+						const XMFLOAT2 materialXi = sampler.Get2D(PathSamplerCpu::GetBounceDimension(bounceIndex, PT_SAMPLE_DIMENSION_MATERIAL));
+						const XMVECTOR materialCol = SampleMaterialCpu(sd, materialXi, wo, materialWi, materialPdf);
+						if (lightIndex != INVALID_UINT32 && IsNotBlackCpu(materialCol) && materialPdf > 0.0f)
+						{
+							XMStoreFloat3(&shadowRay.mDir, materialWi);
+							XMStoreFloat3(&shadowRay.mContribution, materialCol * throughput / lightSelectionPdf);
+							shadowRay.mMaterialPdf = materialPdf;
+							shadowRays.push_back(shadowRay);
+						}
+					}
+
+					// 5. GI
+					float giPdf = 0.0f;
+					XMVECTOR giWi = XMVectorZero();
+					const XMFLOAT2 giXi = sampler.Get2D(PathSamplerCpu::GetBounceDimension(bounceIndex, PT_SAMPLE_DIMENSION_BSDF));
+					const XMVECTOR giColor = SampleMaterialCpu(sd, giXi, wo, giWi, giPdf);
+					bool spawnRay = IsNotBlackCpu(giColor) && giPdf > 0.0f;
+					if (spawnRay)
+					{
+						isLastBounceSpecular = IsSpecularMaterialCpu(sd.mMaterialType);
+						throughput *= giColor / giPdf;
+
+						// II. russian roulette
+						if (uScene.mPathTracerEnableRussianRoulette && remainingDepth <= maxDepth - minDepth)
+						{
+							const float survival = MIN(MAX(MAX(XMVectorGetX(throughput), XMVectorGetY(throughput)), XMVectorGetZ(throughput)), 1.0f);
+							if (survival <= sampler.Get1D(PathSamplerCpu::GetBounceDimension(bounceIndex, PT_SAMPLE_DIMENSION_RUSSIAN_ROULETTE)))
+								spawnRay = false;
+							else
+								throughput /= survival;
+						}
+					}
+
+					// 6. spawn new ray
+					if (spawnRay && remainingDepth > 0)
+					{
+						WavefrontRayQueueCpu::Entry ray;
+						ray.mPathIndex = pathIndex;
+						XMStoreFloat3(&ray.mOri, it.mPointWorld);
+						XMStoreFloat3(&ray.mDir, giWi);
+						rays.push_back(ray);
+					}
+				}
+
+				XMStoreFloat3(&mThroughput[pathIndex], throughput);
+				XMStoreFloat3(&mRadiance[pathIndex], radiance);
+				mSeed[pathIndex] = sampler.GetRandomState();
+				mIsLastBounceSpecular[pathIndex] = isLastBounceSpecular;
+			}
+			mRays.Append(rays);
+			mShadowRays.Append(shadowRays);
+		});
+	}
+
+	void Connect(vector<u64>& rayCounts)
+	{
+		// a path has at most one light sample and one material sample per bounce and they add to different arrays, so no atomics are needed
+		ThreadPool::ParallelFor(mShadowRays.mCount, sGrainSize, [&](i64 begin, i64 end, u32 threadIndex)
+		{
+			u64 rayCount = 0;
+			for (i64 i = begin; i < end; i++)
+			{
+				const u32 pathIndex = mShadowRays.mPathIndex[i];
+				const u32 lightIndex = mShadowRays.mLightIndex[i];
+				const XMVECTOR ori = XMLoadFloat3(&mShadowRays.mOri[i]);
+				const float materialPdf = mShadowRays.mMaterialPdf[i];
+				XMVECTOR contribution = XMLoadFloat3(&mShadowRays.mContribution[i]);
+				const XMVECTOR dir = XMLoadFloat3(&mShadowRays.mDir[i]);
+				XMVECTOR lightPoint = XMVectorZero();
+				XMVECTOR lightNor = XMVectorZero();
+				if (materialPdf > 0.0f) // material sample
+				{
+					if (!IsLightVisibleCpu(mScene, lightIndex, ori, dir, lightPoint, lightNor, rayCount))
+						continue;
+					XMVECTOR materialLightWi;
+					float materialLightPdf = 1.0f;
+					const XMVECTOR materialLightCol = EvaluateLightCpu(ori, lightPoint, lightNor, lightIndex, materialLightWi, materialLightPdf);
+					// no delta light when sampling material
+					if (materialLightPdf <= 0.0f)
+						continue;
+					contribution *= materialLightCol * (PowerHeuristicCpu(1, materialPdf, 1, materialLightPdf) / materialPdf);
+					XMStoreFloat3(&mMaterialSampleRadiance[pathIndex], XMLoadFloat3(&mMaterialSampleRadiance[pathIndex]) + contribution);
+				}
+				else if (IsLightSampleVisibleCpu(mScene, lightIndex, ori, ori + dir, lightPoint, rayCount)) // light sample, dir ends at the sampled point
+					XMStoreFloat3(&mLightSampleRadiance[pathIndex], XMLoadFloat3(&mLightSampleRadiance[pathIndex]) + contribution);
+			}
+			rayCounts[threadIndex] += rayCount;
+		});
+	}
+
+	void Accumulate(vector<XMFLOAT3>& pixels)
+	{
+		ThreadPool::ParallelFor(mPathCount, sGrainSize, [&](i64 begin, i64 end, u32 threadIndex)
+		{
+			for (i64 i = begin; i < end; i++)
+			{
+				const XMVECTOR radiance = XMLoadFloat3(&mRadiance[i]) + XMLoadFloat3(&mLightSampleRadiance[i]) + XMLoadFloat3(&mMaterialSampleRadiance[i]);
+				XMStoreFloat3(&pixels[i], XMLoadFloat3(&pixels[i]) + radiance);
+			}
+		});
+	}
+};
+
+inline u32 GetAdaptiveTileIndexCpu(u32 x, u32 y)
+{
+	return x / PT_ADAPTIVE_TILE_SIZE + (y / PT_ADAPTIVE_TILE_SIZE) * PT_ADAPTIVE_TILE_COUNT_X;
+}
+
+inline float GetPixelRelativeErrorCpu(float sampleCount, float mean, float m2)
+{
+	if (sampleCount < PT_ADAPTIVE_SAMPLE_COUNT_MIN)
+		return 1.0f;
+	const float standardError = sqrtf(m2 / ((sampleCount - 1.0f) * sampleCount));
+	return MIN(standardError / (mean + PT_ADAPTIVE_LUMINANCE_BIAS), 1.0f);
+}
+
+// sample count, mean luminance, Welford M2 and relative error, same as UpdateConvergence of PathTracerAdaptiveUtil.hlsli
+inline XMFLOAT4 UpdateConvergenceCpu(const XMFLOAT4& convergence, FXMVECTOR color)
+{
+	const float luminance = Dot3Cpu(color, XMVectorSet(0.2126f, 0.7152f, 0.0722f, 0.0f));
+	const float sampleCount = convergence.x + 1.0f;
+	const float delta = luminance - convergence.y;
+	const float mean = convergence.y + delta / sampleCount;
+	const float m2 = convergence.z + delta * (luminance - mean);
+	return XMFLOAT4(sampleCount, mean, m2, GetPixelRelativeErrorCpu(sampleCount, mean, m2));
+}
+
+// the accumulation of the GPU adaptive sampling, the backbuffer is a running average over the sample count of each pixel
+// and the error of a tile is the mean relative error of its pixels like cs_pathtracer_adaptive_tile_error.hlsl
+class AdaptiveSamplerCpu
+{
+public:
+	AdaptiveSamplerCpu(const ReferenceSceneCpu& scene, const CameraCpu& camera, u32 width, u32 height, u32 tileSize) :
+		mScene(scene),
+		mCamera(camera),
+		mWidth(width),
+		mHeight(height),
+		mScheduler(width, height, tileSize, ThreadPool::GetThreadCount()),
+		mPixels(width * height, XMFLOAT3(0.0f, 0.0f, 0.0f)),
+		mConvergence(width * height, XMFLOAT4(0.0f, 0.0f, 0.0f, 0.0f)),
+		mTileErrors(PT_ADAPTIVE_TILE_COUNT, 1.0f),
+		mTileActive(PT_ADAPTIVE_TILE_COUNT, 1),
+		mPathCounts(ThreadPool::GetThreadCount(), 0),
+		mSampleCount(0),
+		mActiveTileCountSum(0),
+		mGlobalError(1.0f),
+		mMilliseconds(0.0f)
+	{
+	}
+
+	const vector<XMFLOAT3>& GetPixels() const { return mPixels; }
+	u64 GetPathCount() const
+	{
+		u64 pathCount = 0;
+		for (u64 count : mPathCounts)
+			pathCount += count;
+		return pathCount;
+	}
+	float GetMilliseconds() const { return mMilliseconds; }
+
+	// one sample per pass, tiles below errorThreshold stop taking samples once every pixel has sampleCountMin of them when adaptive is set
+	// returns true if the mean tile error reached targetError within sampleCountMax passes
+	bool Render(bool adaptive, float errorThreshold, u32 sampleCountMin, float targetError, u32 sampleCountMax, vector<u64>& rayCounts)
+	{
+		CpuTimer timer;
+		bool reached = false;
+		for (u32 sampleIndex = 0; sampleIndex < sampleCountMax && !reached; sampleIndex++)
+		{
+			const bool skipConverged = adaptive && sampleIndex >= sampleCountMin;
+			for (u32 i = 0; i < PT_ADAPTIVE_TILE_COUNT; i++)
+			{
+				mTileActive[i] = !skipConverged || mTileErrors[i] >= errorThreshold;
+				mActiveTileCountSum += mTileActive[i];
+			}
+			mScheduler.Run([&](u32 tileIndex, u32 threadIndex)
+			{
+				const XMVECTOR eyePos = XMLoadFloat3(&mCamera.mEyePos);
+				u64 rayCount = 0;
+				u64 pathCount = 0;
+				u32 x0, y0, x1, y1;
+				mScheduler.GetTileRect(tileIndex, x0, y0, x1, y1);
+				for (u32 y = y0; y < y1; y++)
+				{
+					for (u32 x = x0; x < x1; x++)
+					{
+						if (!mTileActive[GetAdaptiveTileIndexCpu(x, y)])
+							continue;
+						PathSamplerCpu sampler(*mScene.mSceneUniform, x, y, sampleIndex);
+						const XMVECTOR viewDirWorld = GenerateCameraRayCpu(mCamera, x, y, sampler);
+						const XMVECTOR color = PathTraceCpu(mScene, sampler, eyePos, viewDirWorld, rayCount);
+						const u32 pixelIndex = x + y * mWidth;
+						XMFLOAT4& convergence = mConvergence[pixelIndex];
+						XMStoreFloat3(&mPixels[pixelIndex], (XMLoadFloat3(&mPixels[pixelIndex]) * convergence.x + color) / (convergence.x + 1.0f));
+						convergence = UpdateConvergenceCpu(convergence, color);
+						pathCount++;
+					}
+				}
+				rayCounts[threadIndex] += rayCount;
+				mPathCounts[threadIndex] += pathCount;
+			});
+			mSampleCount = sampleIndex + 1;
+			UpdateTileErrors();
+			reached = mSampleCount >= sampleCountMin && mGlobalError <= targetError;
+		}
+		mMilliseconds = timer.GetMilliseconds();
+		return reached;
+	}
+
+	void PrintStats(const char* name, float targetError, bool reached) const
+	{
+		if (reached)
+			printf("%s: error %f reached in %f s, %u passes, %llu paths (%f per pixel), %f of the tiles active per pass\n",
+				name, targetError, mMilliseconds / 1000.0f, mSampleCount, GetPathCount(), (float)GetPathCount() / (mWidth * mHeight), (float)mActiveTileCountSum / ((u64)mSampleCount * PT_ADAPTIVE_TILE_COUNT));
+		else
+			printf("%s: error %f not reached, %f after %u passes in %f s, %llu paths (%f per pixel)\n",
+				name, targetError, mGlobalError, mSampleCount, mMilliseconds / 1000.0f, GetPathCount(), (float)GetPathCount() / (mWidth * mHeight));
+	}
+
+private:
+	const ReferenceSceneCpu& mScene;
+	CameraCpu mCamera;
+	u32 mWidth;
+	u32 mHeight;
+	TileSchedulerCpu mScheduler;
+	vector<XMFLOAT3> mPixels;
+	vector<XMFLOAT4> mConvergence; // same layout as gConvergencePT
+	vector<float> mTileErrors;
+	vector<u8> mTileActive;
+	vector<u64> mPathCounts; // per thread
+	u32 mSampleCount;
+	u64 mActiveTileCountSum; // summed over all passes
+	float mGlobalError;
+	float mMilliseconds;
+
+	void UpdateTileErrors()
+	{
+		ThreadPool::ParallelFor(PT_ADAPTIVE_TILE_COUNT, PT_ADAPTIVE_TILE_COUNT_X, [&](i64 begin, i64 end, u32 threadIndex)
+		{
+			for (i64 i = begin; i < end; i++)
+			{
+				const u32 x0 = (i % PT_ADAPTIVE_TILE_COUNT_X) * PT_ADAPTIVE_TILE_SIZE;
+				const u32 y0 = (i / PT_ADAPTIVE_TILE_COUNT_X) * PT_ADAPTIVE_TILE_SIZE;
+				const u32 x1 = MIN(x0 + PT_ADAPTIVE_TILE_SIZE, mWidth);
+				const u32 y1 = MIN(y0 + PT_ADAPTIVE_TILE_SIZE, mHeight);
+				float errorSum = 0.0f;
+				for (u32 y = y0; y < y1; y++)
+					for (u32 x = x0; x < x1; x++)
+						errorSum += mConvergence[x + y * mWidth].w;
+				mTileErrors[i] = errorSum / ((x1 - x0) * (y1 - y0));
+			}
+		});
+		float errorSum = 0.0f;
+		for (float error : mTileErrors)
+			errorSum += error;
+		mGlobalError = errorSum / PT_ADAPTIVE_TILE_COUNT;
+	}
+};
+
+// adaptive sampling to the target error next to uniform sampling to the same error, sampleCountMax caps the passes of both
+// returns false if the image can't be written
+inline bool RenderReferenceAdaptiveCpu(const ReferenceSceneCpu& scene, const CameraCpu& camera, u32 sampleCountMax, const string& filePathName)
+{
+	const SceneUniform& sceneUniform = *scene.mSceneUniform;
+	vector<float> targetErrorArg;
+	const float targetError = PARAM_cpuAdaptive.GetAsFloatVec(targetErrorArg) && targetErrorArg.size() > 0 ? targetErrorArg[0] : sceneUniform.mPathTracerAdaptiveTargetError;
+	const float errorThreshold = MIN(sceneUniform.mPathTracerAdaptiveErrorThreshold, targetError);
+	const u32 sampleCountMin = MAX(sceneUniform.mPathTracerAdaptiveSampleCountMin, (u32)PT_ADAPTIVE_SAMPLE_COUNT_MIN);
+	const u32 tileSize = PARAM_cpuTileSize.GetAsInt() > 0 ? PARAM_cpuTileSize.GetAsInt() : 16;
+	vector<u64> rayCounts(ThreadPool::GetThreadCount(), 0);
+	printf("%ux%u, up to %u spp, %u threads, target error %f, tile error threshold %f, %u samples per pixel before tiles can stop\n",
+		PT_BACKBUFFER_WIDTH, PT_BACKBUFFER_HEIGHT, sampleCountMax, ThreadPool::GetThreadCount(), targetError, errorThreshold, sampleCountMin);
+
+	AdaptiveSamplerCpu uniform(scene, camera, PT_BACKBUFFER_WIDTH, PT_BACKBUFFER_HEIGHT, tileSize);
+	const bool uniformReached = uniform.Render(false, errorThreshold, sampleCountMin, targetError, sampleCountMax, rayCounts);
+	uniform.PrintStats("uniform", targetError, uniformReached);
+	AdaptiveSamplerCpu adaptive(scene, camera, PT_BACKBUFFER_WIDTH, PT_BACKBUFFER_HEIGHT, tileSize);
+	const bool adaptiveReached = adaptive.Render(true, errorThreshold, sampleCountMin, targetError, sampleCountMax, rayCounts);
+	adaptive.PrintStats("adaptive", targetError, adaptiveReached);
+	if (uniformReached && adaptiveReached)
+		printf("adaptive sampling reaches the target error %f times faster with %f times fewer paths\n",
+			uniform.GetMilliseconds() / adaptive.GetMilliseconds(), (float)uniform.GetPathCount() / adaptive.GetPathCount());
+
+	const bool written = WriteImagePfmCpu(filePathName, PT_BACKBUFFER_WIDTH, PT_BACKBUFFER_HEIGHT, adaptive.GetPixels());
+	if (written)
+		printf("adaptive image written to %s\n", filePathName.c_str());
+	else
+		fprintf(stderr, "can't write %s\n", filePathName.c_str());
+	return written;
+}
+
+// adds samples [sampleIndexBegin, sampleIndexEnd) of every pixel to pixelSums
+inline void RenderSamplesCpu(const ReferenceSceneCpu& scene, const CameraCpu& camera, u32 sampleIndexBegin, u32 sampleIndexEnd, vector<XMFLOAT3>& pixelSums, vector<u64>& rayCounts)
+{
+	ThreadPool::ParallelFor(PT_BACKBUFFER_HEIGHT, 1, [&](i64 begin, i64 end, u32 threadIndex)
+	{
+		const XMVECTOR eyePos = XMLoadFloat3(&camera.mEyePos);
+		u64 rayCount = 0;
+		for (u32 y = (u32)begin; y < (u32)end; y++)
+		{
+			for (u32 x = 0; x < PT_BACKBUFFER_WIDTH; x++)
+			{
+				XMFLOAT3& pixelSum = pixelSums[x + y * PT_BACKBUFFER_WIDTH];
+				for (u32 sampleIndex = sampleIndexBegin; sampleIndex < sampleIndexEnd; sampleIndex++)
+				{
+					PathSamplerCpu sampler(*scene.mSceneUniform, x, y, sampleIndex);
+					const XMVECTOR viewDirWorld = GenerateCameraRayCpu(camera, x, y, sampler);
+					XMStoreFloat3(&pixelSum, XMLoadFloat3(&pixelSum) + PathTraceCpu(scene, sampler, eyePos, viewDirWorld, rayCount));
+				}
+			}
+		}
+		rayCounts[threadIndex] += rayCount;
+	});
+}
+
+// every sampler renders the same scene and is compared at each power of 2 spp to a random sampler reference,
+// the reference takes sample indices past the ones being compared so it stays independent of the random sampler
+inline void CompareSamplersCpu(const ReferenceSceneCpu& scene, const CameraCpu& camera, u32 referenceSampleCount)
+{
+	static const char* samplerNames[PT_SAMPLER_COUNT] = { "random", "sobol", "blue noise" };
+	const u32 sampleCountMax = PARAM_compareSamplers.GetAsInt() > 0 ? PARAM_compareSamplers.GetAsInt() : 64;
+	const u32 pixelCount = PT_BACKBUFFER_WIDTH * PT_BACKBUFFER_HEIGHT;
+	vector<u64> rayCounts(ThreadPool::GetThreadCount(), 0);
+	SceneUniform sceneUniform = *scene.mSceneUniform;
+	ReferenceSceneCpu samplerScene = scene;
+	samplerScene.mSceneUniform = &sceneUniform;
+	printf("%ux%u, %u spp reference, %u threads, owen scrambling %s, %u sampled dimensions\n",
+		PT_BACKBUFFER_WIDTH, PT_BACKBUFFER_HEIGHT, referenceSampleCount, ThreadPool::GetThreadCount(), sceneUniform.mPathTracerSamplerOwenScrambling ? "on" : "off", sceneUniform.mPathTracerSamplerDimensionMax);
+
+	CpuTimer timer;
+	vector<XMFLOAT3> reference(pixelCount, XMFLOAT3(0.0f, 0.0f, 0.0f));
+	sceneUniform.mPathTracerSampler = PT_SAMPLER_RANDOM;
+	RenderSamplesCpu(samplerScene, camera, sampleCountMax, sampleCountMax + referenceSampleCount, reference, rayCounts);
+	for (XMFLOAT3& pixel : reference)
+		XMStoreFloat3(&pixel, XMLoadFloat3(&pixel) / (float)referenceSampleCount);
+	printf("reference rendered in %f s\n", timer.GetMilliseconds() / 1000.0f);
+
+	// rmse[sampler][i] at 2^i spp
+	vector<vector<float>> rmse(PT_SAMPLER_COUNT);
+	vector<XMFLOAT3> pixelSums(pixelCount);
+	for (u32 samplerIndex = 0; samplerIndex < PT_SAMPLER_COUNT; samplerIndex++)
+	{
+		sceneUniform.mPathTracerSampler = samplerIndex;
+		fill(pixelSums.begin(), pixelSums.end(), XMFLOAT3(0.0f, 0.0f, 0.0f));
+		for (u32 sampleCount = 0; sampleCount < sampleCountMax; )
+		{
+			const u32 nextSampleCount = sampleCount ? MIN(sampleCount * 2, sampleCountMax) : 1;
+			RenderSamplesCpu(samplerScene, camera, sampleCount, nextSampleCount, pixelSums, rayCounts);
+			sampleCount = nextSampleCount;
+			double squaredErrorSum = 0.0;
+			for (u32 i = 0; i < pixelCount; i++)
+			{
+				const XMVECTOR error = XMLoadFloat3(&pixelSums[i]) / (float)sampleCount - XMLoadFloat3(&reference[i]);
+				squaredErrorSum += Dot3Cpu(error, error);
+			}
+			rmse[samplerIndex].push_back((float)sqrt(squaredErrorSum / (pixelCount * 3.0)));
+		}
+	}
+
+	printf("%6s %14s %14s %14s\n", "spp", samplerNames[PT_SAMPLER_RANDOM], samplerNames[PT_SAMPLER_SOBOL], samplerNames[PT_SAMPLER_BLUE_NOISE]);
+	for (u32 i = 0; i < rmse[PT_SAMPLER_RANDOM].size(); i++)
+		printf("%6u %14f %14f %14f\n", MIN(1u << i, sampleCountMax), rmse[PT_SAMPLER_RANDOM][i], rmse[PT_SAMPLER_SOBOL][i], rmse[PT_SAMPLER_BLUE_NOISE][i]);
+	const u32 last = (u32)rmse[PT_SAMPLER_RANDOM].size() - 1;
+	for (u32 samplerIndex = PT_SAMPLER_SOBOL; samplerIndex < PT_SAMPLER_COUNT; samplerIndex++)
+		printf("%s: %f of the random sampler RMSE at %u spp\n", samplerNames[samplerIndex], rmse[samplerIndex][last] / rmse[PT_SAMPLER_RANDOM][last], sampleCountMax);
+}
+
+// running means over the sample count of each pixel, the CPU copy of the textures the path tracer writes for the denoiser
+struct DenoiseBuffersCpu
+{
+	vector<XMFLOAT3> mColor;
+	vector<XMFLOAT4> mNormalDepth;
+	vector<XMFLOAT3> mAlbedo;
+	vector<XMFLOAT4> mConvergence; // only the sample count and Welford M2 are read by the denoiser
+};
+
+// samples [sampleIndexBegin, sampleIndexBegin + sampleCount) of every pixel with the first hit features of each of them
+inline void RenderDenoiseBuffersCpu(const ReferenceSceneCpu& scene, const CameraCpu& camera, u32 sampleIndexBegin, u32 sampleCount, DenoiseBuffersCpu& buffers, vector<u64>& rayCounts)
+{
+	const u32 pixelCount = PT_BACKBUFFER_WIDTH * PT_BACKBUFFER_HEIGHT;
+	buffers.mColor.assign(pixelCount, XMFLOAT3(0.0f, 0.0f, 0.0f));
+	buffers.mNormalDepth.assign(pixelCount, XMFLOAT4(0.0f, 0.0f, 0.0f, 0.0f));
+	buffers.mAlbedo.assign(pixelCount, XMFLOAT3(0.0f, 0.0f, 0.0f));
+	buffers.mConvergence.assign(pixelCount, XMFLOAT4(0.0f, 0.0f, 0.0f, 1.0f));
+	ThreadPool::ParallelFor(PT_BACKBUFFER_HEIGHT, 1, [&](i64 begin, i64 end, u32 threadIndex)
+	{
+		const XMVECTOR eyePos = XMLoadFloat3(&camera.mEyePos);
+		u64 rayCount = 0;
+		for (u32 y = (u32)begin; y < (u32)end; y++)
+		{
+			for (u32 x = 0; x < PT_BACKBUFFER_WIDTH; x++)
+			{
+				const u32 pixelIndex = x + y * PT_BACKBUFFER_WIDTH;
+				for (u32 sampleIndex = sampleIndexBegin; sampleIndex < sampleIndexBegin + sampleCount; sampleIndex++)
+				{
+					PathSamplerCpu sampler(*scene.mSceneUniform, x, y, sampleIndex);
+					const XMVECTOR viewDirWorld = GenerateCameraRayCpu(camera, x, y, sampler);
+					DenoiseFeaturesCpu features;
+					const XMVECTOR color = PathTraceCpu(scene, sampler, eyePos, viewDirWorld, rayCount, &features);
+					const float count = buffers.mConvergence[pixelIndex].x;
+					XMStoreFloat3(&buffers.mColor[pixelIndex], (XMLoadFloat3(&buffers.mColor[pixelIndex]) * count + color) / (count + 1.0f));
+					XMStoreFloat4(&buffers.mNormalDepth[pixelIndex], (XMLoadFloat4(&buffers.mNormalDepth[pixelIndex]) * count + XMVectorSetW(XMLoadFloat3(&features.mNormal), features.mHitDistance)) / (count + 1.0f));
+					XMStoreFloat3(&buffers.mAlbedo[pixelIndex], (XMLoadFloat3(&buffers.mAlbedo[pixelIndex]) * count + XMLoadFloat3(&features.mAlbedo)) / (count + 1.0f));
+					buffers.mConvergence[pixelIndex] = UpdateConvergenceCpu(buffers.mConvergence[pixelIndex], color);
+				}
+			}
+		}
+		rayCounts[threadIndex] += rayCount;
+	});
+}
+
+inline float GetDenoiseLuminanceCpu(FXMVECTOR color)
+{
+	return Dot3Cpu(color, XMVectorSet(0.2126f, 0.7152f, 0.0722f, 0.0f));
+}
+
+inline XMVECTOR GetDenoiseDemodulationAlbedoCpu(const XMFLOAT3& albedo)
+{
+	return XMVectorMax(XMLoadFloat3(&albedo), XMVectorReplicate(PT_DENOISE_ALBEDO_MIN));
+}
+
+inline XMVECTOR GetDenoiseNormalCpu(const XMFLOAT4& normalDepth)
+{
+	const XMVECTOR normal = XMVectorSet(normalDepth.x, normalDepth.y, normalDepth.z, 0.0f);
+	const float normalLength = Length3Cpu(normal);
+	return normalLength > 0.0f ? normal / normalLength : XMVectorZero();
+}
+
+inline float GetDenoiseKernelWeightCpu(int offset)
+{
+	static const float kernel[3] = { 3.0f / 8.0f, 1.0f / 4.0f, 1.0f / 16.0f };
+	return kernel[abs(offset)];
+}
+
+inline float GetDenoiseEdgeStoppingWeightCpu(FXMVECTOR normalP, float depthP, float luminanceP, FXMVECTOR normalQ, float depthQ, float luminanceQ, float depthGradientDistance, float luminanceSigma)
+{
+	if (depthQ <= 0.0f)
+		return 0.0f;
+	const float weightNormal = powf(SaturateCpu(Dot3Cpu(normalP, normalQ)), PT_DENOISE_SIGMA_NORMAL);
+	const float weightDepth = fabsf(depthP - depthQ) / (PT_DENOISE_SIGMA_DEPTH * depthGradientDistance + 1e-4f);
+	const float weightLuminance = fabsf(luminanceP - luminanceQ) / (luminanceSigma + 1e-6f);
+	return weightNormal * expf(-weightDepth - weightLuminance);
+}
+
+inline bool IsOnScreenCpu(int x, int y)
+{
+	return x >= 0 && y >= 0 && x < PT_BACKBUFFER_WIDTH && y < PT_BACKBUFFER_HEIGHT;
+}
+
+// port of cs_pathtracer_denoise_temporal.hlsl and cs_pathtracer_denoise_atrous.hlsl without the reprojected prior,
+// the reference never restarts so there is no history to reproject
+inline void DenoiseCpu(const DenoiseBuffersCpu& buffers, vector<XMFLOAT3>& denoised)
+{
+	const u32 pixelCount = PT_BACKBUFFER_WIDTH * PT_BACKBUFFER_HEIGHT;
+	vector<XMFLOAT4> illumination(pixelCount); // demodulated color and the variance of its luminance
+	vector<XMFLOAT4> filtered(pixelCount);
+	ThreadPool::ParallelFor(PT_BACKBUFFER_HEIGHT, 1, [&](i64 begin, i64 end, u32 threadIndex)
+	{
+		for (int y = (int)begin; y < (int)end; y++)
+		{
+			for (int x = 0; x < PT_BACKBUFFER_WIDTH; x++)
+			{
+				const u32 pixelIndex = x + y * PT_BACKBUFFER_WIDTH;
+				const XMFLOAT4& convergence = buffers.mConvergence[pixelIndex];
+				const float sampleCount = convergence.x;
+				const XMVECTOR albedo = GetDenoiseDemodulationAlbedoCpu(buffers.mAlbedo[pixelIndex]);
+				float variance = 0.0f;
+				if (sampleCount >= PT_DENOISE_TEMPORAL_VARIANCE_SAMPLE_COUNT_MIN)
+				{
+					const float albedoLuminance = GetDenoiseLuminanceCpu(albedo);
+					variance = convergence.z / ((sampleCount - 1.0f) * sampleCount) / (albedoLuminance * albedoLuminance);
+				}
+				else
+				{
+					// too few samples for the variance of the pixel, use the spatial variance of its neighbors
+					float luminanceSum = 0.0f;
+					float luminanceSquaredSum = 0.0f;
+					float tapCount = 0.0f;
+					for (int tapY = y - 1; tapY <= y + 1; tapY++)
+					{
+						for (int tapX = x - 1; tapX <= x + 1; tapX++)
+						{
+							const u32 tapIndex = tapX + tapY * PT_BACKBUFFER_WIDTH;
+							if (!IsOnScreenCpu(tapX, tapY) || buffers.mNormalDepth[tapIndex].w <= 0.0f)
+								continue;
+							const float luminance = GetDenoiseLuminanceCpu(XMLoadFloat3(&buffers.mColor[tapIndex]) / GetDenoiseDemodulationAlbedoCpu(buffers.mAlbedo[tapIndex]));
+							luminanceSum += luminance;
+							luminanceSquaredSum += luminance * luminance;
+							tapCount += 1.0f;
+						}
+					}
+					if (tapCount >= 2.0f)
+					{
+						const float luminanceMean = luminanceSum / tapCount;
+						variance = MAX(luminanceSquaredSum / tapCount - luminanceMean * luminanceMean, 0.0f) / MAX(sampleCount, 1.0f);
+					}
+				}
+				XMStoreFloat4(&illumination[pixelIndex], XMVectorSetW(XMLoadFloat3(&buffers.mColor[pixelIndex]) / albedo, variance));
+			}
+		}
+	});
+
+	for (u32 iterationIndex = 0; iterationIndex < PT_DENOISE_ATROUS_ITERATION_COUNT; iterationIndex++)
+	{
+		const int step = 1 << iterationIndex;
+		ThreadPool::ParallelFor(PT_BACKBUFFER_HEIGHT, 1, [&](i64 begin, i64 end, u32 threadIndex)
+		{
+			for (int y = (int)begin; y < (int)end; y++)
+			{
+				for (int x = 0; x < PT_BACKBUFFER_WIDTH; x++)
+				{
+					const u32 pixelIndex = x + y * PT_BACKBUFFER_WIDTH;
+					const XMFLOAT4& center = illumination[pixelIndex];
+					const XMFLOAT4& normalDepth = buffers.mNormalDepth[pixelIndex];
+					filtered[pixelIndex] = center;
+					if (normalDepth.w <= 0.0f) // misses are not filtered
+						continue;
+					const XMVECTOR normal = GetDenoiseNormalCpu(normalDepth);
+					const float luminance = GetDenoiseLuminanceCpu(XMLoadFloat4(&center));
+					float varianceSum = 0.0f;
+					float weightSum = 0.0f;
+					for (int tapY = y - 1; tapY <= y + 1; tapY++)
+					{
+						for (int tapX = x - 1; tapX <= x + 1; tapX++)
+						{
+							if (!IsOnScreenCpu(tapX, tapY))
+								continue;
+							const float weight = (tapX != x ? 0.25f : 0.5f) * (tapY != y ? 0.25f : 0.5f);
+							varianceSum += illumination[tapX + tapY * PT_BACKBUFFER_WIDTH].w * weight;
+							weightSum += weight;
+						}
+					}
+					const float luminanceSigma = PT_DENOISE_SIGMA_LUMINANCE * sqrtf(varianceSum / weightSum);
+					float depthGradient = 0.0f;
+					for (int axis = 0; axis < 2; axis++)
+					{
+						float axisGradient = -1.0f;
+						for (int side = -1; side <= 1; side += 2)
+						{
+							const int tapX = axis ? x : x + side;
+							const int tapY = axis ? y + side : y;
+							const float tapDepth = IsOnScreenCpu(tapX, tapY) ? buffers.mNormalDepth[tapX + tapY * PT_BACKBUFFER_WIDTH].w : 0.0f;
+							if (tapDepth > 0.0f && (axisGradient < 0.0f || fabsf(tapDepth - normalDepth.w) < axisGradient))
+								axisGradient = fabsf(tapDepth - normalDepth.w);
+						}
+						depthGradient = MAX(depthGradient, axisGradient);
+					}
+					XMVECTOR illuminationSum = XMVectorZero();
+					varianceSum = 0.0f;
+					weightSum = 0.0f;
+					for (int offsetY = -2; offsetY <= 2; offsetY++)
+					{
+						for (int offsetX = -2; offsetX <= 2; offsetX++)
+						{
+							const int tapX = x + offsetX * step;
+							const int tapY = y + offsetY * step;
+							if (!IsOnScreenCpu(tapX, tapY))
+								continue;
+							const u32 tapIndex = tapX + tapY * PT_BACKBUFFER_WIDTH;
+							const XMFLOAT4& tap = illumination[tapIndex];
+							const XMFLOAT4& tapNormalDepth = buffers.mNormalDepth[tapIndex];
+							float weight = GetDenoiseKernelWeightCpu(offsetX) * GetDenoiseKernelWeightCpu(offsetY);
+							if (offsetX || offsetY)
+								weight *= GetDenoiseEdgeStoppingWeightCpu(normal, normalDepth.w, luminance, GetDenoiseNormalCpu(tapNormalDepth), tapNormalDepth.w, GetDenoiseLuminanceCpu(XMLoadFloat4(&tap)),
+									depthGradient * step * sqrtf((float)(offsetX * offsetX + offsetY * offsetY)), luminanceSigma);
+							illuminationSum += XMLoadFloat4(&tap) * weight;
+							varianceSum += tap.w * weight * weight;
+							weightSum += weight;
+						}
+					}
+					XMStoreFloat4(&filtered[pixelIndex], XMVectorSetW(illuminationSum / weightSum, varianceSum / (weightSum * weightSum)));
+				}
+			}
+		});
+		illumination.swap(filtered);
+	}
+
+	denoised.resize(pixelCount);
+	for (u32 i = 0; i < pixelCount; i++)
+		XMStoreFloat3(&denoised[i], XMLoadFloat4(&illumination[i]) * GetDenoiseDemodulationAlbedoCpu(buffers.mAlbedo[i]));
+}
+
+// feature files sit next to the color image, e.g. image_normal.pfm next to image.pfm
+inline string GetDenoiseFilePathNameCpu(const string& filePathName, const string& suffix)
+{
+	const size_t extension = filePathName.rfind(".pfm");
+	return extension == string::npos ? filePathName + suffix + ".pfm" : filePathName.substr(0, extension) + suffix + ".pfm";
+}
+
+// PFM only has 3 channels, the distance goes to its own file and the convergence keeps sample count, mean luminance and M2
+inline bool WriteDenoiseBuffersCpu(const string& filePathName, const DenoiseBuffersCpu& buffers)
+{
+	const u32 pixelCount = PT_BACKBUFFER_WIDTH * PT_BACKBUFFER_HEIGHT;
+	vector<XMFLOAT3> normals(pixelCount);
+	vector<XMFLOAT3> depths(pixelCount);
+	vector<XMFLOAT3> convergences(pixelCount);
+	for (u32 i = 0; i < pixelCount; i++)
+	{
+		normals[i] = XMFLOAT3(buffers.mNormalDepth[i].x, buffers.mNormalDepth[i].y, buffers.mNormalDepth[i].z);
+		depths[i] = XMFLOAT3(buffers.mNormalDepth[i].w, buffers.mNormalDepth[i].w, buffers.mNormalDepth[i].w);
+		convergences[i] = XMFLOAT3(buffers.mConvergence[i].x, buffers.mConvergence[i].y, buffers.mConvergence[i].z);
+	}
+	return WriteImagePfmCpu(filePathName, PT_BACKBUFFER_WIDTH, PT_BACKBUFFER_HEIGHT, buffers.mColor) &&
+		WriteImagePfmCpu(GetDenoiseFilePathNameCpu(filePathName, "_normal"), PT_BACKBUFFER_WIDTH, PT_BACKBUFFER_HEIGHT, normals) &&
+		WriteImagePfmCpu(GetDenoiseFilePathNameCpu(filePathName, "_depth"), PT_BACKBUFFER_WIDTH, PT_BACKBUFFER_HEIGHT, depths) &&
+		WriteImagePfmCpu(GetDenoiseFilePathNameCpu(filePathName, "_albedo"), PT_BACKBUFFER_WIDTH, PT_BACKBUFFER_HEIGHT, buffers.mAlbedo) &&
+		WriteImagePfmCpu(GetDenoiseFilePathNameCpu(filePathName, "_convergence"), PT_BACKBUFFER_WIDTH, PT_BACKBUFFER_HEIGHT, convergences);
+}
+
+inline bool ReadDenoiseBuffersCpu(const string& filePathName, DenoiseBuffersCpu& buffers)
+{
+	const u32 pixelCount = PT_BACKBUFFER_WIDTH * PT_BACKBUFFER_HEIGHT;
+	vector<XMFLOAT3> normals;
+	vector<XMFLOAT3> depths;
+	vector<XMFLOAT3> convergences;
+	if (!ReadImagePfmCpu(filePathName, PT_BACKBUFFER_WIDTH, PT_BACKBUFFER_HEIGHT, buffers.mColor) ||
+		!ReadImagePfmCpu(GetDenoiseFilePathNameCpu(filePathName, "_normal"), PT_BACKBUFFER_WIDTH, PT_BACKBUFFER_HEIGHT, normals) ||
+		!ReadImagePfmCpu(GetDenoiseFilePathNameCpu(filePathName, "_depth"), PT_BACKBUFFER_WIDTH, PT_BACKBUFFER_HEIGHT, depths) ||
+		!ReadImagePfmCpu(GetDenoiseFilePathNameCpu(filePathName, "_albedo"), PT_BACKBUFFER_WIDTH, PT_BACKBUFFER_HEIGHT, buffers.mAlbedo) ||
+		!ReadImagePfmCpu(GetDenoiseFilePathNameCpu(filePathName, "_convergence"), PT_BACKBUFFER_WIDTH, PT_BACKBUFFER_HEIGHT, convergences))
+		return false;
+	buffers.mNormalDepth.resize(pixelCount);
+	buffers.mConvergence.resize(pixelCount);
+	for (u32 i = 0; i < pixelCount; i++)
+	{
+		buffers.mNormalDepth[i] = XMFLOAT4(normals[i].x, normals[i].y, normals[i].z, depths[i].x);
+		buffers.mConvergence[i] = XMFLOAT4(convergences[i].x, convergences[i].y, convergences[i].z, GetPixelRelativeErrorCpu(convergences[i].x, convergences[i].y, convergences[i].z));
+	}
+	return true;
+}
+
+// denoises an image and the feature files -cpuDenoise wrote next to it, returns false if they can't be read or the result can't be written
+inline bool DenoiseFileCpu(const string& filePathName)
+{
+	DenoiseBuffersCpu buffers;
+	if (!ReadDenoiseBuffersCpu(filePathName, buffers))
+	{
+		fprintf(stderr, "can't read %s or one of its feature files\n", filePathName.c_str());
+		return false;
+	}
+	CpuTimer timer;
+	vector<XMFLOAT3> denoised;
+	DenoiseCpu(buffers, denoised);
+	printf("denoised %s in %f ms\n", filePathName.c_str(), timer.GetMilliseconds());
+	const string denoisedFilePathName = GetDenoiseFilePathNameCpu(filePathName, "_denoised");
+	const bool written = WriteImagePfmCpu(denoisedFilePathName, PT_BACKBUFFER_WIDTH, PT_BACKBUFFER_HEIGHT, denoised);
+	if (written)
+		printf("written to %s\n", denoisedFilePathName.c_str());
+	else
+		fprintf(stderr, "can't write %s\n", denoisedFilePathName.c_str());
+	return written;
+}
+
+// peak signal to noise ratio with a peak of 1, radiance above 1 is clamped like the display does
+inline float GetPsnrCpu(const vector<XMFLOAT3>& image, const vector<XMFLOAT3>& reference)
+{
+	double squaredErrorSum = 0.0;
+	for (u32 i = 0; i < image.size(); i++)
+	{
+		const XMVECTOR error = XMVectorSaturate(XMLoadFloat3(&image[i])) - XMVectorSaturate(XMLoadFloat3(&reference[i]));
+		squaredErrorSum += Dot3Cpu(error, error);
+	}
+	const double mse = squaredErrorSum / (image.size() * 3.0);
+	return mse > 0.0 ? (float)(-10.0 * log10(mse)) : INFINITY;
+}
+
+// PSNR of the noisy and the denoised image at 1, 4 and 16 spp against a reference of referenceSampleCount spp,
+// the reference takes sample indices past the ones being denoised so its noise is independent
+inline void BenchmarkDenoiserCpu(const ReferenceSceneCpu& scene, const CameraCpu& camera, u32 referenceSampleCount)
+{
+	static const u32 sampleCounts[] = { 1, 4, 16 };
+	const u32 sampleCountMax = sampleCounts[_countof(sampleCounts) - 1];
+	vector<u64> rayCounts(ThreadPool::GetThreadCount(), 0);
+	printf("%ux%u, %u spp reference, %u threads, %u a-trous iterations\n",
+		PT_BACKBUFFER_WIDTH, PT_BACKBUFFER_HEIGHT, referenceSampleCount, ThreadPool::GetThreadCount(), PT_DENOISE_ATROUS_ITERATION_COUNT);
+
+	CpuTimer timer;
+	DenoiseBuffersCpu reference;
+	RenderDenoiseBuffersCpu(scene, camera, sampleCountMax, referenceSampleCount, reference, rayCounts);
+	printf("reference rendered in %f s\n", timer.GetMilliseconds() / 1000.0f);
+
+	printf("%6s %14s %14s %14s %14s\n", "spp", "render ms", "noisy psnr", "denoised psnr", "denoise ms");
+	for (u32 sampleCount : sampleCounts)
+	{
+		DenoiseBuffersCpu buffers;
+		timer.Reset();
+		RenderDenoiseBuffersCpu(scene, camera, 0, sampleCount, buffers, rayCounts);
+		const float renderTime = timer.GetMilliseconds();
+		vector<XMFLOAT3> denoised;
+		timer.Reset();
+		DenoiseCpu(buffers, denoised);
+		const float denoiseTime = timer.GetMilliseconds();
+		printf("%6u %14f %14f %14f %14f\n", sampleCount, renderTime, GetPsnrCpu(buffers.mColor, reference.mColor), GetPsnrCpu(denoised, reference.mColor), denoiseTime);
+	}
+}
+
+// quad lights of random size, orientation and power in the upper half of the box, lit on both sides like the quads of the scene,
+// the light BVH does not know about visibility so lights buried under the floor would only measure occlusion
+inline void CreateRandomQuadLightsCpu(u32 lightCount, const AABB& bounds, vector<LightData>& lights)
+{
+	mt19937 generator(lightCount);
+	uniform_real_distribution<float> distribution(0.0f, 1.0f);
+	const XMVECTOR boundsMin = XMVectorSet(bounds.mMin.x, (bounds.mMin.y + bounds.mMax.y) * 0.5f, bounds.mMin.z, 0.0f);
+	const XMVECTOR boundsSize = XMLoadFloat3(&bounds.mMax) - boundsMin;
+	// the total area stays the same so the many small lights of the large counts don't hide the scene
+	const float extent = MAX(MAX(bounds.mMax.x - bounds.mMin.x, bounds.mMax.y - bounds.mMin.y), bounds.mMax.z - bounds.mMin.z);
+	const float sizeMax = extent * 0.2f / sqrtf((float)lightCount);
+	lights.clear();
+	for (u32 i = 0; i < lightCount; i++)
+	{
+		const XMVECTOR pos = boundsMin + boundsSize * XMVectorSet(distribution(generator), distribution(generator), distribution(generator), 0.0f);
+		const float cosTheta = distribution(generator) * 2.0f - 1.0f;
+		const float sinTheta = sqrtf(MAX(0.0f, 1.0f - cosTheta * cosTheta));
+		const float phi = distribution(generator) * 2.0f * XM_PI;
+		const XMVECTOR nor = XMVectorSet(sinTheta * cosf(phi), sinTheta * sinf(phi), cosTheta, 0.0f);
+		const XMVECTOR up = fabsf(cosTheta) < 0.9f ? XMVectorSet(0.0f, 0.0f, 1.0f, 0.0f) : XMVectorSet(1.0f, 0.0f, 0.0f, 0.0f);
+		const XMVECTOR tan = XMVector3Normalize(XMVector3Cross(up, nor));
+		const XMVECTOR bitan = XMVector3Cross(nor, tan);
+		// powers spread over 3 orders of magnitude so a few lights dominate, as in real scenes
+		const float power = powf(1000.0f, distribution(generator)) * 0.1f;
+
+		LightData ld = {};
+		ld.mLightType = LIGHT_TYPE_QUAD;
+		ld.mScale = XMFLOAT3(sizeMax * (0.25f + distribution(generator)), sizeMax * (0.25f + distribution(generator)), 1.0f);
+		ld.mArea = 4.0f * ld.mScale.x * ld.mScale.y;
+		ld.mColor = XMFLOAT3(power, power, power);
+		XMStoreFloat3(&ld.mPosWorld, pos);
+		XMStoreFloat3(&ld.mDirWorld, nor);
+		// rows of mViewInv are the axes and the position of the quad, mView is its rigid inverse
+		XMFLOAT3 t, b, n, p;
+		XMStoreFloat3(&t, tan);
+		XMStoreFloat3(&b, bitan);
+		XMStoreFloat3(&n, nor);
+		XMStoreFloat3(&p, pos);
+		ld.mViewInv = XMFLOAT4X4(
+			t.x, t.y, t.z, 0.0f,
+			b.x, b.y, b.z, 0.0f,
+			n.x, n.y, n.z, 0.0f,
+			p.x, p.y, p.z, 1.0f);
+		ld.mView = XMFLOAT4X4(
+			t.x, b.x, n.x, 0.0f,
+			t.y, b.y, n.y, 0.0f,
+			t.z, b.z, n.z, 0.0f,
+			-Dot3Cpu(pos, tan), -Dot3Cpu(pos, bitan), -Dot3Cpu(pos, nor), 1.0f);
+		lights.push_back(ld);
+	}
+}
+
+// per pixel luminance variance of 1 spp estimates, Welford's running mean and sum of squared differences
+inline void RenderLuminanceVarianceCpu(const ReferenceSceneCpu& scene, const CameraCpu& camera, u32 sampleCount, vector<float>& means, float& meanVariance, float& milliseconds)
+{
+	const u32 pixelCount = PT_BACKBUFFER_WIDTH * PT_BACKBUFFER_HEIGHT;
+	vector<u64> rayCounts(ThreadPool::GetThreadCount(), 0);
+	vector<XMFLOAT3> pixels(pixelCount);
+	vector<float> m2(pixelCount, 0.0f);
+	means.assign(pixelCount, 0.0f);
+	milliseconds = 0.0f;
+	for (u32 sampleIndex = 0; sampleIndex < sampleCount; sampleIndex++)
+	{
+		fill(pixels.begin(), pixels.end(), XMFLOAT3(0.0f, 0.0f, 0.0f));
+		CpuTimer timer;
+		RenderSamplesCpu(scene, camera, sampleIndex, sampleIndex + 1, pixels, rayCounts);
+		milliseconds += timer.GetMilliseconds();
+		for (u32 i = 0; i < pixelCount; i++)
+		{
+			const float luminance = Dot3Cpu(XMLoadFloat3(&pixels[i]), XMVectorSet(0.2126f, 0.7152f, 0.0722f, 0.0f));
+			const float delta = luminance - means[i];
+			means[i] += delta / (sampleIndex + 1);
+			m2[i] += delta * (luminance - means[i]);
+		}
+	}
+	double varianceSum = 0.0;
+	for (u32 i = 0; i < pixelCount; i++)
+		varianceSum += sampleCount > 1 ? m2[i] / (sampleCount - 1) : 0.0f;
+	meanVariance = (float)(varianceSum / pixelCount);
+}
+
+// the scene lights are swapped for random quads in the scene bounds, both light selections render the same quads,
+// efficiency is 1 / (variance * time) so the light BVH wins when its lower variance pays for the slower selection
+inline void BenchmarkLightSelectionCpu(const ReferenceSceneCpu& scene, const CameraCpu& camera, u32 sampleCount)
+{
+	static const char* selectionNames[PT_LIGHT_SELECTION_COUNT] = { "uniform", "bvh" };
+	static const u32 lightCounts[] = { 10, 100, 10000 };
+	sampleCount = PARAM_benchmarkLightBvh.GetAsInt() > 0 ? PARAM_benchmarkLightBvh.GetAsInt() : sampleCount;
+	AABB bounds;
+	bounds.mMin = XMFLOAT3(-10.0f, -10.0f, -10.0f);
+	bounds.mMax = XMFLOAT3(10.0f, 10.0f, 10.0f);
+	if (!PathTracer::sMeshWorldBVHs.empty())
+		bounds = PathTracer::sMeshWorldBVHs[PathTracer::sMeshBvhRootIndexGlobal].mAABB;
+	SceneUniform sceneUniform = *scene.mSceneUniform;
+	ReferenceSceneCpu benchmarkScene = scene;
+	benchmarkScene.mSceneUniform = &sceneUniform;
+	printf("%ux%u, %u spp, %u threads\n", PT_BACKBUFFER_WIDTH, PT_BACKBUFFER_HEIGHT, sampleCount, ThreadPool::GetThreadCount());
+
+	vector<LightData> sceneLights;
+	vector<LightBvhNode> sceneLightBvhNodes;
+	sceneLights.swap(PathTracer::sLightData);
+	sceneLightBvhNodes.swap(PathTracer::sLightBvhNodes);
+	for (u32 lightCount : lightCounts)
+	{
+		CreateRandomQuadLightsCpu(lightCount, bounds, PathTracer::sLightData);
+		CpuTimer buildTimer;
+		PathTracer::BuildLightBvh();
+		const float buildMilliseconds = buildTimer.GetMilliseconds();
+
+		vector<float> means[PT_LIGHT_SELECTION_COUNT];
+		float variances[PT_LIGHT_SELECTION_COUNT];
+		float milliseconds[PT_LIGHT_SELECTION_COUNT];
+		for (u32 selection = 0; selection < PT_LIGHT_SELECTION_COUNT; selection++)
+		{
+			sceneUniform.mPathTracerLightSelection = selection;
+			RenderLuminanceVarianceCpu(benchmarkScene, camera, sampleCount, means[selection], variances[selection], milliseconds[selection]);
+			printf("%5u lights, %7s: mean variance %f, %f s\n", lightCount, selectionNames[selection], variances[selection], milliseconds[selection] / 1000.0f);
+		}
+		// both are unbiased so the means only differ by noise
+		double meanDifferenceSum = 0.0;
+		double meanSum = 0.0;
+		for (u32 i = 0; i < means[PT_LIGHT_SELECTION_UNIFORM].size(); i++)
+		{
+			meanDifferenceSum += means[PT_LIGHT_SELECTION_BVH][i] - means[PT_LIGHT_SELECTION_UNIFORM][i];
+			meanSum += means[PT_LIGHT_SELECTION_UNIFORM][i];
+		}
+		const float efficiency = (variances[PT_LIGHT_SELECTION_UNIFORM] * milliseconds[PT_LIGHT_SELECTION_UNIFORM]) / (variances[PT_LIGHT_SELECTION_BVH] * milliseconds[PT_LIGHT_SELECTION_BVH]);
+		printf("%5u lights: bvh built in %f ms, %.2fx the efficiency of uniform selection, relative mean difference %f\n",
+			lightCount, buildMilliseconds, efficiency, meanSum > 0.0 ? (float)(meanDifferenceSum / meanSum) : 0.0f);
+	}
+	sceneLights.swap(PathTracer::sLightData);
+	sceneLightBvhNodes.swap(PathTracer::sLightBvhNodes);
+}
+
+inline XMVECTOR RandomUnitVectorCpu(mt19937& generator, uniform_real_distribution<float>& distribution)
+{
+	const float z = distribution(generator) * 2.0f - 1.0f;
+	const float phi = distribution(generator) * TWO_PI;
+	const float r = sqrtf(MAX(0.0f, 1.0f - z * z));
+	return XMVectorSet(r * cosf(phi), r * sinf(phi), z, 0.0f);
+}
+
+inline void GetOrthonormalBasisCpu(FXMVECTOR nor, XMVECTOR& tan, XMVECTOR& bitan)
+{
+	const XMVECTOR up = fabsf(XMVectorGetY(nor)) < 0.999f ? XMVectorSet(0.0f, 1.0f, 0.0f, 0.0f) : XMVectorSet(1.0f, 0.0f, 0.0f, 0.0f);
+	tan = XMVector3Normalize(XMVector3Cross(up, nor));
+	bitan = XMVector3Cross(nor, tan);
+}
+
+// both estimators of the irradiance must agree within noise, brute force only counts the hits on the mesh light itself
+// returns false if light sampling is biased
+inline bool ValidateMeshLightsCpu(const ReferenceSceneCpu& scene)
+{
+	const u32 pointCount = 16;
+	const u32 sampleCount = PARAM_validateMeshLights.GetAsInt() > 0 ? PARAM_validateMeshLights.GetAsInt() : 4096;
+	mt19937 generator(0);
+	uniform_real_distribution<float> distribution(0.0f, 1.0f);
+	u64 rayCount = 0;
+	u32 meshLightCount = 0;
+	float zMax = 0.0f;
+	for (u32 lightIndex = 0; lightIndex < PathTracer::sLightData.size(); lightIndex++)
+	{
+		const LightData& ld = PathTracer::sLightData[lightIndex];
+		if (ld.mLightType != LIGHT_TYPE_MESH)
+			continue;
+		meshLightCount++;
+		const XMVECTOR center = XMLoadFloat3(&ld.mPosWorld);
+		const float radius = Length3Cpu(XMLoadFloat3(&ld.mScale));
+		const float luminance = Dot3Cpu(XMLoadFloat3(&ld.mColor), XMVectorSet(0.2126f, 0.7152f, 0.0722f, 0.0f));
+		for (u32 pointIndex = 0; pointIndex < pointCount; pointIndex++)
+		{
+			const XMVECTOR pos = center + RandomUnitVectorCpu(generator, distribution) * (radius * (1.5f + 1.5f * distribution(generator)));
+			XMVECTOR nor = RandomUnitVectorCpu(generator, distribution);
+			if (Dot3Cpu(nor, center - pos) < 0.0f)
+				nor = -nor; // facing the light, or most points see nothing
+			XMVECTOR tan, bitan;
+			GetOrthonormalBasisCpu(nor, tan, bitan);
+			double sums[2] = {};
+			double squareSums[2] = {};
+			for (u32 sampleIndex = 0; sampleIndex < sampleCount; sampleIndex++)
+			{
+				// light sampling
+				float estimate = 0.0f;
+				XMVECTOR samplePoint, wi, p;
+				float pdf = 0.0f;
+				const XMFLOAT2 xi(distribution(generator), distribution(generator));
+				const XMVECTOR col = SampleLightCpu(pos, xi, lightIndex, samplePoint, wi, pdf);
+				const float cosTheta = Dot3Cpu(wi, nor);
+				if (pdf > 0.0f && cosTheta > 0.0f && IsNotBlackCpu(col) && IsLightSampleVisibleCpu(scene, lightIndex, pos, samplePoint, p, rayCount))
+					estimate = luminance * cosTheta / pdf;
+				sums[0] += estimate;
+				squareSums[0] += (double)estimate * estimate;
+
+				// cosine weighted hemisphere sampling, pi * L
+				estimate = 0.0f;
+				const float r = sqrtf(distribution(generator));
+				const float phi = distribution(generator) * TWO_PI;
+				const XMVECTOR dir = tan * (r * cosf(phi)) + bitan * (r * sinf(phi)) + nor * sqrtf(MAX(0.0f, 1.0f - r * r));
+				XMVECTOR n;
+				if (IsLightVisibleCpu(scene, lightIndex, pos, dir, p, n, rayCount))
+					estimate = PI * luminance;
+				sums[1] += estimate;
+				squareSums[1] += (double)estimate * estimate;
+			}
+			float means[2];
+			float standardErrors[2];
+			for (u32 i = 0; i < 2; i++)
+			{
+				means[i] = (float)(sums[i] / sampleCount);
+				standardErrors[i] = (float)sqrt(MAX(0.0, squareSums[i] / sampleCount - (double)means[i] * means[i]) / sampleCount);
+			}
+			// a single hit of the hemisphere is worth pi * L, when it has none its variance is unknown rather than 0
+			standardErrors[1] = MAX(standardErrors[1], PI * luminance / sampleCount);
+			const float standardError = sqrtf(standardErrors[0] * standardErrors[0] + standardErrors[1] * standardErrors[1]);
+			const float z = standardError > 0.0f ? fabsf(means[0] - means[1]) / standardError : 0.0f;
+			zMax = MAX(zMax, z);
+			printf("mesh light %u point %2u: light sampling %f +- %f, hemisphere sampling %f +- %f, z %.2f\n",
+				lightIndex, pointIndex, means[0], standardErrors[0], means[1], standardErrors[1], z);
+		}
+	}
+	printf("%u mesh lights validated with %llu rays, largest z %.2f\n", meshLightCount, rayCount, zMax);
+	const bool unbiased = zMax <= 4.0f;
+	if (!unbiased)
+		fprintf(stderr, "mesh light sampling is biased, light and hemisphere sampling differ by up to %.2f standard errors\n", zMax);
+	return unbiased;
+}
+
+// white furnace: with an albedo of 1 and light of 1 from every direction, a surface reflects its directional albedo which can't exceed 1,
+// lossless materials reflect exactly 1, and for materials that can be evaluated importance sampling has to agree with uniform sampling
+// returns false if any case fails
+inline bool WhiteFurnaceCpu()
+{
+	struct MaterialCase
+	{
+		const char* mName;
+		u32 mMaterialType;
+		float mRoughness;
+		float mFresnel;
+		float mMetallic;
+		bool mLossless;
+	};
+	static const MaterialCase cases[] =
+	{
+		{ "diffuse", MATERIAL_TYPE_DIFFUSE, 1.0f, 0.04f, 0.0f, true },
+		{ "ggx dielectric rough 0.1", MATERIAL_TYPE_GGX, 0.1f, 0.04f, 0.0f, false },
+		{ "ggx dielectric rough 0.5", MATERIAL_TYPE_GGX, 0.5f, 0.04f, 0.0f, false },
+		{ "ggx dielectric rough 1.0", MATERIAL_TYPE_GGX, 1.0f, 0.04f, 0.0f, false },
+		{ "ggx conductor rough 0.1", MATERIAL_TYPE_GGX, 0.1f, 1.0f, 1.0f, false },
+		{ "ggx conductor rough 0.5", MATERIAL_TYPE_GGX, 0.5f, 1.0f, 1.0f, false },
+		{ "ggx conductor rough 1.0", MATERIAL_TYPE_GGX, 1.0f, 1.0f, 1.0f, false },
+		{ "mirror", MATERIAL_TYPE_SPECULAR_REFLECTIIVE, 0.0f, 1.0f, 1.0f, true },
+		{ "glass", MATERIAL_TYPE_SPECULAR_TRANSMISSIVE, 0.0f, 0.04f, 0.0f, true },
+	};
+	static const float cosThetaOs[] = { 1.0f, 0.7f, 0.3f, 0.1f };
+	const u32 sampleCount = PARAM_whiteFurnace.GetAsInt() > 0 ? PARAM_whiteFurnace.GetAsInt() : 65536;
+	mt19937 generator(0);
+	uniform_real_distribution<float> distribution(0.0f, 1.0f);
+	u32 failureCount = 0;
+	for (const MaterialCase& materialCase : cases)
+	{
+		SurfaceCpu sd = {};
+		sd.mAlbedo = XMVectorSet(1.0f, 1.0f, 1.0f, 0.0f);
+		sd.mNorWorld = XMVectorSet(0.0f, 0.0f, 1.0f, 0.0f);
+		sd.mRoughness = materialCase.mRoughness;
+		sd.mFresnel = materialCase.mFresnel;
+		sd.mMetallic = materialCase.mMetallic;
+		sd.mMaterialType = materialCase.mMaterialType;
+		const bool isSpecular = IsSpecularMaterialCpu(sd.mMaterialType);
+		for (float cosThetaO : cosThetaOs)
+		{
+			const XMVECTOR wo = XMVectorSet(sqrtf(1.0f - cosThetaO * cosThetaO), 0.0f, cosThetaO, 0.0f);
+			double sums[2] = {};
+			double squareSums[2] = {};
+			for (u32 sampleIndex = 0; sampleIndex < sampleCount; sampleIndex++)
+			{
+				// importance sampling
+				float estimate = 0.0f;
+				XMVECTOR wi;
+				float pdf = 0.0f;
+				const XMVECTOR col = SampleMaterialCpu(sd, XMFLOAT2(distribution(generator), distribution(generator)), wo, wi, pdf);
+				if (pdf > 0.0f)
+					estimate = XMVectorGetX(col) / pdf;
+				sums[0] += estimate;
+				squareSums[0] += (double)estimate * estimate;
+
+				// uniform hemisphere sampling, delta materials can't be evaluated
+				if (isSpecular)
+					continue;
+				estimate = 0.0f;
+				const float cosThetaI = distribution(generator);
+				const float sinThetaI = sqrtf(1.0f - cosThetaI * cosThetaI);
+				const float phi = distribution(generator) * TWO_PI;
+				float evaluatePdf = 0.0f;
+				estimate = XMVectorGetX(EvaluateMaterialCpu(sd, wo, XMVectorSet(sinThetaI * cosf(phi), sinThetaI * sinf(phi), cosThetaI, 0.0f), evaluatePdf)) * TWO_PI;
+				sums[1] += estimate;
+				squareSums[1] += (double)estimate * estimate;
+			}
+			float means[2];
+			float standardErrors[2];
+			for (u32 i = 0; i < 2; i++)
+			{
+				means[i] = (float)(sums[i] / sampleCount);
+				standardErrors[i] = (float)sqrt(MAX(0.0, squareSums[i] / sampleCount - (double)means[i] * means[i]) / sampleCount);
+			}
+			const float tolerance = 3.0f * standardErrors[0] + 0.001f;
+			bool failed = means[0] > 1.0f + tolerance || (materialCase.mLossless && means[0] < 1.0f - tolerance);
+			float z = 0.0f;
+			if (!isSpecular)
+			{
+				const float standardError = sqrtf(standardErrors[0] * standardErrors[0] + standardErrors[1] * standardErrors[1]);
+				z = standardError > 0.0f ? fabsf(means[0] - means[1]) / standardError : 0.0f;
+				failed = failed || z > 4.0f;
+			}
+			if (failed)
+			{
+				fprintf(stderr, "white furnace: %s at cos %.1f reflects %f +- %f with importance sampling and %f +- %f with uniform sampling, z %.2f\n", materialCase.mName, cosThetaO,
+					means[0], standardErrors[0], means[1], standardErrors[1], z);
+				failureCount++;
+			}
+			printf("%-26s cos %.1f: importance sampling %f +- %f, uniform sampling %f +- %f, z %.2f%s\n", materialCase.mName, cosThetaO,
+				means[0], standardErrors[0], means[1], standardErrors[1], z, failed ? ", FAILED" : "");
+		}
+	}
+	printf("white furnace: %u of %u cases failed\n", failureCount, (u32)(sizeof(cases) / sizeof(cases[0]) * sizeof(cosThetaOs) / sizeof(cosThetaOs[0])));
+	return failureCount == 0;
+}
+
+bool PathTracerCpu::RenderReference(const SceneUniform& sceneUniform, Camera& camera, u32 sampleCount, const string& filePathName)
+{
+	printf(">>> CPU reference path tracer <<<\n");
+	string denoiseFilePathName;
+	if (PARAM_denoiseFile.GetAsString(denoiseFilePathName))
+	{
+		const bool denoised = DenoiseFileCpu(denoiseFilePathName);
+		printf("==============================\n");
+		return denoised;
+	}
+	ReferenceSceneCpu scene;
+	scene.mSceneUniform = &sceneUniform;
+	scene.mUseBVH = sceneUniform.mPathTracerUseBVH && !PathTracer::sMeshWorldBVHs.empty(); // -buildBvhGpu leaves nothing to traverse on the CPU
+	sWatertightTriangles = sceneUniform.mPathTracerWatertightTriangles != 0;
+
+	// the GPU copies of mesh textures are not readable, load the albedo of each mesh again
+	unordered_map<Texture*, TextureCpu> textures;
+	scene.mMeshAlbedos.resize(PathTracer::sMeshes.size(), nullptr);
+	for (u32 i = 0; i < PathTracer::sMeshes.size(); i++)
+	{
+		Mesh* meshSource = PathTracer::sMeshSources[i];
+		if (!meshSource || PathTracer::sMeshes[i].mTextureCount == 0)
+			continue;
+		Texture* albedo = meshSource->GetTextures()[0];
+		auto found = textures.find(albedo);
+		if (found == textures.end())
+		{
+			TextureCpu texture;
+			const bool loaded = LoadTextureCpu(albedo->GetName(), texture);
+			if (!verifyf(loaded, "can't load %s for the CPU reference, using the standard color", albedo->GetName().c_str()))
+				continue;
+			found = textures.emplace(albedo, move(texture)).first;
+		}
+		scene.mMeshAlbedos[i] = &found->second;
+	}
+
+	const u32 width = PT_BACKBUFFER_WIDTH;
+	const u32 height = PT_BACKBUFFER_HEIGHT;
+	CameraCpu cameraCpu;
+	cameraCpu.mProjInv = camera.GetProjInvMatrix();
+	cameraCpu.mViewInv = camera.GetViewInvMatrix();
+	cameraCpu.mEyePos = camera.GetPosition();
+	cameraCpu.mNearClipPlane = camera.GetNearClipPlane();
+	if (PARAM_compareSamplers.Get())
+	{
+		CompareSamplersCpu(scene, cameraCpu, sampleCount);
+		printf("==============================\n");
+		return true;
+	}
+	if (PARAM_whiteFurnace.Get())
+	{
+		const bool passed = WhiteFurnaceCpu();
+		printf("==============================\n");
+		return passed;
+	}
+	if (PARAM_validateMeshLights.Get())
+	{
+		const bool passed = ValidateMeshLightsCpu(scene);
+		printf("==============================\n");
+		return passed;
+	}
+	if (PARAM_benchmarkLightBvh.Get())
+	{
+		BenchmarkLightSelectionCpu(scene, cameraCpu, sampleCount);
+		printf("==============================\n");
+		return true;
+	}
+	if (PARAM_cpuAdaptive.Get())
+	{
+		const bool written = RenderReferenceAdaptiveCpu(scene, cameraCpu, sampleCount, filePathName);
+		printf("==============================\n");
+		return written;
+	}
+	if (PARAM_benchmarkDenoiser.Get())
+	{
+		BenchmarkDenoiserCpu(scene, cameraCpu, sampleCount);
+		printf("==============================\n");
+		return true;
+	}
+	if (PARAM_cpuDenoise.Get())
+	{
+		DenoiseBuffersCpu buffers;
+		vector<u64> rayCounts(ThreadPool::GetThreadCount(), 0);
+		CpuTimer timer;
+		RenderDenoiseBuffersCpu(scene, cameraCpu, 0, sampleCount, buffers, rayCounts);
+		printf("%ux%u, %u spp with first hit features: %f s\n", width, height, sampleCount, timer.GetMilliseconds() / 1000.0f);
+		const bool written = WriteDenoiseBuffersCpu(filePathName, buffers);
+		if (!written)
+			fprintf(stderr, "can't write %s or one of its feature files\n", filePathName.c_str());
+		const bool denoised = written && DenoiseFileCpu(filePathName);
+		printf("==============================\n");
+		return denoised;
+	}
+	vector<XMFLOAT3> pixels(width * height, XMFLOAT3(0.0f, 0.0f, 0.0f));
+	vector<u64> rayCounts(ThreadPool::GetThreadCount(), 0);
+	const bool wavefront = PARAM_cpuWavefront.Get();
+	const u32 tileSize = PARAM_cpuTileSize.GetAsInt() > 0 ? PARAM_cpuTileSize.GetAsInt() : 16;
+	TileSchedulerCpu scheduler(width, height, tileSize, ThreadPool::GetThreadCount());
+	WavefrontCpu* wavefrontCpu = wavefront ? new WavefrontCpu(scene, cameraCpu, width, height) : nullptr;
+	vector<float> timeBudgetArg;
+	const float timeBudget = PARAM_cpuTimeBudget.GetAsFloatVec(timeBudgetArg) && timeBudgetArg.size() > 0 ? timeBudgetArg[0] * 1000.0f : 0.0f;
+	u32 renderedSampleCount = 0;
+	CpuTimer timer;
+	for (u32 sampleIndex = 0; sampleIndex < sampleCount && (timeBudget <= 0.0f || timer.GetMilliseconds() < timeBudget); sampleIndex++)
+	{
+		renderedSampleCount++;
+		if (wavefront)
+		{
+			wavefrontCpu->RenderSample(sampleIndex, pixels, rayCounts);
+			continue;
+		}
+		// one pass per sample so every pass after the first is partitioned by the tile cost of the previous one
+		scheduler.Run([&](u32 tileIndex, u32 threadIndex)
+		{
+			const XMVECTOR eyePos = XMLoadFloat3(&cameraCpu.mEyePos);
+			u64 rayCount = 0;
+			u32 x0, y0, x1, y1;
+			scheduler.GetTileRect(tileIndex, x0, y0, x1, y1);
+			for (u32 y = y0; y < y1; y++)
+			{
+				for (u32 x = x0; x < x1; x++)
+				{
+					PathSamplerCpu sampler(sceneUniform, x, y, sampleIndex);
+					const XMVECTOR viewDirWorld = GenerateCameraRayCpu(cameraCpu, x, y, sampler);
+					XMFLOAT3& pixel = pixels[x + y * width];
+					XMStoreFloat3(&pixel, XMLoadFloat3(&pixel) + PathTraceCpu(scene, sampler, eyePos, viewDirWorld, rayCount));
+				}
+			}
+			rayCounts[threadIndex] += rayCount;
+		});
+	}
+	for (XMFLOAT3& pixel : pixels)
+		XMStoreFloat3(&pixel, XMLoadFloat3(&pixel) / (float)renderedSampleCount);
+	const float renderTime = timer.GetMilliseconds();
+
+	u64 rayCount = 0;
+	for (u64 count : rayCounts)
+		rayCount += count;
+	const u64 pathCount = (u64)width * height * renderedSampleCount;
+	displayfln("%ux%u, %u spp, %u threads, %s, %s: %f s", width, height, renderedSampleCount, ThreadPool::GetThreadCount(), wavefront ? "wavefront" : "megakernel", scene.mUseBVH ? "bvh" : "brute force", renderTime / 1000.0f);
+	displayfln("%f Mpaths/s, %f Mrays/s, %f rays per path", pathCount / (renderTime * 1000.0f), rayCount / (renderTime * 1000.0f), (float)rayCount / pathCount);
+	// one line with fixed keys so nightly runs can be parsed and compared, printed in every configuration unlike displayfln
+	printf("stats: bvh_build_ms=%f sample_ms=%f mrays_per_s=%f spp=%u\n", PathTracer::sBvhBuildMilliseconds, renderTime / renderedSampleCount, rayCount / (renderTime * 1000.0f), renderedSampleCount);
+	fflush(stdout);
+	const bool written = WriteImagePfmCpu(filePathName, width, height, pixels);
+	if (written)
+		displayfln("written to %s", filePathName.c_str());
+	else
+		fprintf(stderr, "can't write %s\n", filePathName.c_str());
+	const string pngFilePathName = ReplaceExtensionCpu(filePathName, ".png");
+	const bool pngWritten = WriteImagePngCpu(pngFilePathName, width, height, pixels);
+	if (pngWritten)
+		displayfln("tonemapped image written to %s", pngFilePathName.c_str());
+	else
+		fprintf(stderr, "can't write %s\n", pngFilePathName.c_str());
+	if (wavefront)
+		wavefrontCpu->PrintStats();
+	else
+		scheduler.PrintStats();
+	delete wavefrontCpu;
+	printf("==============================\n");
+	return written && pngWritten;
+}
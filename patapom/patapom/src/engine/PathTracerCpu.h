@@ -0,0 +1,46 @@
+#pragma once
+
+#include "PathTracer.h"
+
+// CPU side traversal of the path tracer BVHs, used to validate and benchmark BVH layouts without the GPU
+class PathTracerCpu
+{
+public:
+	struct RayCpu
+	{
+		XMFLOAT3 mOri;
+		XMFLOAT3 mDir;
+		XMFLOAT3 mInvDir;
+	};
+
+	struct HitCpu
+	{
+		float mT;
+		u32 mTriangleIndex; // global index into PathTracer::sTriangles
+		u32 mNodeVisitCount; // nodes visited by the whole packet for packet traversal
+	};
+
+	enum SimdLevel : u8
+	{
+		SimdLevelSSE, // 4 rays per packet
+		SimdLevelAVX2, // 8 rays per packet
+		SimdLevelAVX512, // 16 rays per packet
+		SimdLevelCount
+	};
+
+	static const u32 sPacketWidthMax = 16;
+	static bool sWatertightTriangles; // triangle test of the single ray traversals, Moller-Trumbore when false
+
+	static RayCpu MakeRay(const XMFLOAT3& ori, const XMFLOAT3& dir);
+	static bool IntersectTrianglesBruteForce(u32 meshIndex, const RayCpu& rayModel, HitCpu& hit); // reference for BVH traversals
+	static bool IntersectTriangleBVH(u32 meshIndex, const RayCpu& rayModel, HitCpu& hit);
+	static bool IntersectTriangleWideBVH(u32 meshIndex, const RayCpu& rayModel, HitCpu& hit); // requires PathTracer::UpdateWideBvhCpu
+	static bool BenchmarkWideBVH(); // false if the wide and the binary BVH disagree on a closest hit
+	static SimdLevel GetSimdLevel(); // widest instruction set supported by both the CPU and the OS
+	static u32 GetPacketWidth(SimdLevel simdLevel);
+	// traces up to GetPacketWidth(simdLevel) rays together, returns false if the rays were not coherent enough and went through IntersectTriangleBVH one by one
+	static bool IntersectTriangleBvhPacket(u32 meshIndex, const RayCpu* raysModel, HitCpu* hits, u32 rayCount, SimdLevel simdLevel);
+	static bool ValidateWatertightTriangles(); // rays at shared edges and vertices of a tessellated mesh, plus cost per test of each triangle test, false if the watertight test lets a ray through
+	static bool BenchmarkRayPackets(const vector<string>& meshNames); // primary and shadow rays of the first meshNames.size() meshes, single ray against every packet width the CPU supports, false if the packets miss closest hits
+	static bool RenderReference(const SceneUniform& sceneUniform, Camera& camera, u32 sampleCount, const string& filePathName); // port of the single pass mode of cs_pathtracer.hlsl, writes a PFM, false if an image can't be written or a validation report fails
+};
@@ -1883,8 +1883,20 @@ void Renderer::CreateGraphicsPSO(
 	D3D12_INPUT_LAYOUT_DESC inputLayoutDesc = { nullptr, 0 };
 	if (pass.GetMeshes().size())
 	{
-		inputLayoutDesc.NumElements = COUNT_OF(VertexInputLayout);
-		inputLayoutDesc.pInputElementDescs = VertexInputLayout;
+		// the meshes of a pass are drawn with the same input layout
+		const Mesh::VertexFormat vertexFormat = pass.GetMeshes()[0]->GetVertexFormat();
+		for (const Mesh* mesh : pass.GetMeshes())
+			fatalAssertf(mesh->GetVertexFormat() == vertexFormat, "meshes of pass %s have different vertex formats", pass.GetDebugName().c_str());
+		if (vertexFormat == Mesh::VertexFormat::PACKED)
+		{
+			inputLayoutDesc.NumElements = COUNT_OF(PackedVertexInputLayout);
+			inputLayoutDesc.pInputElementDescs = PackedVertexInputLayout;
+		}
+		else
+		{
+			inputLayoutDesc.NumElements = COUNT_OF(VertexInputLayout);
+			inputLayoutDesc.pInputElementDescs = VertexInputLayout;
+		}
 	}
 
 	// create PSO
@@ -2174,9 +2186,11 @@ void Renderer::RecordGraphicsPassInstanced(
 				commandList.GetImpl()->IASetIndexBuffer(&mesh->GetIndexBufferView());
 				commandList.GetImpl()->SetGraphicsRootConstantBufferView(GetUniformSlot(RegisterSpace::OBJECT, RegisterType::CBV), mesh->GetUniformBufferGpuAddress(mCurrentFramebufferIndex));
 				commandList.GetImpl()->SetGraphicsRootDescriptorTable(GetUniformSlot(RegisterSpace::OBJECT, RegisterType::SRV), mesh->GetCbvSrvUavDescriptorHeapTableHandle(mCurrentFramebufferIndex).GetGpuHandle());
+				// instances are placed by the shader, only a single instance is known to be where the mesh is
+				const Mesh::Lod& lod = mesh->GetLod(instanceCount == 1 && pass.GetCamera() ? mesh->SelectLod(*pass.GetCamera()) : 0);
 				string passFullname = pass.GetDebugName() + ":" + pass.GetGraphicShaderNames();
 				GPU_MARKER(commandList, "%s", passFullname.c_str());
-				commandList.GetImpl()->DrawIndexedInstanced(mesh->GetIndexCount(), instanceCount, 0, 0, 0);
+				commandList.GetImpl()->DrawIndexedInstanced(lod.mIndexCount, instanceCount, lod.mIndexOffset, 0, 0);
 			}
 		}
 	}
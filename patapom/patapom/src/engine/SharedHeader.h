@@ -49,28 +49,20 @@
 #define LIGHT_TYPE_QUAD				1
 #define LIGHT_TYPE_POINT			2
 #define LIGHT_TYPE_SPHERE			3
+#define LIGHT_TYPE_MESH				4 // path tracer only, emissive meshes are hit as materials so this never goes into the intersection flags
 
 #define MATERIAL_TYPE_INVALID					0x00000000
 #define MATERIAL_TYPE_GGX						0x00000001
 #define MATERIAL_TYPE_SPECULAR_REFLECTIIVE		0x00000002
 #define MATERIAL_TYPE_SPECULAR_TRANSMISSIVE		0x00000003
 #define MATERIAL_TYPE_EMISSIVE					0x00000004
+#define MATERIAL_TYPE_DIFFUSE					0x00000005 // Lambertian, cheaper than MATERIAL_TYPE_GGX with no metallic
 
 // path tracer
-#define PT_TRIANGLE_BVH_STACK_SIZE						256 // 256 uint array so it's actually 256 * 4 bytes per thread
-#define PT_TRIANGLE_BVH_TREE_HEIGHT_MAX					PT_TRIANGLE_BVH_STACK_SIZE
-#define PT_TRIANGLE_PER_SCENE_MAX						300000
-#define PT_TRIANGLE_PER_MESH_MAX						9000
-#define PT_MESH_PER_SCENE_MAX							10
-#if PT_TRIANGLE_PER_SCENE_MAX > PT_MESH_PER_SCENE_MAX
-	#define PT_LEAF_PER_TREE_MAX						PT_TRIANGLE_PER_MESH_MAX
-#else
-	#define PT_LEAF_PER_TREE_MAX						PT_MESH_PER_SCENE_MAX
-#endif
-#define PT_TRIANGLE_BVH_PER_SCENE_MAX					PT_TRIANGLE_PER_SCENE_MAX - 1
-#define PT_MESH_BVH_PER_SCENE_MAX						PT_MESH_PER_SCENE_MAX - 1
-#define PT_BVH_PER_SCENE_MAX							MAX(PT_TRIANGLE_BVH_PER_SCENE_MAX, PT_MESH_BVH_PER_SCENE_MAX)
-#define PT_LIGHT_PER_SCENE_MAX							LIGHT_PER_SCENE_MAX
+#define PT_TRIANGLE_BVH_STACK_SIZE						256 // 256 uint array so it's actually 256 * 4 bytes per thread, the CPU build checks that every tree is shallow enough
+#define PT_MESH_BVH_STACK_SIZE							64 // the mesh BVH is checked against this the same way
+#define PT_LIGHT_BVH_STACK_SIZE							64 // the light BVH build keeps every leaf shallow enough for this
+#define PT_LIGHT_BVH_BIN_COUNT							12 // split candidates per axis of the light BVH build
 #define PT_THREAD_PER_THREADGROUP_X						8
 #define PT_THREAD_PER_THREADGROUP_Y						8
 #define PT_BUILDBVH_TYPE_TRIANGLE						0
@@ -85,15 +77,26 @@
 #define PT_RADIXSORT_BIT_PER_BITGROUP					1
 #define PT_RADIXSORT_BITGROUP_COUNT						(PT_RADIXSORT_BIT_PER_ENTRY / PT_RADIXSORT_BIT_PER_BITGROUP)
 #define GET_PT_RADIXSORT_DISPATCH_COUNT(leafPerTree)	CEIL_DIVIDE(leafPerTree, PT_BUILDBVH_ENTRY_PER_DISPATCH)
-#define PT_RADIXSORT_DISPATCH_COUNT_MAX					GET_PT_RADIXSORT_DISPATCH_COUNT(PT_LEAF_PER_TREE_MAX)
 #define GET_PT_RADIXSORT_THREAD_COUNT(leafPerTree)		(PT_BUILDBVH_THREAD_PER_DISPATCH * GET_PT_RADIXSORT_DISPATCH_COUNT(leafPerTree))
-#define PT_RADIXSORT_THREAD_COUNT_MAX					GET_PT_RADIXSORT_THREAD_COUNT(PT_LEAF_PER_TREE_MAX)
 #define PT_RADIXSORT_SWEEP_THREAD_PER_THREADGROUP		512
+#define PT_SAH_BIN_COUNT								16
+#define PT_SAH_TRAVERSAL_COST							1.0f
+#define PT_SAH_INTERSECTION_COST						1.0f
+#define PT_SAH_PARALLEL_BINNING_LEAF_MIN				8192 // nodes with fewer leaves are binned on one thread
+#define PT_BVH_PARALLEL_BUILD_LEAF_MIN					8192 // smaller trees are built on one thread, in parallel with other trees
+#define PT_BVH_RADIXSORT_BIT_PER_PASS					8
+#define PT_WIDE_BVH_WIDTH								4 // 4 or 8 children per wide BVH node
+#define PT_WIDE_BVH_PACKED_UINT_COUNT					(PT_WIDE_BVH_WIDTH / 4) // 4 quantized 8 bit bounds per UINT
+#define PT_BVH_REFIT_REBUILD_SAH_RATIO					1.5f // a refitted tree is rebuilt once its SAH cost exceeds the cost right after the last build by this ratio
 #define PT_BACKBUFFER_WIDTH								960
 #define PT_BACKBUFFER_HEIGHT							960
 #define PT_MINDEPTH_MAX									5
 #define PT_MAXDEPTH_MAX									10
 #define PT_DEBUG_LINE_COUNT_PER_RAY						3
+#define PT_POINT_LIGHT_RADIUS							0.0001f // point lights are tiny spheres when intersected
+#define PT_SPAWN_RAY_BIAS								0.00001f
+#define PT_MESH_LIGHT_SAMPLE_TOLERANCE					0.001f // a mesh light sample is visible if the closest hit is this close to it, relative to the distance
+#define PT_MATERIAL_COUNT_MAX							32 // meshes with the same material parameters and albedo texture share a material
 
 #define PT_MODE_OFF										0
 #define PT_MODE_DEFAULT									1
@@ -103,6 +106,70 @@
 #define PT_MODE_DEBUG_MESH_INTERSECTION					5
 #define PT_MODE_DEBUG_ALBEDO							6
 #define PT_MODE_DEBUG_NORMAL							7
+#define PT_MODE_WAVEFRONT								8
+
+// wavefront path tracer, one path per pixel in flight and every queue is a float4 buffer holding its fields one after another (SoA)
+#define PT_WAVEFRONT_THREAD_PER_THREADGROUP				64
+#define PT_WAVEFRONT_PATH_COUNT							(PT_BACKBUFFER_WIDTH * PT_BACKBUFFER_HEIGHT)
+#define PT_WAVEFRONT_SHADOW_RAY_PER_PATH				2 // light sample and material sample
+#define PT_WAVEFRONT_PATH_FIELD_COUNT					6
+#define PT_WAVEFRONT_RAY_FIELD_COUNT					2
+#define PT_WAVEFRONT_HIT_FIELD_COUNT					4
+#define PT_WAVEFRONT_SHADOW_FIELD_COUNT					3
+#define PT_WAVEFRONT_QUEUE_RAY							0
+#define PT_WAVEFRONT_QUEUE_HIT							1
+#define PT_WAVEFRONT_QUEUE_SHADOW						2
+#define PT_WAVEFRONT_QUEUE_COUNT						3
+#define PT_WAVEFRONT_QUEUE_COUNTER_COUNT				(PT_WAVEFRONT_QUEUE_COUNT * PT_MAXDEPTH_MAX) // every queue gets its own counter per bounce so nothing has to be reset between stages
+#define PT_WAVEFRONT_MATERIAL_BUCKET_COUNT				(PT_MATERIAL_COUNT_MAX + 1) // hits are sorted by material before shading, lights get the last bucket
+#define PT_WAVEFRONT_MATERIAL_HISTOGRAM_OFFSET			PT_WAVEFRONT_QUEUE_COUNTER_COUNT // hits per bucket per bounce, counted by the extend stage
+#define PT_WAVEFRONT_MATERIAL_CURSOR_OFFSET				(PT_WAVEFRONT_MATERIAL_HISTOGRAM_OFFSET + PT_WAVEFRONT_MATERIAL_BUCKET_COUNT * PT_MAXDEPTH_MAX) // hits placed per bucket per bounce, counted by the sort stage
+#define PT_WAVEFRONT_COUNTER_COUNT						(PT_WAVEFRONT_MATERIAL_CURSOR_OFFSET + PT_WAVEFRONT_MATERIAL_BUCKET_COUNT * PT_MAXDEPTH_MAX)
+
+// adaptive sampling, the convergence of every pixel is tracked next to the backbuffer and reduced per tile
+#define PT_ADAPTIVE_TILE_SIZE							16
+#define PT_ADAPTIVE_TILE_COUNT_X						((PT_BACKBUFFER_WIDTH + PT_ADAPTIVE_TILE_SIZE - 1) / PT_ADAPTIVE_TILE_SIZE)
+#define PT_ADAPTIVE_TILE_COUNT_Y						((PT_BACKBUFFER_HEIGHT + PT_ADAPTIVE_TILE_SIZE - 1) / PT_ADAPTIVE_TILE_SIZE)
+#define PT_ADAPTIVE_TILE_COUNT							(PT_ADAPTIVE_TILE_COUNT_X * PT_ADAPTIVE_TILE_COUNT_Y)
+#define PT_ADAPTIVE_TILE_ERROR_FRAME					PT_ADAPTIVE_TILE_COUNT // entry after the tile errors, frame the errors were measured at
+#define PT_ADAPTIVE_TILE_ERROR_BUFFER_SIZE				(PT_ADAPTIVE_TILE_COUNT + 1)
+#define PT_ADAPTIVE_LUMINANCE_BIAS						0.01f // keeps the relative error of black pixels finite
+#define PT_ADAPTIVE_SAMPLE_COUNT_MIN					2 // variance needs at least 2 samples
+
+// denoiser, an edge avoiding a-trous wavelet filter of the accumulated image guided by the first hit features like SVGF,
+// the path tracer already accumulates so the temporal part only reprojects the last denoised image after a restart
+#define PT_DENOISE_ATROUS_ITERATION_COUNT				5 // 5x5 kernel with a step of 1, 2, 4, 8 and 16 pixels
+#define PT_DENOISE_SIGMA_DEPTH							1.0f // in units of the depth gradient of the pixel times the tap distance
+#define PT_DENOISE_SIGMA_NORMAL							128.0f // exponent of the cosine between the normals
+#define PT_DENOISE_SIGMA_LUMINANCE						4.0f // in standard deviations of the filtered luminance
+#define PT_DENOISE_ALBEDO_MIN							0.001f // illumination is the color divided by the albedo, this keeps black albedo finite
+#define PT_DENOISE_TEMPORAL_VARIANCE_SAMPLE_COUNT_MIN	4 // pixels with fewer samples estimate their variance from their neighbors
+#define PT_DENOISE_PRIOR_WEIGHT_MAX						4.0f // the history reprojected after a restart counts as this many samples at most
+#define PT_DENOISE_REPROJECTION_NORMAL_MIN				0.9f // history texels facing away more than this are rejected
+#define PT_DENOISE_REPROJECTION_DEPTH_TOLERANCE			0.05f // history texels farther than this from the current surface, relative to the distance, are rejected
+
+// samplers, every random number of a path has its own dimension so low discrepancy sequences stay stratified across samples
+#define PT_SAMPLER_RANDOM								0 // hash seeded LCG, white noise
+#define PT_SAMPLER_SOBOL								1 // Owen scrambled Sobol, shuffled per pixel and per dimension pair
+#define PT_SAMPLER_BLUE_NOISE							2 // the same Sobol points for every pixel, shifted by a rank-1 lattice blue noise dither of the pixel
+#define PT_SAMPLER_COUNT								3
+#define PT_SAMPLE_DIMENSION_LENS						0 // 2D, jitter inside the pixel
+#define PT_SAMPLE_DIMENSION_BOUNCE_START				2
+#define PT_SAMPLE_DIMENSION_LIGHT						0 // 2D, offsets of the dimensions of a bounce from here on
+#define PT_SAMPLE_DIMENSION_LIGHT_SELECTION				2 // 1D
+#define PT_SAMPLE_DIMENSION_MATERIAL					3 // 2D, BSDF sample MIS'd with the light sample
+#define PT_SAMPLE_DIMENSION_BSDF						5 // 2D, direction of the next bounce
+#define PT_SAMPLE_DIMENSION_RUSSIAN_ROULETTE			7 // 1D
+#define PT_SAMPLE_DIMENSION_PER_BOUNCE					8
+#define PT_SAMPLE_DIMENSION_COUNT						(PT_SAMPLE_DIMENSION_BOUNCE_START + PT_SAMPLE_DIMENSION_PER_BOUNCE * PT_MAXDEPTH_MAX)
+#define PT_SAMPLER_R2_GENERATOR_X						3242174889u // 1 / plastic number in 0.32 fixed point, generator of the R2 lattice of the blue noise dither
+#define PT_SAMPLER_R2_GENERATOR_Y						2447445413u // 1 / plastic number^2 in 0.32 fixed point
+
+// light selection of the light sample of every bounce
+#define PT_LIGHT_SELECTION_UNIFORM						0 // every light with the same probability
+#define PT_LIGHT_SELECTION_BVH							1 // down the light BVH, each child with the probability of its importance to the shading point
+#define PT_LIGHT_SELECTION_COUNT						2
+#define PT_ONE_MINUS_EPSILON							0.99999994f // largest float below 1
 
 // water sim
 #define WATERSIM_CELL_COUNT_X							32 // 8
@@ -203,6 +270,51 @@ struct BVH
 	UINT mMeshIndex;
 };
 
+// a binary BVH collapsed into nodes of up to PT_WIDE_BVH_WIDTH children
+// child bounds are quantized to 8 bits per axis relative to the node, bound = origin + q * 2^(exponent - 127)
+struct WideBVH
+{
+	FLOAT3 mOrigin;
+	UINT mExponents; // biased x, y, z exponents in the lower 3 bytes, child count in the highest byte
+	UINT mQuantizedMin[PT_WIDE_BVH_PACKED_UINT_COUNT * 3]; // axis major, 4 children per UINT
+	UINT mQuantizedMax[PT_WIDE_BVH_PACKED_UINT_COUNT * 3];
+	UINT mChildIndexLocal[PT_WIDE_BVH_WIDTH]; // wide bvh index for internal children, leaf index for leaf children
+	UINT mLeafMask; // bit i is set if child i is a leaf
+	UINT mMeshIndex;
+};
+
+SHARED_HEADER_CPP_STATIC_INLINE UINT GetWideBvhChildCount(UINT exponents)
+{
+	return exponents >> 24;
+}
+
+SHARED_HEADER_CPP_STATIC_INLINE float GetWideBvhScale(UINT exponents, UINT axis)
+{
+	const UINT biasedExponent = (exponents >> (axis * 8)) & 0xff;
+	return SHARED_HEADER_SWITCH_CPP_HLSL(ldexpf(1.0f, (int)biasedExponent - 127), asfloat(biasedExponent << 23));
+}
+
+SHARED_HEADER_CPP_STATIC_INLINE UINT GetWideBvhQuantized(UINT packed, UINT child)
+{
+	return (packed >> ((child & 3) * 8)) & 0xff;
+}
+
+SHARED_HEADER_CPP_STATIC_INLINE AABB DecodeWideBvhChildAABB(WideBVH node, UINT child)
+{
+	AABB aabb;
+	const UINT packedIndex = child / 4;
+	const float scaleX = GetWideBvhScale(node.mExponents, 0);
+	const float scaleY = GetWideBvhScale(node.mExponents, 1);
+	const float scaleZ = GetWideBvhScale(node.mExponents, 2);
+	aabb.mMin.x = node.mOrigin.x + GetWideBvhQuantized(node.mQuantizedMin[packedIndex], child) * scaleX;
+	aabb.mMin.y = node.mOrigin.y + GetWideBvhQuantized(node.mQuantizedMin[packedIndex + PT_WIDE_BVH_PACKED_UINT_COUNT], child) * scaleY;
+	aabb.mMin.z = node.mOrigin.z + GetWideBvhQuantized(node.mQuantizedMin[packedIndex + PT_WIDE_BVH_PACKED_UINT_COUNT * 2], child) * scaleZ;
+	aabb.mMax.x = node.mOrigin.x + GetWideBvhQuantized(node.mQuantizedMax[packedIndex], child) * scaleX;
+	aabb.mMax.y = node.mOrigin.y + GetWideBvhQuantized(node.mQuantizedMax[packedIndex + PT_WIDE_BVH_PACKED_UINT_COUNT], child) * scaleY;
+	aabb.mMax.z = node.mOrigin.z + GetWideBvhQuantized(node.mQuantizedMax[packedIndex + PT_WIDE_BVH_PACKED_UINT_COUNT * 2], child) * scaleZ;
+	return aabb;
+}
+
 struct GlobalBvhSettings
 {
 	UINT mMeshBvhRootIndex;
@@ -213,11 +325,9 @@ struct MeshPT
 {
 	FLOAT4X4 mModel;
 	FLOAT4X4 mModelInv;
-	UINT mMaterialType;
+	UINT mMaterialType; // same as the type of the material, emitters are told apart without reading it
 	FLOAT3 mEmissive;
-	float mRoughness;
-	float mFresnel;
-	float mMetallic;
+	UINT mMaterialIndex;
 	UINT mTriangleCount;
 	UINT mTriangleIndexLocalToGlobalOffset;
 	UINT mTriangleBvhIndexLocalToGlobalOffset;
@@ -226,6 +336,20 @@ struct MeshPT
 	UINT mTextureCount;
 };
 
+struct MaterialPT
+{
+	UINT mMaterialType;
+	FLOAT3 mAlbedo;
+	float mRoughness;
+	float mFresnel; // F0 of Schlick's approximation, dielectrics take their index of refraction from it
+	float mMetallic;
+	UINT mAlbedoTextureIndex; // into the mesh textures, INVALID_UINT32 to use mAlbedo
+	UINT mUseSceneParameters; // albedo, roughness, fresnel and metallic come from the scene uniform so the UI can tweak them
+	UINT PADDING0;
+	UINT PADDING1;
+	UINT PADDING2;
+};
+
 struct AabbProxy
 {
 	AABB mAABB;
@@ -337,8 +461,31 @@ struct LightData
 	float mAngle;
 	int mTextureIndex;
 	UINT mLightType;
-	UINT PADDING0;
-	UINT PADDING1;
+	UINT mMeshIndex; // LIGHT_TYPE_MESH only
+	UINT mAliasEntryOffset; // LIGHT_TYPE_MESH only, the alias table has one entry per triangle of the mesh
+};
+
+// a triangle of an emissive mesh is picked in constant time by choosing an entry uniformly, then keeping it with mProbability or taking mAlias (Vose 1991)
+struct AliasEntry
+{
+	float mProbability;
+	UINT mAlias;
+};
+
+// binary BVH over the lights of the path tracer, the root is at index 0 and every leaf holds 1 light
+// the bounds of a node are the pbrt-v4 light bounds of Conty Estevez and Kulla 2018, Importance Sampling of Many Lights with Adaptive Tree Splitting
+struct LightBvhNode
+{
+	FLOAT3 mAabbMin;
+	float mPower; // of every light below
+	FLOAT3 mAabbMax;
+	float mCosThetaO; // every emitter normal is within this angle of mAxis
+	FLOAT3 mAxis;
+	float mCosThetaE; // every emitter emits within this angle of its normal
+	UINT mLeftIndex; // light index for leaves
+	UINT mRightIndex;
+	UINT mIsLeaf;
+	UINT mTwoSided;
 };
 
 struct SceneUniform
@@ -410,7 +557,22 @@ struct SceneUniform
 	UINT mPathTracerDebugMeshBvhIndex;
 	float mDebugFloat;
 	float mDebugFloat2;
-	UINT PADDING_2;
+	UINT mPathTracerWatertightTriangles;
+	//
+	UINT mPathTracerAdaptiveSampling;
+	float mPathTracerAdaptiveErrorThreshold; // tiles whose relative error is below this stop taking samples
+	UINT mPathTracerAdaptiveSampleCountMin;
+	float mPathTracerAdaptiveTargetError; // the image is done once the mean relative error of every tile is below this
+	//
+	UINT mPathTracerSampler;
+	UINT mPathTracerSamplerSeed; // picks another scramble and shift of every sequence
+	UINT mPathTracerSamplerOwenScrambling; // random digit scrambling (XOR) of the Sobol points when 0
+	UINT mPathTracerSamplerDimensionMax; // dimensions past this fall back to the random sampler
+	//
+	UINT mPathTracerLightSelection;
+	UINT mPathTracerWavefrontSortByMaterial; // shade the hits of the wavefront mode in material order
+	UINT mPathTracerDenoise; // show the denoised image instead of the accumulated one
+	UINT PADDING2;
 	//
 	LightData mLightData[LIGHT_PER_SCENE_MAX];
 };
@@ -477,6 +639,17 @@ struct PassUniformPathTracer : PassUniformDefault
 	UINT mTriangleCountPT;
 	UINT mMeshCountPT;
 	UINT mLightCountPT;
+	UINT mWavefrontBounceIndex; // only used by the wavefront stages, each bounce has its own passes
+};
+
+struct PassUniformDenoiser : PassUniformDefault
+{
+	FLOAT4X4 mHistoryViewProj; // camera of the frame the history was written at
+	FLOAT3 mHistoryEyePos;
+	UINT mDenoiseIterationIndex; // only used by the a-trous passes, each iteration has its own pass
+	UINT mDenoiseResetPrior; // first frame after a restart, every pixel reprojects the history again once it has a sample
+	UINT mDenoiseHistoryValid;
+	UINT mDenoiseEveryPixelSampled; // every pixel has a sample since the last restart, the prior is reprojected and the history written from then on
 	UINT PADDING_0;
 };
 
@@ -531,7 +704,11 @@ struct ObjectUniform
 	float mRoughness;
 	float mFresnel;
 	float mMetallic;
+	UINT mVertexPacked; // the vertex buffer holds PackedVertex instead of Vertex
+	FLOAT3 mPackedPositionOffset; // object space position of a packed position of 0
 	UINT PADDING_0;
+	FLOAT3 mPackedPositionScale;
+	UINT PADDING_1;
 };
 
 #endif
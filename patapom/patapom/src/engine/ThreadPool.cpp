@@ -0,0 +1,129 @@
+#include "ThreadPool.h"
+
+CommandLineArg PARAM_threadCount("-threadCount"); // total CPU job threads including the main thread
+
+bool						ThreadPool::sInitialized = false;
+bool						ThreadPool::sExit = false;
+u64							ThreadPool::sGeneration = 0;
+u32							ThreadPool::sBusyWorkerCount = 0;
+i64							ThreadPool::sJobCount = 0;
+i64							ThreadPool::sJobGrainSize = 1;
+const ThreadPool::RangeJob*	ThreadPool::sJob = nullptr;
+atomic<i64>					ThreadPool::sJobNextIndex(0);
+vector<thread>				ThreadPool::sWorkers;
+mutex						ThreadPool::sMutex;
+mutex						ThreadPool::sDispatchMutex;
+condition_variable			ThreadPool::sJobCondition;
+condition_variable			ThreadPool::sDoneCondition;
+thread_local bool			ThreadPool::sInsideJob = false;
+thread_local u32			ThreadPool::sThreadIndex = 0;
+
+void ThreadPool::Init(u32 threadCount)
+{
+	if (sInitialized)
+		return;
+	if (threadCount == 0)
+		threadCount = PARAM_threadCount.GetAsInt();
+	if (threadCount == 0)
+		threadCount = thread::hardware_concurrency();
+	if (threadCount == 0)
+		threadCount = 1;
+	sExit = false;
+	for (u32 i = 1; i < threadCount; i++)
+		sWorkers.push_back(thread(WorkerLoop, i));
+	sInitialized = true;
+	displayfln("thread pool initialized with %u threads", threadCount);
+}
+
+void ThreadPool::Shutdown()
+{
+	if (!sInitialized)
+		return;
+	{
+		lock_guard<mutex> lock(sMutex);
+		sExit = true;
+	}
+	sJobCondition.notify_all();
+	for (auto& worker : sWorkers)
+		worker.join();
+	sWorkers.clear();
+	sInitialized = false;
+}
+
+u32 ThreadPool::GetThreadCount()
+{
+	if (!sInitialized)
+		Init();
+	return sWorkers.size() + 1;
+}
+
+bool ThreadPool::IsInsideJob()
+{
+	return sInsideJob;
+}
+
+bool ThreadPool::IsInitialized()
+{
+	return sInitialized;
+}
+
+void ThreadPool::Dispatch(i64 count, i64 grainSize, const RangeJob& job)
+{
+	// only one job is in flight at a time, jobs issued from other threads simply queue up here
+	lock_guard<mutex> dispatchLock(sDispatchMutex);
+	{
+		lock_guard<mutex> lock(sMutex);
+		sJob = &job;
+		sJobCount = count;
+		sJobGrainSize = grainSize;
+		sJobNextIndex = 0;
+		sGeneration++;
+	}
+	sJobCondition.notify_all();
+
+	RunJob();
+
+	// workers that picked up this job keep the busy count above 0 until their last chunk is done
+	unique_lock<mutex> lock(sMutex);
+	sDoneCondition.wait(lock, [] { return sBusyWorkerCount == 0; });
+	sJob = nullptr;
+}
+
+void ThreadPool::RunJob()
+{
+	sInsideJob = true;
+	while (true)
+	{
+		const i64 begin = sJobNextIndex.fetch_add(sJobGrainSize);
+		if (begin >= sJobCount)
+			break;
+		const i64 end = MIN(begin + sJobGrainSize, sJobCount);
+		(*sJob)(begin, end, sThreadIndex);
+	}
+	sInsideJob = false;
+}
+
+void ThreadPool::WorkerLoop(u32 threadIndex)
+{
+	sThreadIndex = threadIndex;
+	u64 generation = 0;
+	while (true)
+	{
+		unique_lock<mutex> lock(sMutex);
+		sJobCondition.wait(lock, [&] { return sExit || sGeneration != generation; });
+		if (sExit)
+			return;
+		generation = sGeneration;
+		if (!sJob) // the job was already finished by others before this thread woke up
+			continue;
+		sBusyWorkerCount++;
+		lock.unlock();
+
+		RunJob();
+
+		lock.lock();
+		sBusyWorkerCount--;
+		if (sBusyWorkerCount == 0)
+			sDoneCondition.notify_all();
+	}
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include "GlobalInclude.h"
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+
+// fork-join pool for CPU side work, the calling thread always takes part in the job
+class ThreadPool
+{
+public:
+	typedef function<void(i64 begin, i64 end, u32 threadIndex)> RangeJob;
+
+	static void Init(u32 threadCount = 0); // 0 means one thread per hardware thread
+	static void Shutdown();
+	static u32 GetThreadCount(); // worker threads + the calling thread
+	static bool IsInsideJob();
+	static bool IsInitialized(); // code that may run during static initialization must not start the pool
+
+	// runs functor(begin, end, threadIndex) over [0, count) in chunks of grainSize and blocks until all chunks are done
+	// threadIndex is in [0, GetThreadCount()), nested calls from inside a job run serially on the current thread
+	template<typename Functor>
+	static void ParallelFor(i64 count, i64 grainSize, Functor functor)
+	{
+		if (count <= 0)
+			return;
+		if (grainSize < 1)
+			grainSize = 1;
+		if (!sInitialized)
+			Init();
+		if (count <= grainSize || sInsideJob || sWorkers.size() == 0)
+		{
+			functor((i64)0, count, sThreadIndex);
+			return;
+		}
+		Dispatch(count, grainSize, RangeJob(functor));
+	}
+
+private:
+	static bool sInitialized;
+	static bool sExit;
+	static u64 sGeneration;
+	static u32 sBusyWorkerCount;
+	static i64 sJobCount;
+	static i64 sJobGrainSize;
+	static const RangeJob* sJob;
+	static atomic<i64> sJobNextIndex;
+	static vector<thread> sWorkers;
+	static mutex sMutex;
+	static mutex sDispatchMutex;
+	static condition_variable sJobCondition;
+	static condition_variable sDoneCondition;
+	static thread_local bool sInsideJob;
+	static thread_local u32 sThreadIndex;
+
+	static void Dispatch(i64 count, i64 grainSize, const RangeJob& job);
+	static void RunJob();
+	static void WorkerLoop(u32 threadIndex);
+};
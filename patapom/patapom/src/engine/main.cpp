@@ -16,13 +16,60 @@
 #include "Renderer.h"
 #include "ImageBasedLighting.h"
 #include "PathTracer.h"
+#include "PathTracerCpu.h"
+#include "Denoiser.h"
 #include "WaterSim.h"
 #include "DeferredLighting.h"
+#include "ThreadPool.h"
 
 HWND gHwnd = NULL; // Handle to the window
 const LPCTSTR WindowName = L"POM"; // name of the window (not the title)
 const LPCTSTR WindowTitle = L"POM_1.0"; // title of the window
 CommandLineArg PARAM_debugMode("-debugMode"); // turning on debug will impact the framerate badly
+CommandLineArg PARAM_renderCpuReference("-renderCpuReference"); // path trace the scene on the CPU with this many samples per pixel (16 by default) and quit, no window or device is created
+CommandLineArg PARAM_cpuReferenceFile("-cpuReferenceFile"); // linear output of -renderCpuReference, pathtracer_cpu_reference.pfm by default, a tonemapped png with the same name is written next to it
+CommandLineArg PARAM_emissiveMesh("-emissiveMesh"); // radiance of the ball in the path tracer, which turns it into a mesh light, e.g. -emissiveMesh=4,4,4
+CommandLineArg PARAM_meshMaterials("-meshMaterials"); // give the meshes their own path tracer materials instead of the material parameters of the UI
+CommandLineArg PARAM_benchmarkObjParser("-benchmarkObjParser"); // time the stringstream and the chunked obj parser on these comma separated obj files and quit, every bundled obj by default
+CommandLineArg PARAM_vertexCacheStats("-vertexCacheStats"); // report vertex reuse and ACMR before and after the vertex cache optimization for these comma separated obj files and quit, every bundled obj by default
+CommandLineArg PARAM_benchmarkMeshCache("-benchmarkMeshCache"); // time parsing these comma separated obj files against reading and mapping their binary mesh caches and quit, every bundled obj by default
+CommandLineArg PARAM_packedVertices("-packedVertices"); // draw the meshes of the standard vertex shader with 20 byte quantized vertices instead of 48 byte float vertices
+CommandLineArg PARAM_packedVertexError("-packedVertexError"); // report the round trip error of the packed vertex layout for these comma separated obj files and quit, every bundled obj by default
+CommandLineArg PARAM_lodErrorPixels("-lodErrorPixels"); // screen space error in pixels the levels of detail of a mesh may show, 1 by default, 0 always draws the full meshes
+CommandLineArg PARAM_meshLodStats("-meshLodStats"); // report the triangle counts and the Hausdorff distance to the full mesh of the levels of detail of these comma separated obj files and quit, every bundled obj by default
+
+// headless mesh reports, each runs on the comma separated obj files given to its flag and quits with 1 if any of them fails
+const char* const MeshReportFileNamesDefault = "box.obj,ball_simple.obj,ball.obj,gameboy.obj,rex.obj"; // every bundled obj
+struct MeshReport
+{
+	CommandLineArg* mArg;
+	bool (*mRun)(const string& fileNames);
+};
+const MeshReport MeshReports[] = {
+	{ &PARAM_benchmarkObjParser, Mesh::BenchmarkObjParser },
+	{ &PARAM_vertexCacheStats, Mesh::ReportVertexCacheStats },
+	{ &PARAM_benchmarkMeshCache, Mesh::BenchmarkMeshCache },
+	{ &PARAM_packedVertexError, Mesh::ReportPackedVertexError },
+	{ &PARAM_meshLodStats, Mesh::ReportLods },
+};
+
+// headless path tracer reports, each runs on the default scene once the systems are initialized and quits with 1 if it fails
+struct SceneReport
+{
+	CommandLineArg* mArg;
+	bool (*mRun)(Scene& scene);
+};
+const SceneReport SceneReports[] = {
+	{ &PARAM_validateBvhMultithreaded, PathTracer::ValidateMultithreadedBvhBuild },
+	{ &PARAM_validateBvhRefit, PathTracer::ValidateBvhRefit },
+	{ &PARAM_benchmarkWideBvh, [](Scene&) { return PathTracerCpu::BenchmarkWideBVH(); } },
+	{ &PARAM_validateBvhCache, PathTracer::ValidateBvhCache },
+	{ &PARAM_validateLargeMesh, PathTracer::ValidateLargeMeshBuild },
+	{ &PARAM_benchmarkRayPackets, PathTracer::BenchmarkRayPackets },
+	{ &PARAM_validateWatertightTriangles, [](Scene&) { return PathTracerCpu::ValidateWatertightTriangles(); } },
+	{ &PARAM_stressInstances, PathTracer::StressTestInstances },
+	{ &PARAM_validateRadixSort, [](Scene&) { return PathTracer::ValidateRadixSort(); } },
+};
 
 // direct input
 IDirectInputDevice8* gDIKeyboard;
@@ -40,6 +87,7 @@ const int MaxFramePerSecond = 240;
 const string ShaderSrcPath = "../../src/shader/";
 const string ShaderBuildPath = "../shader/" PLATFORM_STR "/" CONFIG_STR "/";
 const string AssetPath = "../../asset/";
+const string CachePath = "../cache/";
 
 bool gFullScreen = false; // is window full screen?
 bool gRunning = true; // we will exit the program when this becomes false
@@ -92,6 +140,25 @@ ID3D12DescriptorHeap* g_pd3dSrvDescHeap = NULL;
 void LoadStores()
 {
 	// A. Mesh
+	vector<float> emissive;
+	if (PARAM_emissiveMesh.GetAsFloatVec(emissive) && emissive.size() >= 3)
+		gMesh.SetEmissive(XMFLOAT3(emissive[0], emissive[1], emissive[2]));
+	vector<float> lodErrorPixels;
+	if (PARAM_lodErrorPixels.GetAsFloatVec(lodErrorPixels) && lodErrorPixels.size())
+		Mesh::sLodErrorPixels = lodErrorPixels[0];
+	if (PARAM_packedVertices.Get())
+	{
+		for (Mesh* mesh : { &gCube, &gMesh, &gPlaneX, &gPlaneY, &gPlaneZ })
+			mesh->SetVertexFormat(Mesh::VertexFormat::PACKED);
+	}
+	if (PARAM_meshMaterials.Get())
+	{
+		gMesh.SetMaterial(MATERIAL_TYPE_SPECULAR_TRANSMISSIVE, XMFLOAT3(1.0f, 1.0f, 1.0f), 0.0f, 0.04f, 0.0f);
+		gCube.SetMaterial(MATERIAL_TYPE_SPECULAR_REFLECTIIVE, XMFLOAT3(0.9f, 0.9f, 0.9f), 0.0f, 1.0f, 1.0f);
+		gPlaneX.SetMaterial(MATERIAL_TYPE_DIFFUSE, XMFLOAT3(0.8f, 0.2f, 0.2f), 1.0f, 0.04f, 0.0f);
+		gPlaneY.SetMaterial(MATERIAL_TYPE_GGX, XMFLOAT3(0.9f, 0.7f, 0.4f), 0.3f, 0.9f, 1.0f);
+		gPlaneZ.SetMaterial(MATERIAL_TYPE_DIFFUSE, XMFLOAT3(0.2f, 0.8f, 0.2f), 1.0f, 0.04f, 0.0f);
+	}
 	gMesh.AddTexture(&gTextureAlbedo);
 	gMesh.AddTexture(&gTextureNormal);
 	gCube.AddTexture(&gTextureAlbedo);
@@ -170,6 +237,7 @@ void LoadStores()
 	gPassPathTracerBlit.AddShader(&PathTracer::sPathTracerBlitBackbufferPS);
 	gPassPathTracerBlit.AddTexture(&PathTracer::sBackbufferPT);
 	gPassPathTracerBlit.AddTexture(&PathTracer::sDebugBackbufferPT);
+	gPassPathTracerBlit.AddTexture(&Denoiser::sDenoisedPT);
 	
 	// shader toy debug
 	gPassShadertoyDebug.AddMesh(&gFullscreenTriangle);
@@ -498,6 +566,8 @@ bool InitImgui()
 void UpdateGameLogic()
 {
 	// update game logic (before waiting for the current frame to finish)
+	if (gPathTracerMode && PathTracer::UpdateMeshTransforms(gSceneDefault))
+		PathTracer::Restart(gSceneDefault);
 }
 
 void UpdateResourcesGPU()
@@ -519,7 +589,8 @@ void Record()
 	{
 		GPU_LABEL(commandList, "Pathtracer");
 
-		bool finished = gSceneDefault.mSceneUniform.mPathTracerCurrentSampleIndex >= gSceneDefault.mSceneUniform.mPathTracerMaxSampleCountPerPixel;
+		PathTracer::ReadAdaptiveTileErrors(gSceneDefault);
+		bool finished = gSceneDefault.mSceneUniform.mPathTracerCurrentSampleIndex >= gSceneDefault.mSceneUniform.mPathTracerMaxSampleCountPerPixel || PathTracer::IsAdaptiveTargetErrorReached(gSceneDefault);
 		if (finished && gPathTracerForceUpdate)
 			gSceneDefault.mSceneUniform.mPathTracerCurrentSampleIndex = 0;
 		bool runPathTracer = !finished || gPathTracerForceUpdate;
@@ -546,6 +617,14 @@ void Record()
 					gSceneDefault.mSceneUniform.mPathTracerCurrentSampleIndex++;
 				}
 			}
+			else if (gSceneDefault.mSceneUniform.mPathTracerMode == PT_MODE_WAVEFRONT)
+			{
+				// every bounce of the whole screen in one frame, tiles don't apply
+				PathTracer::RunPathTracerWavefront(commandList);
+				gSceneDefault.mSceneUniform.mPathTracerCurrentTileIndex = 0;
+				gSceneDefault.mSceneUniform.mPathTracerCurrentDepth = 0;
+				gSceneDefault.mSceneUniform.mPathTracerCurrentSampleIndex++;
+			}
 			else
 			{
 				PathTracer::RunPathTracer(commandList); 
@@ -564,8 +643,11 @@ void Record()
 		// always copy depth buffer even when we don't run path tracer to refresh the depth buffer
 		PathTracer::CopyDepthBuffer(commandList);
 		PathTracer::DebugDraw(commandList);
+		if (gSceneDefault.mSceneUniform.mPathTracerDenoise)
+			Denoiser::RunDenoiser(commandList, gSceneDefault);
 		PathTracer::sBackbufferPT.MakeReadyToRead(commandList);
 		PathTracer::sDebugBackbufferPT.MakeReadyToRead(commandList);
+		Denoiser::sDenoisedPT.MakeReadyToRead(commandList);
 		gRenderer.RecordGraphicsPass(gPassPathTracerBlit, commandList);
 		if (runPathTracer)
 			gSceneDefault.SetUniformDirty(); // set dirty in the end for subsequent drawcalls (mainly for next frame)
@@ -788,6 +870,18 @@ void UpdateUI(bool initOnly = false)
 	static bool pathTracerUpdateDebug = gSceneDefault.mSceneUniform.mPathTracerUpdateDebug = 0;
 	static bool pathTracerEnableRussianRoulette = gSceneDefault.mSceneUniform.mPathTracerEnableRussianRoulette = true;
 	static bool pathTracerUseBVH = gSceneDefault.mSceneUniform.mPathTracerUseBVH = true;
+	static bool pathTracerWatertightTriangles = gSceneDefault.mSceneUniform.mPathTracerWatertightTriangles = true;
+	static bool pathTracerAdaptiveSampling = gSceneDefault.mSceneUniform.mPathTracerAdaptiveSampling = false;
+	static float pathTracerAdaptiveErrorThreshold = gSceneDefault.mSceneUniform.mPathTracerAdaptiveErrorThreshold = 0.04f;
+	static int pathTracerAdaptiveSampleCountMin = gSceneDefault.mSceneUniform.mPathTracerAdaptiveSampleCountMin = 4;
+	static float pathTracerAdaptiveTargetError = gSceneDefault.mSceneUniform.mPathTracerAdaptiveTargetError = 0.05f;
+	static int pathTracerSampler = gSceneDefault.mSceneUniform.mPathTracerSampler = PT_SAMPLER_RANDOM;
+	static int pathTracerSamplerSeed = gSceneDefault.mSceneUniform.mPathTracerSamplerSeed = 0;
+	static bool pathTracerSamplerOwenScrambling = gSceneDefault.mSceneUniform.mPathTracerSamplerOwenScrambling = true;
+	static int pathTracerSamplerDimensionMax = gSceneDefault.mSceneUniform.mPathTracerSamplerDimensionMax = PT_SAMPLE_DIMENSION_COUNT;
+	static int pathTracerLightSelection = gSceneDefault.mSceneUniform.mPathTracerLightSelection = PT_LIGHT_SELECTION_BVH;
+	static bool pathTracerWavefrontSortByMaterial = gSceneDefault.mSceneUniform.mPathTracerWavefrontSortByMaterial = true;
+	static bool pathTracerDenoise = gSceneDefault.mSceneUniform.mPathTracerDenoise = false;
 	static float pathTracerDebugDirLength = gSceneDefault.mSceneUniform.mPathTracerDebugDirLength = 0.0f;
 	static int pathTracerDebugMeshBvhIndex = gSceneDefault.mSceneUniform.mPathTracerDebugMeshBvhIndex = 0;
 	static int pathTracerDebugTriangleBvhIndex = gSceneDefault.mSceneUniform.mPathTracerDebugTriangleBvhIndex = 0;
@@ -1124,7 +1218,7 @@ void UpdateUI(bool initOnly = false)
 
 		if (ImGui::TreeNode("Pathtracer"))
 		{
-			if (ImGui::Combo("pathTracerMode", &gPathTracerMode, "off\0default\0progressive\0triangle\0light\0mesh\0albedo\0normal"))
+			if (ImGui::Combo("pathTracerMode", &gPathTracerMode, "off\0default\0progressive\0triangle\0light\0mesh\0albedo\0normal\0wavefront"))
 			{
 				gSceneDefault.mSceneUniform.mPathTracerMode = gPathTracerMode;
 				needToRestartPathTracer = true;
@@ -1150,6 +1244,78 @@ void UpdateUI(bool initOnly = false)
 				needToRestartPathTracer = true;
 			}
 
+			if (ImGui::Checkbox("pathTracerWatertightTriangles", &pathTracerWatertightTriangles))
+			{
+				gSceneDefault.mSceneUniform.mPathTracerWatertightTriangles = pathTracerWatertightTriangles;
+				needToRestartPathTracer = true;
+			}
+
+			if (ImGui::Checkbox("pathTracerAdaptiveSampling", &pathTracerAdaptiveSampling))
+			{
+				gSceneDefault.mSceneUniform.mPathTracerAdaptiveSampling = pathTracerAdaptiveSampling;
+				needToRestartPathTracer = true;
+			}
+
+			if (ImGui::SliderFloat("pathTracerAdaptiveErrorThreshold", &pathTracerAdaptiveErrorThreshold, 0.001f, 0.5f))
+			{
+				gSceneDefault.mSceneUniform.mPathTracerAdaptiveErrorThreshold = pathTracerAdaptiveErrorThreshold;
+				needToUpdateSceneUniform = true;
+			}
+
+			if (ImGui::SliderInt("pathTracerAdaptiveSampleCountMin", &pathTracerAdaptiveSampleCountMin, PT_ADAPTIVE_SAMPLE_COUNT_MIN, 100))
+			{
+				gSceneDefault.mSceneUniform.mPathTracerAdaptiveSampleCountMin = pathTracerAdaptiveSampleCountMin;
+				needToUpdateSceneUniform = true;
+			}
+
+			if (ImGui::SliderFloat("pathTracerAdaptiveTargetError", &pathTracerAdaptiveTargetError, 0.001f, 0.5f))
+			{
+				gSceneDefault.mSceneUniform.mPathTracerAdaptiveTargetError = pathTracerAdaptiveTargetError;
+				needToUpdateSceneUniform = true;
+			}
+
+			if (ImGui::Combo("pathTracerSampler", &pathTracerSampler, "random\0sobol\0blue noise"))
+			{
+				gSceneDefault.mSceneUniform.mPathTracerSampler = pathTracerSampler;
+				needToRestartPathTracer = true;
+			}
+
+			if (ImGui::SliderInt("pathTracerSamplerSeed", &pathTracerSamplerSeed, 0, 100))
+			{
+				gSceneDefault.mSceneUniform.mPathTracerSamplerSeed = pathTracerSamplerSeed;
+				needToRestartPathTracer = true;
+			}
+
+			if (ImGui::Checkbox("pathTracerSamplerOwenScrambling", &pathTracerSamplerOwenScrambling))
+			{
+				gSceneDefault.mSceneUniform.mPathTracerSamplerOwenScrambling = pathTracerSamplerOwenScrambling;
+				needToRestartPathTracer = true;
+			}
+
+			if (ImGui::SliderInt("pathTracerSamplerDimensionMax", &pathTracerSamplerDimensionMax, 0, PT_SAMPLE_DIMENSION_COUNT))
+			{
+				gSceneDefault.mSceneUniform.mPathTracerSamplerDimensionMax = pathTracerSamplerDimensionMax;
+				needToRestartPathTracer = true;
+			}
+
+			if (ImGui::Combo("pathTracerLightSelection", &pathTracerLightSelection, "uniform\0bvh"))
+			{
+				gSceneDefault.mSceneUniform.mPathTracerLightSelection = pathTracerLightSelection;
+				needToRestartPathTracer = true;
+			}
+
+			if (ImGui::Checkbox("pathTracerWavefrontSortByMaterial", &pathTracerWavefrontSortByMaterial))
+			{
+				gSceneDefault.mSceneUniform.mPathTracerWavefrontSortByMaterial = pathTracerWavefrontSortByMaterial;
+				needToUpdateSceneUniform = true;
+			}
+
+			if (ImGui::Checkbox("pathTracerDenoise", &pathTracerDenoise))
+			{
+				gSceneDefault.mSceneUniform.mPathTracerDenoise = pathTracerDenoise;
+				needToUpdateSceneUniform = true;
+			}
+
 			if (ImGui::SliderInt("pathTracerMinDepth", &pathTracerMinDepth, 0, PT_MINDEPTH_MAX))
 			{
 				gSceneDefault.mSceneUniform.mPathTracerMinDepth = pathTracerMinDepth;
@@ -1232,6 +1398,12 @@ void UpdateUI(bool initOnly = false)
 				gSceneDefault.mSceneUniform.mPathTracerMaxDepth,
 				gSceneDefault.mSceneUniform.mPathTracerCurrentSampleIndex,
 				gSceneDefault.mSceneUniform.mPathTracerMaxSampleCountPerPixel);
+			if (gSceneDefault.mSceneUniform.mPathTracerAdaptiveSampling)
+				ImGui::Text("[Adaptive] error:%.4f/%.4f, active tiles:%d/%d",
+					PathTracer::sAdaptiveGlobalError,
+					gSceneDefault.mSceneUniform.mPathTracerAdaptiveTargetError,
+					PathTracer::sAdaptiveActiveTileCount,
+					PT_ADAPTIVE_TILE_COUNT);
 			ImGui::Text("Hold C + RMB to use mouse to select debug pixel.");
 			ImGui::TreePop();
 		}
@@ -1274,6 +1446,8 @@ void Cleanup()
 	gDirectInput->Release();
 
 	ImageBasedLighting::Shutdown();
+	Denoiser::Shutdown();
+	ThreadPool::Shutdown();
 }
 
 extern LRESULT ImGui_ImplWin32_WndProcHandler(HWND hWnd, UINT msg, WPARAM wParam, LPARAM lParam);
@@ -1404,6 +1578,7 @@ void InitSystems()
 {
 	ImageBasedLighting::InitIBL(gStoreDefault, gSceneDefault);
 	PathTracer::InitPathTracer(gStoreDefault, gSceneDefault);
+	Denoiser::InitDenoiser(gStoreDefault, gSceneDefault);
 	WaterSim::InitWaterSim(gStoreDefault, gSceneDefault);
 }
 
@@ -1426,6 +1601,34 @@ void PrepareSystems()
 	gRenderer.EndSingleTimeCommands();
 }
 
+// headless, but it still enters through WinMain so it only runs on Windows, returns the exit code of the process
+int RenderCpuReference()
+{
+	// everything the CPU path tracer reads is built on the CPU before the renderer starts
+	LoadStores();
+	InitSystems();
+	UpdateUI(true); // scene uniform defaults live in the UI
+	gCameraMain.Update();
+
+	string filePathName = "pathtracer_cpu_reference.pfm";
+	PARAM_cpuReferenceFile.GetAsString(filePathName);
+	const int sampleCount = PARAM_renderCpuReference.GetAsInt() > 0 ? PARAM_renderCpuReference.GetAsInt() : 16;
+	const bool passed = PathTracerCpu::RenderReference(gSceneDefault.mSceneUniform, gCameraMain, sampleCount, filePathName);
+
+	ThreadPool::Shutdown();
+	return passed ? 0 : 1;
+}
+
+// headless like RenderCpuReference, returns the exit code of the process
+int RunSceneReport(const SceneReport& report)
+{
+	LoadStores();
+	InitSystems();
+	const bool passed = report.mRun(gSceneDefault);
+	ThreadPool::Shutdown();
+	return passed ? 0 : 1;
+}
+
 int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR lpCmdLine, int nShowCmd) // need either wWinMain or GetCommandLine to get the unicode command line
 {
 #if _CONSOLE
@@ -1433,6 +1636,30 @@ int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR lpCmdLine
 #endif
 	InitCommandLineArgs(lpCmdLine);
 
+	if (!PathTracer::ReadBvhBuilderArg())
+		return 1;
+
+	if (PARAM_renderCpuReference.Get())
+		return RenderCpuReference();
+
+	for (const SceneReport& report : SceneReports)
+	{
+		if (report.mArg->Get())
+			return RunSceneReport(report);
+	}
+
+	for (const MeshReport& report : MeshReports)
+	{
+		if (report.mArg->Get())
+		{
+			string fileNames = MeshReportFileNamesDefault;
+			report.mArg->GetAsString(fileNames);
+			const bool passed = report.mRun(fileNames);
+			ThreadPool::Shutdown();
+			return passed ? 0 : 1;
+		}
+	}
+
 	// create the window
 	if (!InitWindow(hInstance, gWindowWidth, gWindowHeight, nShowCmd, gFullScreen))
 	{
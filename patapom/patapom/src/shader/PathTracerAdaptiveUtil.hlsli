@@ -0,0 +1,59 @@
+#ifndef PATHTRACER_ADAPTIVE_UTIL_H
+#define PATHTRACER_ADAPTIVE_UTIL_H
+
+// every pixel keeps its sample count, running mean luminance, sum of squared differences from the mean (Welford)
+// and relative error in gConvergencePT, the backbuffer is averaged with the sample count of the pixel instead of the global sample index
+// so tiles that stop taking samples don't darken
+
+uint GetAdaptiveTileIndex(uint2 screenPos)
+{
+	uint2 tilePos = screenPos / PT_ADAPTIVE_TILE_SIZE;
+	return tilePos.x + tilePos.y * PT_ADAPTIVE_TILE_COUNT_X;
+}
+
+float GetAdaptiveLuminance(float3 color)
+{
+	return dot(color, float3(0.2126f, 0.7152f, 0.0722f));
+}
+
+// standard error of the mean luminance relative to the mean, 1 until there are enough samples to tell
+float GetPixelRelativeError(float sampleCount, float mean, float m2)
+{
+	if (sampleCount < PT_ADAPTIVE_SAMPLE_COUNT_MIN)
+		return 1.0f;
+	float standardError = sqrt(m2 / ((sampleCount - 1.0f) * sampleCount));
+	return min(standardError / (mean + PT_ADAPTIVE_LUMINANCE_BIAS), 1.0f);
+}
+
+float4 UpdateConvergence(float4 convergence, float3 color)
+{
+	float luminance = GetAdaptiveLuminance(color);
+	float sampleCount = convergence.x + 1.0f;
+	float delta = luminance - convergence.y;
+	float mean = convergence.y + delta / sampleCount;
+	float m2 = convergence.z + delta * (luminance - mean);
+	return float4(sampleCount, mean, m2, GetPixelRelativeError(sampleCount, mean, m2));
+}
+
+// the tile errors are written after every frame, they are only trusted once every pixel had the min sample count since the last restart
+bool IsAdaptiveTileConverged(uint2 screenPos)
+{
+	if (!uScene.mPathTracerAdaptiveSampling || uScene.mPathTracerCurrentSampleIndex < max(uScene.mPathTracerAdaptiveSampleCountMin, PT_ADAPTIVE_SAMPLE_COUNT_MIN))
+		return false;
+	return gAdaptiveTileErrorBuffer[GetAdaptiveTileIndex(screenPos)] < uScene.mPathTracerAdaptiveErrorThreshold;
+}
+
+void ClearAdaptiveSamples(uint2 screenPos)
+{
+	gBackbufferPT[screenPos] = 0.0f.xxxx;
+	gConvergencePT[screenPos] = 0.0f.xxxx;
+}
+
+void AccumulateAdaptiveSample(uint2 screenPos, float3 color)
+{
+	float4 convergence = gConvergencePT[screenPos];
+	gBackbufferPT[screenPos] = (gBackbufferPT[screenPos] * convergence.x + float4(color, 1.0f)) / (convergence.x + 1.0f);
+	gConvergencePT[screenPos] = UpdateConvergence(convergence, color);
+}
+
+#endif
@@ -0,0 +1,1051 @@
+#ifndef PATHTRACER_COMMON_H
+#define PATHTRACER_COMMON_H
+
+// everything the path tracer kernels share, include it after declaring the scene buffers of the pass (t0 to t6) and uPass
+
+#define PT_INTERSECTION_TYPE_MASK				0x00000003			// ... 0000 0011
+#define PT_INTERSECTION_TYPE_MATERIAL			0x00000001			// ... 0000 0001
+#define PT_INTERSECTION_TYPE_LIGHT				0x00000002			// ... 0000 0010
+#define PT_INTERSECTION_LIGHT_TYPE_SHIFT		2
+#define PT_INTERSECTION_LIGHT_TYPE_MASK			0x0000000C			// ... 0000 1100
+#define PT_LIGHT_TYPE_TO_INTERSECTION(x)		(x << PT_INTERSECTION_LIGHT_TYPE_SHIFT)
+#define PT_INTERSECTION_LIGHT_TYPE_INVALID		PT_LIGHT_TYPE_TO_INTERSECTION(LIGHT_TYPE_INVALID)	// ... 0000 0000
+#define PT_INTERSECTION_LIGHT_TYPE_QUAD			PT_LIGHT_TYPE_TO_INTERSECTION(LIGHT_TYPE_QUAD)		// ... 0000 0010
+#define PT_INTERSECTION_LIGHT_TYPE_POINT		PT_LIGHT_TYPE_TO_INTERSECTION(LIGHT_TYPE_POINT)	// ... 0000 0100
+#define PT_INTERSECTION_LIGHT_TYPE_SPHERE		PT_LIGHT_TYPE_TO_INTERSECTION(LIGHT_TYPE_SPHERE)	// ... 0000 0110
+
+struct Intersection 
+{
+	uint mTriangleIndex;
+	uint mMeshIndex;
+	uint mLightIndex;
+	float3 mPointWorld;
+	float3 mPointModel;
+	uint mIntersectionFlags; // to cache small but important information so that we don't need to constantly evaluate surface during intersection test
+	uint mRayAabbTestCount;
+};
+
+struct SurfaceDataInPT : SurfaceDataIn
+{
+	float2 mUV;
+	float4 mTanWorld;
+	uint mMaterialType;
+	float3 mEmissive;
+};
+Intersection InitIntersection()
+{
+	Intersection it = (Intersection)0;
+	it.mTriangleIndex = INVALID_UINT32;
+	it.mMeshIndex = INVALID_UINT32;
+	it.mLightIndex = INVALID_UINT32;
+	it.mPointWorld = 0.0f.xxx;
+	it.mPointModel = 0.0f.xxx;
+	it.mIntersectionFlags = 0;
+	it.mRayAabbTestCount = 0;
+	return it;
+}
+
+Intersection SetIntersection(uint meshIndex, uint triangleIndex, float4x4 model, float3 oriModel, float3 dirModel, float tModel, uint itFlag)
+{
+	Intersection it = (Intersection)0;
+	it.mTriangleIndex = triangleIndex;
+	it.mMeshIndex = meshIndex;
+	it.mPointModel = oriModel + dirModel * tModel;
+	it.mPointWorld = mul(model, float4(it.mPointModel, 1)).xyz;
+	uint bitsToUnset = ~(PT_INTERSECTION_TYPE_MASK);
+	it.mIntersectionFlags &= bitsToUnset;
+	it.mIntersectionFlags |= itFlag;
+	it.mRayAabbTestCount = 0;
+	return it;
+}
+
+float RaySphere(float3 p, float r, float3 ori, float3 dir)
+{
+	float3 v = p - ori;
+	float t = dot(v, dir);
+	if (t > 0.0f && length(v - t * dir) < r)
+		return t;
+	else
+		return -1.0f;
+}
+
+float RayPlane(float3 p, float3 nor, float3 ori, float3 dir)
+{
+	// return 0.0f when ray is parallel to plane
+	float norDotDir = dot(nor, dir);
+	if (norDotDir == 0.0f)
+		return 0.0f;
+	else
+		return dot(nor, (p - ori)) / norDotDir;
+}
+
+// done in local space
+float RayQuad(float4x4 modelMatInv, float3 pos, float3 nor, float3 scale, float3 dir, float3 ori)
+{
+	// early reject
+	float t = RayPlane(pos, nor, ori, dir);
+	if (t <= 0.0f)
+		return t;
+
+	float3 oriLocal = mul(modelMatInv, float4(ori, 1.0f)).xyz;
+	float3 dirLocal = mul(modelMatInv, float4(dir, 0.0f)).xyz;
+	float tLocal = t * length(dirLocal) / length(dir);
+
+	float3 pLocal = oriLocal + dirLocal * tLocal;
+	if (pLocal.x > -scale.x && pLocal.x < scale.x && pLocal.y > -scale.y && pLocal.y < scale.y)
+		return t;
+	else
+		return t = -1.0f;
+}
+
+float RayTriangle(TrianglePT tri, float3 ori, float3 dir)
+{
+	// early reject
+	float3 nor = normalize(cross(tri.mVertices[1].pos - tri.mVertices[0].pos, tri.mVertices[2].pos - tri.mVertices[0].pos));
+	float t = RayPlane(tri.mVertices[0].pos, nor, ori, dir);
+	if (t <= 0.0f) 
+		return t;
+
+	float3 p = ori + t * dir;
+	float sign01 = dot(nor, cross(tri.mVertices[1].pos - tri.mVertices[0].pos, p - tri.mVertices[0].pos));
+	float sign12 = dot(nor, cross(tri.mVertices[2].pos - tri.mVertices[1].pos, p - tri.mVertices[1].pos));
+	float sign20 = dot(nor, cross(tri.mVertices[0].pos - tri.mVertices[2].pos, p - tri.mVertices[2].pos));
+
+	if (sign01 > 0 && sign12 > 0 && sign20 > 0)
+		return t;
+	else
+		return -1.0f;
+}
+
+float RayTriangleWatertight(TrianglePT tri, float3 ori, float3 dir)
+{
+	// Woop et al. 2013, shear the triangle so the ray runs along +z through the origin, neighboring triangles then
+	// evaluate their shared edge on the same 2D coordinates and a ray can't slip between them.
+	// the CPU version redoes edge functions that round to 0 in double, there is no such fallback here
+	float3 dirAbs = abs(dir);
+	uint kz = dirAbs.x > dirAbs.y ? (dirAbs.x > dirAbs.z ? 0 : 2) : (dirAbs.y > dirAbs.z ? 1 : 2);
+	uint kx = (kz + 1) % 3;
+	uint ky = (kx + 1) % 3;
+	if (dir[kz] < 0.0f)
+	{
+		// keep the winding
+		uint kTemp = kx;
+		kx = ky;
+		ky = kTemp;
+	}
+	float3 shear = float3(dir[kx], dir[ky], 1.0f) / dir[kz];
+
+	float3 a = tri.mVertices[0].pos - ori;
+	float3 b = tri.mVertices[1].pos - ori;
+	float3 c = tri.mVertices[2].pos - ori;
+	float2 a2 = float2(a[kx], a[ky]) - shear.xy * a[kz];
+	float2 b2 = float2(b[kx], b[ky]) - shear.xy * b[kz];
+	float2 c2 = float2(c[kx], c[ky]) - shear.xy * c[kz];
+	// precise keeps these from turning into mad, which would break the exact negation of a shared edge between its two triangles
+	precise float u = c2.x * b2.y - c2.y * b2.x;
+	precise float v = a2.x * c2.y - a2.y * c2.x;
+	precise float w = b2.x * a2.y - b2.y * a2.x;
+
+	if ((u < 0.0f || v < 0.0f || w < 0.0f) && (u > 0.0f || v > 0.0f || w > 0.0f))
+		return -1.0f;
+	float det = u + v + w;
+	if (det == 0.0f)
+		return -1.0f;
+	float t = (u * shear.z * a[kz] + v * shear.z * b[kz] + w * shear.z * c[kz]) / det;
+	return t > 0.0f ? t : -1.0f;
+}
+
+float RayLight(LightData ld, float3 ori, float3 dir)
+{
+	float t = -1.0f;
+	if (ld.mLightType == LIGHT_TYPE_POINT)
+	{
+		// geometrically treat point light as sphere for now
+		t = RaySphere(ld.mPosWorld, PT_POINT_LIGHT_RADIUS, ori, dir);
+	}
+	else if (ld.mLightType == LIGHT_TYPE_QUAD)
+	{
+		// use light view matrix as inverse model matrix to transform dir and ori from world space to local space
+		t = RayQuad(ld.mView, ld.mPosWorld, ld.mDirWorld, ld.mScale, dir, ori);
+	}
+	else if (ld.mLightType == LIGHT_TYPE_SPHERE)
+	{
+		// TODO: add RaySphere
+	}
+	return t;
+}
+
+float RayAabbFace(AABB aabb, uint face, float3 ori, float3 dir)
+{
+	float3 nor = float3(0.0f, 0.0f, 0.0f);
+	float3 pos = float3(0.0f, 0.0f, 0.0f);
+
+	switch (face)
+	{
+	case 0:
+		nor = float3(0.0f, 0.0f, -1.0f);
+		pos = aabb.mMin;
+		break;
+	case 1:
+		nor = float3(1.0f, 0.0f, 0.0f);
+		pos = aabb.mMax;
+		break;
+	case 2:
+		nor = float3(0.0f, 0.0f, 1.0f);
+		pos = aabb.mMax;
+		break;
+	case 3:
+		nor = float3(-1.0f, 0.0f, 0.0f);
+		pos = aabb.mMin;
+		break;
+	case 4:
+		nor = float3(0.0f, -1.0f, 0.0f);
+		pos = aabb.mMin;
+		break;
+	case 5:
+		nor = float3(0.0f, 1.0f, 0.0f);
+		pos = aabb.mMax;
+		break;
+	default:
+		return -1.0f;
+		break;
+	}
+
+	if (dot(dir, nor) == 0.0f) 
+		return -1.0f;
+	float t = dot(pos - ori, nor) / dot(dir, nor);
+	float3 p = ori + t * dir;
+
+	switch (face)
+	{
+	case 0:
+	case 2:
+		if (p.x < aabb.mMin.x || p.x > aabb.mMax.x || p.y < aabb.mMin.y || p.y > aabb.mMax.y)
+			t = -1.0f;
+		break;
+	case 1:
+	case 3:
+		if (p.z < aabb.mMin.z || p.z > aabb.mMax.z || p.y < aabb.mMin.y || p.y > aabb.mMax.y)
+			t = -1.0f;
+		break;
+	case 4:
+	case 5:
+		if (p.x < aabb.mMin.x || p.x > aabb.mMax.x || p.z < aabb.mMin.z || p.z > aabb.mMax.z)
+			t = -1.0f;
+		break;
+	default:
+		t = -1.0f;
+		break;
+	}
+	return t;
+}
+
+float RayAABB(AABB aabb, float3 ori, float3 dir)
+{
+	float minT = -1.0f;
+	float maxT = -1.0f;
+
+	[unroll]
+	for (uint i = 0; i < 6; i++)
+	{
+		float t = RayAabbFace(aabb, i, ori, dir);
+		if (t > 0.0f)
+		{
+			if (minT < 0.0f || t < minT)
+			{
+				minT = t;
+			}
+			if (maxT < 0.0f || t > maxT)
+			{
+				maxT = t;
+			}
+		}
+	}
+
+	// not using maxT for now
+	return minT;
+}
+
+// cos(a - b) and sin(a - b) with a - b clamped to at least 0, from the sine and cosine of a and b
+float CosSubClamped(float sinA, float cosA, float sinB, float cosB)
+{
+	if (cosA > cosB)
+		return 1.0f;
+	return cosA * cosB + sinA * sinB;
+}
+
+float SinSubClamped(float sinA, float cosA, float sinB, float cosB)
+{
+	if (cosA > cosB)
+		return 0.0f;
+	return sinA * cosB - cosA * sinB;
+}
+
+// bound of the light of a light BVH node reaching pos, pbrt-v4's LightBounds::Importance
+// the angle between the node and the closest emitter normal is reduced by the angle the node subtends from pos
+float GetLightBvhImportance(LightBvhNode node, float3 pos, float3 nor)
+{
+	if (node.mPower <= 0.0f)
+		return 0.0f;
+	float3 center = (node.mAabbMin + node.mAabbMax) * 0.5f;
+	float3 centerToPos = pos - center;
+	float distance2 = dot(centerToPos, centerToPos);
+	float r2 = dot(node.mAabbMax - center, node.mAabbMax - center);
+	float d2 = max(distance2, sqrt(r2)); // pbrt-v4 keeps the distance away from 0 with half the diagonal
+	float3 wi = distance2 > 0.0f ? centerToPos * rsqrt(distance2) : 0.0f.xxx;
+	float cosThetaW = dot(node.mAxis, wi);
+	if (node.mTwoSided)
+		cosThetaW = abs(cosThetaW);
+	float sinThetaW = sqrt(saturate(1.0f - cosThetaW * cosThetaW));
+	// inside the bounding sphere of the node light can come from anywhere
+	bool inside = distance2 <= r2;
+	float sinThetaB = inside ? 0.0f : sqrt(r2 / distance2);
+	float cosThetaB = inside ? -1.0f : sqrt(saturate(1.0f - r2 / distance2));
+	float sinThetaO = sqrt(saturate(1.0f - node.mCosThetaO * node.mCosThetaO));
+	float cosThetaX = CosSubClamped(sinThetaW, cosThetaW, sinThetaO, node.mCosThetaO);
+	float sinThetaX = SinSubClamped(sinThetaW, cosThetaW, sinThetaO, node.mCosThetaO);
+	float cosThetaP = CosSubClamped(sinThetaX, cosThetaX, sinThetaB, cosThetaB);
+	if (cosThetaP <= node.mCosThetaE)
+		return 0.0f;
+	float importance = node.mPower * cosThetaP / d2;
+	// the receiver side is two sided as well, transmissive materials light their back
+	if (any(nor != 0.0f))
+	{
+		float cosThetaI = abs(dot(wi, normalize(nor)));
+		float sinThetaI = sqrt(saturate(1.0f - cosThetaI * cosThetaI));
+		importance *= CosSubClamped(sinThetaI, cosThetaI, sinThetaB, cosThetaB);
+	}
+	return max(importance, 0.0f);
+}
+
+// light of the light sample at pos, pdf is the probability of picking it and INVALID_UINT32 means no light can reach pos
+uint SampleLightIndex(float3 pos, float3 nor, float u, out float pdf)
+{
+	pdf = 0.0f;
+	if (uPass.mLightCountPT == 0)
+		return INVALID_UINT32;
+	if (uScene.mPathTracerLightSelection == PT_LIGHT_SELECTION_UNIFORM)
+	{
+		pdf = 1.0f / uPass.mLightCountPT;
+		return min(uint(u * uPass.mLightCountPT), uPass.mLightCountPT - 1);
+	}
+	// down the light BVH, each child with its share of the importance, u is rescaled to pick again at the next level
+	LightBvhNode node = gLightBvhBuffer[0];
+	if (node.mIsLeaf && GetLightBvhImportance(node, pos, nor) <= 0.0f)
+		return INVALID_UINT32;
+	float pmf = 1.0f;
+	while (!node.mIsLeaf)
+	{
+		LightBvhNode left = gLightBvhBuffer[node.mLeftIndex];
+		LightBvhNode right = gLightBvhBuffer[node.mRightIndex];
+		float importanceLeft = GetLightBvhImportance(left, pos, nor);
+		float importanceRight = GetLightBvhImportance(right, pos, nor);
+		if (importanceLeft <= 0.0f && importanceRight <= 0.0f)
+			return INVALID_UINT32;
+		float pLeft = importanceLeft / (importanceLeft + importanceRight);
+		if (u < pLeft)
+		{
+			u = min(u / pLeft, PT_ONE_MINUS_EPSILON);
+			pmf *= pLeft;
+			node = left;
+		}
+		else
+		{
+			u = min((u - pLeft) / (1.0f - pLeft), PT_ONE_MINUS_EPSILON);
+			pmf *= 1.0f - pLeft;
+			node = right;
+		}
+	}
+	pdf = pmf;
+	return node.mLeftIndex;
+}
+
+float IntersectLights(out Intersection it, float3 ori, float3 dir)
+{
+	it = InitIntersection();
+	float tmin = -1.0f;
+	if (uPass.mLightCountPT == 0)
+		return tmin;
+	uint stack[PT_LIGHT_BVH_STACK_SIZE];
+	uint top = 0;
+	stack[top++] = 0;
+	while (top > 0)
+	{
+		LightBvhNode node = gLightBvhBuffer[stack[--top]];
+		AABB aabb;
+		aabb.mMin = node.mAabbMin;
+		aabb.mMax = node.mAabbMax;
+		if (RayAABB(aabb, ori, dir) <= 0.0f)
+			continue;
+		if (!node.mIsLeaf)
+		{
+			stack[top++] = node.mLeftIndex;
+			stack[top++] = node.mRightIndex;
+			continue;
+		}
+		uint lightIndex = node.mLeftIndex;
+		float t = RayLight(gLightDataBufferPT[lightIndex], ori, dir);
+		if (t > 0.0f && (t < tmin || tmin < 0.0f))
+		{
+			tmin = t;
+			it.mLightIndex = lightIndex;
+			it.mPointWorld = ori + dir * t;
+			it.mPointModel = it.mPointWorld; // lights are in world space
+			uint bitsToUnset = ~(PT_INTERSECTION_LIGHT_TYPE_MASK | PT_INTERSECTION_TYPE_MASK);
+			it.mIntersectionFlags &= bitsToUnset;
+			it.mIntersectionFlags |= (PT_INTERSECTION_TYPE_LIGHT | PT_LIGHT_TYPE_TO_INTERSECTION(gLightDataBufferPT[lightIndex].mLightType));
+		}
+	}
+	return tmin;
+}
+
+// instances share the triangles of the first mesh with the same geometry, so the hit mesh comes from the traversal and not from the triangle
+float TraverseTriangleLeafBVH(inout Intersection it, uint meshIndex, uint triangleIndex, float4x4 model, float3 oriModel, float3 dirModel)
+{
+	TrianglePT tri = gTriangleBufferPT[triangleIndex];
+	float tModel = uScene.mPathTracerWatertightTriangles ? RayTriangleWatertight(tri, oriModel, dirModel) : RayTriangle(tri, oriModel, dirModel);
+	if (tModel > 0.0f)
+		it = SetIntersection(meshIndex, triangleIndex, model, oriModel, dirModel, tModel, PT_INTERSECTION_TYPE_MATERIAL);
+	else
+		tModel = -1.0f;
+	return tModel;
+}
+
+float TraverseTriangleBVH(
+	out Intersection it,
+	uint meshIndex,
+	uint triangleBvhLocalIndex, 
+	uint triangleBvhIndexLocalToGlobalOffset, 
+	uint triangleIndexLocalToGlobalOffset,
+	float4x4 model,
+	float3 oriModel, 
+	float3 dirModel)
+{
+	float tMin = -1.0f;
+	uint stack[PT_TRIANGLE_BVH_STACK_SIZE];
+	uint top = 0;
+	uint rayAabbTestCount = 0;
+	stack[top++] = triangleBvhLocalIndex;
+	while (top > 0 && top < PT_TRIANGLE_BVH_STACK_SIZE - 2)
+	{
+		rayAabbTestCount++;
+		BVH triangleBVH = gTriangleModelBvhBuffer[stack[--top] + triangleBvhIndexLocalToGlobalOffset];
+		if (RayAABB(triangleBVH.mAABB, oriModel, dirModel) > 0.0f)
+		{
+			float tLeft = -1.0f;
+			float tRight = -1.0f;
+			Intersection itLeft = InitIntersection();
+			Intersection itRight = InitIntersection();
+
+			// left
+			if (triangleBVH.mLeftIsLeaf)
+				tLeft = TraverseTriangleLeafBVH(itLeft, meshIndex, triangleBVH.mLeftIndexLocal + triangleIndexLocalToGlobalOffset, model, oriModel, dirModel);
+			else
+				stack[top++] = triangleBVH.mLeftIndexLocal;
+
+			// right
+			if (triangleBVH.mRightIsLeaf)
+				tRight = TraverseTriangleLeafBVH(itRight, meshIndex, triangleBVH.mRightIndexLocal + triangleIndexLocalToGlobalOffset, model, oriModel, dirModel);
+			else
+				stack[top++] = triangleBVH.mRightIndexLocal;
+
+			// intersection
+			if (tLeft > 0.0f && tRight > 0.0f)
+			{
+				if (tLeft < tRight)
+				{
+					if (tMin < 0.0f || tLeft < tMin)
+					{
+						tMin = tLeft;
+						it = itLeft;
+					}
+				}
+				else
+				{
+					if (tMin < 0.0f || tRight < tMin)
+					{
+						tMin = tRight;
+						it = itRight;
+					}
+				}
+			}
+			else if (tLeft > 0.0f)
+			{
+				if (tMin < 0.0f || tLeft < tMin)
+				{
+					tMin = tLeft;
+					it = itLeft;
+				}
+			}
+			else if (tRight > 0.0f)
+			{
+				if (tMin < 0.0f || tRight < tMin)
+				{
+					tMin = tRight;
+					it = itRight;
+				}
+			}
+			rayAabbTestCount += itLeft.mRayAabbTestCount + itRight.mRayAabbTestCount;
+		}
+	}
+	it.mRayAabbTestCount = rayAabbTestCount;
+	return tMin;
+}
+
+float TraverseMeshLeafBVH(out Intersection it, uint leafIndex, float3 ori, float3 dir)
+{
+	MeshPT mesh = gMeshBufferPT[leafIndex];
+	float4x4 modelInv = mesh.mModelInv;
+	float3 oriModel = mul(modelInv, float4(ori, 1.0f)).xyz;
+	float3 dirModel = mul(modelInv, float4(dir, 0.0f)).xyz;
+	float dirModelLength = length(dirModel);
+	dirModel = normalize(dirModel);
+	float tModel = TraverseTriangleBVH(
+		it,
+		leafIndex,
+		mesh.mRootTriangleBvhIndexLocal,
+		mesh.mTriangleBvhIndexLocalToGlobalOffset,
+		mesh.mTriangleIndexLocalToGlobalOffset,
+		mesh.mModel,
+		oriModel,
+		dirModel);
+	return tModel / dirModelLength;
+}
+
+float TraverseMeshBVH(out Intersection it, uint meshBvhIndex, float3 ori, float3 dir)
+{
+	float tMin = -1.0f;
+	uint stack[PT_MESH_BVH_STACK_SIZE];
+	uint top = 0;
+	uint rayAabbTestCount = 0;
+	stack[top++] = meshBvhIndex;
+	while (top > 0 && top < PT_MESH_BVH_STACK_SIZE - 2)
+	{
+		rayAabbTestCount++;
+		BVH meshBVH = gMeshWorldBvhBuffer[stack[--top]];
+		if (RayAABB(meshBVH.mAABB, ori, dir) > 0.0f)
+		{
+			float tLeft = -1.0f;
+			float tRight = -1.0f;
+			Intersection itLeft = InitIntersection();
+			Intersection itRight = InitIntersection();
+
+			// left
+			if (meshBVH.mLeftIsLeaf)
+				tLeft = TraverseMeshLeafBVH(itLeft, meshBVH.mLeftIndexLocal, ori, dir);
+			else
+				stack[top++] = meshBVH.mLeftIndexLocal;
+
+			// right
+			if (meshBVH.mRightIsLeaf)
+				tRight = TraverseMeshLeafBVH(itRight, meshBVH.mRightIndexLocal, ori, dir);
+			else
+				stack[top++] = meshBVH.mRightIndexLocal;
+
+			// intersection
+			if (tLeft > 0.0f && tRight > 0.0f)
+			{
+				if (tLeft < tRight)
+				{
+					if (tMin < 0.0f || tLeft < tMin)
+					{
+						tMin = tLeft;
+						it = itLeft;
+					}
+				}
+				else
+				{
+					if (tMin < 0.0f || tRight < tMin)
+					{
+						tMin = tRight;
+						it = itRight;
+					}
+				}
+			}
+			else if (tLeft > 0.0f)
+			{
+				if (tMin < 0.0f || tLeft < tMin)
+				{
+					tMin = tLeft;
+					it = itLeft;
+				}
+			}
+			else if (tRight > 0.0f)
+			{
+				if (tMin < 0.0f || tRight < tMin)
+				{
+					tMin = tRight;
+					it = itRight;
+				}
+			}
+			rayAabbTestCount += itLeft.mRayAabbTestCount + itRight.mRayAabbTestCount;
+		}
+	}
+	it.mRayAabbTestCount = rayAabbTestCount;
+	return tMin;
+}
+
+uint GetMeshBvhRootIndex()
+{
+	if (uScene.mPathTracerMeshBvhRootIndex != INVALID_UINT32)
+		return uScene.mPathTracerMeshBvhRootIndex;
+	else
+		return gGlobalBvhSettingBuffer[0].mMeshBvhRootIndex;
+}
+
+float IntersectMeshBVH(out Intersection it, float3 ori, float3 dir)
+{
+	float t = TraverseMeshBVH(it, GetMeshBvhRootIndex(), ori, dir);
+	if (t < 0.0f)
+		t = -1.0f;
+	return t;
+}
+
+float IntersectTriangles(out Intersection it, float3 ori, float3 dir)
+{
+	float tmin = -1.0f;
+	// instances share triangles, so every mesh walks its own triangle range
+	for (uint meshIndex = 0; meshIndex < uPass.mMeshCountPT; meshIndex++)
+	{
+		MeshPT mesh = gMeshBufferPT[meshIndex];
+		float4x4 model = mesh.mModel;
+		float4x4 modelInv = mesh.mModelInv;
+		float3 oriModel = mul(modelInv, float4(ori, 1.0f)).xyz;
+		float3 dirModel = mul(modelInv, float4(dir, 0.0f)).xyz;
+		float dirModelLength = length(dirModel);
+		dirModel = normalize(dirModel);
+		for (uint i = mesh.mTriangleIndexLocalToGlobalOffset; i < mesh.mTriangleIndexLocalToGlobalOffset + mesh.mTriangleCount; i++)
+		{
+			TrianglePT tri = gTriangleBufferPT[i];
+			float tModel = uScene.mPathTracerWatertightTriangles ? RayTriangleWatertight(tri, oriModel, dirModel) : RayTriangle(tri, oriModel, dirModel);
+			float t = tModel / dirModelLength; // modelInv * (ori + t * dir) = oriModel + tModel * dirModel, if length(dir) == length(dirModel) == 1, then t * modelINv * dir = tModel * dirModel
+			if (t > 0.0f && (t < tmin || tmin < 0.0f))
+			{
+				it = SetIntersection(meshIndex, i, model, oriModel, dirModel, tModel, PT_INTERSECTION_TYPE_MATERIAL);
+				tmin = t;
+			}
+		}
+	}
+	return tmin;
+}
+
+float IntersectInternal(out Intersection it, float3 ori, float3 dir)
+{
+	float tmin = -1.0f;
+	Intersection itTriangles;
+	Intersection itLights;
+	ori = ori + dir * PT_SPAWN_RAY_BIAS;
+	float tTriangles = -1.0f;
+	// can't use tTriangles = uScene.mPathTracerUseBVH ? IntersectMeshBVH(itTriangles, ori, dir) : IntersectTriangles(itTriangles, ori, dir);
+	// because both braches of the ternary operator will be evaluated for some reason, this might be a driver bug
+	if (uScene.mPathTracerUseBVH)
+		tTriangles = IntersectMeshBVH(itTriangles, ori, dir);
+	else
+		tTriangles = IntersectTriangles(itTriangles, ori, dir);
+	float tLights = IntersectLights(itLights, ori, dir);
+	if (tTriangles > 0.0f && tLights > 0.0f)
+	{
+		if (tTriangles < tLights)
+		{
+			tmin = tTriangles;
+			it = itTriangles;
+		}
+		else
+		{
+			tmin = tLights;
+			it = itLights;
+		}
+	}
+	else if (tTriangles > 0.0f)
+	{
+		tmin = tTriangles;
+		it = itTriangles;
+	}
+	else if (tLights > 0.0f)
+	{
+		tmin = tLights;
+		it = itLights;
+	}
+	return tmin;
+}
+
+bool Intersect(out Intersection it, float3 ori, float3 dir)
+{
+	float tmin = IntersectInternal(it, ori, dir);
+	if (tmin > 0.0f)
+		return true;
+	else
+		return false;
+}
+
+float3 GetTriangleNormalWorld(MeshPT mesh, TrianglePT tri)
+{
+	float3 p0 = mul(mesh.mModel, float4(tri.mVertices[0].pos, 1.0f)).xyz;
+	float3 p1 = mul(mesh.mModel, float4(tri.mVertices[1].pos, 1.0f)).xyz;
+	float3 p2 = mul(mesh.mModel, float4(tri.mVertices[2].pos, 1.0f)).xyz;
+	return normalize(cross(p1 - p0, p2 - p0));
+}
+
+// n is the geometric normal at p for mesh lights, the other lights know their own normal
+bool IsLightVisibleInternal(uint lightIndex, float3 ori, float3 dir, out float3 p, out float3 n)
+{
+	p = 0.0f.xxx;
+	n = 0.0f.xxx;
+	Intersection it = InitIntersection();
+	if(Intersect(it, ori, dir))
+	{
+		if((it.mIntersectionFlags & PT_INTERSECTION_TYPE_LIGHT) && (lightIndex == it.mLightIndex))
+		{
+			p = it.mPointWorld;
+			return true;
+		}
+		// emissive meshes are hit as materials
+		LightData ld = gLightDataBufferPT[lightIndex];
+		if ((it.mIntersectionFlags & PT_INTERSECTION_TYPE_MATERIAL) && ld.mLightType == LIGHT_TYPE_MESH && ld.mMeshIndex == it.mMeshIndex)
+		{
+			p = it.mPointWorld;
+			n = GetTriangleNormalWorld(gMeshBufferPT[it.mMeshIndex], gTriangleBufferPT[it.mTriangleIndex]);
+			return true;
+		}
+	}
+	return false;
+}
+
+bool IsLightVisibleInternal(uint lightIndex, float3 ori, float3 dir, out float3 p)
+{
+	float3 n = 0.0f.xxx;
+	return IsLightVisibleInternal(lightIndex, ori, dir, p, n);
+}
+
+// the other triangles of a mesh light can hide the sampled point, so the hit has to be the sampled point itself
+bool IsLightSampleVisible(uint lightIndex, float3 ori, float3 samplePoint, out float3 p)
+{
+	float3 n = 0.0f.xxx;
+	float3 oriToSample = samplePoint - ori;
+	if (!IsLightVisibleInternal(lightIndex, ori, normalize(oriToSample), p, n))
+		return false;
+	return gLightDataBufferPT[lightIndex].mLightType != LIGHT_TYPE_MESH || length(p - samplePoint) <= length(oriToSample) * PT_MESH_LIGHT_SAMPLE_TOLERANCE;
+}
+
+bool IsLightVisible(uint lightIndex, float3 ori, float3 dir)
+{
+	float3 p = 0.0f.xxx;
+	return IsLightVisibleInternal(lightIndex, ori, dir, p);
+}
+
+void BarycentricInterpolate(float3 p, TrianglePT tri, out float2 uv, out float3 nor, out float4 tan)
+{
+	float s = 0.5f * length(cross(tri.mVertices[0].pos - tri.mVertices[1].pos, tri.mVertices[0].pos - tri.mVertices[2].pos));
+	float s0 = 0.5f * length(cross(p - tri.mVertices[1].pos, p - tri.mVertices[2].pos)) / s;
+	float s1 = 0.5f * length(cross(p - tri.mVertices[2].pos, p - tri.mVertices[0].pos)) / s;
+	float s2 = 0.5f * length(cross(p - tri.mVertices[0].pos, p - tri.mVertices[1].pos)) / s;
+	uv = s0 * tri.mVertices[0].uv + s1 * tri.mVertices[1].uv + s2 * tri.mVertices[2].uv;
+	nor = s0 * tri.mVertices[0].nor + s1 * tri.mVertices[1].nor + s2 * tri.mVertices[2].nor;
+	tan = s0 * tri.mVertices[0].tan + s1 * tri.mVertices[1].tan + s2 * tri.mVertices[2].tan;
+}
+
+void EvaluateSurface(out SurfaceDataInPT sdiPT, Intersection it)
+{
+	if (it.mIntersectionFlags & PT_INTERSECTION_TYPE_MATERIAL)
+	{
+		TrianglePT tri = gTriangleBufferPT[it.mTriangleIndex];
+		MeshPT mesh = gMeshBufferPT[it.mMeshIndex];
+		float4x4 model = mesh.mModel;
+		float4x4 modelInv = mesh.mModelInv;
+		float2 uv;
+		float3 normalModel;
+		float4 tanModel;
+		BarycentricInterpolate(it.mPointModel, tri, uv, normalModel, tanModel);
+		sdiPT.mUV = uv;
+		sdiPT.mNorWorld = mul(float4(normalModel, 0.0f), modelInv).xyz;
+		sdiPT.mTanWorld = float4(mul(model, float4(tanModel.xyz, 0.0f)).xyz, tanModel.w);
+		MaterialPT material = gMaterialBufferPT[mesh.mMaterialIndex];
+		sdiPT.mSpecularity = uScene.mSpecularity;
+		if (material.mUseSceneParameters)
+		{
+			sdiPT.mAlbedo = uScene.mStandardColor.rgb;
+			sdiPT.mRoughness = uScene.mRoughness;
+			sdiPT.mFresnel = uScene.mFresnel;
+			sdiPT.mMetallic = uScene.mMetallic;
+		}
+		else
+		{
+			sdiPT.mAlbedo = material.mAlbedo;
+			sdiPT.mRoughness = material.mRoughness;
+			sdiPT.mFresnel = material.mFresnel;
+			sdiPT.mMetallic = material.mMetallic;
+		}
+		if (!uScene.mUsePerPassTextures && material.mAlbedoTextureIndex != INVALID_UINT32)
+			sdiPT.mAlbedo = gMeshTextures[material.mAlbedoTextureIndex].SampleLevel(gSamplerLinear, TransformUV(sdiPT.mUV), 0.0f).rgb;
+		sdiPT.mPosWorld = it.mPointWorld;
+		sdiPT.mMaterialType = material.mMaterialType;
+		if (mesh.mMaterialType == MATERIAL_TYPE_EMISSIVE)
+			sdiPT.mEmissive = mesh.mEmissive;
+	}
+	else if (it.mIntersectionFlags & PT_INTERSECTION_TYPE_LIGHT)
+	{
+		LightData ld = gLightDataBufferPT[it.mLightIndex];
+		sdiPT.mEmissive = ld.mColor;
+	}
+}
+
+// lightNor is only read for mesh lights
+float3 EvaluateLight(float3 itPos, float3 lightPos, float3 lightNor, uint lightIndex, out float3 wi, out float pdf)
+{
+	float3 result = 0.0f.xxx;
+	float3 nLight = 0.0f.xxx;
+	if (gLightDataBufferPT[lightIndex].mLightType == LIGHT_TYPE_MESH)
+	{
+		pdf = 1.0f / gLightDataBufferPT[lightIndex].mArea; // triangles are picked by area
+		nLight = lightNor;
+	}
+	else if (gLightDataBufferPT[lightIndex].mLightType == LIGHT_TYPE_POINT)
+	{
+		pdf = 0.0f; // delta light has 0 chance to be hit
+		nLight = lightPos - itPos;
+	}
+	else if (gLightDataBufferPT[lightIndex].mLightType == LIGHT_TYPE_QUAD)
+	{
+		pdf = 1.0f / gLightDataBufferPT[lightIndex].mArea;
+		nLight = float3(0.0f, 0.0f, 1.0f);
+		nLight = mul(float4(nLight, 0.0f), gLightDataBufferPT[lightIndex].mView).xyz;
+	}
+	else if (gLightDataBufferPT[lightIndex].mLightType == LIGHT_TYPE_SPHERE)
+	{
+		//TODO: add support for sphere light
+	}
+	float3 itPosToLight = lightPos - itPos;
+	wi = normalize(itPosToLight);
+	float absDot = abs(dot(nLight, -wi)); // solid angle
+	if (absDot == 0)
+	{
+		result = 0.0f.xxx;
+		pdf = 0.0f;
+	}
+	else
+	{
+		result = gLightDataBufferPT[lightIndex].mColor;
+		float d = length(itPosToLight);
+		pdf *= d * d / absDot; // adjust due to solid angle, the light selection pdf is applied by the caller
+	}
+	return result;
+}
+
+float3 EvaluateLight(float3 itPos, float3 lightPos, uint lightIndex, out float3 wi, out float pdf)
+{
+	return EvaluateLight(itPos, lightPos, 0.0f.xxx, lightIndex, wi, pdf);
+}
+
+float3 EvaluateLight(float3 itPos, float3 lightPos, float3 lightNor, uint lightIndex, out float pdf)
+{
+	float3 wi = 0.0f.xxx;
+	return EvaluateLight(itPos, lightPos, lightNor, lightIndex, wi, pdf);
+}
+
+float3 EvaluateLight(float3 itPos, float3 lightPos, uint lightIndex, out float pdf)
+{
+	float3 wi = 0.0f.xxx;
+	return EvaluateLight(itPos, lightPos, lightIndex, wi, pdf);
+}
+
+// uniform point on a triangle of the mesh picked by its alias table, xi.x picks the entry and what is left of it picks between the entry and its alias
+float3 SampleMeshLight(LightData ld, float2 xi, out float3 n)
+{
+	MeshPT mesh = gMeshBufferPT[ld.mMeshIndex];
+	float scaled = xi.x * mesh.mTriangleCount;
+	uint entryIndex = min(uint(scaled), mesh.mTriangleCount - 1);
+	AliasEntry entry = gLightAliasBuffer[ld.mAliasEntryOffset + entryIndex];
+	float u = scaled - entryIndex;
+	uint triangleIndex = entryIndex;
+	if (u < entry.mProbability)
+	{
+		u = u / entry.mProbability;
+	}
+	else
+	{
+		u = (u - entry.mProbability) / (1.0f - entry.mProbability);
+		triangleIndex = entry.mAlias;
+	}
+	u = min(u, PT_ONE_MINUS_EPSILON);
+	TrianglePT tri = gTriangleBufferPT[mesh.mTriangleIndexLocalToGlobalOffset + triangleIndex];
+	float3 p0 = mul(mesh.mModel, float4(tri.mVertices[0].pos, 1.0f)).xyz;
+	float3 p1 = mul(mesh.mModel, float4(tri.mVertices[1].pos, 1.0f)).xyz;
+	float3 p2 = mul(mesh.mModel, float4(tri.mVertices[2].pos, 1.0f)).xyz;
+	n = normalize(cross(p1 - p0, p2 - p0));
+	// square to triangle of Shirley and Chiu
+	float sqrtU = sqrt(u);
+	float b0 = 1.0f - sqrtU;
+	float b1 = xi.y * sqrtU;
+	return p0 * b0 + p1 * b1 + p2 * (1.0f - b0 - b1);
+}
+
+// p is the sampled point for the visibility test
+float3 SampleLight(float3 itPos, float2 xi, uint lightIndex, out float3 p, out float3 wi, out float pdf)
+{
+	float3 result = 0.0f.xxx;
+	float3 n = 0.0f.xxx;
+	p = 0.0f.xxx;
+	if (gLightDataBufferPT[lightIndex].mLightType == LIGHT_TYPE_MESH)
+	{
+		p = SampleMeshLight(gLightDataBufferPT[lightIndex], xi, n);
+	}
+	else if (gLightDataBufferPT[lightIndex].mLightType == LIGHT_TYPE_POINT)
+	{
+		p = gLightDataBufferPT[lightIndex].mPosWorld;
+	}
+	else if (gLightDataBufferPT[lightIndex].mLightType == LIGHT_TYPE_QUAD)
+	{
+		p = float3(xi * 2.0f - 1.0f, 0.0f) * gLightDataBufferPT[lightIndex].mScale;
+		// local to world space
+		p = mul(gLightDataBufferPT[lightIndex].mViewInv, float4(p, 1.0f)).xyz;
+	}
+	else if (gLightDataBufferPT[lightIndex].mLightType == LIGHT_TYPE_SPHERE)
+	{
+		//TODO: add support to sphere light
+	}
+	return EvaluateLight(itPos, p, n, lightIndex, wi, pdf);
+}
+
+float3 SampleLight(float3 itPos, float2 xi, uint lightIndex, out float3 wi, out float pdf)
+{
+	float3 p = 0.0f.xxx;
+	return SampleLight(itPos, xi, lightIndex, p, wi, pdf);
+}
+
+// delta materials can only be sampled, their light is picked up by the next bounce instead of by light sampling
+bool IsSpecularMaterial(uint materialType)
+{
+	return materialType == MATERIAL_TYPE_SPECULAR_REFLECTIIVE || materialType == MATERIAL_TYPE_SPECULAR_TRANSMISSIVE;
+}
+
+// Fresnel reflectance of a smooth dielectric for unpolarized light, cosThetaI is on the side of the incident light
+float FresnelDielectric(float cosThetaI, float eta)
+{
+	float sinThetaT2 = (1.0f - cosThetaI * cosThetaI) / (eta * eta);
+	if (sinThetaT2 >= 1.0f)
+		return 1.0f; // total internal reflection
+	float cosThetaT = sqrt(1.0f - sinThetaT2);
+	float rParallel = (eta * cosThetaI - cosThetaT) / (eta * cosThetaI + cosThetaT);
+	float rPerpendicular = (cosThetaI - eta * cosThetaT) / (cosThetaI + eta * cosThetaT);
+	return 0.5f * (rParallel * rParallel + rPerpendicular * rPerpendicular);
+}
+
+// inverse of F0 = ((eta - 1) / (eta + 1))^2
+float FresnelF0ToEta(float F0)
+{
+	float sqrtF0 = sqrt(saturate(F0));
+	return (1.0f + sqrtF0) / max(1.0f - sqrtF0, 0.001f);
+}
+
+float3 SampleCosineHemisphere(float2 xi, float3 N)
+{
+	float r = sqrt(xi.x);
+	float phi = 2.0f * PI * xi.y;
+	float3 upVector = abs(N.z) < 0.999f ? float3(0.0f, 0.0f, 1.0f) : float3(1.0f, 0.0f, 0.0f);
+	float3 tangentX = normalize(cross(upVector, N));
+	float3 tangentY = cross(N, tangentX);
+	return tangentX * (r * cos(phi)) + tangentY * (r * sin(phi)) + N * sqrt(max(0.0f, 1.0f - xi.x));
+}
+
+// cosine term in LTE is handled in BRDF functions
+float3 EvaluateMaterial(SurfaceDataInPT sdiPT, float3 wo, float3 wi, out float pdf)
+{
+	float3 result = 0.0f.xxx;
+	pdf = 0.0f;
+	if (sdiPT.mMaterialType == MATERIAL_TYPE_DIFFUSE)
+	{
+		float3 nor = normalize(sdiPT.mNorWorld);
+		float cosThetaI = dot(wi, nor);
+		if (cosThetaI > 0.0f && dot(wo, nor) > 0.0f)
+		{
+			pdf = cosThetaI * ONE_OVER_PI;
+			result = sdiPT.mAlbedo * (cosThetaI * ONE_OVER_PI);
+		}
+	}
+	else if (sdiPT.mMaterialType == MATERIAL_TYPE_GGX)
+	{
+		// the diffuse and specular lobes are sampled in proportion to their weights, see SampleMaterial
+		float3 wh = normalize(wi + wo);
+		float specularPdf = max(GGX_PDF(wo, wh, sdiPT.mNorWorld, sdiPT.mRoughness), 0.0f);
+		float diffusePdf = max(dot(wi, normalize(sdiPT.mNorWorld)), 0.0f) * ONE_OVER_PI;
+		pdf = lerp(diffusePdf, specularPdf, sdiPT.mMetallic);
+		SurfaceDataIn sdi = (SurfaceDataIn)sdiPT;
+		result = BRDF_GGX(sdi, wi, wo);
+	}
+	// specular materials can't be evaluated but only sampled, and emitters don't reflect
+	return result;
+}
+
+// delta materials return a pdf of 1 for the lobe they picked, so the throughput is multiplied by the returned color
+float3 SampleMaterial(SurfaceDataInPT sdiPT, float2 xi, float3 wo, out float3 wi, out float pdf)
+{
+	wi = 0.0f.xxx;
+	if (sdiPT.mMaterialType == MATERIAL_TYPE_DIFFUSE)
+	{
+		wi = SampleCosineHemisphere(xi, normalize(sdiPT.mNorWorld));
+	}
+	else if (sdiPT.mMaterialType == MATERIAL_TYPE_GGX)
+	{
+		if (xi.x < sdiPT.mMetallic)
+		{
+			// ImportanceSampleGGX squares the roughness like the IBL prefilter, while GGX_D and GGX_PDF take it as alpha
+			xi.x /= sdiPT.mMetallic;
+			float3 wh = ImportanceSampleGGX(xi, sqrt(sdiPT.mRoughness), sdiPT.mNorWorld);
+			wi = 2.0f * dot(wo, wh) * wh - wo;
+		}
+		else
+		{
+			xi.x = (xi.x - sdiPT.mMetallic) / (1.0f - sdiPT.mMetallic);
+			wi = SampleCosineHemisphere(xi, normalize(sdiPT.mNorWorld));
+		}
+	}
+	else if (sdiPT.mMaterialType == MATERIAL_TYPE_SPECULAR_REFLECTIIVE)
+	{
+		// smooth conductor, the albedo is its color at normal incidence
+		float3 nor = normalize(sdiPT.mNorWorld);
+		float cosThetaO = dot(wo, nor);
+		pdf = 0.0f;
+		if (cosThetaO <= 0.0f)
+			return 0.0f.xxx;
+		wi = 2.0f * cosThetaO * nor - wo;
+		pdf = 1.0f;
+		return sdiPT.mAlbedo + (1.0f.xxx - sdiPT.mAlbedo) * pow(1.0f - cosThetaO, 5.0f);
+	}
+	else if (sdiPT.mMaterialType == MATERIAL_TYPE_SPECULAR_TRANSMISSIVE)
+	{
+		// smooth dielectric, reflects or refracts with the Fresnel reflectance as the probability so either lobe returns the albedo
+		// the radiance is not scaled by the squared ratio of the indices of refraction, it only matters for light that ends inside the medium
+		float3 nor = normalize(sdiPT.mNorWorld);
+		float eta = FresnelF0ToEta(sdiPT.mFresnel);
+		float cosThetaO = dot(wo, nor);
+		if (cosThetaO < 0.0f)
+		{
+			// leaving the medium
+			eta = 1.0f / eta;
+			cosThetaO = -cosThetaO;
+			nor = -nor;
+		}
+		float reflectance = FresnelDielectric(cosThetaO, eta);
+		pdf = 1.0f;
+		if (xi.x < reflectance)
+		{
+			wi = 2.0f * cosThetaO * nor - wo;
+		}
+		else
+		{
+			float sinThetaT2 = (1.0f - cosThetaO * cosThetaO) / (eta * eta);
+			wi = -wo / eta + (cosThetaO / eta - sqrt(1.0f - sinThetaT2)) * nor;
+		}
+		return sdiPT.mAlbedo;
+	}
+	return EvaluateMaterial(sdiPT, wo, wi, pdf);
+}
+
+float PowerHeuristic(int nf, float fPdf, int ng, float gPdf)
+{
+	float f = nf * fPdf;
+	float g = ng * gPdf;
+	return (f * f) / (f * f + g * g);
+}
+
+#endif
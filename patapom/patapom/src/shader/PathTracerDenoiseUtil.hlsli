@@ -0,0 +1,95 @@
+#ifndef PATHTRACER_DENOISE_UTIL_H
+#define PATHTRACER_DENOISE_UTIL_H
+
+// the first hit of every sample writes its normal, distance to the eye and albedo next to the color,
+// gNormalDepthPT and gAlbedoPT are running means over the sample count of the pixel like gBackbufferPT
+// so they have to be accumulated before AccumulateAdaptiveSample increments it
+
+struct DenoiseFeatures
+{
+	float3 mNormal;
+	float mHitDistance;
+	float3 mAlbedo;
+};
+
+// a miss has no normal and no distance, the white albedo keeps its color as it is
+DenoiseFeatures InitDenoiseFeatures()
+{
+	DenoiseFeatures features;
+	features.mNormal = 0.0f.xxx;
+	features.mHitDistance = 0.0f;
+	features.mAlbedo = 1.0f.xxx;
+	return features;
+}
+
+#ifdef PATHTRACER_COMMON_H // the denoise passes only read the features, they don't bind the scene buffers PathTracerCommon.hlsli needs
+// lights are not demodulated, their color is all emission
+DenoiseFeatures GetDenoiseFeatures(SurfaceDataInPT sdiPT, Intersection it, float3 eyePos)
+{
+	DenoiseFeatures features;
+	features.mNormal = sdiPT.mNorWorld;
+	features.mHitDistance = length(it.mPointWorld - eyePos);
+	features.mAlbedo = (it.mIntersectionFlags & PT_INTERSECTION_TYPE_LIGHT) || sdiPT.mMaterialType == MATERIAL_TYPE_EMISSIVE ? 1.0f.xxx : sdiPT.mAlbedo;
+	return features;
+}
+#endif
+
+void ClearDenoiseFeatures(uint2 screenPos)
+{
+	gNormalDepthPT[screenPos] = 0.0f.xxxx;
+	gAlbedoPT[screenPos] = 0.0f.xxxx;
+}
+
+void AccumulateDenoiseFeatures(uint2 screenPos, DenoiseFeatures features)
+{
+	float sampleCount = gConvergencePT[screenPos].x;
+	gNormalDepthPT[screenPos] = (gNormalDepthPT[screenPos] * sampleCount + float4(features.mNormal, features.mHitDistance)) / (sampleCount + 1.0f);
+	gAlbedoPT[screenPos] = (gAlbedoPT[screenPos] * sampleCount + float4(features.mAlbedo, 1.0f)) / (sampleCount + 1.0f);
+}
+
+// filter weights, shared by the temporal and the a-trous passes
+
+float GetDenoiseLuminance(float3 color)
+{
+	return dot(color, float3(0.2126f, 0.7152f, 0.0722f));
+}
+
+// illumination is what the filter blurs, the albedo is multiplied back after the last iteration
+float3 GetDenoiseDemodulationAlbedo(float3 albedo)
+{
+	return max(albedo, PT_DENOISE_ALBEDO_MIN.xxx);
+}
+
+// direction of the ray through the center of the pixel, same as the camera rays of the path tracer without the jitter
+float3 GetDenoisePixelDirection(uint2 screenPos)
+{
+	float4 ndcNearPos = float4((float2(screenPos) + 0.5f) / float2(PT_BACKBUFFER_WIDTH, PT_BACKBUFFER_HEIGHT) * float2(2.0f, -2.0f) - float2(1.0f, -1.0f), REVERSED_Z_SWITCH(0.0f, 1.0f), 1.0f);
+	float4 viewNearPos = mul(uPass.mProjInv, ndcNearPos * uPass.mNearClipPlane);
+	viewNearPos /= viewNearPos.w;
+	return normalize(mul(uPass.mViewInv, float4(normalize(viewNearPos.xyz), 0.0f)).xyz);
+}
+
+// the accumulated normal of a pixel on an edge is shorter than 1, a miss has none
+float3 GetDenoiseNormal(float4 normalDepth)
+{
+	float normalLength = length(normalDepth.xyz);
+	return normalLength > 0.0f ? normalDepth.xyz / normalLength : 0.0f.xxx;
+}
+
+float GetDenoiseKernelWeight(int offset)
+{
+	static const float kernel[3] = { 3.0f / 8.0f, 1.0f / 4.0f, 1.0f / 16.0f };
+	return kernel[abs(offset)];
+}
+
+float GetDenoiseEdgeStoppingWeight(float3 normalP, float depthP, float luminanceP, float3 normalQ, float depthQ, float luminanceQ, float depthGradientDistance, float luminanceSigma)
+{
+	if (depthQ <= 0.0f)
+		return 0.0f; // misses never blur into surfaces
+	float weightNormal = pow(saturate(dot(normalP, normalQ)), PT_DENOISE_SIGMA_NORMAL);
+	float weightDepth = abs(depthP - depthQ) / (PT_DENOISE_SIGMA_DEPTH * depthGradientDistance + 1e-4f);
+	float weightLuminance = abs(luminanceP - luminanceQ) / (luminanceSigma + 1e-6f);
+	return weightNormal * exp(-weightDepth - weightLuminance);
+}
+
+#endif
@@ -0,0 +1,107 @@
+#ifndef PATHTRACER_SAMPLER_UTIL_H
+#define PATHTRACER_SAMPLER_UTIL_H
+
+// every random number of a path is asked for by dimension, see PT_SAMPLE_DIMENSION_*
+// the random sampler ignores the dimension and returns the next numbers of the LCG, so it keeps the sequence of frandom
+// the other samplers use 2D Sobol points padded to any dimension count by shuffling the sample index per dimension pair (Burley 2020)
+
+struct PathSampler
+{
+	uint mType;
+	uint2 mPixel;
+	uint mPixelSeed; // hash of the pixel and the sampler seed
+	uint mSampleIndex;
+	uint mRandomState; // LCG state of the random sampler and the dimensions past mPathTracerSamplerDimensionMax
+};
+
+PathSampler InitPathSampler(uint2 screenPos, uint sampleIndex, uint randomState)
+{
+	PathSampler sampler;
+	sampler.mType = uScene.mPathTracerSampler;
+	sampler.mPixel = screenPos;
+	sampler.mPixelSeed = hash(hash(hash(uScene.mPathTracerSamplerSeed) + screenPos.x) + screenPos.y);
+	sampler.mSampleIndex = sampleIndex;
+	sampler.mRandomState = randomState;
+	return sampler;
+}
+
+uint GetBounceSampleDimension(uint bounceIndex, uint dimensionInBounce)
+{
+	return PT_SAMPLE_DIMENSION_BOUNCE_START + bounceIndex * PT_SAMPLE_DIMENSION_PER_BOUNCE + dimensionInBounce;
+}
+
+// hash based Owen scrambling of the reversed bits, the higher bits of the result only depend on the higher bits of x
+// from Burley 2020, Practical Hash-based Owen Scrambling, with the constants of Vegdahl 2021
+uint LaineKarrasPermutation(uint x, uint seed)
+{
+	x += seed;
+	x ^= x * 0x6c50b47cu;
+	x ^= x * 0xb82f1e52u;
+	x ^= x * 0xc7afe638u;
+	x ^= x * 0x8d22f6e6u;
+	return x;
+}
+
+uint NestedUniformScramble(uint x, uint seed)
+{
+	return reversebits(LaineKarrasPermutation(reversebits(x), seed));
+}
+
+// the first 2 Sobol dimensions, van der Corput and the one of the polynomial x + 1
+uint2 Sobol2D(uint index)
+{
+	uint2 p = 0;
+	uint direction = 0x80000000u;
+	for (uint bit = 0; index; bit++, index >>= 1)
+	{
+		if (index & 1)
+			p ^= uint2(0x80000000u >> bit, direction);
+		direction ^= direction >> 1;
+	}
+	return p;
+}
+
+// 24 bits so the float is exact and below 1
+float2 FixedPointToUnitFloat2(uint2 p)
+{
+	return (p >> 8) * (1.0f / 16777216.0f);
+}
+
+// the first power of 2 samples of the shuffled index are still a (0,m,2)-net because the high bits of a Sobol point only depend on the low bits of its index
+uint2 GetShuffledSobol2D(uint sampleIndex, uint seed, bool owenScrambling)
+{
+	uint2 p = Sobol2D(NestedUniformScramble(sampleIndex, seed));
+	uint seedX = hash(seed);
+	uint seedY = hash(seedX);
+	if (owenScrambling)
+		return uint2(NestedUniformScramble(p.x, seedX), NestedUniformScramble(p.y, seedY));
+	return p ^ uint2(seedX, seedY);
+}
+
+// the R2 rank-1 lattice over the pixel position is a blue noise dither (Roberts 2018), neighboring pixels get far apart shifts
+uint2 GetBlueNoiseDither(uint2 pixel)
+{
+	uint2 generator = uint2(PT_SAMPLER_R2_GENERATOR_X, PT_SAMPLER_R2_GENERATOR_Y);
+	return pixel.x * generator + pixel.y * generator.yx;
+}
+
+float2 GetSample2D(inout PathSampler sampler, uint dimension)
+{
+	if (sampler.mType == PT_SAMPLER_RANDOM || dimension >= uScene.mPathTracerSamplerDimensionMax)
+		return frandom2(sampler.mRandomState);
+	if (sampler.mType == PT_SAMPLER_SOBOL)
+		return FixedPointToUnitFloat2(GetShuffledSobol2D(sampler.mSampleIndex, hash(sampler.mPixelSeed + dimension), uScene.mPathTracerSamplerOwenScrambling));
+	// every pixel gets the same points toroidally shifted by the dither, so the error of neighboring pixels is negatively correlated,
+	// the wrap around in 0.32 fixed point is the shift modulo 1
+	uint2 p = GetShuffledSobol2D(sampler.mSampleIndex, hash(hash(uScene.mPathTracerSamplerSeed) + dimension), true);
+	return FixedPointToUnitFloat2(p + GetBlueNoiseDither(sampler.mPixel));
+}
+
+float GetSample1D(inout PathSampler sampler, uint dimension)
+{
+	if (sampler.mType == PT_SAMPLER_RANDOM || dimension >= uScene.mPathTracerSamplerDimensionMax)
+		return frandom(sampler.mRandomState);
+	return GetSample2D(sampler, dimension).x;
+}
+
+#endif
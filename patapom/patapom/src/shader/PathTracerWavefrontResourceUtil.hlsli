@@ -0,0 +1,147 @@
+#ifndef PATHTRACER_WAVEFRONT_RESOURCE_UTIL_H
+#define PATHTRACER_WAVEFRONT_RESOURCE_UTIL_H
+
+// every wavefront queue is a float4 buffer, field f of entry i lives at f * capacity + i
+// so threads next to each other read and write memory next to each other
+// stages of a bounce run one after another, so the storage of every queue is reused by the next bounce and only the counters are per bounce
+
+#define PT_WAVEFRONT_PATH_THROUGHPUT				0 // w is the last bounce specular flag
+#define PT_WAVEFRONT_PATH_RADIANCE					1 // w is the rng seed
+#define PT_WAVEFRONT_PATH_LIGHT_SAMPLE_RADIANCE		2 // written by the connect stage
+#define PT_WAVEFRONT_PATH_MATERIAL_SAMPLE_RADIANCE	3 // written by the connect stage
+#define PT_WAVEFRONT_PATH_FIRST_HIT_NORMAL_DEPTH	4 // features of the first hit for the denoiser, written by the shade stage of bounce 0
+#define PT_WAVEFRONT_PATH_FIRST_HIT_ALBEDO			5
+
+#define PT_WAVEFRONT_RAY_ORI						0 // w is the path index
+#define PT_WAVEFRONT_RAY_DIR						1
+
+#define PT_WAVEFRONT_HIT_POINT_WORLD				0 // w is the path index
+#define PT_WAVEFRONT_HIT_POINT_MODEL				1
+#define PT_WAVEFRONT_HIT_DIR						2
+#define PT_WAVEFRONT_HIT_IDS						3 // triangle, mesh, light, intersection flags
+
+#define PT_WAVEFRONT_SHADOW_ORI						0 // w is the path index
+#define PT_WAVEFRONT_SHADOW_DIR						1 // w is the light index
+#define PT_WAVEFRONT_SHADOW_CONTRIBUTION			2 // w is the material pdf, 0 for light samples
+
+#define PT_WAVEFRONT_SHADOW_CAPACITY				(PT_WAVEFRONT_PATH_COUNT * PT_WAVEFRONT_SHADOW_RAY_PER_PATH)
+
+uint2 GetWavefrontScreenPos(uint pathIndex)
+{
+	return uint2(pathIndex % PT_BACKBUFFER_WIDTH, pathIndex / PT_BACKBUFFER_WIDTH);
+}
+
+float4 GetWavefrontPathField(uint pathIndex, uint field)
+{
+	return gWavefrontPathBuffer[field * PT_WAVEFRONT_PATH_COUNT + pathIndex];
+}
+
+void SetWavefrontPathField(uint pathIndex, uint field, float4 value)
+{
+	gWavefrontPathBuffer[field * PT_WAVEFRONT_PATH_COUNT + pathIndex] = value;
+}
+
+uint GetWavefrontQueueCounterIndex(uint queue, uint bounceIndex)
+{
+	return queue * PT_MAXDEPTH_MAX + bounceIndex;
+}
+
+uint GetWavefrontQueueCount(uint queue, uint bounceIndex)
+{
+	return gWavefrontQueueCounterBuffer[GetWavefrontQueueCounterIndex(queue, bounceIndex)];
+}
+
+uint AppendWavefrontQueue(uint queue, uint bounceIndex)
+{
+	uint entryIndex;
+	InterlockedAdd(gWavefrontQueueCounterBuffer[GetWavefrontQueueCounterIndex(queue, bounceIndex)], 1, entryIndex);
+	return entryIndex;
+}
+
+void PushWavefrontRay(uint bounceIndex, uint pathIndex, float3 ori, float3 dir)
+{
+	uint entryIndex = AppendWavefrontQueue(PT_WAVEFRONT_QUEUE_RAY, bounceIndex);
+	gWavefrontRayQueue[PT_WAVEFRONT_RAY_ORI * PT_WAVEFRONT_PATH_COUNT + entryIndex] = float4(ori, asfloat(pathIndex));
+	gWavefrontRayQueue[PT_WAVEFRONT_RAY_DIR * PT_WAVEFRONT_PATH_COUNT + entryIndex] = float4(dir, 0.0f);
+}
+
+void GetWavefrontRay(uint entryIndex, out uint pathIndex, out float3 ori, out float3 dir)
+{
+	float4 oriField = gWavefrontRayQueue[PT_WAVEFRONT_RAY_ORI * PT_WAVEFRONT_PATH_COUNT + entryIndex];
+	pathIndex = asuint(oriField.w);
+	ori = oriField.xyz;
+	dir = gWavefrontRayQueue[PT_WAVEFRONT_RAY_DIR * PT_WAVEFRONT_PATH_COUNT + entryIndex].xyz;
+}
+
+uint GetWavefrontMaterialBucket(uint meshIndex, uint intersectionFlags)
+{
+	if (intersectionFlags & PT_INTERSECTION_TYPE_LIGHT)
+		return PT_MATERIAL_COUNT_MAX;
+	return gMeshBufferPT[meshIndex].mMaterialIndex;
+}
+
+uint GetWavefrontMaterialHistogramIndex(uint bucket, uint bounceIndex)
+{
+	return PT_WAVEFRONT_MATERIAL_HISTOGRAM_OFFSET + bounceIndex * PT_WAVEFRONT_MATERIAL_BUCKET_COUNT + bucket;
+}
+
+uint GetWavefrontMaterialCursorIndex(uint bucket, uint bounceIndex)
+{
+	return PT_WAVEFRONT_MATERIAL_CURSOR_OFFSET + bounceIndex * PT_WAVEFRONT_MATERIAL_BUCKET_COUNT + bucket;
+}
+
+void PushWavefrontHit(uint bounceIndex, uint pathIndex, Intersection it, float3 dir)
+{
+	uint entryIndex = AppendWavefrontQueue(PT_WAVEFRONT_QUEUE_HIT, bounceIndex);
+	if (uScene.mPathTracerWavefrontSortByMaterial)
+		InterlockedAdd(gWavefrontQueueCounterBuffer[GetWavefrontMaterialHistogramIndex(GetWavefrontMaterialBucket(it.mMeshIndex, it.mIntersectionFlags), bounceIndex)], 1);
+	gWavefrontHitQueue[PT_WAVEFRONT_HIT_POINT_WORLD * PT_WAVEFRONT_PATH_COUNT + entryIndex] = float4(it.mPointWorld, asfloat(pathIndex));
+	gWavefrontHitQueue[PT_WAVEFRONT_HIT_POINT_MODEL * PT_WAVEFRONT_PATH_COUNT + entryIndex] = float4(it.mPointModel, 0.0f);
+	gWavefrontHitQueue[PT_WAVEFRONT_HIT_DIR * PT_WAVEFRONT_PATH_COUNT + entryIndex] = float4(dir, 0.0f);
+	gWavefrontHitQueue[PT_WAVEFRONT_HIT_IDS * PT_WAVEFRONT_PATH_COUNT + entryIndex] = asfloat(uint4(it.mTriangleIndex, it.mMeshIndex, it.mLightIndex, it.mIntersectionFlags));
+}
+
+uint GetWavefrontHitMaterialBucket(uint entryIndex)
+{
+	uint4 ids = asuint(gWavefrontHitQueue[PT_WAVEFRONT_HIT_IDS * PT_WAVEFRONT_PATH_COUNT + entryIndex]);
+	return GetWavefrontMaterialBucket(ids.y, ids.w);
+}
+
+void GetWavefrontHit(uint entryIndex, out uint pathIndex, out Intersection it, out float3 dir)
+{
+	it = InitIntersection();
+	float4 pointWorld = gWavefrontHitQueue[PT_WAVEFRONT_HIT_POINT_WORLD * PT_WAVEFRONT_PATH_COUNT + entryIndex];
+	uint4 ids = asuint(gWavefrontHitQueue[PT_WAVEFRONT_HIT_IDS * PT_WAVEFRONT_PATH_COUNT + entryIndex]);
+	pathIndex = asuint(pointWorld.w);
+	it.mPointWorld = pointWorld.xyz;
+	it.mPointModel = gWavefrontHitQueue[PT_WAVEFRONT_HIT_POINT_MODEL * PT_WAVEFRONT_PATH_COUNT + entryIndex].xyz;
+	it.mTriangleIndex = ids.x;
+	it.mMeshIndex = ids.y;
+	it.mLightIndex = ids.z;
+	it.mIntersectionFlags = ids.w;
+	dir = gWavefrontHitQueue[PT_WAVEFRONT_HIT_DIR * PT_WAVEFRONT_PATH_COUNT + entryIndex].xyz;
+}
+
+// materialPdf of 0 marks a light sample, its contribution is final and only needs the visibility test
+void PushWavefrontShadowRay(uint bounceIndex, uint pathIndex, uint lightIndex, float3 ori, float3 dir, float3 contribution, float materialPdf)
+{
+	uint entryIndex = AppendWavefrontQueue(PT_WAVEFRONT_QUEUE_SHADOW, bounceIndex);
+	gWavefrontShadowQueue[PT_WAVEFRONT_SHADOW_ORI * PT_WAVEFRONT_SHADOW_CAPACITY + entryIndex] = float4(ori, asfloat(pathIndex));
+	gWavefrontShadowQueue[PT_WAVEFRONT_SHADOW_DIR * PT_WAVEFRONT_SHADOW_CAPACITY + entryIndex] = float4(dir, asfloat(lightIndex));
+	gWavefrontShadowQueue[PT_WAVEFRONT_SHADOW_CONTRIBUTION * PT_WAVEFRONT_SHADOW_CAPACITY + entryIndex] = float4(contribution, materialPdf);
+}
+
+void GetWavefrontShadowRay(uint entryIndex, out uint pathIndex, out uint lightIndex, out float3 ori, out float3 dir, out float3 contribution, out float materialPdf)
+{
+	float4 oriField = gWavefrontShadowQueue[PT_WAVEFRONT_SHADOW_ORI * PT_WAVEFRONT_SHADOW_CAPACITY + entryIndex];
+	float4 dirField = gWavefrontShadowQueue[PT_WAVEFRONT_SHADOW_DIR * PT_WAVEFRONT_SHADOW_CAPACITY + entryIndex];
+	float4 contributionField = gWavefrontShadowQueue[PT_WAVEFRONT_SHADOW_CONTRIBUTION * PT_WAVEFRONT_SHADOW_CAPACITY + entryIndex];
+	pathIndex = asuint(oriField.w);
+	lightIndex = asuint(dirField.w);
+	ori = oriField.xyz;
+	dir = dirField.xyz;
+	contribution = contributionField.xyz;
+	materialPdf = contributionField.w;
+}
+
+#endif
@@ -132,6 +132,30 @@ void DiscardVertex(inout VS_OUTPUT vert)
     vert.pos = float4(-1, -1, -1, 1);
 }
 
+float3 DecodeOctahedral(float2 encoded)
+{
+	float3 v = float3(encoded, 1.0f - abs(encoded.x) - abs(encoded.y));
+	float t = saturate(-v.z);
+	v.xy += v.xy >= 0.0f ? -t : t;
+	return normalize(v);
+}
+
+#ifndef CUSTOM_OBJECT_UNIFORM
+// meshes with the packed vertex layout have positions within their bounds, octahedral normals and tangents and half uvs,
+// the lowest bit of the tangent y is set when the bitangent is flipped, see Mesh::EncodePackedVertex
+VS_INPUT UnpackVertex(VS_INPUT input)
+{
+	if (uObject.mVertexPacked)
+	{
+		input.pos = uObject.mPackedPositionOffset + input.pos * uObject.mPackedPositionScale;
+		input.nor = DecodeOctahedral(input.nor.xy);
+		int tangentY = (int)round(input.tan.y * 32767.0f);
+		input.tan = float4(DecodeOctahedral(float2(input.tan.x, (tangentY & ~1) / 32767.0f)), tangentY & 1 ? -1.0f : 1.0f);
+	}
+	return input;
+}
+#endif
+
 //^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^//
 ///////////////// VS /////////////////
 
@@ -407,12 +431,17 @@ float Fresnel(float vDotH, float F0)
 }
 
 // wi = lightDir, wo = eyeDir
-float GGX(float3 wi, float3 wo, float3 wh, float3 N, float roughness)
+float GGX(float3 wi, float3 wo, float3 wh, float3 N, float roughness, float F0)
 {
-	float fresnel = Fresnel(dot(wh, wo), uScene.mFresnel);
+	float fresnel = Fresnel(dot(wh, wo), F0);
 	return saturate(fresnel * GGX_NoFresnel(wi, wo, wh, N, roughness));
 }
 
+float GGX(float3 wi, float3 wo, float3 wh, float3 N, float roughness)
+{
+	return GGX(wi, wo, wh, N, roughness, uScene.mFresnel);
+}
+
 float3 BRDF_GGX(SurfaceDataIn sdi, float3 wi, float3 wo)
 {
 	if (dot(wi, sdi.mNorWorld) < 0.0f || dot(wo, sdi.mNorWorld) < 0.0f)
@@ -429,7 +458,7 @@ float3 BRDF_GGX(SurfaceDataIn sdi, float3 wi, float3 wo)
 	else
 		wh = normalize(wh);
 
-	float specular = GGX(wi, wo, wh, sdi.mNorWorld, sdi.mRoughness);
+	float specular = GGX(wi, wo, wh, sdi.mNorWorld, sdi.mRoughness, sdi.mFresnel);
 	float diffuse = ONE_OVER_PI; // TODO: use Disney diffuse
 	return sdi.mAlbedo * (diffuse * (1.0f - sdi.mMetallic) + specular * sdi.mMetallic) * saturate(CosTheta(wi, sdi.mNorWorld));
 }
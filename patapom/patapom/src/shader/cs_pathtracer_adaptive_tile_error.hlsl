@@ -0,0 +1,39 @@
+#define CUSTOM_PASS_UNIFORM
+
+#include "ShaderInclude.hlsli"
+
+cbuffer PassUniformBuffer : register(b0, SPACE(PASS))
+{
+	PassUniformPathTracer uPass;
+};
+
+RWTexture2D<float4> gConvergencePT : register(u0, SPACE(PASS));
+RWStructuredBuffer<float> gAdaptiveTileErrorBuffer : register(u1, SPACE(PASS));
+
+#define TILE_PIXEL_COUNT (PT_ADAPTIVE_TILE_SIZE * PT_ADAPTIVE_TILE_SIZE)
+
+groupshared float2 gTileErrorAndPixelCount[TILE_PIXEL_COUNT];
+
+// one thread group per tile, the error of a tile is the mean relative error of its pixels
+[numthreads(PT_ADAPTIVE_TILE_SIZE, PT_ADAPTIVE_TILE_SIZE, 1)]
+void main(uint3 gDispatchThreadID : SV_DispatchThreadID, uint3 gGroupID : SV_GroupID, uint gGroupIndex : SV_GroupIndex)
+{
+	uint2 screenPos = gDispatchThreadID.xy;
+	bool onScreen = screenPos.x < PT_BACKBUFFER_WIDTH && screenPos.y < PT_BACKBUFFER_HEIGHT;
+	gTileErrorAndPixelCount[gGroupIndex] = onScreen ? float2(gConvergencePT[screenPos].w, 1.0f) : 0.0f.xx;
+	GroupMemoryBarrierWithGroupSync();
+	for (uint stride = TILE_PIXEL_COUNT / 2; stride > 0; stride >>= 1)
+	{
+		if (gGroupIndex < stride)
+			gTileErrorAndPixelCount[gGroupIndex] += gTileErrorAndPixelCount[gGroupIndex + stride];
+		GroupMemoryBarrierWithGroupSync();
+	}
+	if (gGroupIndex == 0)
+	{
+		float2 tileErrorAndPixelCount = gTileErrorAndPixelCount[0];
+		gAdaptiveTileErrorBuffer[gGroupID.x + gGroupID.y * PT_ADAPTIVE_TILE_COUNT_X] = tileErrorAndPixelCount.x / tileErrorAndPixelCount.y;
+		// the CPU reads the errors back a few frames later, the frame tells it whether they were measured after the last restart
+		if (gGroupID.x == 0 && gGroupID.y == 0)
+			gAdaptiveTileErrorBuffer[PT_ADAPTIVE_TILE_ERROR_FRAME] = asfloat(uFrame.mFrameCountSinceGameStart);
+	}
+}
@@ -51,7 +51,14 @@ void main(uint3 gDispatchThreadID : SV_DispatchThreadID)
 					{
 						if (uPass.mBuildBvhType == PT_BUILDBVH_TYPE_TRIANGLE)
 						{
-							gMeshBufferPT[uPass.mBuildBvhMeshIndex].mRootTriangleBvhIndexLocal = current; // local, we apply offsets in other places
+							// local, we apply offsets in other places
+							// instances come after the mesh that owns their triangles and are not built again, they share its root
+							uint triangleOffset = gMeshBufferPT[uPass.mBuildBvhMeshIndex].mTriangleIndexLocalToGlobalOffset;
+							for (uint meshIndex = uPass.mBuildBvhMeshIndex; meshIndex < uPass.mBuildBvhMeshCount; meshIndex++)
+							{
+								if (gMeshBufferPT[meshIndex].mTriangleIndexLocalToGlobalOffset == triangleOffset)
+									gMeshBufferPT[meshIndex].mRootTriangleBvhIndexLocal = current;
+							}
 						}
 						else if (uPass.mBuildBvhType == PT_BUILDBVH_TYPE_MESH)
 						{
@@ -0,0 +1,133 @@
+#define CUSTOM_PASS_UNIFORM
+
+#include "ShaderInclude.hlsli"
+
+cbuffer PassUniformBuffer : register(b0, SPACE(PASS))
+{
+	PassUniformDenoiser uPass;
+};
+
+RWTexture2D<float4> gBackbufferPT : register(u0, SPACE(PASS));
+RWTexture2D<float4> gConvergencePT : register(u1, SPACE(PASS));
+RWTexture2D<float4> gNormalDepthPT : register(u2, SPACE(PASS));
+RWTexture2D<float4> gAlbedoPT : register(u3, SPACE(PASS));
+RWTexture2D<float4> gDenoisePingPT : register(u4, SPACE(PASS)); // illumination and its variance
+RWTexture2D<float4> gDenoisePongPT : register(u5, SPACE(PASS));
+RWTexture2D<float4> gDenoisePriorPT : register(u6, SPACE(PASS)); // reprojected history illumination and its weight, negative weight until it is reprojected
+RWTexture2D<float4> gDenoiseHistoryPT : register(u7, SPACE(PASS)); // illumination and the samples it is worth
+RWTexture2D<float4> gDenoiseHistoryFeaturesPT : register(u8, SPACE(PASS)); // normal and distance
+RWTexture2D<float4> gDenoisedPT : register(u9, SPACE(PASS));
+
+#include "PathTracerDenoiseUtil.hlsli"
+
+// even iterations read the ping texture and odd ones the pong texture, the temporal pass writes ping
+float4 ReadIllumination(uint iterationIndex, int2 screenPos)
+{
+	return iterationIndex & 1 ? gDenoisePongPT[screenPos] : gDenoisePingPT[screenPos];
+}
+
+void WriteIllumination(uint iterationIndex, int2 screenPos, float4 illumination)
+{
+	if (iterationIndex & 1)
+		gDenoisePingPT[screenPos] = illumination;
+	else
+		gDenoisePongPT[screenPos] = illumination;
+}
+
+bool IsOnScreen(int2 screenPos)
+{
+	return all(screenPos >= 0) && screenPos.x < PT_BACKBUFFER_WIDTH && screenPos.y < PT_BACKBUFFER_HEIGHT;
+}
+
+// distance difference to the closest neighbor on each axis, the side across an edge is ignored
+float GetDepthGradient(int2 screenPos, float depth)
+{
+	float gradient = 0.0f;
+	for (int axis = 0; axis < 2; axis++)
+	{
+		float axisGradient = -1.0f; // no neighbor on this axis yet
+		for (int side = -1; side <= 1; side += 2)
+		{
+			int2 tapPos = screenPos + (axis ? int2(0, side) : int2(side, 0));
+			float tapDepth = IsOnScreen(tapPos) ? gNormalDepthPT[tapPos].w : 0.0f;
+			if (tapDepth > 0.0f && (axisGradient < 0.0f || abs(tapDepth - depth) < axisGradient))
+				axisGradient = abs(tapDepth - depth);
+		}
+		gradient = max(gradient, axisGradient);
+	}
+	return gradient;
+}
+
+// 3x3 gaussian of the variance, the luminance weight of a single noisy variance would stop the filter at random
+float GetFilteredVariance(uint iterationIndex, int2 screenPos)
+{
+	float varianceSum = 0.0f;
+	float weightSum = 0.0f;
+	for (int y = -1; y <= 1; y++)
+	{
+		for (int x = -1; x <= 1; x++)
+		{
+			int2 tapPos = screenPos + int2(x, y);
+			if (!IsOnScreen(tapPos))
+				continue;
+			float weight = (x ? 0.25f : 0.5f) * (y ? 0.25f : 0.5f);
+			varianceSum += ReadIllumination(iterationIndex, tapPos).a * weight;
+			weightSum += weight;
+		}
+	}
+	return varianceSum / weightSum;
+}
+
+// one iteration of the edge avoiding a-trous wavelet filter, the step doubles every iteration
+// the last iteration multiplies the albedo back and keeps the result as the history of the next restart
+[numthreads(PT_THREAD_PER_THREADGROUP_X, PT_THREAD_PER_THREADGROUP_Y, 1)]
+void main(uint3 gDispatchThreadID : SV_DispatchThreadID)
+{
+	int2 screenPos = int2(gDispatchThreadID.xy);
+	if (!IsOnScreen(screenPos))
+		return;
+	uint iterationIndex = uPass.mDenoiseIterationIndex;
+	int step = 1 << iterationIndex;
+	float4 center = ReadIllumination(iterationIndex, screenPos);
+	float4 normalDepth = gNormalDepthPT[screenPos];
+	float4 filtered = center;
+	if (normalDepth.w > 0.0f) // misses are not filtered
+	{
+		float3 normal = GetDenoiseNormal(normalDepth);
+		float luminance = GetDenoiseLuminance(center.rgb);
+		float luminanceSigma = PT_DENOISE_SIGMA_LUMINANCE * sqrt(GetFilteredVariance(iterationIndex, screenPos));
+		float depthGradient = GetDepthGradient(screenPos, normalDepth.w);
+		float3 illuminationSum = 0.0f.xxx;
+		float varianceSum = 0.0f;
+		float weightSum = 0.0f;
+		for (int y = -2; y <= 2; y++)
+		{
+			for (int x = -2; x <= 2; x++)
+			{
+				int2 tapPos = screenPos + int2(x, y) * step;
+				if (!IsOnScreen(tapPos))
+					continue;
+				float4 tap = ReadIllumination(iterationIndex, tapPos);
+				float4 tapNormalDepth = gNormalDepthPT[tapPos];
+				float weight = GetDenoiseKernelWeight(x) * GetDenoiseKernelWeight(y);
+				if (x || y)
+					weight *= GetDenoiseEdgeStoppingWeight(normal, normalDepth.w, luminance, GetDenoiseNormal(tapNormalDepth), tapNormalDepth.w, GetDenoiseLuminance(tap.rgb), depthGradient * step * length(float2(x, y)), luminanceSigma);
+				illuminationSum += tap.rgb * weight;
+				varianceSum += tap.a * weight * weight;
+				weightSum += weight;
+			}
+		}
+		filtered = float4(illuminationSum / weightSum, varianceSum / (weightSum * weightSum));
+	}
+	if (iterationIndex < PT_DENOISE_ATROUS_ITERATION_COUNT - 1)
+	{
+		WriteIllumination(iterationIndex, screenPos, filtered);
+		return;
+	}
+	gDenoisedPT[screenPos] = float4(filtered.rgb * GetDenoiseDemodulationAlbedo(gAlbedoPT[screenPos].rgb), 1.0f);
+	if (uPass.mDenoiseEveryPixelSampled)
+	{
+		gDenoiseHistoryPT[screenPos] = float4(filtered.rgb, gConvergencePT[screenPos].x + max(gDenoisePriorPT[screenPos].w, 0.0f));
+		gDenoiseHistoryFeaturesPT[screenPos] = normalDepth;
+	}
+}
@@ -0,0 +1,123 @@
+#define CUSTOM_PASS_UNIFORM
+
+#include "ShaderInclude.hlsli"
+
+cbuffer PassUniformBuffer : register(b0, SPACE(PASS))
+{
+	PassUniformDenoiser uPass;
+};
+
+RWTexture2D<float4> gBackbufferPT : register(u0, SPACE(PASS));
+RWTexture2D<float4> gConvergencePT : register(u1, SPACE(PASS));
+RWTexture2D<float4> gNormalDepthPT : register(u2, SPACE(PASS));
+RWTexture2D<float4> gAlbedoPT : register(u3, SPACE(PASS));
+RWTexture2D<float4> gDenoisePingPT : register(u4, SPACE(PASS)); // illumination and its variance
+RWTexture2D<float4> gDenoisePongPT : register(u5, SPACE(PASS));
+RWTexture2D<float4> gDenoisePriorPT : register(u6, SPACE(PASS)); // reprojected history illumination and its weight, negative weight until it is reprojected
+RWTexture2D<float4> gDenoiseHistoryPT : register(u7, SPACE(PASS)); // illumination and the samples it is worth
+RWTexture2D<float4> gDenoiseHistoryFeaturesPT : register(u8, SPACE(PASS)); // normal and distance
+RWTexture2D<float4> gDenoisedPT : register(u9, SPACE(PASS));
+
+#include "PathTracerDenoiseUtil.hlsli"
+
+// bilinear history taps on the same surface as the pixel, the camera of the history is the one before the last restart
+float4 ReprojectHistory(uint2 screenPos, float4 normalDepth)
+{
+	if (!uPass.mDenoiseHistoryValid || normalDepth.w <= 0.0f)
+		return 0.0f.xxxx;
+	float3 normal = GetDenoiseNormal(normalDepth);
+	float3 posWorld = uPass.mEyePos + GetDenoisePixelDirection(screenPos) * normalDepth.w;
+	float4 historyClip = mul(uPass.mHistoryViewProj, float4(posWorld, 1.0f));
+	if (historyClip.w <= 0.0f)
+		return 0.0f.xxxx;
+	float2 historyPos = (historyClip.xy / historyClip.w * float2(0.5f, -0.5f) + 0.5f) * float2(PT_BACKBUFFER_WIDTH, PT_BACKBUFFER_HEIGHT) - 0.5f;
+	int2 historyPosBase = int2(floor(historyPos));
+	float2 bilinear = historyPos - historyPosBase;
+	float historyDistance = length(posWorld - uPass.mHistoryEyePos);
+	float3 illuminationSum = 0.0f.xxx;
+	float lengthSum = 0.0f;
+	float weightSum = 0.0f;
+	for (int y = 0; y < 2; y++)
+	{
+		for (int x = 0; x < 2; x++)
+		{
+			int2 tapPos = historyPosBase + int2(x, y);
+			if (any(tapPos < 0) || tapPos.x >= PT_BACKBUFFER_WIDTH || tapPos.y >= PT_BACKBUFFER_HEIGHT)
+				continue;
+			float4 history = gDenoiseHistoryPT[tapPos];
+			float4 historyFeatures = gDenoiseHistoryFeaturesPT[tapPos];
+			if (history.w <= 0.0f || historyFeatures.w <= 0.0f)
+				continue;
+			if (dot(GetDenoiseNormal(historyFeatures), normal) < PT_DENOISE_REPROJECTION_NORMAL_MIN)
+				continue;
+			if (abs(historyFeatures.w - historyDistance) > PT_DENOISE_REPROJECTION_DEPTH_TOLERANCE * historyDistance)
+				continue;
+			float weight = (x ? bilinear.x : 1.0f - bilinear.x) * (y ? bilinear.y : 1.0f - bilinear.y);
+			illuminationSum += history.rgb * weight;
+			lengthSum += history.w * weight;
+			weightSum += weight;
+		}
+	}
+	if (weightSum < 0.01f)
+		return 0.0f.xxxx;
+	return float4(illuminationSum / weightSum, min(lengthSum / weightSum, PT_DENOISE_PRIOR_WEIGHT_MAX));
+}
+
+// variance of the mean illumination luminance, from the samples of the pixel once it has enough of them and from its neighbors before
+float GetIlluminationVariance(uint2 screenPos, float4 convergence, float3 albedo)
+{
+	float sampleCount = convergence.x;
+	if (sampleCount >= PT_DENOISE_TEMPORAL_VARIANCE_SAMPLE_COUNT_MIN)
+	{
+		float albedoLuminance = GetDenoiseLuminance(albedo);
+		return convergence.z / ((sampleCount - 1.0f) * sampleCount) / (albedoLuminance * albedoLuminance);
+	}
+	float luminanceSum = 0.0f;
+	float luminanceSquaredSum = 0.0f;
+	float tapCount = 0.0f;
+	for (int y = -1; y <= 1; y++)
+	{
+		for (int x = -1; x <= 1; x++)
+		{
+			int2 tapPos = int2(screenPos) + int2(x, y);
+			if (any(tapPos < 0) || tapPos.x >= PT_BACKBUFFER_WIDTH || tapPos.y >= PT_BACKBUFFER_HEIGHT || gNormalDepthPT[tapPos].w <= 0.0f)
+				continue;
+			float luminance = GetDenoiseLuminance(gBackbufferPT[tapPos].rgb / GetDenoiseDemodulationAlbedo(gAlbedoPT[tapPos].rgb));
+			luminanceSum += luminance;
+			luminanceSquaredSum += luminance * luminance;
+			tapCount += 1.0f;
+		}
+	}
+	if (tapCount < 2.0f)
+		return 0.0f;
+	float luminanceMean = luminanceSum / tapCount;
+	return max(luminanceSquaredSum / tapCount - luminanceMean * luminanceMean, 0.0f) / max(sampleCount, 1.0f);
+}
+
+// demodulates the accumulated color and blends in the history reprojected after the last restart,
+// the prior counts as a few samples so the samples of the new camera take over as they come in
+[numthreads(PT_THREAD_PER_THREADGROUP_X, PT_THREAD_PER_THREADGROUP_Y, 1)]
+void main(uint3 gDispatchThreadID : SV_DispatchThreadID)
+{
+	uint2 screenPos = gDispatchThreadID.xy;
+	if (screenPos.x >= PT_BACKBUFFER_WIDTH || screenPos.y >= PT_BACKBUFFER_HEIGHT)
+		return;
+	float4 convergence = gConvergencePT[screenPos];
+	float sampleCount = convergence.x;
+	float3 albedo = GetDenoiseDemodulationAlbedo(gAlbedoPT[screenPos].rgb);
+	float4 prior = uPass.mDenoiseResetPrior ? float4(0.0f.xxx, -1.0f) : gDenoisePriorPT[screenPos];
+	if (prior.w < 0.0f && uPass.mDenoiseEveryPixelSampled)
+		prior = ReprojectHistory(screenPos, gNormalDepthPT[screenPos]);
+	gDenoisePriorPT[screenPos] = prior;
+	float priorWeight = max(prior.w, 0.0f);
+	float totalWeight = sampleCount + priorWeight;
+	if (totalWeight <= 0.0f)
+	{
+		gDenoisePingPT[screenPos] = 0.0f.xxxx;
+		return;
+	}
+	float3 illumination = gBackbufferPT[screenPos].rgb / albedo;
+	float sampleShare = sampleCount / totalWeight;
+	float variance = GetIlluminationVariance(screenPos, convergence, albedo) * sampleShare * sampleShare;
+	gDenoisePingPT[screenPos] = float4(illumination * sampleShare + prior.rgb * (priorWeight / totalWeight), variance);
+}
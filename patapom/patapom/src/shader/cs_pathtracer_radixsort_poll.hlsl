@@ -11,7 +11,7 @@ cbuffer PassUniformBuffer : register(b0, SPACE(PASS))
 StructuredBuffer<MeshPT> gMeshBufferPT : register(t0, SPACE(PASS));
 RWStructuredBuffer<AabbProxy> gProxyBuffer : register(u0, SPACE(PASS));
 RWStructuredBuffer<uint4> gRadixSortBitCountArray : register(u1, SPACE(PASS));
-RWStructuredBuffer<uint4> gRadixSortPrefixSumAuxArray : register(u2, SPACE(PASS)); // element count = NextPowerOfTwo32(PT_RADIXSORT_THREAD_COUNT_MAX) need to be initialized to 0 to handle non power of 2 element count
+RWStructuredBuffer<uint4> gRadixSortPrefixSumAuxArray : register(u2, SPACE(PASS)); // element count = NextPowerOfTwo32(GET_PT_RADIXSORT_THREAD_COUNT(leaf count of the largest tree)) need to be initialized to 0 to handle non power of 2 element count
 RWStructuredBuffer<GlobalBvhSettings> gGlobalBvhSettingBuffer : register(u3, SPACE(PASS));
 
 [numthreads(PT_BUILDBVH_THREAD_PER_THREADGROUP, 1, 1)]
@@ -11,7 +11,7 @@ cbuffer PassUniformBuffer : register(b0, SPACE(PASS))
 StructuredBuffer<MeshPT> gMeshBufferPT : register(t0, SPACE(PASS));
 StructuredBuffer<AabbProxy> gRadixSortEntryBufferIn : register(t1, SPACE(PASS));
 StructuredBuffer<uint4> gRadixSortBitCountArray : register(t2, SPACE(PASS));
-StructuredBuffer<uint4> gRadixSortPrefixSumAuxArray : register(t3, SPACE(PASS)); // element count = PT_RADIXSORT_DISPATCH_COUNT_MAX
+StructuredBuffer<uint4> gRadixSortPrefixSumAuxArray : register(t3, SPACE(PASS)); // element count = GET_PT_RADIXSORT_DISPATCH_COUNT(leaf count of the largest tree)
 StructuredBuffer<GlobalBvhSettings> gGlobalBvhSettingBuffer : register(t4, SPACE(PASS));
 RWStructuredBuffer<AabbProxy> gRadixSortEntryBufferOut : register(u0, SPACE(PASS));
 
@@ -8,7 +8,7 @@ cbuffer PassUniformBuffer : register(b0, SPACE(PASS))
 	PassUniformPathTracerBuildScene uPass;
 };
 
-RWStructuredBuffer<uint4> gRadixSortPrefixSumAuxArray : register(u0, SPACE(PASS)); // element count = PT_RADIXSORT_DISPATCH_COUNT_MAX
+RWStructuredBuffer<uint4> gRadixSortPrefixSumAuxArray : register(u0, SPACE(PASS)); // element count = GET_PT_RADIXSORT_DISPATCH_COUNT(leaf count of the largest tree)
 
 [numthreads(PT_RADIXSORT_SWEEP_THREAD_PER_THREADGROUP, 1, 1)]
 void main(uint3 gDispatchThreadID : SV_DispatchThreadID)
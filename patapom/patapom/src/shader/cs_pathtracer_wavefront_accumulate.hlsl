@@ -0,0 +1,64 @@
+#define CUSTOM_PASS_UNIFORM
+
+#include "ShaderInclude.hlsli"
+
+cbuffer PassUniformBuffer : register(b0, SPACE(PASS))
+{
+	PassUniformPathTracer uPass;
+};
+
+RWStructuredBuffer<float4> gWavefrontPathBuffer : register(u0, SPACE(PASS));
+RWStructuredBuffer<float4> gWavefrontRayQueue : register(u1, SPACE(PASS));
+RWStructuredBuffer<float4> gWavefrontHitQueue : register(u2, SPACE(PASS));
+RWStructuredBuffer<float4> gWavefrontShadowQueue : register(u3, SPACE(PASS));
+RWStructuredBuffer<uint> gWavefrontQueueCounterBuffer : register(u4, SPACE(PASS));
+RWTexture2D<float4> gBackbufferPT : register(u5, SPACE(PASS));
+RWTexture2D<float> gDepthbufferPT : register(u6, SPACE(PASS));
+RWTexture2D<float4> gConvergencePT : register(u7, SPACE(PASS));
+RWStructuredBuffer<float> gAdaptiveTileErrorBuffer : register(u8, SPACE(PASS));
+RWStructuredBuffer<uint> gWavefrontHitOrderBuffer : register(u9, SPACE(PASS)); // hit queue entries in material order
+RWTexture2D<float4> gNormalDepthPT : register(u10, SPACE(PASS));
+RWTexture2D<float4> gAlbedoPT : register(u11, SPACE(PASS));
+StructuredBuffer<TrianglePT> gTriangleBufferPT : register(t0, SPACE(PASS));
+StructuredBuffer<MeshPT> gMeshBufferPT : register(t1, SPACE(PASS));
+StructuredBuffer<LightData> gLightDataBufferPT : register(t2, SPACE(PASS));
+StructuredBuffer<BVH> gMeshWorldBvhBuffer : register(t3, SPACE(PASS));
+StructuredBuffer<BVH> gTriangleModelBvhBuffer : register(t4, SPACE(PASS));
+StructuredBuffer<GlobalBvhSettings> gGlobalBvhSettingBuffer : register(t5, SPACE(PASS));
+StructuredBuffer<LightBvhNode> gLightBvhBuffer : register(t6, SPACE(PASS));
+StructuredBuffer<AliasEntry> gLightAliasBuffer : register(t7, SPACE(PASS));
+StructuredBuffer<MaterialPT> gMaterialBufferPT : register(t8, SPACE(PASS));
+Texture2D gMeshTextures[] : register(t9, SPACE(PASS)); // unbounded texture array, only bound to the shade passes
+
+#include "PathTracerCommon.hlsli"
+#include "PathTracerWavefrontResourceUtil.hlsli"
+#include "PathTracerAdaptiveUtil.hlsli"
+#include "PathTracerDenoiseUtil.hlsli"
+
+[numthreads(PT_WAVEFRONT_THREAD_PER_THREADGROUP, 1, 1)]
+void main(uint3 gDispatchThreadID : SV_DispatchThreadID)
+{
+	uint pathIndex = gDispatchThreadID.x;
+	if (pathIndex >= PT_WAVEFRONT_PATH_COUNT)
+		return;
+	uint2 screenPos = GetWavefrontScreenPos(pathIndex);
+	if (IsAdaptiveTileConverged(screenPos))
+		return;
+	float3 finalColor =
+		GetWavefrontPathField(pathIndex, PT_WAVEFRONT_PATH_RADIANCE).rgb +
+		GetWavefrontPathField(pathIndex, PT_WAVEFRONT_PATH_LIGHT_SAMPLE_RADIANCE).rgb +
+		GetWavefrontPathField(pathIndex, PT_WAVEFRONT_PATH_MATERIAL_SAMPLE_RADIANCE).rgb;
+	float4 normalDepth = GetWavefrontPathField(pathIndex, PT_WAVEFRONT_PATH_FIRST_HIT_NORMAL_DEPTH);
+	DenoiseFeatures firstHitFeatures;
+	firstHitFeatures.mNormal = normalDepth.xyz;
+	firstHitFeatures.mHitDistance = normalDepth.w;
+	firstHitFeatures.mAlbedo = GetWavefrontPathField(pathIndex, PT_WAVEFRONT_PATH_FIRST_HIT_ALBEDO).rgb;
+	if (!uScene.mPathTracerCurrentSampleIndex)
+	{
+		ClearAdaptiveSamples(screenPos);
+		ClearDenoiseFeatures(screenPos);
+	}
+	// average the total estimation with the sample count of the pixel, write to backbuffer
+	AccumulateDenoiseFeatures(screenPos, firstHitFeatures);
+	AccumulateAdaptiveSample(screenPos, finalColor);
+}
@@ -0,0 +1,75 @@
+#define CUSTOM_PASS_UNIFORM
+
+#include "ShaderInclude.hlsli"
+
+cbuffer PassUniformBuffer : register(b0, SPACE(PASS))
+{
+	PassUniformPathTracer uPass;
+};
+
+RWStructuredBuffer<float4> gWavefrontPathBuffer : register(u0, SPACE(PASS));
+RWStructuredBuffer<float4> gWavefrontRayQueue : register(u1, SPACE(PASS));
+RWStructuredBuffer<float4> gWavefrontHitQueue : register(u2, SPACE(PASS));
+RWStructuredBuffer<float4> gWavefrontShadowQueue : register(u3, SPACE(PASS));
+RWStructuredBuffer<uint> gWavefrontQueueCounterBuffer : register(u4, SPACE(PASS));
+RWTexture2D<float4> gBackbufferPT : register(u5, SPACE(PASS));
+RWTexture2D<float> gDepthbufferPT : register(u6, SPACE(PASS));
+RWTexture2D<float4> gConvergencePT : register(u7, SPACE(PASS));
+RWStructuredBuffer<float> gAdaptiveTileErrorBuffer : register(u8, SPACE(PASS));
+RWStructuredBuffer<uint> gWavefrontHitOrderBuffer : register(u9, SPACE(PASS)); // hit queue entries in material order
+RWTexture2D<float4> gNormalDepthPT : register(u10, SPACE(PASS));
+RWTexture2D<float4> gAlbedoPT : register(u11, SPACE(PASS));
+StructuredBuffer<TrianglePT> gTriangleBufferPT : register(t0, SPACE(PASS));
+StructuredBuffer<MeshPT> gMeshBufferPT : register(t1, SPACE(PASS));
+StructuredBuffer<LightData> gLightDataBufferPT : register(t2, SPACE(PASS));
+StructuredBuffer<BVH> gMeshWorldBvhBuffer : register(t3, SPACE(PASS));
+StructuredBuffer<BVH> gTriangleModelBvhBuffer : register(t4, SPACE(PASS));
+StructuredBuffer<GlobalBvhSettings> gGlobalBvhSettingBuffer : register(t5, SPACE(PASS));
+StructuredBuffer<LightBvhNode> gLightBvhBuffer : register(t6, SPACE(PASS));
+StructuredBuffer<AliasEntry> gLightAliasBuffer : register(t7, SPACE(PASS));
+StructuredBuffer<MaterialPT> gMaterialBufferPT : register(t8, SPACE(PASS));
+Texture2D gMeshTextures[] : register(t9, SPACE(PASS)); // unbounded texture array, only bound to the shade passes
+
+#include "PathTracerCommon.hlsli"
+#include "PathTracerWavefrontResourceUtil.hlsli"
+#include "PathTracerAdaptiveUtil.hlsli"
+
+// visibility of the light and material samples of this bounce
+// a path has at most one of each per bounce and they add to different fields, so no atomics are needed
+[numthreads(PT_WAVEFRONT_THREAD_PER_THREADGROUP, 1, 1)]
+void main(uint3 gDispatchThreadID : SV_DispatchThreadID)
+{
+	uint bounceIndex = uPass.mWavefrontBounceIndex;
+	uint entryIndex = gDispatchThreadID.x;
+	if (entryIndex >= GetWavefrontQueueCount(PT_WAVEFRONT_QUEUE_SHADOW, bounceIndex))
+		return;
+	uint pathIndex = 0;
+	uint lightIndex = 0;
+	float3 ori = 0.0f.xxx;
+	float3 dir = 0.0f.xxx;
+	float3 contribution = 0.0f.xxx;
+	float materialPdf = 0.0f;
+	GetWavefrontShadowRay(entryIndex, pathIndex, lightIndex, ori, dir, contribution, materialPdf);
+	float3 lightPoint = 0.0f.xxx;
+	float3 lightNor = 0.0f.xxx;
+	uint field = PT_WAVEFRONT_PATH_LIGHT_SAMPLE_RADIANCE;
+	if (materialPdf <= 0.0f) // light sample, dir ends at the sampled point
+	{
+		if (!IsLightSampleVisible(lightIndex, ori, ori + dir, lightPoint))
+			return;
+	}
+	else // material sample
+	{
+		if (!IsLightVisibleInternal(lightIndex, ori, dir, lightPoint, lightNor))
+			return;
+		float materialLightPdf = 1.0f;
+		float3 materialLightCol = EvaluateLight(ori, lightPoint, lightNor, lightIndex, materialLightPdf);
+		// no delta light when sampling material
+		if (materialLightPdf <= 0.0f)
+			return;
+		float weight = PowerHeuristic(1.0f, materialPdf, 1.0f, materialLightPdf);
+		contribution *= materialLightCol * weight / materialPdf;
+		field = PT_WAVEFRONT_PATH_MATERIAL_SAMPLE_RADIANCE;
+	}
+	SetWavefrontPathField(pathIndex, field, GetWavefrontPathField(pathIndex, field) + float4(contribution, 0.0f));
+}
@@ -0,0 +1,66 @@
+#define CUSTOM_PASS_UNIFORM
+
+#include "ShaderInclude.hlsli"
+
+cbuffer PassUniformBuffer : register(b0, SPACE(PASS))
+{
+	PassUniformPathTracer uPass;
+};
+
+RWStructuredBuffer<float4> gWavefrontPathBuffer : register(u0, SPACE(PASS));
+RWStructuredBuffer<float4> gWavefrontRayQueue : register(u1, SPACE(PASS));
+RWStructuredBuffer<float4> gWavefrontHitQueue : register(u2, SPACE(PASS));
+RWStructuredBuffer<float4> gWavefrontShadowQueue : register(u3, SPACE(PASS));
+RWStructuredBuffer<uint> gWavefrontQueueCounterBuffer : register(u4, SPACE(PASS));
+RWTexture2D<float4> gBackbufferPT : register(u5, SPACE(PASS));
+RWTexture2D<float> gDepthbufferPT : register(u6, SPACE(PASS));
+RWTexture2D<float4> gConvergencePT : register(u7, SPACE(PASS));
+RWStructuredBuffer<float> gAdaptiveTileErrorBuffer : register(u8, SPACE(PASS));
+RWStructuredBuffer<uint> gWavefrontHitOrderBuffer : register(u9, SPACE(PASS)); // hit queue entries in material order
+RWTexture2D<float4> gNormalDepthPT : register(u10, SPACE(PASS));
+RWTexture2D<float4> gAlbedoPT : register(u11, SPACE(PASS));
+StructuredBuffer<TrianglePT> gTriangleBufferPT : register(t0, SPACE(PASS));
+StructuredBuffer<MeshPT> gMeshBufferPT : register(t1, SPACE(PASS));
+StructuredBuffer<LightData> gLightDataBufferPT : register(t2, SPACE(PASS));
+StructuredBuffer<BVH> gMeshWorldBvhBuffer : register(t3, SPACE(PASS));
+StructuredBuffer<BVH> gTriangleModelBvhBuffer : register(t4, SPACE(PASS));
+StructuredBuffer<GlobalBvhSettings> gGlobalBvhSettingBuffer : register(t5, SPACE(PASS));
+StructuredBuffer<LightBvhNode> gLightBvhBuffer : register(t6, SPACE(PASS));
+StructuredBuffer<AliasEntry> gLightAliasBuffer : register(t7, SPACE(PASS));
+StructuredBuffer<MaterialPT> gMaterialBufferPT : register(t8, SPACE(PASS));
+Texture2D gMeshTextures[] : register(t9, SPACE(PASS)); // unbounded texture array, only bound to the shade passes
+
+#include "PathTracerCommon.hlsli"
+#include "PathTracerWavefrontResourceUtil.hlsli"
+#include "PathTracerAdaptiveUtil.hlsli"
+
+// closest hit of every ray in the queue of this bounce, hits are compacted into the hit queue
+[numthreads(PT_WAVEFRONT_THREAD_PER_THREADGROUP, 1, 1)]
+void main(uint3 gDispatchThreadID : SV_DispatchThreadID)
+{
+	uint bounceIndex = uPass.mWavefrontBounceIndex;
+	uint entryIndex = gDispatchThreadID.x;
+	if (entryIndex >= GetWavefrontQueueCount(PT_WAVEFRONT_QUEUE_RAY, bounceIndex))
+		return;
+	uint pathIndex = 0;
+	float3 ori = 0.0f.xxx;
+	float3 dir = 0.0f.xxx;
+	GetWavefrontRay(entryIndex, pathIndex, ori, dir);
+	if (!any(dir)) // converged tile, see the generate stage
+		return;
+	Intersection it = InitIntersection();
+	bool hitAnything = Intersect(it, ori, dir);
+	if (hitAnything)
+		PushWavefrontHit(bounceIndex, pathIndex, it, dir);
+	// every path has a camera ray in the first bounce, transform world position to depth, write to depthbuffer
+	if (bounceIndex == 0)
+	{
+		float firstDepth = DEPTH_FAR_REVERSED_Z_SWITCH;
+		if (hitAnything)
+		{
+			float4 posProj = mul(uPass.mProj, mul(uPass.mView, float4(it.mPointWorld, 1.0f)));
+			firstDepth = posProj.z / posProj.w;
+		}
+		gDepthbufferPT[GetWavefrontScreenPos(pathIndex)] = firstDepth;
+	}
+}
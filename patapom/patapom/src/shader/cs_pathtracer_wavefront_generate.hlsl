@@ -0,0 +1,75 @@
+#define CUSTOM_PASS_UNIFORM
+
+#include "ShaderInclude.hlsli"
+
+cbuffer PassUniformBuffer : register(b0, SPACE(PASS))
+{
+	PassUniformPathTracer uPass;
+};
+
+RWStructuredBuffer<float4> gWavefrontPathBuffer : register(u0, SPACE(PASS));
+RWStructuredBuffer<float4> gWavefrontRayQueue : register(u1, SPACE(PASS));
+RWStructuredBuffer<float4> gWavefrontHitQueue : register(u2, SPACE(PASS));
+RWStructuredBuffer<float4> gWavefrontShadowQueue : register(u3, SPACE(PASS));
+RWStructuredBuffer<uint> gWavefrontQueueCounterBuffer : register(u4, SPACE(PASS));
+RWTexture2D<float4> gBackbufferPT : register(u5, SPACE(PASS));
+RWTexture2D<float> gDepthbufferPT : register(u6, SPACE(PASS));
+RWTexture2D<float4> gConvergencePT : register(u7, SPACE(PASS));
+RWStructuredBuffer<float> gAdaptiveTileErrorBuffer : register(u8, SPACE(PASS));
+RWStructuredBuffer<uint> gWavefrontHitOrderBuffer : register(u9, SPACE(PASS)); // hit queue entries in material order
+RWTexture2D<float4> gNormalDepthPT : register(u10, SPACE(PASS));
+RWTexture2D<float4> gAlbedoPT : register(u11, SPACE(PASS));
+StructuredBuffer<TrianglePT> gTriangleBufferPT : register(t0, SPACE(PASS));
+StructuredBuffer<MeshPT> gMeshBufferPT : register(t1, SPACE(PASS));
+StructuredBuffer<LightData> gLightDataBufferPT : register(t2, SPACE(PASS));
+StructuredBuffer<BVH> gMeshWorldBvhBuffer : register(t3, SPACE(PASS));
+StructuredBuffer<BVH> gTriangleModelBvhBuffer : register(t4, SPACE(PASS));
+StructuredBuffer<GlobalBvhSettings> gGlobalBvhSettingBuffer : register(t5, SPACE(PASS));
+StructuredBuffer<LightBvhNode> gLightBvhBuffer : register(t6, SPACE(PASS));
+StructuredBuffer<AliasEntry> gLightAliasBuffer : register(t7, SPACE(PASS));
+StructuredBuffer<MaterialPT> gMaterialBufferPT : register(t8, SPACE(PASS));
+Texture2D gMeshTextures[] : register(t9, SPACE(PASS)); // unbounded texture array, only bound to the shade passes
+
+#include "PathTracerCommon.hlsli"
+#include "PathTracerWavefrontResourceUtil.hlsli"
+#include "PathTracerAdaptiveUtil.hlsli"
+#include "PathTracerDenoiseUtil.hlsli"
+#include "PathTracerSamplerUtil.hlsli"
+
+// one camera ray per pixel, path index is the pixel index
+[numthreads(PT_WAVEFRONT_THREAD_PER_THREADGROUP, 1, 1)]
+void main(uint3 gDispatchThreadID : SV_DispatchThreadID)
+{
+	uint pathIndex = gDispatchThreadID.x;
+	if (pathIndex >= PT_WAVEFRONT_PATH_COUNT)
+		return;
+	if (pathIndex < PT_WAVEFRONT_COUNTER_COUNT)
+	{
+		// nothing appends during this stage, so each thread resets one counter and the first ray queue is filled without atomics
+		gWavefrontQueueCounterBuffer[pathIndex] = pathIndex == GetWavefrontQueueCounterIndex(PT_WAVEFRONT_QUEUE_RAY, 0) ? PT_WAVEFRONT_PATH_COUNT : 0;
+	}
+	uint2 screenPos = GetWavefrontScreenPos(pathIndex);
+	uint2 screenSize = uint2(PT_BACKBUFFER_WIDTH, PT_BACKBUFFER_HEIGHT);
+	// set up RNG, dir, same as the single pass mode
+	uint rng_seed = hash(hash(hash(uFrame.mFrameCountSinceGameStart) + screenPos.x) + screenPos.y);
+	PathSampler sampler = InitPathSampler(screenPos, uScene.mPathTracerCurrentSampleIndex, rng_seed);
+	float2 screenPosJitter = GetSample2D(sampler, PT_SAMPLE_DIMENSION_LENS);
+	rng_seed = sampler.mRandomState;
+	float4 ndcNearPos = float4(float2(screenPos + screenPosJitter) / float2(screenSize) * float2(2.0f, -2.0f) - float2(1.0f, -1.0f), REVERSED_Z_SWITCH(0.0f, 1.0f), 1.0f);
+	float4 viewNearPos = mul(uPass.mProjInv, ndcNearPos * uPass.mNearClipPlane);
+	viewNearPos /= viewNearPos.w;
+	float3 viewDir = normalize(viewNearPos.xyz);
+	float3 viewDirWorld = normalize(mul(uPass.mViewInv, float4(viewDir, 0.0f)).xyz);
+	// init path state
+	SetWavefrontPathField(pathIndex, PT_WAVEFRONT_PATH_THROUGHPUT, float4(1.0f.xxx, 0.0f));
+	SetWavefrontPathField(pathIndex, PT_WAVEFRONT_PATH_RADIANCE, float4(0.0f.xxx, asfloat(rng_seed)));
+	SetWavefrontPathField(pathIndex, PT_WAVEFRONT_PATH_LIGHT_SAMPLE_RADIANCE, 0.0f.xxxx);
+	SetWavefrontPathField(pathIndex, PT_WAVEFRONT_PATH_MATERIAL_SAMPLE_RADIANCE, 0.0f.xxxx);
+	// every path starts out as a miss for the denoiser, the shade stage of the first bounce overwrites the features of hits
+	DenoiseFeatures firstHitFeatures = InitDenoiseFeatures();
+	SetWavefrontPathField(pathIndex, PT_WAVEFRONT_PATH_FIRST_HIT_NORMAL_DEPTH, float4(firstHitFeatures.mNormal, firstHitFeatures.mHitDistance));
+	SetWavefrontPathField(pathIndex, PT_WAVEFRONT_PATH_FIRST_HIT_ALBEDO, float4(firstHitFeatures.mAlbedo, 0.0f));
+	gWavefrontRayQueue[PT_WAVEFRONT_RAY_ORI * PT_WAVEFRONT_PATH_COUNT + pathIndex] = float4(uPass.mEyePos, asfloat(pathIndex));
+	// the first ray queue is filled without atomics so every pixel keeps its entry, pixels of converged tiles get a null direction the extend stage drops
+	gWavefrontRayQueue[PT_WAVEFRONT_RAY_DIR * PT_WAVEFRONT_PATH_COUNT + pathIndex] = float4(IsAdaptiveTileConverged(screenPos) ? 0.0f.xxx : viewDirWorld, 0.0f);
+}
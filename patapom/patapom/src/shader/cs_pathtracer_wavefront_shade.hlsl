@@ -0,0 +1,148 @@
+#define CUSTOM_PASS_UNIFORM
+
+#include "ShaderInclude.hlsli"
+
+cbuffer PassUniformBuffer : register(b0, SPACE(PASS))
+{
+	PassUniformPathTracer uPass;
+};
+
+RWStructuredBuffer<float4> gWavefrontPathBuffer : register(u0, SPACE(PASS));
+RWStructuredBuffer<float4> gWavefrontRayQueue : register(u1, SPACE(PASS));
+RWStructuredBuffer<float4> gWavefrontHitQueue : register(u2, SPACE(PASS));
+RWStructuredBuffer<float4> gWavefrontShadowQueue : register(u3, SPACE(PASS));
+RWStructuredBuffer<uint> gWavefrontQueueCounterBuffer : register(u4, SPACE(PASS));
+RWTexture2D<float4> gBackbufferPT : register(u5, SPACE(PASS));
+RWTexture2D<float> gDepthbufferPT : register(u6, SPACE(PASS));
+RWTexture2D<float4> gConvergencePT : register(u7, SPACE(PASS));
+RWStructuredBuffer<float> gAdaptiveTileErrorBuffer : register(u8, SPACE(PASS));
+RWStructuredBuffer<uint> gWavefrontHitOrderBuffer : register(u9, SPACE(PASS)); // hit queue entries in material order
+RWTexture2D<float4> gNormalDepthPT : register(u10, SPACE(PASS));
+RWTexture2D<float4> gAlbedoPT : register(u11, SPACE(PASS));
+StructuredBuffer<TrianglePT> gTriangleBufferPT : register(t0, SPACE(PASS));
+StructuredBuffer<MeshPT> gMeshBufferPT : register(t1, SPACE(PASS));
+StructuredBuffer<LightData> gLightDataBufferPT : register(t2, SPACE(PASS));
+StructuredBuffer<BVH> gMeshWorldBvhBuffer : register(t3, SPACE(PASS));
+StructuredBuffer<BVH> gTriangleModelBvhBuffer : register(t4, SPACE(PASS));
+StructuredBuffer<GlobalBvhSettings> gGlobalBvhSettingBuffer : register(t5, SPACE(PASS));
+StructuredBuffer<LightBvhNode> gLightBvhBuffer : register(t6, SPACE(PASS));
+StructuredBuffer<AliasEntry> gLightAliasBuffer : register(t7, SPACE(PASS));
+StructuredBuffer<MaterialPT> gMaterialBufferPT : register(t8, SPACE(PASS));
+Texture2D gMeshTextures[] : register(t9, SPACE(PASS)); // unbounded texture array, only bound to the shade passes
+
+#include "PathTracerCommon.hlsli"
+#include "PathTracerWavefrontResourceUtil.hlsli"
+#include "PathTracerAdaptiveUtil.hlsli"
+#include "PathTracerDenoiseUtil.hlsli"
+#include "PathTracerSamplerUtil.hlsli"
+
+// surface evaluation of every hit of this bounce, same math and RNG order as PathTraceCommon of cs_pathtracer.hlsl
+// light and material samples go to the shadow queue instead of being traced here
+[numthreads(PT_WAVEFRONT_THREAD_PER_THREADGROUP, 1, 1)]
+void main(uint3 gDispatchThreadID : SV_DispatchThreadID)
+{
+	uint bounceIndex = uPass.mWavefrontBounceIndex;
+	uint entryIndex = gDispatchThreadID.x;
+	if (entryIndex >= GetWavefrontQueueCount(PT_WAVEFRONT_QUEUE_HIT, bounceIndex))
+		return;
+	if (uScene.mPathTracerWavefrontSortByMaterial)
+		entryIndex = gWavefrontHitOrderBuffer[entryIndex]; // threads next to each other shade the same material
+	uint pathIndex = 0;
+	float3 dir = 0.0f.xxx;
+	Intersection it;
+	GetWavefrontHit(entryIndex, pathIndex, it, dir);
+	float4 throughputField = GetWavefrontPathField(pathIndex, PT_WAVEFRONT_PATH_THROUGHPUT);
+	float4 radianceField = GetWavefrontPathField(pathIndex, PT_WAVEFRONT_PATH_RADIANCE);
+	float3 throughput = throughputField.xyz;
+	bool isLastBounceSpecular = throughputField.w != 0.0f;
+	float3 radiance = radianceField.xyz;
+	PathSampler sampler = InitPathSampler(GetWavefrontScreenPos(pathIndex), uScene.mPathTracerCurrentSampleIndex, asuint(radianceField.w));
+	uint maxDepth = uScene.mPathTracerMaxDepth;
+	uint minDepth = uScene.mPathTracerMinDepth;
+	uint remainingDepth = maxDepth - 1 - bounceIndex;
+	float3 wo = -dir;
+	bool spawnRay = false;
+	float3 giWi = 0.0f.xxx;
+
+	SurfaceDataInPT sdiPT = (SurfaceDataInPT)0;
+	EvaluateSurface(sdiPT, it);
+	if (bounceIndex == 0)
+	{
+		DenoiseFeatures firstHitFeatures = GetDenoiseFeatures(sdiPT, it, uPass.mEyePos);
+		SetWavefrontPathField(pathIndex, PT_WAVEFRONT_PATH_FIRST_HIT_NORMAL_DEPTH, float4(firstHitFeatures.mNormal, firstHitFeatures.mHitDistance));
+		SetWavefrontPathField(pathIndex, PT_WAVEFRONT_PATH_FIRST_HIT_ALBEDO, float4(firstHitFeatures.mAlbedo, 0.0f));
+	}
+
+	// no need to include light source except for first bounce or specular bounce, 
+	// because both direct and indirect light bounces are covered explicitly
+	if (bounceIndex == 0 || isLastBounceSpecular)
+		radiance += throughput * sdiPT.mEmissive;
+
+	// terminate on lights, emissive meshes included
+	if (!(it.mIntersectionFlags & PT_INTERSECTION_TYPE_LIGHT) && sdiPT.mMaterialType != MATERIAL_TYPE_EMISSIVE)
+	{
+		// 2. sample light
+		float lightPdf = 1.0f;
+		float3 lightSamplePoint = 0.0f.xxx;
+		float3 lightWi = 0.0f.xxx;
+		float2 lightXi = GetSample2D(sampler, GetBounceSampleDimension(bounceIndex, PT_SAMPLE_DIMENSION_LIGHT));
+		float lightSelectionPdf = 0.0f;
+		uint lightIndex = SampleLightIndex(it.mPointWorld, sdiPT.mNorWorld, GetSample1D(sampler, GetBounceSampleDimension(bounceIndex, PT_SAMPLE_DIMENSION_LIGHT_SELECTION)), lightSelectionPdf);
+		float3 lightCol = 0.0f.xxx;
+		if (lightIndex != INVALID_UINT32)
+			lightCol = SampleLight(it.mPointWorld, lightXi, lightIndex, lightSamplePoint, lightWi, lightPdf);
+		if (IsNotBlack(lightCol))
+		{
+			float lightMaterialPdf = 1.0f;
+			float3 lightMaterialCol = EvaluateMaterial(sdiPT, wo, lightWi, lightMaterialPdf);
+			if (IsNotBlack(lightMaterialCol) && lightMaterialPdf > 0.0f)
+			{
+				float weight = 1.0f; // delta light
+				if (lightPdf > 0.0f)
+					weight = PowerHeuristic(1.0f, lightPdf, 1.0f, lightMaterialPdf) / lightPdf;
+				// the light sample ray is not normalized, it ends at the sampled point so the connect stage can tell it was hit
+				PushWavefrontShadowRay(bounceIndex, pathIndex, lightIndex, it.mPointWorld, lightSamplePoint - it.mPointWorld, lightCol * lightMaterialCol * weight * throughput / lightSelectionPdf, 0.0f);
+			}
+		}
+
+		// 3. sample material, the light is evaluated by the connect stage once the hit point on it is known
+		// delta materials pick up the light on the next bounce
+		if (lightPdf > 0.0f && !IsSpecularMaterial(sdiPT.mMaterialType))
+		{
+			float materialPdf = 1.0f;
+			float3 materialWi = 0.0f.xxx;
+			float2 materialXi = GetSample2D(sampler, GetBounceSampleDimension(bounceIndex, PT_SAMPLE_DIMENSION_MATERIAL));
+			float3 materialCol = SampleMaterial(sdiPT, materialXi, wo, materialWi, materialPdf);
+			if (lightIndex != INVALID_UINT32 && IsNotBlack(materialCol) && materialPdf > 0.0f)
+				PushWavefrontShadowRay(bounceIndex, pathIndex, lightIndex, it.mPointWorld, materialWi, materialCol * throughput / lightSelectionPdf, materialPdf);
+		}
+
+		// 5. GI
+		float giPdf = 0.0f;
+		float2 giXi = GetSample2D(sampler, GetBounceSampleDimension(bounceIndex, PT_SAMPLE_DIMENSION_BSDF));
+		float3 giColor = SampleMaterial(sdiPT, giXi, wo, giWi, giPdf);
+		if (IsNotBlack(giColor) && giPdf > 0.0f)
+		{
+			isLastBounceSpecular = IsSpecularMaterial(sdiPT.mMaterialType);
+			throughput *= giColor / giPdf;
+			spawnRay = true;
+		}
+	}
+
+	// II. russian roulette
+	if (spawnRay && uScene.mPathTracerEnableRussianRoulette && remainingDepth <= maxDepth - minDepth)
+	{
+		float survival = min(max(max(throughput.x, throughput.y), throughput.z), 1.0f);
+		if (survival <= GetSample1D(sampler, GetBounceSampleDimension(bounceIndex, PT_SAMPLE_DIMENSION_RUSSIAN_ROULETTE)))
+			spawnRay = false;
+		else
+			throughput /= survival;
+	}
+
+	// 6. spawn new ray
+	if (spawnRay && remainingDepth > 0)
+		PushWavefrontRay(bounceIndex + 1, pathIndex, it.mPointWorld, giWi);
+
+	SetWavefrontPathField(pathIndex, PT_WAVEFRONT_PATH_THROUGHPUT, float4(throughput, isLastBounceSpecular ? 1.0f : 0.0f));
+	SetWavefrontPathField(pathIndex, PT_WAVEFRONT_PATH_RADIANCE, float4(radiance, asfloat(sampler.mRandomState)));
+}
@@ -5,12 +5,13 @@
 
 Texture2D gBackbufferPT : register(t0, SPACE(PASS));
 Texture2D gDebugBackbufferPT : register(t1, SPACE(PASS));
+Texture2D gDenoisedPT : register(t2, SPACE(PASS));
 
 PS_OUTPUT main(VS_OUTPUT input)
 {
 	PS_OUTPUT output;
 	float2 uv = input.uv;
-	float4 col = gBackbufferPT.Sample(gSamplerLinear, TransformUV(uv));
+	float4 col = uScene.mPathTracerDenoise ? gDenoisedPT.Sample(gSamplerLinear, TransformUV(uv)) : gBackbufferPT.Sample(gSamplerLinear, TransformUV(uv));
 	float4 colDebug = 0.0f.xxxx;
 	if (uScene.mPathTracerEnableDebug)
 		colDebug = gDebugBackbufferPT.Sample(gSamplerLinear, TransformUV(uv));
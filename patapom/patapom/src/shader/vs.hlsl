@@ -3,6 +3,7 @@
 VS_OUTPUT main(VS_INPUT input)
 {
     VS_OUTPUT output;
+    input = UnpackVertex(input);
     float4 posWorld = mul(uObject.mModel, float4(input.pos, 1.0f));
     float4 posView = mul(uPass.mView, posWorld);
     output.pos = mul(uPass.mProj, posView);